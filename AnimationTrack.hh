@@ -0,0 +1,404 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Keyframe tracks for Vector3 and Quat<float> animation curves. Keys are
+ * sorted by time and stored as SoA streams next to whatever the
+ * interpolation needs per key (Hermite tangents, squad control points), so
+ * sampling only reads the two keys around t. A TrackCursor remembers the
+ * last segment of its track: forward playback finds the next segment in one
+ * or two compares, seeking falls back to a binary search.
+ *
+ * sampleTracks() evaluates many tracks at one time, the usual skeleton
+ * case. The key search and gather are per track, the interpolation itself
+ * runs across tracks on FloatV registers and matches sample() to a few ULP.
+ */
+#ifndef ANIMATION_TRACK_HH
+#define ANIMATION_TRACK_HH
+#include "Quat.hh"
+#include "QuatBatch.hh"
+#include "Simd.hh"
+#include "Vector.hh"
+#include "VectorSoA.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class Interpolation {
+  Linear,  // lerp for Vector3, slerp for Quat
+  Hermite, // Vector3 only, cubic with per key tangents
+  Squad,   // Quat only, C1 continuous spherical cubic
+};
+
+// Per track playback state, one per track and player
+class TrackCursor {
+  public:
+  std::uint32_t key = 0;
+};
+
+// The keys around a time, k1 == k0 + 1 except on one key tracks
+class TrackSegment {
+  public:
+  std::uint32_t k0 = 0;
+  std::uint32_t k1 = 0;
+  float         u = 0.0f;  // [0, 1] between k0 and k1
+  float         dt = 0.0f; // Time from k0 to k1
+};
+
+/**
+ * Segment of the count sorted times containing t, clamped to the first and
+ * last key. Tries the cursor's segment and the one after it before
+ * searching, and leaves the cursor on the result.
+ */
+inline TrackSegment
+findSegment(const float * times, std::uint32_t count, float t,
+            TrackCursor & cursor)
+{
+  assert(count > 0);
+  TrackSegment s;
+  if (count == 1) {
+    cursor.key = 0;
+    return s;
+  }
+
+  const std::uint32_t last = count - 2;
+  std::uint32_t       k = cursor.key;
+  if (k <= last && times[k] <= t && t < times[k + 1]) {
+    // Same segment
+  } else if (k + 1 <= last && times[k + 1] <= t && t < times[k + 2]) {
+    ++k;
+  } else if (t < times[0]) {
+    k = 0;
+  } else if (t >= times[last + 1]) {
+    k = last;
+  } else {
+    const float * above = std::upper_bound(times, times + count, t);
+    k = std::min(static_cast<std::uint32_t>(above - times) - 1u, last);
+  }
+  cursor.key = k;
+
+  s.k0 = k;
+  s.k1 = k + 1;
+  s.dt = times[k + 1] - times[k];
+  s.u = std::fmin(std::fmax((t - times[k]) / s.dt, 0.0f), 1.0f);
+  return s;
+}
+
+class Vector3Track {
+  public:
+  Vector3Track() = default;
+
+  /**
+   * n keys at strictly increasing times. Hermite tangents are dvalue/dtime,
+   * without them they default to Catmull-Rom over the uneven key spacing,
+   * (p[i+1] - p[i-1]) / (t[i+1] - t[i-1]), one sided at the ends.
+   */
+  Vector3Track(const float * key_times, const Vector3 * values, std::size_t n,
+               Interpolation interp = Interpolation::Linear,
+               const Vector3 * tangents = nullptr)
+      : times(key_times, key_times + n), keys(n), mode(interp)
+  {
+    assert(n > 0 && mode != Interpolation::Squad);
+    for (std::size_t i = 0; i < n; ++i) {
+      assert(i == 0 || times[i - 1] < times[i]);
+      Vector3 m(0.0f);
+      if (tangents != nullptr) {
+        m = tangents[i];
+      } else if (n > 1) {
+        const std::size_t a = (i == 0) ? 0 : i - 1;
+        const std::size_t b = (i + 1 == n) ? i : i + 1;
+        m = (values[b] - values[a]) / (times[b] - times[a]);
+      }
+      keys.comp[0][i] = values[i].x;
+      keys.comp[1][i] = values[i].y;
+      keys.comp[2][i] = values[i].z;
+      keys.comp[3][i] = m.x;
+      keys.comp[4][i] = m.y;
+      keys.comp[5][i] = m.z;
+    }
+  }
+
+  [[nodiscard]] std::uint32_t
+  size() const
+  {
+    return static_cast<std::uint32_t>(times.size());
+  }
+  [[nodiscard]] Vector3
+  value(std::size_t i) const
+  {
+    return Vector3(keys.comp[0][i], keys.comp[1][i], keys.comp[2][i]);
+  }
+  [[nodiscard]] Vector3
+  tangent(std::size_t i) const
+  {
+    return Vector3(keys.comp[3][i], keys.comp[4][i], keys.comp[5][i]);
+  }
+
+  [[nodiscard]] Vector3
+  sample(float t, TrackCursor & cursor) const
+  {
+    const TrackSegment s = findSegment(times.data(), size(), t, cursor);
+    const Vector3      p0 = value(s.k0);
+    const Vector3      p1 = value(s.k1);
+    if (mode == Interpolation::Linear) {
+      return p0 + (p1 - p0) * s.u;
+    }
+    const float u = s.u;
+    const float u2 = u * u;
+    const float u3 = u2 * u;
+    const float h00 = 2.0f * u3 - 3.0f * u2 + 1.0f;
+    const float h10 = u3 - 2.0f * u2 + u;
+    const float h01 = 3.0f * u2 - 2.0f * u3;
+    const float h11 = u3 - u2;
+    return p0 * h00 + tangent(s.k0) * (h10 * s.dt) + p1 * h01 +
+           tangent(s.k1) * (h11 * s.dt);
+  }
+
+  std::vector<float> times;
+  SoAStorage<6>      keys; // value x, y, z, tangent x, y, z
+  Interpolation      mode = Interpolation::Linear;
+};
+
+// Scalar reference of slerpLanes, with the same nlerp fallback
+inline Quat<float>
+slerpScalar(const Quat<float> & a, const Quat<float> & b, float t,
+            bool short_arc = true)
+{
+  const float d = a.dotp(b);
+  const float sign = (short_arc && d < 0.0f) ? -1.0f : 1.0f;
+  const float cos_theta = d * sign;
+  float       wa = 1.0f - t;
+  float       wb = t;
+  if (cos_theta <= 1.0f - 1e-4f) {
+    const float theta = std::acos(cos_theta);
+    const float inv_sin = 1.0f / std::sqrt(1.0f - cos_theta * cos_theta);
+    wa = std::sin(wa * theta) * inv_sin;
+    wb = std::sin(wb * theta) * inv_sin;
+  }
+  const Quat<float> r = a * wa + b * (wb * sign);
+  return r / std::sqrt(r.squaredCompSums());
+}
+
+class QuatTrack {
+  public:
+  QuatTrack() = default;
+
+  /**
+   * n unit keys at strictly increasing times. Keys are negated where needed
+   * so neighbours share a hemisphere and every segment takes the short arc.
+   * Squad controls are Shoemake's, which assume evenly spaced keys: uneven
+   * spacing stays C0 but loses some smoothness across keys.
+   */
+  QuatTrack(const float * key_times, const Quat<float> * values, std::size_t n,
+            Interpolation interp = Interpolation::Linear)
+      : times(key_times, key_times + n), keys(n), mode(interp)
+  {
+    assert(n > 0 && mode != Interpolation::Hermite);
+    std::vector<Quat<float>> q(values, values + n);
+    for (std::size_t i = 1; i < n; ++i) {
+      assert(times[i - 1] < times[i]);
+      if (q[i - 1].dotp(q[i]) < 0.0f) {
+        q[i] = q[i] * -1.0f;
+      }
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+      // s[i] = q[i] exp(-(log(q[i]^-1 q[i+1]) + log(q[i]^-1 q[i-1])) / 4)
+      Quat<float> s = q[i];
+      if (mode == Interpolation::Squad && i > 0 && i + 1 < n) {
+        const Quat<float> inv = q[i].conjugateQuat();
+        const Quat<float> sum =
+            logUnit(inv * q[i + 1]) + logUnit(inv * q[i - 1]);
+        s = q[i] * expPure(sum * -0.25f);
+      }
+      keys.comp[0][i] = q[i].x;
+      keys.comp[1][i] = q[i].y;
+      keys.comp[2][i] = q[i].z;
+      keys.comp[3][i] = q[i].w;
+      keys.comp[4][i] = s.x;
+      keys.comp[5][i] = s.y;
+      keys.comp[6][i] = s.z;
+      keys.comp[7][i] = s.w;
+    }
+  }
+
+  [[nodiscard]] std::uint32_t
+  size() const
+  {
+    return static_cast<std::uint32_t>(times.size());
+  }
+  [[nodiscard]] Quat<float>
+  value(std::size_t i) const
+  {
+    return Quat<float>(keys.comp[0][i], keys.comp[1][i], keys.comp[2][i],
+                       keys.comp[3][i]);
+  }
+  [[nodiscard]] Quat<float>
+  control(std::size_t i) const
+  {
+    return Quat<float>(keys.comp[4][i], keys.comp[5][i], keys.comp[6][i],
+                       keys.comp[7][i]);
+  }
+
+  [[nodiscard]] Quat<float>
+  sample(float t, TrackCursor & cursor) const
+  {
+    const TrackSegment s = findSegment(times.data(), size(), t, cursor);
+    const Quat<float>  q = slerpScalar(value(s.k0), value(s.k1), s.u);
+    if (mode == Interpolation::Linear) {
+      return q;
+    }
+    // Keys share a hemisphere, the controls must not be flipped to one
+    const Quat<float> c =
+        slerpScalar(control(s.k0), control(s.k1), s.u, false);
+    return slerpScalar(q, c, 2.0f * s.u * (1.0f - s.u), false);
+  }
+
+  std::vector<float> times;
+  SoAStorage<8>      keys; // key x, y, z, w, squad control x, y, z, w
+  Interpolation      mode = Interpolation::Linear;
+
+  private:
+  // (theta * axis, 0) of a unit (sin(theta) * axis, cos(theta))
+  static Quat<float>
+  logUnit(const Quat<float> & q)
+  {
+    const float sin_theta = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z);
+    if (sin_theta < 1e-6f) {
+      return Quat<float>(q.x, q.y, q.z, 0.0f);
+    }
+    const float k = std::atan2(sin_theta, q.w) / sin_theta;
+    return Quat<float>(q.x * k, q.y * k, q.z * k, 0.0f);
+  }
+  // Inverse of logUnit
+  static Quat<float>
+  expPure(const Quat<float> & v)
+  {
+    const float theta = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    const float k = (theta < 1e-6f) ? 1.0f : std::sin(theta) / theta;
+    return Quat<float>(v.x * k, v.y * k, v.z * k, std::cos(theta));
+  }
+};
+
+/**
+ * Samples count tracks at time t into out, resized to count, advancing
+ * cursors[i] for tracks[i]. Tracks may mix Linear and Hermite: linear
+ * lanes get the tangents p1 - p0, on which the Hermite cubic is the line.
+ */
+inline void
+sampleTracks(const Vector3Track * tracks, TrackCursor * cursors,
+             std::size_t count, float t, Vector3SoA & out)
+{
+  constexpr std::size_t w = FloatV::width;
+  out.resize(count);
+  // p0, p1 and the tangents scaled by the segment length, then u
+  alignas(simdAlignment) float lanes[13][w];
+  for (std::size_t i = 0; i < count; i += w) {
+    for (std::size_t k = 0; k < w; ++k) {
+      if (i + k >= count) {
+        for (auto & c : lanes) {
+          c[k] = 0.0f;
+        }
+        continue;
+      }
+      const Vector3Track & track = tracks[i + k];
+      const TrackSegment   s =
+          findSegment(track.times.data(), track.size(), t, cursors[i + k]);
+      const float * const * c = track.keys.comp;
+      for (int j = 0; j < 3; ++j) {
+        const float p0 = c[j][s.k0];
+        const float p1 = c[j][s.k1];
+        lanes[j][k] = p0;
+        lanes[3 + j][k] = p1;
+        if (track.mode == Interpolation::Linear) {
+          lanes[6 + j][k] = p1 - p0;
+          lanes[9 + j][k] = p1 - p0;
+        } else {
+          lanes[6 + j][k] = c[3 + j][s.k0] * s.dt;
+          lanes[9 + j][k] = c[3 + j][s.k1] * s.dt;
+        }
+      }
+      lanes[12][k] = s.u;
+    }
+
+    const FloatV u = FloatV::load(lanes[12]);
+    const FloatV u2 = u * u;
+    const FloatV u3 = u2 * u;
+    const FloatV two = FloatV::set1(2.0f);
+    const FloatV three = FloatV::set1(3.0f);
+    const FloatV h01 = FloatV::mulAdd(three, u2, -(two * u3));
+    const FloatV h00 = FloatV::set1(1.0f) - h01;
+    const FloatV h10 = FloatV::mulAdd(-two, u2, u3 + u);
+    const FloatV h11 = u3 - u2;
+    float * const dst[3] = {out.x(), out.y(), out.z()};
+    for (int j = 0; j < 3; ++j) {
+      const FloatV p = FloatV::mulAdd(
+          FloatV::load(lanes[j]), h00,
+          FloatV::mulAdd(
+              FloatV::load(lanes[3 + j]), h01,
+              FloatV::mulAdd(FloatV::load(lanes[6 + j]), h10,
+                             FloatV::load(lanes[9 + j]) * h11)));
+      p.store(dst[j] + i);
+    }
+  }
+}
+
+/**
+ * Samples count tracks at time t into out, resized to count, advancing
+ * cursors[i] for tracks[i]. squad(q0, q1, s0, s1, u) is
+ * slerp(slerp(q0, q1, u), slerp(s0, s1, u), 2u(1 - u)), registers without
+ * a Squad track stop after the first slerp.
+ */
+inline void
+sampleTracks(const QuatTrack * tracks, TrackCursor * cursors,
+             std::size_t count, float t, QuatSoA & out)
+{
+  constexpr std::size_t w = FloatV::width;
+  out.resize(count);
+  // q0, q1, s0, s1 as x, y, z, w each, then u
+  alignas(simdAlignment) float lanes[17][w];
+  const auto quatLanes = [&](int first) {
+    return QuatLanes{FloatV::load(lanes[first]), FloatV::load(lanes[first + 1]),
+                     FloatV::load(lanes[first + 2]),
+                     FloatV::load(lanes[first + 3])};
+  };
+  for (std::size_t i = 0; i < count; i += w) {
+    bool any_squad = false;
+    for (std::size_t k = 0; k < w; ++k) {
+      if (i + k >= count) {
+        // Identity keys keep the padding lanes finite
+        for (int j = 0; j < 17; ++j) {
+          lanes[j][k] = (j % 4 == 3 && j < 16) ? 1.0f : 0.0f;
+        }
+        continue;
+      }
+      const QuatTrack &  track = tracks[i + k];
+      const TrackSegment s =
+          findSegment(track.times.data(), track.size(), t, cursors[i + k]);
+      const float * const * c = track.keys.comp;
+      const int control = (track.mode == Interpolation::Squad) ? 4 : 0;
+      any_squad = any_squad || control != 0;
+      for (int j = 0; j < 4; ++j) {
+        lanes[j][k] = c[j][s.k0];
+        lanes[4 + j][k] = c[j][s.k1];
+        lanes[8 + j][k] = c[control + j][s.k0];
+        lanes[12 + j][k] = c[control + j][s.k1];
+      }
+      lanes[16][k] = s.u;
+    }
+
+    const FloatV u = FloatV::load(lanes[16]);
+    QuatLanes    q = slerpLanes(quatLanes(0), quatLanes(4), u);
+    if (any_squad) {
+      // Linear lanes have s == q, so both slerps agree and the last is a no-op
+      const QuatLanes s = slerpLanes(quatLanes(8), quatLanes(12), u, false);
+      q = slerpLanes(q, s, (u + u) * (FloatV::set1(1.0f) - u), false);
+    }
+    q.store(out, i);
+  }
+}
+
+#endif // ANIMATION_TRACK_HH
@@ -0,0 +1,1134 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Bounding volume hierarchies over Vector3 triangles and points, for ray
+ * casts and box overlap queries against static or animated geometry. Nodes
+ * are 4 wide with the child boxes stored in SoA, so one Float4 pass tests a
+ * ray against all four children, and ray packets test FloatV::width rays
+ * against one child box at a time.
+ *
+ * The builder bins primitive centroids along the widest axis, takes the
+ * split with the lowest surface area heuristic cost and keeps splitting the
+ * largest child of a node until it has four. The top of the tree is built on
+ * the calling thread with the binning split over the ThreadPool, the
+ * subtrees below it concurrently, each into its own contiguous node range.
+ * refit() keeps the topology and recomputes every box bottom up, one
+ * subtree per thread, which is the per frame path for geometry that deforms
+ * rather than tears apart. Rebuild when it does.
+ */
+#ifndef BVH_HH
+#define BVH_HH
+#include "Parallel.hh"
+#include "Simd.hh"
+#include "Vector.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Axis aligned box, default constructed empty so grow() can start from it
+class Aabb {
+  public:
+  Vector3 min{std::numeric_limits<float>::infinity()};
+  Vector3 max{-std::numeric_limits<float>::infinity()};
+
+  Aabb() = default;
+  Aabb(const Vector3 & lo, const Vector3 & hi) : min(lo), max(hi)
+  {
+  }
+
+  void
+  grow(const Vector3 & p)
+  {
+    min = Vector3(std::min(min.x, p.x), std::min(min.y, p.y),
+                  std::min(min.z, p.z));
+    max = Vector3(std::max(max.x, p.x), std::max(max.y, p.y),
+                  std::max(max.z, p.z));
+  }
+  void
+  grow(const Aabb & b)
+  {
+    min = Vector3(std::min(min.x, b.min.x), std::min(min.y, b.min.y),
+                  std::min(min.z, b.min.z));
+    max = Vector3(std::max(max.x, b.max.x), std::max(max.y, b.max.y),
+                  std::max(max.z, b.max.z));
+  }
+
+  [[nodiscard]] bool
+  empty() const
+  {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+  [[nodiscard]] Vector3
+  center() const
+  {
+    return (min + max) * 0.5f;
+  }
+  // Half the surface area, all the surface area heuristic needs
+  [[nodiscard]] float
+  halfArea() const
+  {
+    if (empty()) {
+      return 0.0f;
+    }
+    const Vector3 d = max - min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+  }
+  [[nodiscard]] bool
+  overlaps(const Aabb & b) const
+  {
+    return min.x <= b.max.x && b.min.x <= max.x && min.y <= b.max.y &&
+           b.min.y <= max.y && min.z <= b.max.z && b.min.z <= max.z;
+  }
+  [[nodiscard]] bool
+  contains(const Vector3 & p) const
+  {
+    return min.x <= p.x && p.x <= max.x && min.y <= p.y && p.y <= max.y &&
+           min.z <= p.z && p.z <= max.z;
+  }
+};
+
+// Hits count for t in [0, t_max], t in units of direction, which need not
+// be unit length
+class Ray {
+  public:
+  Vector3 origin;
+  Vector3 direction;
+  float   t_max = std::numeric_limits<float>::infinity();
+};
+
+class RayHit {
+  public:
+  static constexpr std::uint32_t none = 0xFFFFFFFFu;
+
+  float         t = std::numeric_limits<float>::infinity();
+  float         u = 0.0f; // Barycentric weights of vertices 1 and 2
+  float         v = 0.0f;
+  std::uint32_t primitive = none;
+
+  [[nodiscard]] bool
+  hit() const
+  {
+    return primitive != none;
+  }
+};
+
+/**
+ * Four children, the box of child k in lane k of box[0..2] (min x, y, z)
+ * and box[3..5] (max x, y, z). A leaf child covers count[k] primitives from
+ * first[k] in Bvh::primitives() order, an inner child has count 0 and its
+ * node index in first[k]. Unused slots hold an empty box and first unused.
+ */
+class alignas(64) BvhNode {
+  public:
+  static constexpr std::uint32_t unused = 0xFFFFFFFFu;
+
+  float         box[6][4];
+  std::uint32_t first[4];
+  std::uint32_t count[4];
+
+  BvhNode()
+  {
+    for (int k = 0; k < 4; ++k) {
+      setBox(k, Aabb());
+      first[k] = unused;
+      count[k] = 0;
+    }
+  }
+
+  [[nodiscard]] Aabb
+  childBox(int k) const
+  {
+    return Aabb(Vector3(box[0][k], box[1][k], box[2][k]),
+                Vector3(box[3][k], box[4][k], box[5][k]));
+  }
+  void
+  setBox(int k, const Aabb & b)
+  {
+    box[0][k] = b.min.x;
+    box[1][k] = b.min.y;
+    box[2][k] = b.min.z;
+    box[3][k] = b.max.x;
+    box[4][k] = b.max.y;
+    box[5][k] = b.max.z;
+  }
+  // Union of the child boxes
+  [[nodiscard]] Aabb
+  bounds() const
+  {
+    Aabb b;
+    for (int k = 0; k < 4; ++k) {
+      b.grow(childBox(k));
+    }
+    return b;
+  }
+};
+
+static_assert(sizeof(BvhNode) == 128, "BvhNode is two cache lines");
+
+// FloatV::width rays in SoA, unused lanes have t_max < 0 and never hit
+class RayPacket {
+  public:
+  FloatV ox, oy, oz;
+  FloatV dx, dy, dz;
+  FloatV ix, iy, iz; // 1 / direction, see Bvh::safeInverse
+  FloatV t_max;
+};
+
+/**
+ * The 4 wide tree over primitive boxes, without the primitives themselves.
+ * TriangleBvh and PointBvh pair it with their geometry, anything else that
+ * has a box per primitive can use it directly through the leaf callbacks.
+ */
+class Bvh {
+  public:
+  // Primitives per leaf at most, and the centroid bins per split
+  static constexpr std::size_t maxLeafSize = 4;
+  static constexpr int         binCount = 16;
+  // Levels split by surface area cost, below that by the centroid median.
+  // A median level only halves the child it splits, the others can keep
+  // half the range, so 2^32 primitives need at most 32 more levels.
+  static constexpr int maxSahDepth = 32;
+  static constexpr int maxDepth = maxSahDepth + 32;
+  // Ranges at least this large bin over the pool
+  static constexpr std::size_t parallelBinSize = 1u << 16;
+
+  /**
+   * Builds over n primitives, bounds[i] the box of primitive i. Leaves
+   * refer to primitives() slots, primitives()[slot] is the primitive.
+   */
+  void
+  build(const Aabb * bounds, std::size_t n)
+  {
+    assert(n < BvhNode::unused);
+    node_list.clear();
+    subtree_begin.assign(1, 0);
+    top_count = 0;
+    prim_index.resize(n);
+    refs.resize(n);
+    if (n == 0) {
+      return;
+    }
+
+    // Centroids and the root range, reduced per chunk
+    ThreadPool &      pool = ThreadPool::current();
+    const std::size_t grain = pool.autoGrain(n, 4096);
+    std::vector<Range> partial((n + grain - 1) / grain);
+    parallelFor(0, n, grain, [&](std::size_t b, std::size_t e) {
+      Range & p = partial[b / grain];
+      for (std::size_t i = b; i < e; ++i) {
+        refs[i].box = bounds[i];
+        refs[i].id = static_cast<std::uint32_t>(i);
+        p.bounds.grow(bounds[i]);
+        p.centroids.grow(bounds[i].center());
+      }
+    });
+    Range root;
+    root.end = static_cast<std::uint32_t>(n);
+    for (const Range & p : partial) {
+      root.bounds.grow(p.bounds);
+      root.centroids.grow(p.centroids);
+    }
+
+    // Top levels here, subtrees small enough to share out afterwards
+    subtrees.clear();
+    node_list.emplace_back();
+    buildNode(node_list, 0, root, 0, &subtrees,
+              pool.autoGrain(n / 4, 1024));
+    top_count = node_list.size();
+
+    scratch.resize(subtrees.size());
+    parallelFor(0, subtrees.size(), 1, [&](std::size_t b, std::size_t e) {
+      for (std::size_t t = b; t < e; ++t) {
+        scratch[t].clear();
+        scratch[t].emplace_back();
+        buildNode(scratch[t], 0, subtrees[t].range, subtrees[t].depth,
+                  nullptr, 0);
+      }
+    });
+
+    // Stitch every subtree behind the top, child indices offset
+    subtree_begin.assign(1, top_count);
+    for (std::size_t t = 0; t < subtrees.size(); ++t) {
+      const std::size_t begin = subtree_begin.back();
+      node_list[subtrees[t].parent].first[subtrees[t].slot] =
+          static_cast<std::uint32_t>(begin);
+      subtree_begin.push_back(begin + scratch[t].size());
+    }
+    node_list.resize(subtree_begin.back());
+    parallelFor(0, n, grain, [&](std::size_t b, std::size_t e) {
+      for (std::size_t i = b; i < e; ++i) {
+        prim_index[i] = refs[i].id;
+      }
+    });
+    parallelFor(0, subtrees.size(), 1, [&](std::size_t b, std::size_t e) {
+      for (std::size_t t = b; t < e; ++t) {
+        const auto offset = static_cast<std::uint32_t>(subtree_begin[t]);
+        BvhNode *  out = node_list.data() + offset;
+        for (const BvhNode & node : scratch[t]) {
+          *out = node;
+          for (int k = 0; k < 4; ++k) {
+            if (out->count[k] == 0 && out->first[k] != BvhNode::unused) {
+              out->first[k] += offset;
+            }
+          }
+          ++out;
+        }
+      }
+    });
+  }
+
+  /**
+   * Recomputes every box for the same primitives and topology,
+   * leaf_bounds(first, count) the box of primitives()[first, first + count)
+   * as they are now. Subtrees refit concurrently, then the top.
+   */
+  template<typename LeafBounds>
+  void
+  refit(LeafBounds && leaf_bounds)
+  {
+    if (node_list.empty()) {
+      return;
+    }
+    parallelFor(0, subtree_begin.size() - 1, 1,
+                [&](std::size_t b, std::size_t e) {
+                  for (std::size_t t = b; t < e; ++t) {
+                    refitNodes(subtree_begin[t], subtree_begin[t + 1],
+                               leaf_bounds);
+                  }
+                });
+    refitNodes(0, top_count, leaf_bounds);
+  }
+
+  [[nodiscard]] bool
+  empty() const
+  {
+    return node_list.empty();
+  }
+  [[nodiscard]] const std::vector<BvhNode> &
+  nodes() const
+  {
+    return node_list;
+  }
+  // Primitive of every leaf slot
+  [[nodiscard]] const std::vector<std::uint32_t> &
+  primitives() const
+  {
+    return prim_index;
+  }
+  [[nodiscard]] Aabb
+  bounds() const
+  {
+    return node_list.empty() ? Aabb() : node_list[0].bounds();
+  }
+
+  // 1 / d, tiny components clamped so 0 * inf never makes a NaN
+  static float
+  safeInverse(float d)
+  {
+    const float tiny = 1e-20f;
+    return (std::fabs(d) > tiny) ? 1.0f / d : std::copysign(1.0f / tiny, d);
+  }
+
+  /**
+   * Visits the leaves ray passes through nearest box first, while their
+   * boxes start before t_max. leaf(first, count, t_max) tests the
+   * primitives, lowers t_max to the closest hit so farther boxes are
+   * skipped and returns true to stop early.
+   */
+  template<typename Leaf>
+  void
+  intersectRay(const Ray & ray, Leaf && leaf) const
+  {
+    if (node_list.empty()) {
+      return;
+    }
+    const float inv[3] = {safeInverse(ray.direction.x),
+                          safeInverse(ray.direction.y),
+                          safeInverse(ray.direction.z)};
+    const float org[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+    Float4      scale[3];
+    Float4      offset[3];
+    int         near_row[3];
+    for (int a = 0; a < 3; ++a) {
+      scale[a] = Float4::set1(inv[a]);
+      offset[a] = Float4::set1(-org[a] * inv[a]);
+      // The min plane is entered first along positive directions
+      near_row[a] = (inv[a] >= 0.0f) ? a : a + 3;
+    }
+    const Float4 zero = Float4::zero();
+    float        t_max = ray.t_max;
+
+    Entry stack[stackSize];
+    int   top = 0;
+    stack[top++] = Entry{0, 0, 0.0f};
+    while (top > 0) {
+      const Entry entry = stack[--top];
+      if (entry.t > t_max) {
+        continue;
+      }
+      if (entry.count != 0) {
+        if (leaf(entry.first, entry.count, t_max)) {
+          return;
+        }
+        continue;
+      }
+      const BvhNode & node = node_list[entry.first];
+      Float4          t_near = zero;
+      Float4          t_far = Float4::set1(t_max);
+      for (int a = 0; a < 3; ++a) {
+        const int n = near_row[a];
+        const int f = (n < 3) ? n + 3 : n - 3;
+        t_near = Float4::max(
+            t_near, Float4::mulAdd(Float4::loadu(node.box[n]), scale[a],
+                                   offset[a]));
+        t_far = Float4::min(
+            t_far, Float4::mulAdd(Float4::loadu(node.box[f]), scale[a],
+                                  offset[a]));
+      }
+      const unsigned hits = Float4::lessEqualBits(t_near, t_far);
+      if (hits == 0) {
+        continue;
+      }
+      float t[4];
+      t_near.storeu(t);
+      // Farthest pushed first, so the nearest pops next
+      Entry found[4];
+      int   count = 0;
+      for (int k = 0; k < 4; ++k) {
+        if ((hits >> k) & 1u) {
+          int j = count++;
+          for (; j > 0 && found[j - 1].t < t[k]; --j) {
+            found[j] = found[j - 1];
+          }
+          found[j] = Entry{node.first[k], node.count[k], t[k]};
+        }
+      }
+      for (int j = 0; j < count; ++j) {
+        assert(top < stackSize);
+        stack[top++] = found[j];
+      }
+    }
+  }
+
+  /**
+   * Visits the leaves whose boxes any ray of the packet passes through
+   * before its t_max. leaf(first, count) tests the primitives and lowers
+   * rays.t_max per lane on a hit.
+   */
+  template<typename Leaf>
+  void
+  intersectPacket(RayPacket & rays, Leaf && leaf) const
+  {
+    if (node_list.empty()) {
+      return;
+    }
+    const FloatV ox = -(rays.ox * rays.ix);
+    const FloatV oy = -(rays.oy * rays.iy);
+    const FloatV oz = -(rays.oz * rays.iz);
+    const FloatV zero = FloatV::zero();
+
+    std::uint32_t stack[stackSize];
+    int           top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const BvhNode & node = node_list[stack[--top]];
+      for (int k = 3; k >= 0; --k) {
+        if (node.first[k] == BvhNode::unused) {
+          continue;
+        }
+        const FloatV x0 =
+            FloatV::mulAdd(FloatV::set1(node.box[0][k]), rays.ix, ox);
+        const FloatV x1 =
+            FloatV::mulAdd(FloatV::set1(node.box[3][k]), rays.ix, ox);
+        const FloatV y0 =
+            FloatV::mulAdd(FloatV::set1(node.box[1][k]), rays.iy, oy);
+        const FloatV y1 =
+            FloatV::mulAdd(FloatV::set1(node.box[4][k]), rays.iy, oy);
+        const FloatV z0 =
+            FloatV::mulAdd(FloatV::set1(node.box[2][k]), rays.iz, oz);
+        const FloatV z1 =
+            FloatV::mulAdd(FloatV::set1(node.box[5][k]), rays.iz, oz);
+        const FloatV t_near = FloatV::max(
+            FloatV::max(FloatV::min(x0, x1), FloatV::min(y0, y1)),
+            FloatV::max(FloatV::min(z0, z1), zero));
+        const FloatV t_far = FloatV::min(
+            FloatV::min(FloatV::max(x0, x1), FloatV::max(y0, y1)),
+            FloatV::min(FloatV::max(z0, z1), rays.t_max));
+        if (!(t_near <= t_far).any()) {
+          continue;
+        }
+        if (node.count[k] != 0) {
+          leaf(node.first[k], node.count[k]);
+        } else {
+          assert(top < stackSize);
+          stack[top++] = node.first[k];
+        }
+      }
+    }
+  }
+
+  // leaf(first, count) for every leaf whose box overlaps box
+  template<typename Leaf>
+  void
+  queryAabb(const Aabb & box, Leaf && leaf) const
+  {
+    if (node_list.empty()) {
+      return;
+    }
+    const Float4 lo[3] = {Float4::set1(box.min.x), Float4::set1(box.min.y),
+                          Float4::set1(box.min.z)};
+    const Float4 hi[3] = {Float4::set1(box.max.x), Float4::set1(box.max.y),
+                          Float4::set1(box.max.z)};
+
+    std::uint32_t stack[stackSize];
+    int           top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const BvhNode & node = node_list[stack[--top]];
+      unsigned        hits = 0xFu;
+      for (int a = 0; a < 3; ++a) {
+        hits &= Float4::lessEqualBits(Float4::loadu(node.box[a]), hi[a]) &
+                Float4::lessEqualBits(lo[a], Float4::loadu(node.box[a + 3]));
+      }
+      for (int k = 0; k < 4; ++k) {
+        if (((hits >> k) & 1u) == 0) {
+          continue;
+        }
+        if (node.count[k] != 0) {
+          leaf(node.first[k], node.count[k]);
+        } else {
+          assert(top < stackSize);
+          stack[top++] = node.first[k];
+        }
+      }
+    }
+  }
+
+  private:
+  // Enough for maxDepth levels of 3 siblings waiting plus the 4 just pushed
+  static constexpr int stackSize = 3 * maxDepth + 4;
+
+  // primitives()[begin, end), the box of the primitives and of their
+  // centroids
+  class Range {
+    public:
+    std::uint32_t begin = 0;
+    std::uint32_t end = 0;
+    Aabb          bounds;
+    Aabb          centroids;
+
+    [[nodiscard]] std::uint32_t
+    size() const
+    {
+      return end - begin;
+    }
+  };
+  // What the build partitions, the box travels with the primitive so
+  // binning streams through memory
+  class alignas(16) PrimRef {
+    public:
+    Aabb          box;
+    std::uint32_t id;
+
+    [[nodiscard]] float
+    centroid(int axis) const
+    {
+      return ((&box.min.x)[axis] + (&box.max.x)[axis]) * 0.5f;
+    }
+  };
+  class Bin {
+    public:
+    Aabb          bounds;
+    Aabb          centroids;
+    std::uint32_t count = 0;
+  };
+  // An inner child of a top node, built on its own afterwards
+  class Subtree {
+    public:
+    Range         range;
+    std::uint32_t parent = 0;
+    int           slot = 0;
+    int           depth = 0;
+  };
+  class Entry {
+    public:
+    std::uint32_t first;
+    std::uint32_t count;
+    float         t;
+  };
+
+  /**
+   * Fills out[index] from r and recurses into its inner children. With
+   * defer, inner children of at most defer_size primitives are appended to
+   * it instead and their slots left for the caller.
+   */
+  void
+  buildNode(std::vector<BvhNode> & out, std::uint32_t index, const Range & r,
+            int depth, std::vector<Subtree> * defer, std::size_t defer_size)
+  {
+    assert(depth <= maxDepth);
+    // Split the child with the largest box until there are four
+    Range child[4];
+    int   count = 1;
+    child[0] = r;
+    while (count < 4) {
+      int   pick = -1;
+      float area = -1.0f;
+      for (int k = 0; k < count; ++k) {
+        if (child[k].size() > maxLeafSize &&
+            child[k].bounds.halfArea() > area) {
+          pick = k;
+          area = child[k].bounds.halfArea();
+        }
+      }
+      if (pick < 0) {
+        break;
+      }
+      Range right;
+      split(Range(child[pick]), depth, child[pick], right);
+      child[count++] = right;
+    }
+
+    for (int k = 0; k < count; ++k) {
+      out[index].setBox(k, child[k].bounds);
+      if (child[k].size() <= maxLeafSize) {
+        out[index].first[k] = child[k].begin;
+        out[index].count[k] = child[k].size();
+      } else if (defer != nullptr && child[k].size() <= defer_size) {
+        defer->push_back(Subtree{child[k], index, k, depth + 1});
+      } else {
+        const auto next = static_cast<std::uint32_t>(out.size());
+        out.emplace_back();
+        out[index].first[k] = next;
+        buildNode(out, next, child[k], depth + 1, defer, defer_size);
+      }
+    }
+  }
+
+  // Splits r, larger than a leaf, in two non empty halves
+  void
+  split(const Range & r, int depth, Range & left, Range & right)
+  {
+    const Vector3 extent = r.centroids.max - r.centroids.min;
+    int           axis = (extent.y > extent.x) ? 1 : 0;
+    if (extent.z > ((axis == 0) ? extent.x : extent.y)) {
+      axis = 2;
+    }
+    const float lo = (&r.centroids.min.x)[axis];
+    const float size = (&extent.x)[axis];
+    // Flat or denormal extents overflow the scale, and inf * 0 bins at NaN
+    const float scale = binCount / size;
+    if (depth >= maxSahDepth ||
+        !(scale <= std::numeric_limits<float>::max())) {
+      splitMedian(r, axis, left, right);
+      return;
+    }
+
+    // Bin every centroid, chunks of large ranges over the pool
+    const auto  binOf = [&](const PrimRef & ref) {
+      const int b = static_cast<int>((ref.centroid(axis) - lo) * scale);
+      return std::min(b, binCount - 1);
+    };
+    const auto fill = [&](Bin * bins, std::size_t b, std::size_t e) {
+      for (std::size_t i = b; i < e; ++i) {
+        Bin & bin = bins[binOf(refs[i])];
+        bin.bounds.grow(refs[i].box);
+        bin.centroids.grow(refs[i].box.center());
+        ++bin.count;
+      }
+    };
+    Bin bins[binCount];
+    if (r.size() >= parallelBinSize) {
+      const std::size_t grain =
+          ThreadPool::current().autoGrain(r.size(), parallelBinSize / 4);
+      std::vector<Bin> partial(
+          binCount * ((r.size() + grain - 1) / grain));
+      parallelFor(r.begin, r.end, grain, [&](std::size_t b, std::size_t e) {
+        fill(partial.data() + binCount * ((b - r.begin) / grain), b, e);
+      });
+      for (std::size_t p = 0; p < partial.size(); ++p) {
+        Bin & bin = bins[p % binCount];
+        bin.bounds.grow(partial[p].bounds);
+        bin.centroids.grow(partial[p].centroids);
+        bin.count += partial[p].count;
+      }
+    } else {
+      fill(bins, r.begin, r.end);
+    }
+
+    // Cost of splitting after bin s, both sides area * primitives
+    float         right_cost[binCount];
+    Aabb          acc;
+    std::uint32_t acc_count = 0;
+    for (int s = binCount - 1; s > 0; --s) {
+      acc.grow(bins[s].bounds);
+      acc_count += bins[s].count;
+      right_cost[s] = acc.halfArea() * static_cast<float>(acc_count);
+    }
+    int   best = -1;
+    float best_cost = std::numeric_limits<float>::infinity();
+    acc = Aabb();
+    acc_count = 0;
+    for (int s = 0; s < binCount - 1; ++s) {
+      acc.grow(bins[s].bounds);
+      acc_count += bins[s].count;
+      const float cost =
+          acc.halfArea() * static_cast<float>(acc_count) + right_cost[s + 1];
+      if (acc_count != 0 && acc_count != r.size() && cost < best_cost) {
+        best = s;
+        best_cost = cost;
+      }
+    }
+    if (best < 0) {
+      splitMedian(r, axis, left, right);
+      return;
+    }
+
+    const auto middle = std::partition(
+        refs.begin() + r.begin, refs.begin() + r.end,
+        [&](const PrimRef & ref) { return binOf(ref) <= best; });
+    left = Range();
+    right = Range();
+    left.begin = r.begin;
+    left.end = static_cast<std::uint32_t>(middle - refs.begin());
+    right.begin = left.end;
+    right.end = r.end;
+    for (int s = 0; s < binCount; ++s) {
+      Range & side = (s <= best) ? left : right;
+      side.bounds.grow(bins[s].bounds);
+      side.centroids.grow(bins[s].centroids);
+    }
+  }
+
+  // Halves r at the median centroid along axis, for degenerate ranges
+  void
+  splitMedian(const Range & r, int axis, Range & left, Range & right)
+  {
+    const auto first = refs.begin() + r.begin;
+    const auto middle = first + r.size() / 2;
+    std::nth_element(first, middle, refs.begin() + r.end,
+                     [&](const PrimRef & a, const PrimRef & b) {
+                       return a.centroid(axis) < b.centroid(axis);
+                     });
+    left = Range();
+    right = Range();
+    left.begin = r.begin;
+    left.end = r.begin + r.size() / 2;
+    right.begin = left.end;
+    right.end = r.end;
+    for (Range * side : {&left, &right}) {
+      for (std::uint32_t i = side->begin; i < side->end; ++i) {
+        side->bounds.grow(refs[i].box);
+        side->centroids.grow(refs[i].box.center());
+      }
+    }
+  }
+
+  template<typename LeafBounds>
+  void
+  refitNodes(std::size_t begin, std::size_t end, LeafBounds & leaf_bounds)
+  {
+    // Children come after their parents, so backwards is bottom up
+    for (std::size_t i = end; i-- > begin;) {
+      BvhNode & node = node_list[i];
+      for (int k = 0; k < 4; ++k) {
+        if (node.first[k] == BvhNode::unused) {
+          continue;
+        }
+        node.setBox(k, (node.count[k] != 0)
+                           ? leaf_bounds(node.first[k], node.count[k])
+                           : node_list[node.first[k]].bounds());
+      }
+    }
+  }
+
+  std::vector<BvhNode>       node_list; // Top nodes first, root at 0
+  std::vector<std::uint32_t> prim_index;
+  std::size_t                top_count = 0;
+  // Node ranges of the subtrees, subtree t is [begin[t], begin[t + 1])
+  std::vector<std::size_t> subtree_begin{0};
+
+  // Build state, kept to reuse the allocations
+  std::vector<PrimRef>              refs;
+  std::vector<Subtree>              subtrees;
+  std::vector<std::vector<BvhNode>> scratch;
+};
+
+/**
+ * A Bvh over triangles, 3 vertex indices per triangle or, with null
+ * indices, 3 consecutive vertices each. The vertex and index arrays stay
+ * the caller's and must outlive the tree, refit() reads the vertices again
+ * after they moved. Triangles are copied into leaf order as a vertex and
+ * two edges, so rays never chase the index buffer.
+ */
+class TriangleBvh {
+  public:
+  // Rays per parallelFor chunk of the batch intersect()
+  static constexpr std::size_t rayGrain = 256;
+
+  void
+  build(const Vector3 * vertex_data, const std::uint32_t * index_data,
+        std::size_t triangles)
+  {
+    vertices = vertex_data;
+    indices = index_data;
+    count = triangles;
+    bounds.resize(triangles);
+    parallelFor(0, triangles, 4096, [&](std::size_t b, std::size_t e) {
+      for (std::size_t i = b; i < e; ++i) {
+        Aabb box;
+        for (int k = 0; k < 3; ++k) {
+          box.grow(vertex(i, k));
+        }
+        bounds[i] = box;
+      }
+    });
+    bvh.build(bounds.data(), triangles);
+    gather();
+  }
+
+  // Same triangles, vertices moved
+  void
+  refit()
+  {
+    gather();
+    bvh.refit([&](std::uint32_t first, std::uint32_t n) {
+      Aabb box;
+      for (std::uint32_t s = first; s < first + n; ++s) {
+        const Vector3 & v0 = tri[3 * s];
+        box.grow(v0);
+        box.grow(v0 + tri[3 * s + 1]);
+        box.grow(v0 + tri[3 * s + 2]);
+      }
+      return box;
+    });
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return count;
+  }
+  [[nodiscard]] const Bvh &
+  tree() const
+  {
+    return bvh;
+  }
+
+  // Closest hit along ray, hit.primitive is the triangle index
+  bool
+  intersect(const Ray & ray, RayHit & hit) const
+  {
+    hit = RayHit();
+    bvh.intersectRay(ray, [&](std::uint32_t first, std::uint32_t n,
+                              float & t_max) {
+      for (std::uint32_t s = first; s < first + n; ++s) {
+        float t, u, v;
+        if (intersectTriangle(ray, s, t_max, t, u, v)) {
+          t_max = t;
+          hit.t = t;
+          hit.u = u;
+          hit.v = v;
+          hit.primitive = bvh.primitives()[s];
+        }
+      }
+      return false;
+    });
+    return hit.hit();
+  }
+
+  // Whether anything is hit along ray, stops at the first hit found
+  [[nodiscard]] bool
+  occluded(const Ray & ray) const
+  {
+    bool found = false;
+    bvh.intersectRay(ray, [&](std::uint32_t first, std::uint32_t n,
+                              float & t_max) {
+      for (std::uint32_t s = first; s < first + n; ++s) {
+        float t, u, v;
+        if (intersectTriangle(ray, s, t_max, t, u, v)) {
+          found = true;
+          return true;
+        }
+      }
+      return false;
+    });
+    return found;
+  }
+
+  /**
+   * Closest hits of n rays, FloatV::width rays per packet through the tree
+   * together, packets split over the pool. Coherent rays, e.g. from one
+   * origin, share most of their nodes.
+   */
+  void
+  intersect(const Ray * rays, RayHit * hits, std::size_t n) const
+  {
+    constexpr std::size_t w = FloatV::width;
+    parallelFor(0, n, rayGrain, [&](std::size_t b, std::size_t e) {
+      for (std::size_t i = b; i < e; i += w) {
+        intersectPacket(rays + i, hits + i, std::min(w, e - i));
+      }
+    });
+  }
+
+  // Appends every triangle whose box overlaps box to out
+  void
+  overlap(const Aabb & box, std::vector<std::uint32_t> & out) const
+  {
+    bvh.queryAabb(box, [&](std::uint32_t first, std::uint32_t n) {
+      for (std::uint32_t s = first; s < first + n; ++s) {
+        const Vector3 & v0 = tri[3 * s];
+        Aabb            b(v0, v0);
+        b.grow(v0 + tri[3 * s + 1]);
+        b.grow(v0 + tri[3 * s + 2]);
+        if (b.overlaps(box)) {
+          out.push_back(bvh.primitives()[s]);
+        }
+      }
+    });
+  }
+
+  private:
+  [[nodiscard]] const Vector3 &
+  vertex(std::size_t triangle, int k) const
+  {
+    return vertices[(indices != nullptr) ? indices[3 * triangle + k]
+                                         : 3 * triangle + k];
+  }
+
+  // Vertex and edges of every triangle in leaf order
+  void
+  gather()
+  {
+    tri.resize(3 * count);
+    parallelFor(0, count, 4096, [&](std::size_t b, std::size_t e) {
+      for (std::size_t s = b; s < e; ++s) {
+        const std::uint32_t i = bvh.primitives()[s];
+        const Vector3 &     v0 = vertex(i, 0);
+        tri[3 * s] = v0;
+        tri[3 * s + 1] = vertex(i, 1) - v0;
+        tri[3 * s + 2] = vertex(i, 2) - v0;
+      }
+    });
+  }
+
+  // Moller-Trumbore against leaf slot s, true for 0 <= t <= t_max
+  bool
+  intersectTriangle(const Ray & ray, std::uint32_t s, float t_max, float & t,
+                    float & u, float & v) const
+  {
+    const Vector3 & e1 = tri[3 * s + 1];
+    const Vector3 & e2 = tri[3 * s + 2];
+    const Vector3   p = ray.direction.cross(e2);
+    const float     det = e1.dotp(p);
+    if (std::fabs(det) < 1e-12f) {
+      return false;
+    }
+    const float   inv_det = 1.0f / det;
+    const Vector3 o = ray.origin - tri[3 * s];
+    u = o.dotp(p) * inv_det;
+    if (u < 0.0f || u > 1.0f) {
+      return false;
+    }
+    const Vector3 q = o.cross(e1);
+    v = ray.direction.dotp(q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) {
+      return false;
+    }
+    t = e2.dotp(q) * inv_det;
+    return t >= 0.0f && t <= t_max;
+  }
+
+  // Up to FloatV::width rays from rays, closest hits to hits
+  void
+  intersectPacket(const Ray * rays, RayHit * hits, std::size_t n) const
+  {
+    constexpr std::size_t w = FloatV::width;
+    alignas(simdAlignment) float lane[10][w];
+    for (std::size_t k = 0; k < w; ++k) {
+      // Padding lanes repeat ray 0 behind its origin, they never hit
+      const Ray & r = rays[(k < n) ? k : 0];
+      lane[0][k] = r.origin.x;
+      lane[1][k] = r.origin.y;
+      lane[2][k] = r.origin.z;
+      lane[3][k] = r.direction.x;
+      lane[4][k] = r.direction.y;
+      lane[5][k] = r.direction.z;
+      lane[6][k] = Bvh::safeInverse(r.direction.x);
+      lane[7][k] = Bvh::safeInverse(r.direction.y);
+      lane[8][k] = Bvh::safeInverse(r.direction.z);
+      lane[9][k] = (k < n) ? r.t_max : -1.0f;
+    }
+    RayPacket packet{FloatV::load(lane[0]), FloatV::load(lane[1]),
+                     FloatV::load(lane[2]), FloatV::load(lane[3]),
+                     FloatV::load(lane[4]), FloatV::load(lane[5]),
+                     FloatV::load(lane[6]), FloatV::load(lane[7]),
+                     FloatV::load(lane[8]), FloatV::load(lane[9])};
+    FloatV        hit_u = FloatV::zero();
+    FloatV        hit_v = FloatV::zero();
+    std::uint32_t prim[w];
+    std::fill(prim, prim + w, RayHit::none);
+
+    const FloatV zero = FloatV::zero();
+    const FloatV one = FloatV::set1(1.0f);
+    const FloatV tiny = FloatV::set1(1e-12f);
+    bvh.intersectPacket(packet, [&](std::uint32_t first, std::uint32_t size) {
+      for (std::uint32_t s = first; s < first + size; ++s) {
+        const Vector3 & v0 = tri[3 * s];
+        const Vector3 & e1 = tri[3 * s + 1];
+        const Vector3 & e2 = tri[3 * s + 2];
+        const FloatV    e1x = FloatV::set1(e1.x);
+        const FloatV    e1y = FloatV::set1(e1.y);
+        const FloatV    e1z = FloatV::set1(e1.z);
+        const FloatV    e2x = FloatV::set1(e2.x);
+        const FloatV    e2y = FloatV::set1(e2.y);
+        const FloatV    e2z = FloatV::set1(e2.z);
+        // p = d x e2, det = e1 . p
+        const FloatV px = packet.dy * e2z - packet.dz * e2y;
+        const FloatV py = packet.dz * e2x - packet.dx * e2z;
+        const FloatV pz = packet.dx * e2y - packet.dy * e2x;
+        const FloatV det =
+            FloatV::mulAdd(e1x, px, FloatV::mulAdd(e1y, py, e1z * pz));
+        const MaskV  flat = FloatV::abs(det) < tiny;
+        const FloatV inv_det = one / FloatV::select(flat, one, det);
+        const FloatV ox = packet.ox - FloatV::set1(v0.x);
+        const FloatV oy = packet.oy - FloatV::set1(v0.y);
+        const FloatV oz = packet.oz - FloatV::set1(v0.z);
+        const FloatV u =
+            FloatV::mulAdd(ox, px, FloatV::mulAdd(oy, py, oz * pz)) * inv_det;
+        // q = o x e1
+        const FloatV qx = oy * e1z - oz * e1y;
+        const FloatV qy = oz * e1x - ox * e1z;
+        const FloatV qz = ox * e1y - oy * e1x;
+        const FloatV v = FloatV::mulAdd(
+                             packet.dx, qx,
+                             FloatV::mulAdd(packet.dy, qy, packet.dz * qz)) *
+                         inv_det;
+        const FloatV t =
+            FloatV::mulAdd(e2x, qx, FloatV::mulAdd(e2y, qy, e2z * qz)) *
+            inv_det;
+        const MaskV hit = (!flat) & (u >= zero) & (v >= zero) &
+                          (u + v <= one) & (t >= zero) & (t <= packet.t_max);
+        const unsigned bits = hit.bits();
+        if (bits == 0) {
+          continue;
+        }
+        packet.t_max = FloatV::select(hit, t, packet.t_max);
+        hit_u = FloatV::select(hit, u, hit_u);
+        hit_v = FloatV::select(hit, v, hit_v);
+        for (std::size_t k = 0; k < w; ++k) {
+          if ((bits >> k) & 1u) {
+            prim[k] = bvh.primitives()[s];
+          }
+        }
+      }
+    });
+
+    packet.t_max.store(lane[0]);
+    hit_u.store(lane[1]);
+    hit_v.store(lane[2]);
+    for (std::size_t k = 0; k < n; ++k) {
+      RayHit & h = hits[k];
+      h = RayHit();
+      if (prim[k] != RayHit::none) {
+        h.t = lane[0][k];
+        h.u = lane[1][k];
+        h.v = lane[2][k];
+        h.primitive = prim[k];
+      }
+    }
+  }
+
+  const Vector3 *       vertices = nullptr;
+  const std::uint32_t * indices = nullptr;
+  std::size_t           count = 0;
+  Bvh                   bvh;
+  std::vector<Aabb>     bounds; // Build input, by triangle
+  std::vector<Vector3>  tri;    // v0, v1 - v0, v2 - v0 by leaf slot
+};
+
+/**
+ * A Bvh over points for box queries, the point array stays the caller's
+ * like TriangleBvh's vertices and refit() follows it after it moved.
+ */
+class PointBvh {
+  public:
+  void
+  build(const Vector3 * point_data, std::size_t n)
+  {
+    points = point_data;
+    bounds.resize(n);
+    parallelFor(0, n, 4096, [&](std::size_t b, std::size_t e) {
+      for (std::size_t i = b; i < e; ++i) {
+        bounds[i] = Aabb(points[i], points[i]);
+      }
+    });
+    bvh.build(bounds.data(), n);
+    gather();
+  }
+
+  // Same points, moved
+  void
+  refit()
+  {
+    gather();
+    bvh.refit([&](std::uint32_t first, std::uint32_t n) {
+      Aabb box;
+      for (std::uint32_t s = first; s < first + n; ++s) {
+        box.grow(sorted[s]);
+      }
+      return box;
+    });
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return sorted.size();
+  }
+  [[nodiscard]] const Bvh &
+  tree() const
+  {
+    return bvh;
+  }
+
+  // Appends every point inside box to out
+  void
+  overlap(const Aabb & box, std::vector<std::uint32_t> & out) const
+  {
+    bvh.queryAabb(box, [&](std::uint32_t first, std::uint32_t n) {
+      for (std::uint32_t s = first; s < first + n; ++s) {
+        if (box.contains(sorted[s])) {
+          out.push_back(bvh.primitives()[s]);
+        }
+      }
+    });
+  }
+
+  private:
+  void
+  gather()
+  {
+    const std::size_t n = bvh.primitives().size();
+    sorted.resize(n);
+    parallelFor(0, n, 4096, [&](std::size_t b, std::size_t e) {
+      for (std::size_t s = b; s < e; ++s) {
+        sorted[s] = points[bvh.primitives()[s]];
+      }
+    });
+  }
+
+  const Vector3 *      points = nullptr;
+  Bvh                  bvh;
+  std::vector<Aabb>    bounds; // Build input, by point
+  std::vector<Vector3> sorted; // By leaf slot
+};
+
+#endif // BVH_HH
@@ -0,0 +1,115 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Math that also works in constant expressions, so transforms built from
+ * literals can be folded into .rodata. At runtime everything here defers to
+ * the regular library/SIMD paths.
+ */
+#ifndef CONST_MATH_HH
+#define CONST_MATH_HH
+
+#include <cmath>
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define HB_HAS_IS_CONSTANT_EVALUATED 1
+#endif
+#endif
+#if !defined(HB_HAS_IS_CONSTANT_EVALUATED) &&                                \
+    ((defined(__GNUC__) && __GNUC__ >= 9) ||                                  \
+     (defined(_MSC_VER) && _MSC_VER >= 1925))
+#define HB_HAS_IS_CONSTANT_EVALUATED 1
+#endif
+
+/**
+ * std::is_constant_evaluated() for C++17. Compilers without the builtin
+ * always report true, which only means the constexpr paths below also run
+ * at runtime: correct, just without the SIMD kernels and libm.
+ */
+constexpr bool
+isConstantEvaluated()
+{
+#if defined(HB_HAS_IS_CONSTANT_EVALUATED)
+  return __builtin_is_constant_evaluated();
+#else
+  return true;
+#endif
+}
+
+// Reduces a to [-pi, pi], in double so the series below stay accurate
+constexpr double
+constexprReduceAngle(double a)
+{
+  constexpr double two_pi = 6.283185307179586476925;
+  const double     x = a;
+  const double     turns = x / two_pi;
+  const auto       k = static_cast<long long>(turns + (turns >= 0 ? 0.5 : -0.5));
+  return x - static_cast<double>(k) * two_pi;
+}
+
+// Taylor series in double, converged to double rounding on [-pi, pi]
+template<typename T>
+constexpr T
+constexprSin(T a)
+{
+  if (!isConstantEvaluated()) {
+    return static_cast<T>(std::sin(a));
+  }
+  const double x = constexprReduceAngle(a);
+  double       term = x;
+  double       sum = x;
+  for (int n = 1; n < 18; ++n) {
+    term *= -x * x / static_cast<double>((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return static_cast<T>(sum);
+}
+
+template<typename T>
+constexpr T
+constexprCos(T a)
+{
+  if (!isConstantEvaluated()) {
+    return static_cast<T>(std::cos(a));
+  }
+  const double x = constexprReduceAngle(a);
+  double       term = 1.0;
+  double       sum = 1.0;
+  for (int n = 1; n < 18; ++n) {
+    term *= -x * x / static_cast<double>((2 * n - 1) * (2 * n));
+    sum += term;
+  }
+  return static_cast<T>(sum);
+}
+
+/**
+ * Both at once for the rotation builders: one range reduction in constant
+ * expressions, one sincos call at runtime (GCC and Clang fuse the adjacent
+ * std::sin and std::cos).
+ */
+template<typename T>
+constexpr void
+constexprSinCos(T a, T & s, T & c)
+{
+  if (!isConstantEvaluated()) {
+    s = static_cast<T>(std::sin(a));
+    c = static_cast<T>(std::cos(a));
+    return;
+  }
+  const double x = constexprReduceAngle(a);
+  double       sin_term = x;
+  double       cos_term = 1.0;
+  double       sin_sum = x;
+  double       cos_sum = 1.0;
+  for (int n = 1; n < 18; ++n) {
+    sin_term *= -x * x / static_cast<double>((2 * n) * (2 * n + 1));
+    cos_term *= -x * x / static_cast<double>((2 * n - 1) * (2 * n));
+    sin_sum += sin_term;
+    cos_sum += cos_term;
+  }
+  s = static_cast<T>(sin_sum);
+  c = static_cast<T>(cos_sum);
+}
+
+#endif // CONST_MATH_HH
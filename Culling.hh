@@ -0,0 +1,262 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Frustum planes from a view projection Matrix4 and batch culling of
+ * bounding spheres and boxes kept in SoA streams. Every bound is loaded once
+ * and tested against all frustums passed in, so the main view and its
+ * shadow cascades share one pass over the data. Results are bitmasks, bit
+ * i % 32 of word i / 32 for bound i, which compactVisible() turns into an
+ * index list.
+ */
+#ifndef CULLING_HH
+#define CULLING_HH
+#include "Matrix.hh"
+#include "Parallel.hh"
+#include "Simd.hh"
+#include "Vector.hh"
+#include "VectorSoA.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class Frustum {
+  public:
+  // Clip space depth range of the projection
+  enum class Depth { MinusOneToOne, ZeroToOne };
+
+  // (n, d) with unit n pointing inside, p is inside a plane if n.p + d >= 0
+  Vector4 planes[6];
+
+  /**
+   * Gribb & Hartmann: every clip plane is the last row of the matrix plus
+   * or minus one of the others. Order left, right, bottom, top, near, far.
+   */
+  static Frustum
+  fromMatrix(const Matrix4 & view_proj, Depth depth = Depth::MinusOneToOne)
+  {
+    const float * c = view_proj.cells;
+    // Row 3 + sign * row r
+    const auto plane = [c](int r, float sign) {
+      return Vector4(c[12] + sign * c[4 * r], c[13] + sign * c[4 * r + 1],
+                     c[14] + sign * c[4 * r + 2], c[15] + sign * c[4 * r + 3]);
+    };
+
+    Frustum f;
+    f.planes[0] = plane(0, 1.0f);
+    f.planes[1] = plane(0, -1.0f);
+    f.planes[2] = plane(1, 1.0f);
+    f.planes[3] = plane(1, -1.0f);
+    f.planes[4] = (depth == Depth::ZeroToOne)
+                      ? Vector4(c[8], c[9], c[10], c[11])
+                      : plane(2, 1.0f);
+    f.planes[5] = plane(2, -1.0f);
+    for (auto & p : f.planes) {
+      p /= std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+    }
+    return f;
+  }
+
+  // Scalar references for the batch kernels, true unless fully outside
+  [[nodiscard]] bool
+  intersectsSphere(const Vector3 & center, float radius) const
+  {
+    for (const auto & p : planes) {
+      if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius) {
+        return false;
+      }
+    }
+    return true;
+  }
+  [[nodiscard]] bool
+  intersectsAabb(const Vector3 & center, const Vector3 & extent) const
+  {
+    for (const auto & p : planes) {
+      const float dist = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+      const float reach = std::fabs(p.x) * extent.x +
+                          std::fabs(p.y) * extent.y + std::fabs(p.z) * extent.z;
+      if (dist < -reach) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Bounding spheres as center x, y, z and radius streams
+class SphereSoA {
+  public:
+  SphereSoA() = default;
+  explicit SphereSoA(std::size_t n) : data(n)
+  {
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return data.count;
+  }
+  void
+  resize(std::size_t n)
+  {
+    data.resize(n);
+  }
+  void
+  set(std::size_t i, const Vector3 & center, float radius)
+  {
+    data.comp[0][i] = center.x;
+    data.comp[1][i] = center.y;
+    data.comp[2][i] = center.z;
+    data.comp[3][i] = radius;
+  }
+
+  SoAStorage<4> data;
+};
+
+// Axis aligned boxes as center and half extent streams
+class AabbSoA {
+  public:
+  AabbSoA() = default;
+  explicit AabbSoA(std::size_t n) : data(n)
+  {
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return data.count;
+  }
+  void
+  resize(std::size_t n)
+  {
+    data.resize(n);
+  }
+  void
+  set(std::size_t i, const Vector3 & min, const Vector3 & max)
+  {
+    const Vector3 center = (min + max) * 0.5f;
+    const Vector3 extent = (max - min) * 0.5f;
+    data.comp[0][i] = center.x;
+    data.comp[1][i] = center.y;
+    data.comp[2][i] = center.z;
+    data.comp[3][i] = extent.x;
+    data.comp[4][i] = extent.y;
+    data.comp[5][i] = extent.z;
+  }
+
+  SoAStorage<6> data;
+};
+
+// Bounds per parallelFor chunk, a multiple of 32 so chunks own whole words
+constexpr std::size_t cullChunkSize = 4096;
+
+/**
+ * Runs test(i, plane) -> MaskV of lanes outside that plane for every
+ * register of n bounds and every frustum, and writes the inside bits to
+ * masks[f], (n + 31) / 32 words each.
+ */
+template<typename Test>
+inline void
+cullBlocks(std::size_t n, const Frustum * frustums, std::size_t count,
+           std::uint32_t * const * masks, Test && test)
+{
+  static_assert(32 % FloatV::width == 0, "Mask groups must not straddle words");
+  static_assert(cullChunkSize % 32 == 0, "Chunks must own whole words");
+  constexpr std::size_t w = FloatV::width;
+  parallelFor(0, n, cullChunkSize, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i += w) {
+      const std::uint32_t valid = (1u << std::min(w, end - i)) - 1u;
+      for (std::size_t f = 0; f < count; ++f) {
+        MaskV outside = test(i, frustums[f].planes[0]);
+        for (int p = 1; p < 6; ++p) {
+          outside = outside | test(i, frustums[f].planes[p]);
+        }
+        const std::uint32_t bits = ~outside.bits() & valid;
+        std::uint32_t &     word = masks[f][i / 32];
+        if (i % 32 == 0) {
+          word = 0;
+        }
+        word |= bits << (i % 32);
+      }
+    }
+  });
+}
+
+inline void
+cullSpheres(const SphereSoA & s, const Frustum * frustums, std::size_t count,
+            std::uint32_t * const * masks)
+{
+  const float * const * c = s.data.comp;
+  cullBlocks(s.size(), frustums, count, masks,
+             [&](std::size_t i, const Vector4 & p) {
+               const FloatV dist = FloatV::mulAdd(
+                   FloatV::set1(p.x), FloatV::load(c[0] + i),
+                   FloatV::mulAdd(FloatV::set1(p.y), FloatV::load(c[1] + i),
+                                  FloatV::mulAdd(FloatV::set1(p.z),
+                                                 FloatV::load(c[2] + i),
+                                                 FloatV::set1(p.w))));
+               return dist < -FloatV::load(c[3] + i);
+             });
+}
+
+inline void
+cullAabbs(const AabbSoA & b, const Frustum * frustums, std::size_t count,
+          std::uint32_t * const * masks)
+{
+  const float * const * c = b.data.comp;
+  cullBlocks(b.size(), frustums, count, masks,
+             [&](std::size_t i, const Vector4 & p) {
+               const FloatV dist = FloatV::mulAdd(
+                   FloatV::set1(p.x), FloatV::load(c[0] + i),
+                   FloatV::mulAdd(FloatV::set1(p.y), FloatV::load(c[1] + i),
+                                  FloatV::mulAdd(FloatV::set1(p.z),
+                                                 FloatV::load(c[2] + i),
+                                                 FloatV::set1(p.w))));
+               // Projected half extent, |n| . e
+               const FloatV reach = FloatV::mulAdd(
+                   FloatV::set1(std::fabs(p.x)), FloatV::load(c[3] + i),
+                   FloatV::mulAdd(FloatV::set1(std::fabs(p.y)),
+                                  FloatV::load(c[4] + i),
+                                  FloatV::set1(std::fabs(p.z)) *
+                                      FloatV::load(c[5] + i)));
+               return dist < -reach;
+             });
+}
+
+// Index of the lowest set bit, bits != 0
+inline unsigned
+lowestBit(std::uint32_t bits)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(bits));
+#endif
+}
+
+/**
+ * Writes the index of every set bit of mask, n bits, to out in increasing
+ * order and returns how many there were. out needs room for n indices.
+ */
+inline std::size_t
+compactVisible(const std::uint32_t * mask, std::size_t n, std::uint32_t * out)
+{
+  std::size_t count = 0;
+  for (std::size_t word = 0; word < (n + 31) / 32; ++word) {
+    std::uint32_t bits = mask[word];
+    while (bits != 0) {
+      out[count++] = static_cast<std::uint32_t>(word * 32 + lowestBit(bits));
+      bits &= bits - 1;
+    }
+  }
+  return count;
+}
+
+#endif // CULLING_HH
@@ -0,0 +1,113 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * A dual quaternion real + e * dual, e^2 = 0, holds a rotation and a
+ * translation: real is the rotation, dual = 0.5 * t * real with t = [t, 0].
+ * Blending them and renormalizing stays a rigid transform, which is what
+ * makes dual quaternion skinning free of the linear blend candy wrapper.
+ */
+#ifndef DUAL_QUAT_HH
+#define DUAL_QUAT_HH
+#include "Matrix.hh"
+#include "Quat.hh"
+#include "Vector.hh"
+
+#include <cmath>
+
+template<typename T>
+class DualQuat {
+  public:
+  // Constructors, the default one is the identity transform
+  constexpr DualQuat() : real(0, 0, 0, 1), dual(0, 0, 0, 0) {}
+  constexpr explicit DualQuat(const Quat<T> & r, const Quat<T> & d)
+      : real(r), dual(d)
+  {
+  }
+  // Rotate by the unit quaternion rot, then translate by t
+  constexpr explicit DualQuat(const Quat<T> & rot, const Vector3T<T> & t)
+      : real(rot), dual(Quat<T>(t.x, t.y, t.z, 0) * rot * static_cast<T>(0.5))
+  {
+  }
+
+  static constexpr DualQuat
+  identity()
+  {
+    return DualQuat();
+  }
+
+  // Components of the rigid transform
+  [[nodiscard]] constexpr Quat<T>
+  rotation() const
+  {
+    return real;
+  }
+  // 2 * dual * conj(real), for a unit real part
+  [[nodiscard]] constexpr Vector3T<T>
+  translation() const
+  {
+    return (dual * real.conjugateQuat() * static_cast<T>(2)).vectorizeSelf3d();
+  }
+
+  /**
+   * Unit real part and a dual part orthogonal to it. A weighted sum of unit
+   * dual quaternions needs this before it is a rigid transform again.
+   */
+  [[nodiscard]] DualQuat
+  normalized() const
+  {
+    const T       inv = invSqrt(real.squaredCompSums());
+    const Quat<T> r = real * inv;
+    const Quat<T> d = dual * inv;
+    return DualQuat(r, d - r * r.dotp(d));
+  }
+
+  // Apply to a point, rotation first
+  [[nodiscard]] constexpr Vector3T<T>
+  transformPoint(const Vector3T<T> & p) const
+  {
+    return real.rotateVector(p) + translation();
+  }
+  [[nodiscard]] constexpr Vector3T<T>
+  transformDirection(const Vector3T<T> & d) const
+  {
+    return real.rotateVector(d);
+  }
+
+  [[nodiscard]] constexpr Matrix4T<T>
+  toMatrix4() const
+  {
+    return real.toMatrix4(translation());
+  }
+
+  // Basic operation overrides
+  constexpr DualQuat
+  operator+(const DualQuat & b) const
+  {
+    return DualQuat(real + b.real, dual + b.dual);
+  }
+
+  constexpr DualQuat
+  operator*(T b) const
+  {
+    return DualQuat(real * b, dual * b);
+  }
+
+  // Applies b first, then this, like the Matrix4 product
+  constexpr DualQuat
+  operator*(const DualQuat & b) const
+  {
+    return DualQuat(real * b.real, (real * b.dual) + (dual * b.real));
+  }
+
+  constexpr void
+  operator*=(const DualQuat & b)
+  {
+    *this = operator*(b);
+  }
+
+  Quat<T> real;
+  Quat<T> dual;
+};
+
+#endif // DUAL_QUAT_HH
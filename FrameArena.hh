@@ -0,0 +1,278 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Linear per-frame allocation for the transient buffers of the batch code:
+ * palettes, blend targets, culling masks and index lists. Allocation is a
+ * pointer bump, nothing is freed individually and reset() at frame end
+ * rewinds in O(1). A frame that outgrows the arena chains extra blocks, and
+ * the next reset() merges them into one block of the combined size, so the
+ * steady state frame never reaches the heap. FrameArenas keeps one arena
+ * per ThreadPool thread so chunks can allocate without synchronization.
+ *
+ * Every allocation is simdAlignment aligned by default, so spans feed the
+ * Vector3/Matrix4 pointer kernels directly and makeSoA() backs the SoA
+ * streams with arena memory.
+ */
+#ifndef FRAME_ARENA_HH
+#define FRAME_ARENA_HH
+#include "Parallel.hh"
+#include "Simd.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Non-owning view of count contiguous T
+template<typename T>
+class Span {
+  public:
+  Span() = default;
+  Span(T * p, std::size_t n) : ptr(p), count(n)
+  {
+  }
+  // Span<T> to Span<const T>
+  template<typename U,
+           typename = std::enable_if_t<std::is_same_v<const U, T>>>
+  Span(const Span<U> & b) : ptr(b.data()), count(b.size())
+  {
+  }
+
+  [[nodiscard]] T *
+  data() const
+  {
+    return ptr;
+  }
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return count;
+  }
+  [[nodiscard]] bool
+  empty() const
+  {
+    return count == 0;
+  }
+  T &
+  operator[](std::size_t i) const
+  {
+    return ptr[i];
+  }
+  [[nodiscard]] T *
+  begin() const
+  {
+    return ptr;
+  }
+  [[nodiscard]] T *
+  end() const
+  {
+    return ptr + count;
+  }
+
+  private:
+  T *         ptr = nullptr;
+  std::size_t count = 0;
+};
+
+class FrameArena {
+  public:
+  // bytes up front, 0 defers the first block to the first allocation
+  explicit FrameArena(std::size_t bytes = 0)
+  {
+    reserve(bytes);
+  }
+  ~FrameArena()
+  {
+    release();
+  }
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &
+  operator=(const FrameArena &) = delete;
+
+  /**
+   * Makes the arena one block of at least bytes. Everything allocated so
+   * far is invalidated, like reset().
+   */
+  void
+  reserve(std::size_t bytes)
+  {
+    if (blocks.size() == 1 && blocks[0].size >= bytes) {
+      reset();
+      return;
+    }
+    release();
+    if (bytes != 0) {
+      addBlock(bytes);
+    }
+  }
+
+  /**
+   * bytes of uninitialized memory aligned to align, a power of two no larger
+   * than simdAlignment. Valid until the next reset().
+   */
+  [[nodiscard]] void *
+  allocate(std::size_t bytes, std::size_t align = simdAlignment)
+  {
+    assert(align != 0 && (align & (align - 1)) == 0 && align <= simdAlignment);
+    std::size_t offset = (top + align - 1) & ~(align - 1);
+    if (blocks.empty() || offset + bytes > blocks.back().size) {
+      // Doubling keeps the number of blocks of an overflowing frame low
+      const std::size_t size = blocks.empty() ? 0 : blocks.back().size;
+      addBlock(std::max({bytes, 2 * size, simdAlignment}));
+      offset = 0;
+    }
+    top = offset + bytes;
+    return blocks.back().memory + offset;
+  }
+
+  /**
+   * n uninitialized T. Destructors never run, so T must be trivially
+   * destructible, and the Matrix4/Quat default zeroing is skipped as well.
+   */
+  template<typename T>
+  [[nodiscard]] Span<T>
+  allocArray(std::size_t n)
+  {
+    static_assert(std::is_trivially_copyable_v<T> &&
+                      std::is_trivially_destructible_v<T>,
+                  "The arena neither constructs nor destroys");
+    static_assert(alignof(T) <= simdAlignment, "Overaligned type");
+    return Span<T>(static_cast<T *>(allocate(n * sizeof(T))), n);
+  }
+
+  /**
+   * A Vector3SoA, Vector4SoA, QuatSoA, SphereSoA or AabbSoA of n elements
+   * backed by the arena, padding zeroed and elements unspecified. Kernels
+   * writing it at size n keep it in the arena, see SoAStorage(n, block).
+   */
+  template<typename Soa>
+  [[nodiscard]] Soa
+  makeSoA(std::size_t n)
+  {
+    using Storage = decltype(Soa::data);
+    Soa out;
+    out.data = Storage(n, static_cast<float *>(allocate(Storage::bytes(n))));
+    return out;
+  }
+
+  /**
+   * Invalidates every allocation. O(1) unless the frame overflowed into
+   * extra blocks, then they are merged into one block big enough for it.
+   */
+  void
+  reset()
+  {
+    if (blocks.size() > 1) {
+      std::size_t total = 0;
+      for (const Block & b : blocks) {
+        total += b.size;
+      }
+      release();
+      addBlock(total);
+    }
+    top = 0;
+  }
+
+  // Bytes handed out since the last reset(), padding included
+  [[nodiscard]] std::size_t
+  used() const
+  {
+    std::size_t total = top;
+    for (std::size_t b = 0; b + 1 < blocks.size(); ++b) {
+      total += blocks[b].size;
+    }
+    return total;
+  }
+  [[nodiscard]] std::size_t
+  capacity() const
+  {
+    std::size_t total = 0;
+    for (const Block & b : blocks) {
+      total += b.size;
+    }
+    return total;
+  }
+
+  private:
+  class Block {
+    public:
+    std::uint8_t * memory;
+    std::size_t    size;
+  };
+
+  void
+  addBlock(std::size_t bytes)
+  {
+    bytes = (bytes + simdAlignment - 1) & ~(simdAlignment - 1);
+    blocks.push_back(
+        {static_cast<std::uint8_t *>(simdAlignedAlloc(bytes)), bytes});
+    top = 0;
+  }
+  void
+  release()
+  {
+    for (const Block & b : blocks) {
+      simdAlignedFree(b.memory);
+    }
+    blocks.clear();
+    top = 0;
+  }
+
+  std::vector<Block> blocks; // Allocation happens in back()
+  std::size_t        top = 0; // Bytes used in back()
+};
+
+/**
+ * One FrameArena per thread of a ThreadPool, local() picks the calling
+ * thread's by ThreadPool::threadIndex(). Slot 0 is the thread that drives
+ * the frame and calls parallelFor, no other thread outside the pool may use
+ * local() concurrently with it.
+ */
+class FrameArenas {
+  public:
+  explicit FrameArenas(std::size_t bytes_per_thread,
+                       const ThreadPool & pool = ThreadPool::global())
+      : count(pool.concurrency()),
+        arenas(std::make_unique<FrameArena[]>(pool.concurrency()))
+  {
+    for (unsigned i = 0; i < count; ++i) {
+      arenas[i].reserve(bytes_per_thread);
+    }
+  }
+
+  [[nodiscard]] FrameArena &
+  local()
+  {
+    return get(ThreadPool::threadIndex());
+  }
+  [[nodiscard]] FrameArena &
+  get(unsigned thread)
+  {
+    assert(thread < count);
+    return arenas[thread];
+  }
+  [[nodiscard]] unsigned
+  size() const
+  {
+    return count;
+  }
+
+  // At frame end, once no parallelFor is running
+  void
+  reset()
+  {
+    for (unsigned i = 0; i < count; ++i) {
+      arenas[i].reset();
+    }
+  }
+
+  private:
+  unsigned                      count;
+  std::unique_ptr<FrameArena[]> arenas;
+};
+
+#endif // FRAME_ARENA_HH
@@ -0,0 +1,207 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * IEEE 754 binary16 storage type and the conversions between precisions.
+ * Half only stores, it has no arithmetic: bulk data is kept as Half and
+ * widened to float right before the math, which halves the bytes moved per
+ * element. Conversions round to nearest even, array conversions use F16C
+ * when the CPU has it.
+ */
+#ifndef HALF_HH
+#define HALF_HH
+#include "Simd.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class Half {
+  public:
+  std::uint16_t bits = 0;
+
+  Half() = default;
+  explicit Half(float f) : bits(fromFloat(f)) {}
+
+  // Widening is exact, so it may happen implicitly
+  operator float() const
+  {
+    return toFloat(bits);
+  }
+
+  static Half
+  fromBits(std::uint16_t b)
+  {
+    Half h;
+    h.bits = b;
+    return h;
+  }
+
+  /**
+   * Round to nearest even. Overflow goes to infinity, NaN becomes the
+   * quiet NaN 0x7E00 without its payload (F16C keeps the payload).
+   */
+  static std::uint16_t
+  fromFloat(float f)
+  {
+#if defined(__F16C__)
+    return static_cast<std::uint16_t>(
+        _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+#else
+    constexpr std::uint32_t f32_inf = 255u << 23;
+    constexpr std::uint32_t f16_max = (127u + 16u) << 23; // 65536, rounds to inf
+    constexpr std::uint32_t denorm_magic = ((127u - 15u) + (23u - 10u) + 1u)
+                                           << 23;
+    std::uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    const std::uint32_t sign = u & 0x80000000u;
+    u ^= sign;
+
+    std::uint32_t out;
+    if (u >= f16_max) {
+      out = (u > f32_inf) ? 0x7E00u : 0x7C00u;
+    } else if (u < (113u << 23)) {
+      // Below the smallest normal half, let the FPU round the mantissa
+      // into place by adding 0.5
+      float shifted;
+      float magic;
+      std::memcpy(&shifted, &u, sizeof(u));
+      std::memcpy(&magic, &denorm_magic, sizeof(magic));
+      shifted += magic;
+      std::memcpy(&u, &shifted, sizeof(u));
+      out = u - denorm_magic;
+    } else {
+      // Rebias the exponent, + 0xFFF + the odd bit rounds to nearest even
+      const std::uint32_t mant_odd = (u >> 13) & 1u;
+      u += ((15u - 127u) << 23) + 0xFFFu + mant_odd;
+      out = u >> 13;
+    }
+    return static_cast<std::uint16_t>(out | (sign >> 16));
+#endif
+  }
+
+  static float
+  toFloat(std::uint16_t h)
+  {
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    constexpr std::uint32_t shifted_exp = 0x7C00u << 13;
+    std::uint32_t           u = (h & 0x7FFFu) << 13;
+    const std::uint32_t     exp = u & shifted_exp;
+    u += (127u - 15u) << 23;
+    if (exp == shifted_exp) {
+      u += (128u - 16u) << 23; // Inf or NaN
+    } else if (exp == 0) {
+      // Subnormal, renormalize through the FPU
+      constexpr std::uint32_t magic_bits = 113u << 23;
+      float                   magic;
+      float                   f;
+      u += 1u << 23;
+      std::memcpy(&f, &u, sizeof(f));
+      std::memcpy(&magic, &magic_bits, sizeof(magic));
+      f -= magic;
+      std::memcpy(&u, &f, sizeof(u));
+    }
+    u |= static_cast<std::uint32_t>(h & 0x8000u) << 16;
+    float out;
+    std::memcpy(&out, &u, sizeof(out));
+    return out;
+#endif
+  }
+};
+
+static_assert(sizeof(Half) == 2, "Half arrays must pack to 2 bytes");
+
+#if HB_SIMD_X86
+HB_TARGET("f16c") inline void
+halfToFloatF16c(const Half * in, float * out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+  }
+  for (; i < n; ++i) {
+    out[i] = _cvtsh_ss(in[i].bits);
+  }
+}
+
+HB_TARGET("f16c") inline void
+floatToHalfF16c(const float * in, Half * out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i),
+                                      _MM_FROUND_TO_NEAREST_INT |
+                                          _MM_FROUND_NO_EXC);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), h);
+  }
+  for (; i < n; ++i) {
+    out[i].bits = static_cast<std::uint16_t>(
+        _cvtss_sh(in[i], _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+}
+#endif // HB_SIMD_X86
+
+// n scalars, F16C picked at runtime like the Matrix4 kernels
+inline void
+convertScalars(const Half * in, float * out, std::size_t n)
+{
+#if HB_SIMD_X86
+  if (CpuFeatures::get().f16c) {
+    halfToFloatF16c(in, out, n);
+    return;
+  }
+#endif
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = Half::toFloat(in[i].bits);
+  }
+}
+inline void
+convertScalars(const float * in, Half * out, std::size_t n)
+{
+#if HB_SIMD_X86
+  if (CpuFeatures::get().f16c) {
+    floatToHalfF16c(in, out, n);
+    return;
+  }
+#endif
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i].bits = Half::fromFloat(in[i]);
+  }
+}
+// Any other pair, double <-> Half goes through float
+template<typename To, typename From>
+inline void
+convertScalars(const From * in, To * out, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = static_cast<To>(static_cast<float>(in[i]));
+  }
+}
+template<typename T>
+inline void
+convertScalars(const T * in, T * out, std::size_t n)
+{
+  std::memmove(out, in, n * sizeof(T));
+}
+
+/**
+ * n objects of a type templated on its scalar, Vector3T<Half> to Vector3
+ * or Matrix4T<double> to Matrix4 for example. The objects must be packed
+ * scalars, which every Vector*T and Matrix4T is.
+ */
+template<template<typename> class V, typename To, typename From>
+inline void
+convertPrecision(const V<From> * in, V<To> * out, std::size_t n)
+{
+  static_assert(sizeof(V<From>) % sizeof(From) == 0 &&
+                    sizeof(V<To>) / sizeof(To) == sizeof(V<From>) / sizeof(From),
+                "Only packed scalar types convert as flat arrays");
+  convertScalars(reinterpret_cast<const From *>(in), reinterpret_cast<To *>(out),
+                 n * (sizeof(V<From>) / sizeof(From)));
+}
+
+#endif // HALF_HH
@@ -5,215 +5,315 @@
  */
 #ifndef MATRIX_HH
 #define MATRIX_HH
+#include "ConstMath.hh"
+#include "MatrixSimd.hh"
 #include "Vector.hh"
 
-class Matrix4 {
+#include <type_traits>
+
+template<typename T>
+class Matrix4T {
   public:
   // Components (cells)
-  float cells[16] = {0};
+  T cells[16]{};
+
+  // What the builders compute in, float for Half and T otherwise
+  using Calc = decltype(T() * T());
 
   // Constructors
-  Matrix4() = default;
-  explicit Matrix4(float b)
+  Matrix4T() = default;
+  constexpr explicit Matrix4T(T b)
   {
     fillCells(b);
   }
+  // Precision conversion, arrays go through convertPrecision()
+  template<typename U>
+  constexpr explicit Matrix4T(const Matrix4T<U> & b)
+  {
+    for (int i = 0; i < 16; ++i) {
+      cells[i] = static_cast<T>(b.cells[i]);
+    }
+  }
 
   // Some general matrix operations
-  void
-  fillCells(float b)
+  constexpr void
+  fillCells(T b)
   {
-    std::fill(&cells[0], &cells[16], b);
+    for (auto & cell : cells) {
+      cell = b;
+    }
   }
-  void
+  constexpr void
   makeZero()
   {
-    fillCells(0.0f);
+    fillCells(T(0));
   }
-  void
+  constexpr void
   makeIdentity()
   {
-    cells[0] = 1.0f;
-    cells[1] = 0.0f;
-    cells[2] = 0.0f;
-    cells[3] = 0.0f;
-    cells[4] = 0.0f;
-    cells[5] = 1.0f;
-    cells[6] = 0.0f;
-    cells[7] = 0.0f;
-    cells[8] = 0.0f;
-    cells[9] = 0.0f;
-    cells[10] = 1.0f;
-    cells[11] = 0.0f;
-    cells[12] = 0.0f;
-    cells[13] = 0.0f;
-    cells[14] = 0.0f;
-    cells[15] = 1.0f;
-  }
-  void
-  makeRotX(float a)
-  {
-    cells[0] = 1.0f;
-    cells[1] = 0.0f;
-    cells[2] = 0.0f;
-    cells[3] = 0.0f;
-    cells[4] = 0.0f;
-    cells[5] = std::cos(a);
-    cells[6] = -std::sin(a);
-    cells[7] = 0.0f;
-    cells[8] = 0.0f;
-    cells[9] = std::sin(a);
-    cells[10] = std::cos(a);
-    cells[11] = 0.0f;
-    cells[12] = 0.0f;
-    cells[13] = 0.0f;
-    cells[14] = 0.0f;
-    cells[15] = 1.0f;
-  }
-  void
-  makeRotY(float a)
-  {
-    cells[0] = std::cos(a);
-    cells[1] = 0.0f;
-    cells[2] = std::sin(a);
-    cells[3] = 0.0f;
-    cells[4] = 0.0f;
-    cells[5] = 1.0f;
-    cells[6] = 0.0f;
-    cells[7] = 0.0f;
-    cells[8] = -std::sin(a);
-    cells[9] = 0.0f;
-    cells[10] = std::cos(a);
-    cells[11] = 0.0f;
-    cells[12] = 0.0f;
-    cells[13] = 0.0f;
-    cells[14] = 0.0f;
-    cells[15] = 1.0f;
-  }
-  void
-  makeRotZ(float a)
-  {
-    cells[0] = std::cos(a);
-    cells[1] = -std::sin(a);
-    cells[2] = 0.0f;
-    cells[3] = 0.0f;
-    cells[4] = std::sin(a);
-    cells[5] = std::cos(a);
-    cells[6] = 0.0f;
-    cells[7] = 0.0f;
-    cells[8] = 0.0f;
-    cells[9] = 0.0f;
-    cells[10] = 1.0f;
-    cells[11] = 0.0f;
-    cells[12] = 0.0f;
-    cells[13] = 0.0f;
-    cells[14] = 0.0f;
-    cells[15] = 1.0f;
-  }
-  void
-  makeTrans(const Vector3 & t)
-  {
-    cells[0] = 1.0f;
-    cells[1] = 0.0f;
-    cells[2] = 0.0f;
+    cells[0] = T(1);
+    cells[1] = T(0);
+    cells[2] = T(0);
+    cells[3] = T(0);
+    cells[4] = T(0);
+    cells[5] = T(1);
+    cells[6] = T(0);
+    cells[7] = T(0);
+    cells[8] = T(0);
+    cells[9] = T(0);
+    cells[10] = T(1);
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
+  }
+  constexpr void
+  makeRotX(T a)
+  {
+    Calc s{};
+    Calc c{};
+    constexprSinCos(Calc(a), s, c);
+    cells[0] = T(1);
+    cells[1] = T(0);
+    cells[2] = T(0);
+    cells[3] = T(0);
+    cells[4] = T(0);
+    cells[5] = T(c);
+    cells[6] = T(-s);
+    cells[7] = T(0);
+    cells[8] = T(0);
+    cells[9] = T(s);
+    cells[10] = T(c);
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
+  }
+  constexpr void
+  makeRotY(T a)
+  {
+    Calc s{};
+    Calc c{};
+    constexprSinCos(Calc(a), s, c);
+    cells[0] = T(c);
+    cells[1] = T(0);
+    cells[2] = T(s);
+    cells[3] = T(0);
+    cells[4] = T(0);
+    cells[5] = T(1);
+    cells[6] = T(0);
+    cells[7] = T(0);
+    cells[8] = T(-s);
+    cells[9] = T(0);
+    cells[10] = T(c);
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
+  }
+  constexpr void
+  makeRotZ(T a)
+  {
+    Calc s{};
+    Calc c{};
+    constexprSinCos(Calc(a), s, c);
+    cells[0] = T(c);
+    cells[1] = T(-s);
+    cells[2] = T(0);
+    cells[3] = T(0);
+    cells[4] = T(s);
+    cells[5] = T(c);
+    cells[6] = T(0);
+    cells[7] = T(0);
+    cells[8] = T(0);
+    cells[9] = T(0);
+    cells[10] = T(1);
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
+  }
+  /**
+   * rotY(yaw) * rotX(pitch) * rotZ(roll) written out, so roll applies first
+   * and yaw last. One sincos per angle and no matrix products.
+   */
+  constexpr void
+  makeYawPitchRoll(T yaw, T pitch, T roll)
+  {
+    Calc sy{}, cy{}, sp{}, cp{}, sr{}, cr{};
+    constexprSinCos(Calc(yaw), sy, cy);
+    constexprSinCos(Calc(pitch), sp, cp);
+    constexprSinCos(Calc(roll), sr, cr);
+    cells[0] = T(cy * cr + sy * sp * sr);
+    cells[1] = T(sy * sp * cr - cy * sr);
+    cells[2] = T(sy * cp);
+    cells[3] = T(0);
+    cells[4] = T(cp * sr);
+    cells[5] = T(cp * cr);
+    cells[6] = T(-sp);
+    cells[7] = T(0);
+    cells[8] = T(cy * sp * sr - sy * cr);
+    cells[9] = T(sy * sr + cy * sp * cr);
+    cells[10] = T(cy * cp);
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
+  }
+  // Rotation by a radians about a unit axis, Rodrigues' formula
+  constexpr void
+  makeAxisAngle(const Vector3T<T> & axis, T a)
+  {
+    const Calc x = axis.x;
+    const Calc y = axis.y;
+    const Calc z = axis.z;
+    Calc       s{};
+    Calc       c{};
+    constexprSinCos(Calc(a), s, c);
+    const Calc t = Calc(1) - c;
+    const Calc tx = t * x;
+    const Calc ty = t * y;
+    const Calc tz = t * z;
+    cells[0] = T(tx * x + c);
+    cells[1] = T(tx * y - s * z);
+    cells[2] = T(tx * z + s * y);
+    cells[3] = T(0);
+    cells[4] = T(tx * y + s * z);
+    cells[5] = T(ty * y + c);
+    cells[6] = T(ty * z - s * x);
+    cells[7] = T(0);
+    cells[8] = T(tx * z - s * y);
+    cells[9] = T(ty * z + s * x);
+    cells[10] = T(tz * z + c);
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
+  }
+  constexpr void
+  makeTrans(const Vector3T<T> & t)
+  {
+    cells[0] = T(1);
+    cells[1] = T(0);
+    cells[2] = T(0);
     cells[3] = t.x;
-    cells[4] = 0.0f;
-    cells[5] = 1.0f;
-    cells[6] = 0.0f;
+    cells[4] = T(0);
+    cells[5] = T(1);
+    cells[6] = T(0);
     cells[7] = t.y;
-    cells[8] = 0.0f;
-    cells[9] = 0.0f;
-    cells[10] = 1.0f;
+    cells[8] = T(0);
+    cells[9] = T(0);
+    cells[10] = T(1);
     cells[11] = t.z;
-    cells[12] = 0.0f;
-    cells[13] = 0.0f;
-    cells[14] = 0.0f;
-    cells[15] = 1.0f;
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
   }
-  void
-  makeScale(const Vector3 & s)
+  constexpr void
+  makeScale(const Vector3T<T> & s)
   {
     cells[0] = s.x;
-    cells[1] = 0.0f;
-    cells[2] = 0.0f;
-    cells[3] = 0.0f;
-    cells[4] = 0.0f;
+    cells[1] = T(0);
+    cells[2] = T(0);
+    cells[3] = T(0);
+    cells[4] = T(0);
     cells[5] = s.y;
-    cells[6] = 0.0f;
-    cells[7] = 0.0f;
-    cells[8] = 0.0f;
-    cells[9] = 0.0f;
+    cells[6] = T(0);
+    cells[7] = T(0);
+    cells[8] = T(0);
+    cells[9] = T(0);
     cells[10] = s.z;
-    cells[11] = 0.0f;
-    cells[12] = 0.0f;
-    cells[13] = 0.0f;
-    cells[14] = 0.0f;
-    cells[15] = 1.0f;
+    cells[11] = T(0);
+    cells[12] = T(0);
+    cells[13] = T(0);
+    cells[14] = T(0);
+    cells[15] = T(1);
   }
 
   // SIdentities
-  static Matrix4
+  static constexpr Matrix4T
   zero()
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeZero();
     return cells;
   }
-  static Matrix4
+  static constexpr Matrix4T
   identity()
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeIdentity();
     return cells;
   }
-  static Matrix4
-  rotX(float a)
+  static constexpr Matrix4T
+  rotX(T a)
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeRotX(a);
     return cells;
   }
-  static Matrix4
-  rotY(float a)
+  static constexpr Matrix4T
+  rotY(T a)
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeRotY(a);
     return cells;
   }
-  static Matrix4
-  rotZ(float a)
+  static constexpr Matrix4T
+  rotZ(T a)
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeRotZ(a);
     return cells;
   }
-  static Matrix4
-  trans(const Vector3 & t)
+  static constexpr Matrix4T
+  yawPitchRoll(T yaw, T pitch, T roll)
+  {
+    Matrix4T cells;
+    cells.makeYawPitchRoll(yaw, pitch, roll);
+    return cells;
+  }
+  static constexpr Matrix4T
+  axisAngle(const Vector3T<T> & axis, T a)
+  {
+    Matrix4T cells;
+    cells.makeAxisAngle(axis, a);
+    return cells;
+  }
+  static constexpr Matrix4T
+  trans(const Vector3T<T> & t)
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeTrans(t);
     return cells;
   }
-  static Matrix4
-  scale(float s)
+  static constexpr Matrix4T
+  scale(T s)
   {
-    Matrix4 cells;
-    cells.makeScale(Vector3(s));
+    Matrix4T cells;
+    cells.makeScale(Vector3T<T>(s));
     return cells;
   }
-  static Matrix4
-  scale(const Vector3 & s)
+  static constexpr Matrix4T
+  scale(const Vector3T<T> & s)
   {
-    Matrix4 cells;
+    Matrix4T cells;
     cells.makeScale(s);
     return cells;
   }
 
   // Transformations
-  [[nodiscard]] Matrix4
+  [[nodiscard]] constexpr Matrix4T
   transposed() const
   {
-    Matrix4 out;
+    Matrix4T out;
     out.cells[0] = cells[0];
     out.cells[1] = cells[4];
     out.cells[2] = cells[8];
@@ -232,296 +332,322 @@ class Matrix4 {
     out.cells[15] = cells[15];
     return out;
   }
-  void
-  translate(const Vector3 & t)
+  constexpr void
+  translate(const Vector3T<T> & t)
   {
     cells[3] += t.x;
     cells[7] += t.y;
     cells[11] += t.z;
   }
-  void
-  stretch(const Vector3 & s)
+  constexpr void
+  stretch(const Vector3T<T> & s)
   {
     cells[0] *= s.x;
     cells[5] *= s.y;
     cells[10] *= s.z;
   }
 
-  [[nodiscard]] Vector3
-  mulPoint(const Vector3 & b) const
-  {
-    const Vector3 p(cells[0] * b.x + cells[1] * b.y + cells[2] * b.z + cells[3],
-                    cells[4] * b.x + cells[5] * b.y + cells[6] * b.z + cells[7],
-                    cells[8] * b.x + cells[9] * b.y + cells[10] * b.z +
-                        cells[11]);
-    const float   w =
+  [[nodiscard]] constexpr Vector3T<T>
+  mulPoint(const Vector3T<T> & b) const
+  {
+    const Vector3T<T> p(
+        cells[0] * b.x + cells[1] * b.y + cells[2] * b.z + cells[3],
+        cells[4] * b.x + cells[5] * b.y + cells[6] * b.z + cells[7],
+        cells[8] * b.x + cells[9] * b.y + cells[10] * b.z + cells[11]);
+    const T w =
         cells[12] * b.x + cells[13] * b.y + cells[14] * b.z + cells[15];
     return p / w;
   }
-  [[nodiscard]] Vector3
-  mulDirection(const Vector3 & b) const
+  [[nodiscard]] constexpr Vector3T<T>
+  mulDirection(const Vector3T<T> & b) const
   {
-    return Vector3(cells[0] * b.x + cells[1] * b.y + cells[2] * b.z,
+    return Vector3T<T>(cells[0] * b.x + cells[1] * b.y + cells[2] * b.z,
                    cells[4] * b.x + cells[5] * b.y + cells[6] * b.z,
                    cells[8] * b.x + cells[9] * b.y + cells[10] * b.z);
   }
 
   // Inverse (^-1)
-  [[nodiscard]] Matrix4
-  inverse() const
-  {
-    Matrix4 inv;
-    inv.cells[0] =
-        cells[5] * cells[10] * cells[15] - cells[5] * cells[11] * cells[14] -
-        cells[9] * cells[6] * cells[15] + cells[9] * cells[7] * cells[14] +
-        cells[13] * cells[6] * cells[11] - cells[13] * cells[7] * cells[10];
-
-    inv.cells[1] =
-        -cells[1] * cells[10] * cells[15] + cells[1] * cells[11] * cells[14] +
-        cells[9] * cells[2] * cells[15] - cells[9] * cells[3] * cells[14] -
-        cells[13] * cells[2] * cells[11] + cells[13] * cells[3] * cells[10];
-
-    inv.cells[2] =
-        cells[1] * cells[6] * cells[15] - cells[1] * cells[7] * cells[14] -
-        cells[5] * cells[2] * cells[15] + cells[5] * cells[3] * cells[14] +
-        cells[13] * cells[2] * cells[7] - cells[13] * cells[3] * cells[6];
-
-    inv.cells[3] =
-        -cells[1] * cells[6] * cells[11] + cells[1] * cells[7] * cells[10] +
-        cells[5] * cells[2] * cells[11] - cells[5] * cells[3] * cells[10] -
-        cells[9] * cells[2] * cells[7] + cells[9] * cells[3] * cells[6];
-
-    inv.cells[4] =
-        -cells[4] * cells[10] * cells[15] + cells[4] * cells[11] * cells[14] +
-        cells[8] * cells[6] * cells[15] - cells[8] * cells[7] * cells[14] -
-        cells[12] * cells[6] * cells[11] + cells[12] * cells[7] * cells[10];
-
-    inv.cells[5] =
-        cells[0] * cells[10] * cells[15] - cells[0] * cells[11] * cells[14] -
-        cells[8] * cells[2] * cells[15] + cells[8] * cells[3] * cells[14] +
-        cells[12] * cells[2] * cells[11] - cells[12] * cells[3] * cells[10];
-
-    inv.cells[6] =
-        -cells[0] * cells[6] * cells[15] + cells[0] * cells[7] * cells[14] +
-        cells[4] * cells[2] * cells[15] - cells[4] * cells[3] * cells[14] -
-        cells[12] * cells[2] * cells[7] + cells[12] * cells[3] * cells[6];
-
-    inv.cells[7] =
-        cells[0] * cells[6] * cells[11] - cells[0] * cells[7] * cells[10] -
-        cells[4] * cells[2] * cells[11] + cells[4] * cells[3] * cells[10] +
-        cells[8] * cells[2] * cells[7] - cells[8] * cells[3] * cells[6];
-
-    inv.cells[8] =
-        cells[4] * cells[9] * cells[15] - cells[4] * cells[11] * cells[13] -
-        cells[8] * cells[5] * cells[15] + cells[8] * cells[7] * cells[13] +
-        cells[12] * cells[5] * cells[11] - cells[12] * cells[7] * cells[9];
+  // What inverse() may assume about the matrix, cheapest path last
+  enum class Kind { Projective, Affine, Rigid };
 
-    inv.cells[9] =
-        -cells[0] * cells[9] * cells[15] + cells[0] * cells[11] * cells[13] +
-        cells[8] * cells[1] * cells[15] - cells[8] * cells[3] * cells[13] -
-        cells[12] * cells[1] * cells[11] + cells[12] * cells[3] * cells[9];
-
-    inv.cells[10] =
-        cells[0] * cells[5] * cells[15] - cells[0] * cells[7] * cells[13] -
-        cells[4] * cells[1] * cells[15] + cells[4] * cells[3] * cells[13] +
-        cells[12] * cells[1] * cells[7] - cells[12] * cells[3] * cells[5];
-
-    inv.cells[11] =
-        -cells[0] * cells[5] * cells[11] + cells[0] * cells[7] * cells[9] +
-        cells[4] * cells[1] * cells[11] - cells[4] * cells[3] * cells[9] -
-        cells[8] * cells[1] * cells[7] + cells[8] * cells[3] * cells[5];
+  /**
+   * Affine when the bottom row is exactly 0 0 0 1, which every make* builder
+   * and their products keep. Rigid when the upper 3x3 is also orthonormal
+   * within eps, i.e. built from rotations and translations only.
+   */
+  [[nodiscard]] constexpr Kind
+  classify(T eps = 1e-6f) const
+  {
+    if (cells[12] != 0.0f || cells[13] != 0.0f || cells[14] != 0.0f ||
+        cells[15] != 1.0f) {
+      return Kind::Projective;
+    }
+    const Vector3T<T> r0(cells[0], cells[1], cells[2]);
+    const Vector3T<T> r1(cells[4], cells[5], cells[6]);
+    const Vector3T<T> r2(cells[8], cells[9], cells[10]);
+    const auto        near = [eps](T v, T target) {
+      return (v - target < eps) && (v - target > -eps);
+    };
+    if (near(r0.magSq(), 1.0f) && near(r1.magSq(), 1.0f) &&
+        near(r2.magSq(), 1.0f) && near(r0.dotp(r1), 0.0f) &&
+        near(r0.dotp(r2), 0.0f) && near(r1.dotp(r2), 0.0f)) {
+      return Kind::Rigid;
+    }
+    return Kind::Affine;
+  }
 
-    inv.cells[12] =
-        -cells[4] * cells[9] * cells[14] + cells[4] * cells[10] * cells[13] +
-        cells[8] * cells[5] * cells[14] - cells[8] * cells[6] * cells[13] -
-        cells[12] * cells[5] * cells[10] + cells[12] * cells[6] * cells[9];
+  // Picks the cheapest of the paths below that is correct for this matrix
+  [[nodiscard]] Matrix4T
+  inverse() const
+  {
+    switch (classify()) {
+      case Kind::Rigid: return inverseRigid();
+      case Kind::Affine: return inverseAffine();
+      default: return inverseGeneral();
+    }
+  }
 
-    inv.cells[13] =
-        cells[0] * cells[9] * cells[14] - cells[0] * cells[10] * cells[13] -
-        cells[8] * cells[1] * cells[14] + cells[8] * cells[2] * cells[13] +
-        cells[12] * cells[1] * cells[10] - cells[12] * cells[2] * cells[9];
+  // Rotation + translation only: R^T and -(R^T * t)
+  [[nodiscard]] constexpr Matrix4T
+  inverseRigid() const
+  {
+    Matrix4T inv;
+    inv.cells[0] = cells[0];
+    inv.cells[1] = cells[4];
+    inv.cells[2] = cells[8];
+    inv.cells[4] = cells[1];
+    inv.cells[5] = cells[5];
+    inv.cells[6] = cells[9];
+    inv.cells[8] = cells[2];
+    inv.cells[9] = cells[6];
+    inv.cells[10] = cells[10];
+    inv.cells[3] = -(inv.cells[0] * cells[3] + inv.cells[1] * cells[7] +
+                     inv.cells[2] * cells[11]);
+    inv.cells[7] = -(inv.cells[4] * cells[3] + inv.cells[5] * cells[7] +
+                     inv.cells[6] * cells[11]);
+    inv.cells[11] = -(inv.cells[8] * cells[3] + inv.cells[9] * cells[7] +
+                      inv.cells[10] * cells[11]);
+    inv.cells[15] = T(1);
+    return inv;
+  }
 
-    inv.cells[14] =
-        -cells[0] * cells[5] * cells[14] + cells[0] * cells[6] * cells[13] +
-        cells[4] * cells[1] * cells[14] - cells[4] * cells[2] * cells[13] -
-        cells[12] * cells[1] * cells[6] + cells[12] * cells[2] * cells[5];
+  // Any 0 0 0 1 bottom row: A^-1 of the upper 3x3 and -(A^-1 * t)
+  [[nodiscard]] constexpr Matrix4T
+  inverseAffine() const
+  {
+    Matrix4T inv;
+    inv.cells[0] = cells[5] * cells[10] - cells[6] * cells[9];
+    inv.cells[1] = cells[2] * cells[9] - cells[1] * cells[10];
+    inv.cells[2] = cells[1] * cells[6] - cells[2] * cells[5];
+    inv.cells[4] = cells[6] * cells[8] - cells[4] * cells[10];
+    inv.cells[5] = cells[0] * cells[10] - cells[2] * cells[8];
+    inv.cells[6] = cells[2] * cells[4] - cells[0] * cells[6];
+    inv.cells[8] = cells[4] * cells[9] - cells[5] * cells[8];
+    inv.cells[9] = cells[1] * cells[8] - cells[0] * cells[9];
+    inv.cells[10] = cells[0] * cells[5] - cells[1] * cells[4];
 
-    inv.cells[15] =
-        cells[0] * cells[5] * cells[10] - cells[0] * cells[6] * cells[9] -
-        cells[4] * cells[1] * cells[10] + cells[4] * cells[2] * cells[9] +
-        cells[8] * cells[1] * cells[6] - cells[8] * cells[2] * cells[5];
+    const T inv_det = static_cast<T>(1) / (cells[0] * inv.cells[0] +
+                                           cells[1] * inv.cells[4] +
+                                           cells[2] * inv.cells[8]);
+    for (int r = 0; r < 12; r += 4) {
+      inv.cells[r] *= inv_det;
+      inv.cells[r + 1] *= inv_det;
+      inv.cells[r + 2] *= inv_det;
+      inv.cells[r + 3] =
+          -(inv.cells[r] * cells[3] + inv.cells[r + 1] * cells[7] +
+            inv.cells[r + 2] * cells[11]);
+    }
+    inv.cells[15] = T(1);
+    return inv;
+  }
 
-    const float det = cells[0] * inv.cells[0] + cells[1] * inv.cells[4] +
-                      cells[2] * inv.cells[8] + cells[3] * inv.cells[12];
-    inv /= det;
+  // Full 4x4 inverse, dispatched like operator*. Singular input divides by 0.
+  [[nodiscard]] Matrix4T
+  inverseGeneral() const
+  {
+    Matrix4T inv;
+    if constexpr (std::is_same_v<T, float>) {
+      Matrix4Kernels::active().inverse(cells, inv.cells);
+    } else {
+      mat4InverseScalar(cells, inv.cells);
+    }
     return inv;
   }
 
   // Some general getters
-  [[nodiscard]] Vector3
+  [[nodiscard]] constexpr Vector3T<T>
   xAxis() const
   {
-    return Vector3(cells[0], cells[4], cells[8]);
+    return Vector3T<T>(cells[0], cells[4], cells[8]);
   }
-  [[nodiscard]] Vector3
+  [[nodiscard]] constexpr Vector3T<T>
   yAxis() const
   {
-    return Vector3(cells[1], cells[5], cells[9]);
+    return Vector3T<T>(cells[1], cells[5], cells[9]);
   }
-  [[nodiscard]] Vector3
+  [[nodiscard]] constexpr Vector3T<T>
   zAxis() const
   {
-    return Vector3(cells[2], cells[6], cells[10]);
+    return Vector3T<T>(cells[2], cells[6], cells[10]);
   }
-  [[nodiscard]] Vector3
+  [[nodiscard]] constexpr Vector3T<T>
   translation() const
   {
-    return Vector3(cells[3], cells[7], cells[11]);
+    return Vector3T<T>(cells[3], cells[7], cells[11]);
   }
-  [[nodiscard]] Vector3
+  /**
+   * Scale of a T * R * S matrix: the axis lengths, with x negated when the
+   * upper 3x3 mirrors (det < 0) so that the remaining rotation is proper.
+   * Not constexpr since the lengths need std::sqrt.
+   */
+  [[nodiscard]] Vector3T<T>
   scale() const
   {
-    return Vector3(cells[0], cells[5], cells[10]);
+    const Vector3T<T> x_axis = xAxis();
+    const Vector3T<T> y_axis = yAxis();
+    const Vector3T<T> z_axis = zAxis();
+    const T           sx = x_axis.mag();
+    const T           det = x_axis.dotp(y_axis.cross(z_axis));
+    return Vector3T<T>((det < T(0)) ? -sx : sx, y_axis.mag(), z_axis.mag());
   }
 
   // Some general setters
-  void
-  setTranslation(const Vector3 & t)
+  constexpr void
+  setTranslation(const Vector3T<T> & t)
   {
     cells[3] = t.x;
     cells[7] = t.y;
     cells[11] = t.z;
   }
-  void
-  setXAxis(const Vector3 & t)
+  constexpr void
+  setXAxis(const Vector3T<T> & t)
   {
     cells[0] = t.x;
     cells[4] = t.y;
     cells[8] = t.z;
   }
-  void
-  setYAxis(const Vector3 & t)
+  constexpr void
+  setYAxis(const Vector3T<T> & t)
   {
     cells[1] = t.x;
     cells[5] = t.y;
     cells[9] = t.z;
   }
-  void
-  setZAxis(const Vector3 & t)
+  constexpr void
+  setZAxis(const Vector3T<T> & t)
   {
     cells[2] = t.x;
     cells[6] = t.y;
     cells[10] = t.z;
   }
+  /**
+   * Rescales the axes to the lengths in s, keeping rotation and translation,
+   * so m.setScale(m.scale()) leaves m as it is. A negative component
+   * mirrors its axis, scale() reports s back when only s.x is negative.
+   * Axes of zero length have no direction to keep and stay zero.
+   */
   void
-  setScale(const Vector3 & s)
-  {
-    cells[0] = s.x;
-    cells[5] = s.y;
-    cells[10] = s.z;
+  setScale(const Vector3T<T> & s)
+  {
+    const Vector3T<T> current = scale();
+    const T           fx = (current.x != T(0)) ? s.x / current.x : T(0);
+    const T           fy = (current.y != T(0)) ? s.y / current.y : T(0);
+    const T           fz = (current.z != T(0)) ? s.z / current.z : T(0);
+    for (int r = 0; r < 12; r += 4) {
+      cells[r] *= fx;
+      cells[r + 1] *= fy;
+      cells[r + 2] *= fz;
+    }
   }
 
   // Basic operation overrides
-  Matrix4
-  operator+(const Matrix4 & b) const
+  constexpr Matrix4T
+  operator+(const Matrix4T & b) const
   {
-    Matrix4 out;
+    Matrix4T out;
     for (int i = 0; i < 16; ++i) {
       out.cells[i] = cells[i] + b.cells[i];
     }
     return out;
   }
-  Matrix4
-  operator-(const Matrix4 & b) const
+  constexpr Matrix4T
+  operator-(const Matrix4T & b) const
   {
-    Matrix4 out;
+    Matrix4T out;
     for (int i = 0; i < 16; ++i) {
       out.cells[i] = cells[i] - b.cells[i];
     }
     return out;
   }
-  void
-  operator+=(const Matrix4 & b)
+  constexpr void
+  operator+=(const Matrix4T & b)
   {
     for (int i = 0; i < 16; ++i) {
       cells[i] += b.cells[i];
     }
   }
-  void
-  operator-=(const Matrix4 & b)
+  constexpr void
+  operator-=(const Matrix4T & b)
   {
     for (int i = 0; i < 16; ++i) {
       cells[i] -= b.cells[i];
     }
   }
-  void
-  operator*=(float b)
+  constexpr void
+  operator*=(T b)
   {
     for (auto & cell : cells) {
-      cell *= b;
+      cell = T(cell * b);
     }
   }
-  void
-  operator/=(float b)
+  constexpr void
+  operator/=(T b)
   {
-    operator*=(1.0f / b);
+    operator*=(T(Calc(1) / b));
   }
 
-  // Multiplication
-  Matrix4
-  operator*(const Matrix4 & b) const
-  {
-    Matrix4 out;
-    out.cells[0] = b.cells[0] * cells[0] + b.cells[4] * cells[1] +
-                   b.cells[8] * cells[2] + b.cells[12] * cells[3];
-    out.cells[1] = b.cells[1] * cells[0] + b.cells[5] * cells[1] +
-                   b.cells[9] * cells[2] + b.cells[13] * cells[3];
-    out.cells[2] = b.cells[2] * cells[0] + b.cells[6] * cells[1] +
-                   b.cells[10] * cells[2] + b.cells[14] * cells[3];
-    out.cells[3] = b.cells[3] * cells[0] + b.cells[7] * cells[1] +
-                   b.cells[11] * cells[2] + b.cells[15] * cells[3];
-
-    out.cells[4] = b.cells[0] * cells[4] + b.cells[4] * cells[5] +
-                   b.cells[8] * cells[6] + b.cells[12] * cells[7];
-    out.cells[5] = b.cells[1] * cells[4] + b.cells[5] * cells[5] +
-                   b.cells[9] * cells[6] + b.cells[13] * cells[7];
-    out.cells[6] = b.cells[2] * cells[4] + b.cells[6] * cells[5] +
-                   b.cells[10] * cells[6] + b.cells[14] * cells[7];
-    out.cells[7] = b.cells[3] * cells[4] + b.cells[7] * cells[5] +
-                   b.cells[11] * cells[6] + b.cells[15] * cells[7];
-
-    out.cells[8] = b.cells[0] * cells[8] + b.cells[4] * cells[9] +
-                   b.cells[8] * cells[10] + b.cells[12] * cells[11];
-    out.cells[9] = b.cells[1] * cells[8] + b.cells[5] * cells[9] +
-                   b.cells[9] * cells[10] + b.cells[13] * cells[11];
-    out.cells[10] = b.cells[2] * cells[8] + b.cells[6] * cells[9] +
-                    b.cells[10] * cells[10] + b.cells[14] * cells[11];
-    out.cells[11] = b.cells[3] * cells[8] + b.cells[7] * cells[9] +
-                    b.cells[11] * cells[10] + b.cells[15] * cells[11];
-
-    out.cells[12] = b.cells[0] * cells[12] + b.cells[4] * cells[13] +
-                    b.cells[8] * cells[14] + b.cells[12] * cells[15];
-    out.cells[13] = b.cells[1] * cells[12] + b.cells[5] * cells[13] +
-                    b.cells[9] * cells[14] + b.cells[13] * cells[15];
-    out.cells[14] = b.cells[2] * cells[12] + b.cells[6] * cells[13] +
-                    b.cells[10] * cells[14] + b.cells[14] * cells[15];
-    out.cells[15] = b.cells[3] * cells[12] + b.cells[7] * cells[13] +
-                    b.cells[11] * cells[14] + b.cells[15] * cells[15];
+  // Multiplication, dispatched to the widest kernel the CPU supports, the
+  // scalar reference in constant expressions and for every T but float.
+  // See MatrixSimd.hh for the error bound between the two.
+  constexpr Matrix4T
+  operator*(const Matrix4T & b) const
+  {
+    Matrix4T out;
+    if constexpr (std::is_same_v<T, float>) {
+      if (!isConstantEvaluated()) {
+        Matrix4Kernels::active().mul(cells, b.cells, out.cells);
+        return out;
+      }
+    }
+    mat4MulScalar(cells, b.cells, out.cells);
     return out;
   }
-  void
-  operator*=(const Matrix4 & b)
+  constexpr void
+  operator*=(const Matrix4T & b)
   {
     (*this) = operator*(b);
   }
-  Vector4
-  operator*(const Vector4 & b) const
-  {
-    return Vector4(
-        cells[0] * b.x + cells[1] * b.y + cells[2] * b.z + cells[3] * b.w,
-        cells[4] * b.x + cells[5] * b.y + cells[6] * b.z + cells[7] * b.w,
-        cells[8] * b.x + cells[9] * b.y + cells[10] * b.z + cells[11] * b.w,
-        cells[12] * b.x + cells[13] * b.y + cells[14] * b.z + cells[15] * b.w);
+  constexpr Vector4T<T>
+  operator*(const Vector4T<T> & b) const
+  {
+    Vector4T<T> out;
+    if (!std::is_same_v<T, float> || isConstantEvaluated()) {
+      out = Vector4T<T>(
+          cells[0] * b.x + cells[1] * b.y + cells[2] * b.z + cells[3] * b.w,
+          cells[4] * b.x + cells[5] * b.y + cells[6] * b.z + cells[7] * b.w,
+          cells[8] * b.x + cells[9] * b.y + cells[10] * b.z + cells[11] * b.w,
+          cells[12] * b.x + cells[13] * b.y + cells[14] * b.z +
+              cells[15] * b.w);
+    } else if constexpr (std::is_same_v<T, float>) {
+      Matrix4Kernels::active().mulVec(cells, &b.x, &out.x);
+    }
+    return out;
   }
 };
+
+// See Vector.hh, Half is storage only
+using Matrix4 = Matrix4T<float>;
+using Matrix4d = Matrix4T<double>;
+using Matrix4h = Matrix4T<Half>;
+
 #endif // MATRIX_HH
\ No newline at end of file
@@ -0,0 +1,480 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Batched versions of the per-vector Matrix4 operations. The matrix is
+ * broadcast into registers once and FloatV::width vectors go through each
+ * iteration. Every entry point accepts in == out.
+ */
+#ifndef MATRIX_BATCH_HH
+#define MATRIX_BATCH_HH
+#include "Half.hh"
+#include "Matrix.hh"
+#include "Parallel.hh"
+#include "Simd.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+static_assert(sizeof(Vector3) == 3 * sizeof(float),
+              "Batch kernels read Vector3 arrays as packed floats");
+static_assert(sizeof(Vector3h) == 3 * sizeof(Half),
+              "Half overloads convert Vector3h arrays as packed halves");
+
+class Matrix4Lanes {
+  public:
+  // Cells broadcast to all lanes, row major like Matrix4
+  FloatV c[16];
+
+  explicit Matrix4Lanes(const Matrix4 & m)
+  {
+    for (int i = 0; i < 16; ++i) {
+      c[i] = FloatV::set1(m.cells[i]);
+    }
+  }
+
+  // Row r of the upper 3x4 applied to (x, y, z, w)
+  [[nodiscard]] FloatV
+  row(int r, FloatV x, FloatV y, FloatV z) const
+  {
+    return FloatV::mulAdd(
+        c[4 * r], x,
+        FloatV::mulAdd(c[4 * r + 1], y,
+                       FloatV::mulAdd(c[4 * r + 2], z, c[4 * r + 3])));
+  }
+  [[nodiscard]] FloatV
+  rowNoTrans(int r, FloatV x, FloatV y, FloatV z) const
+  {
+    return FloatV::mulAdd(c[4 * r], x,
+                          FloatV::mulAdd(c[4 * r + 1], y, c[4 * r + 2] * z));
+  }
+};
+
+/**
+ * Runs block(x, y, z) over n packed Vector3, FloatV::width at a time. The
+ * tail is staged through a stack buffer so the kernels only ever see full
+ * registers. Large n is split over parallelBatch, so block may run
+ * concurrently and must only touch its own registers.
+ */
+template<typename Block>
+inline void
+forEachVector3Block(const Vector3 * in, Vector3 * out, std::size_t n,
+                    Block && block)
+{
+  constexpr std::size_t w = FloatV::width;
+  const float *         src = &in->x;
+  float *               dst = &out->x;
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    std::size_t i = b;
+    for (; i + w <= e; i += w) {
+      FloatV x, y, z;
+      FloatV::loadInterleaved3(src + 3 * i, x, y, z);
+      block(x, y, z);
+      FloatV::storeInterleaved3(dst + 3 * i, x, y, z);
+    }
+    if (i < e) {
+      float tail[3 * w] = {0};
+      std::memcpy(tail, src + 3 * i, (e - i) * sizeof(Vector3));
+      FloatV x, y, z;
+      FloatV::loadInterleaved3(tail, x, y, z);
+      block(x, y, z);
+      FloatV::storeInterleaved3(tail, x, y, z);
+      std::memcpy(dst + 3 * i, tail, (e - i) * sizeof(Vector3));
+    }
+  });
+}
+
+// out[i] = m.mulPoint(in[i]), with the perspective divide
+inline void
+transformPoints(const Matrix4 & m, const Vector3 * in, Vector3 * out,
+                std::size_t n)
+{
+  if (n == 0) {
+    return;
+  }
+  const Matrix4Lanes lanes(m);
+  const FloatV       one = FloatV::set1(1.0f);
+  forEachVector3Block(in, out, n, [&](FloatV & x, FloatV & y, FloatV & z) {
+    // Padded tail lanes are zero, w becomes cells[15] there, never read back
+    const FloatV inv_w = one / lanes.row(3, x, y, z);
+    const FloatV px = lanes.row(0, x, y, z);
+    const FloatV py = lanes.row(1, x, y, z);
+    const FloatV pz = lanes.row(2, x, y, z);
+    x = px * inv_w;
+    y = py * inv_w;
+    z = pz * inv_w;
+  });
+}
+
+// out[i] = m.mulPoint(in[i]) for matrices with a 0 0 0 1 bottom row, no divide
+inline void
+transformPointsAffine(const Matrix4 & m, const Vector3 * in, Vector3 * out,
+                      std::size_t n)
+{
+  if (n == 0) {
+    return;
+  }
+  const Matrix4Lanes lanes(m);
+  forEachVector3Block(in, out, n, [&](FloatV & x, FloatV & y, FloatV & z) {
+    const FloatV px = lanes.row(0, x, y, z);
+    const FloatV py = lanes.row(1, x, y, z);
+    z = lanes.row(2, x, y, z);
+    x = px;
+    y = py;
+  });
+}
+
+// out[i] = m.mulDirection(in[i])
+inline void
+transformDirections(const Matrix4 & m, const Vector3 * in, Vector3 * out,
+                    std::size_t n)
+{
+  if (n == 0) {
+    return;
+  }
+  const Matrix4Lanes lanes(m);
+  forEachVector3Block(in, out, n, [&](FloatV & x, FloatV & y, FloatV & z) {
+    const FloatV dx = lanes.rowNoTrans(0, x, y, z);
+    const FloatV dy = lanes.rowNoTrans(1, x, y, z);
+    z = lanes.rowNoTrans(2, x, y, z);
+    x = dx;
+    y = dy;
+  });
+}
+
+// Points per staging block of the Half overloads, 3 KB of floats on the stack
+constexpr std::size_t halfStagingBlock = 256;
+
+/**
+ * Widens blocks of Half vectors to float on the stack, runs kernel(v, count)
+ * on them in place and narrows the result into out. Memory only ever sees
+ * 6 bytes per vector, the math stays in float.
+ */
+template<typename Kernel>
+inline void
+forEachHalfBlock(const Vector3h * in, Vector3h * out, std::size_t n,
+                 Kernel && kernel)
+{
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    alignas(simdAlignment) Vector3 staged[halfStagingBlock];
+    for (std::size_t i = b; i < e; i += halfStagingBlock) {
+      const std::size_t count = std::min(halfStagingBlock, e - i);
+      convertPrecision(in + i, staged, count);
+      kernel(staged, count);
+      convertPrecision(staged, out + i, count);
+    }
+  });
+}
+
+// Half precision streams for the three kernels above, rounded once on store
+inline void
+transformPoints(const Matrix4 & m, const Vector3h * in, Vector3h * out,
+                std::size_t n)
+{
+  forEachHalfBlock(in, out, n, [&](Vector3 * v, std::size_t count) {
+    transformPoints(m, v, v, count);
+  });
+}
+inline void
+transformPointsAffine(const Matrix4 & m, const Vector3h * in, Vector3h * out,
+                      std::size_t n)
+{
+  forEachHalfBlock(in, out, n, [&](Vector3 * v, std::size_t count) {
+    transformPointsAffine(m, v, v, count);
+  });
+}
+inline void
+transformDirections(const Matrix4 & m, const Vector3h * in, Vector3h * out,
+                    std::size_t n)
+{
+  forEachHalfBlock(in, out, n, [&](Vector3 * v, std::size_t count) {
+    transformDirections(m, v, v, count);
+  });
+}
+
+// mat4InverseScalar with one matrix per lane, r is the adjugate, returns det
+inline FloatV
+inverseLanes(const FloatV * c, FloatV * r)
+{
+  r[0] =
+      c[5] * c[10] * c[15] - c[5] * c[11] * c[14] -
+      c[9] * c[6] * c[15] + c[9] * c[7] * c[14] +
+      c[13] * c[6] * c[11] - c[13] * c[7] * c[10];
+
+  r[1] =
+      -c[1] * c[10] * c[15] + c[1] * c[11] * c[14] +
+      c[9] * c[2] * c[15] - c[9] * c[3] * c[14] -
+      c[13] * c[2] * c[11] + c[13] * c[3] * c[10];
+
+  r[2] =
+      c[1] * c[6] * c[15] - c[1] * c[7] * c[14] -
+      c[5] * c[2] * c[15] + c[5] * c[3] * c[14] +
+      c[13] * c[2] * c[7] - c[13] * c[3] * c[6];
+
+  r[3] =
+      -c[1] * c[6] * c[11] + c[1] * c[7] * c[10] +
+      c[5] * c[2] * c[11] - c[5] * c[3] * c[10] -
+      c[9] * c[2] * c[7] + c[9] * c[3] * c[6];
+
+  r[4] =
+      -c[4] * c[10] * c[15] + c[4] * c[11] * c[14] +
+      c[8] * c[6] * c[15] - c[8] * c[7] * c[14] -
+      c[12] * c[6] * c[11] + c[12] * c[7] * c[10];
+
+  r[5] =
+      c[0] * c[10] * c[15] - c[0] * c[11] * c[14] -
+      c[8] * c[2] * c[15] + c[8] * c[3] * c[14] +
+      c[12] * c[2] * c[11] - c[12] * c[3] * c[10];
+
+  r[6] =
+      -c[0] * c[6] * c[15] + c[0] * c[7] * c[14] +
+      c[4] * c[2] * c[15] - c[4] * c[3] * c[14] -
+      c[12] * c[2] * c[7] + c[12] * c[3] * c[6];
+
+  r[7] =
+      c[0] * c[6] * c[11] - c[0] * c[7] * c[10] -
+      c[4] * c[2] * c[11] + c[4] * c[3] * c[10] +
+      c[8] * c[2] * c[7] - c[8] * c[3] * c[6];
+
+  r[8] =
+      c[4] * c[9] * c[15] - c[4] * c[11] * c[13] -
+      c[8] * c[5] * c[15] + c[8] * c[7] * c[13] +
+      c[12] * c[5] * c[11] - c[12] * c[7] * c[9];
+
+  r[9] =
+      -c[0] * c[9] * c[15] + c[0] * c[11] * c[13] +
+      c[8] * c[1] * c[15] - c[8] * c[3] * c[13] -
+      c[12] * c[1] * c[11] + c[12] * c[3] * c[9];
+
+  r[10] =
+      c[0] * c[5] * c[15] - c[0] * c[7] * c[13] -
+      c[4] * c[1] * c[15] + c[4] * c[3] * c[13] +
+      c[12] * c[1] * c[7] - c[12] * c[3] * c[5];
+
+  r[11] =
+      -c[0] * c[5] * c[11] + c[0] * c[7] * c[9] +
+      c[4] * c[1] * c[11] - c[4] * c[3] * c[9] -
+      c[8] * c[1] * c[7] + c[8] * c[3] * c[5];
+
+  r[12] =
+      -c[4] * c[9] * c[14] + c[4] * c[10] * c[13] +
+      c[8] * c[5] * c[14] - c[8] * c[6] * c[13] -
+      c[12] * c[5] * c[10] + c[12] * c[6] * c[9];
+
+  r[13] =
+      c[0] * c[9] * c[14] - c[0] * c[10] * c[13] -
+      c[8] * c[1] * c[14] + c[8] * c[2] * c[13] +
+      c[12] * c[1] * c[10] - c[12] * c[2] * c[9];
+
+  r[14] =
+      -c[0] * c[5] * c[14] + c[0] * c[6] * c[13] +
+      c[4] * c[1] * c[14] - c[4] * c[2] * c[13] -
+      c[12] * c[1] * c[6] + c[12] * c[2] * c[5];
+
+  r[15] =
+      c[0] * c[5] * c[10] - c[0] * c[6] * c[9] -
+      c[4] * c[1] * c[10] + c[4] * c[2] * c[9] +
+      c[8] * c[1] * c[6] - c[8] * c[2] * c[5];
+
+  return c[0] * r[0] + c[1] * r[4] + c[2] * r[8] + c[3] * r[12];
+}
+
+/**
+ * Inverts n matrices, FloatV::width at a time: each group is transposed so
+ * every lane runs the cofactor expansion for one matrix. Matrices with
+ * |det| <= min_abs_det are written as zero and flagged in singular, bit
+ * i % 32 of word i / 32 for matrix i, (n + 31) / 32 words. Nothing branches
+ * per matrix. Returns the number of singular matrices, in == out is fine.
+ * For well conditioned input every cell is within the 16 ULP MatrixSimd.hh
+ * allows the SIMD inverse kernels.
+ */
+inline std::size_t
+inverseBatch(const Matrix4 * in, Matrix4 * out, std::size_t n,
+             std::uint32_t * singular = nullptr, float min_abs_det = 1e-12f)
+{
+  static_assert(32 % FloatV::width == 0, "Mask groups must not straddle words");
+  constexpr std::size_t w = FloatV::width;
+  const FloatV          zero = FloatV::zero();
+  const FloatV          one = FloatV::set1(1.0f);
+  const FloatV          limit = FloatV::set1(min_abs_det);
+  std::atomic<std::size_t> singular_count{0};
+
+  // Chunks start on multiples of 64, so each one owns its mask words
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    // Left uninitialized, only the final partial group goes through it
+    alignas(simdAlignment) float tail[16 * w];
+    std::size_t                  chunk_singular = 0;
+    for (std::size_t i = b; i < e; i += w) {
+      const std::size_t count = (n - i < w) ? n - i : w;
+      const float *     src = in[i].cells;
+      float *           dst = out[i].cells;
+      if (count < w) {
+        // Identity padding keeps the unused lanes regular
+        std::memcpy(tail, src, count * sizeof(Matrix4));
+        for (std::size_t k = count; k < w; ++k) {
+          float * m = tail + 16 * k;
+          std::fill(m, m + 16, 0.0f);
+          m[0] = m[5] = m[10] = m[15] = 1.0f;
+        }
+        src = tail;
+        dst = tail;
+      }
+
+      FloatV c[16];
+      FloatV r[16];
+      for (int row = 0; row < 16; row += 4) {
+        FloatV::loadTransposed4(
+            src + row, 16, c[row], c[row + 1], c[row + 2], c[row + 3]);
+      }
+      const FloatV det = inverseLanes(c, r);
+      const MaskV  bad = FloatV::abs(det) <= limit;
+      const FloatV inv_det =
+          FloatV::select(bad, zero, one / FloatV::select(bad, one, det));
+      for (auto & cell : r) {
+        cell *= inv_det;
+      }
+      for (int row = 0; row < 16; row += 4) {
+        FloatV::storeTransposed4(
+            dst + row, 16, r[row], r[row + 1], r[row + 2], r[row + 3]);
+      }
+
+      const std::uint32_t bits =
+          bad.bits() & static_cast<std::uint32_t>((1ull << count) - 1u);
+      chunk_singular += std::bitset<32>(bits).count();
+      if (singular != nullptr) {
+        std::uint32_t & word = singular[i / 32];
+        if (i % 32 == 0) {
+          word = 0;
+        }
+        word |= bits << (i % 32);
+      }
+      if (count < w) {
+        std::memcpy(out[i].cells, tail, count * sizeof(Matrix4));
+      }
+    }
+    singular_count.fetch_add(chunk_singular, std::memory_order_relaxed);
+  });
+  return singular_count.load(std::memory_order_relaxed);
+}
+
+/**
+ * Writes the rotation rows r0, r1, r2 of width matrices to out[i..], the
+ * last count < width through a stack buffer.
+ */
+inline void
+storeRotationBlock(Matrix4 * out, std::size_t i, std::size_t count,
+                   const FloatV * r)
+{
+  constexpr std::size_t w = FloatV::width;
+  const FloatV          zero = FloatV::zero();
+  alignas(simdAlignment) float tail[16 * w]; // Written only when count < w
+  float * dst = (count < w) ? tail : out[i].cells;
+  FloatV::storeTransposed4(dst, 16, r[0], r[1], r[2], zero);
+  FloatV::storeTransposed4(dst + 4, 16, r[3], r[4], r[5], zero);
+  FloatV::storeTransposed4(dst + 8, 16, r[6], r[7], r[8], zero);
+  FloatV::storeTransposed4(dst + 12, 16, zero, zero, zero,
+                           FloatV::set1(1.0f));
+  if (count < w) {
+    std::memcpy(out[i].cells, tail, count * sizeof(Matrix4));
+  }
+}
+
+/**
+ * out[i] = Matrix4::yawPitchRoll(yaw[i], pitch[i], roll[i]), with the
+ * sines and cosines of width matrices from one FloatV::sincos per angle.
+ * Cells are within 4 FLT_EPSILON of the scalar builder's.
+ */
+inline void
+yawPitchRollBatch(const float * yaw, const float * pitch, const float * roll,
+                  std::size_t n, Matrix4 * out)
+{
+  constexpr std::size_t w = FloatV::width;
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    for (std::size_t i = b; i < e; i += w) {
+      const std::size_t count = std::min(w, n - i);
+      FloatV            a[3];
+      if (count == w) {
+        a[0] = FloatV::loadu(yaw + i);
+        a[1] = FloatV::loadu(pitch + i);
+        a[2] = FloatV::loadu(roll + i);
+      } else {
+        alignas(simdAlignment) float tail[3][w] = {};
+        std::memcpy(tail[0], yaw + i, count * sizeof(float));
+        std::memcpy(tail[1], pitch + i, count * sizeof(float));
+        std::memcpy(tail[2], roll + i, count * sizeof(float));
+        for (int k = 0; k < 3; ++k) {
+          a[k] = FloatV::load(tail[k]);
+        }
+      }
+      FloatV sy, cy, sp, cp, sr, cr;
+      FloatV::sincos(a[0], sy, cy);
+      FloatV::sincos(a[1], sp, cp);
+      FloatV::sincos(a[2], sr, cr);
+      const FloatV sy_sp = sy * sp;
+      const FloatV cy_sp = cy * sp;
+      const FloatV r[9] = {
+          FloatV::mulAdd(cy, cr, sy_sp * sr),
+          FloatV::mulAdd(sy_sp, cr, -(cy * sr)),
+          sy * cp,
+          cp * sr,
+          cp * cr,
+          -sp,
+          FloatV::mulAdd(cy_sp, sr, -(sy * cr)),
+          FloatV::mulAdd(sy, sr, cy_sp * cr),
+          cy * cp,
+      };
+      storeRotationBlock(out, i, count, r);
+    }
+  });
+}
+
+// out[i] = Matrix4::axisAngle(axes[i], angles[i]), axes unit length, cells
+// within 4 FLT_EPSILON of it like yawPitchRollBatch
+inline void
+axisAngleBatch(const Vector3 * axes, const float * angles, std::size_t n,
+               Matrix4 * out)
+{
+  constexpr std::size_t w = FloatV::width;
+  const FloatV          one = FloatV::set1(1.0f);
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    for (std::size_t i = b; i < e; i += w) {
+      const std::size_t count = std::min(w, n - i);
+      FloatV            x, y, z, a;
+      if (count == w) {
+        FloatV::loadInterleaved3(&axes[i].x, x, y, z);
+        a = FloatV::loadu(angles + i);
+      } else {
+        float tail[3 * w] = {0};
+        alignas(simdAlignment) float tail_a[w] = {};
+        std::memcpy(tail, &axes[i].x, count * sizeof(Vector3));
+        std::memcpy(tail_a, angles + i, count * sizeof(float));
+        FloatV::loadInterleaved3(tail, x, y, z);
+        a = FloatV::load(tail_a);
+      }
+      FloatV s, c;
+      FloatV::sincos(a, s, c);
+      const FloatV t = one - c;
+      const FloatV tx = t * x;
+      const FloatV ty = t * y;
+      const FloatV tz = t * z;
+      const FloatV r[9] = {
+          FloatV::mulAdd(tx, x, c),
+          FloatV::mulAdd(tx, y, -(s * z)),
+          FloatV::mulAdd(tx, z, s * y),
+          FloatV::mulAdd(tx, y, s * z),
+          FloatV::mulAdd(ty, y, c),
+          FloatV::mulAdd(ty, z, -(s * x)),
+          FloatV::mulAdd(tx, z, -(s * y)),
+          FloatV::mulAdd(ty, z, s * x),
+          FloatV::mulAdd(tz, z, c),
+      };
+      storeRotationBlock(out, i, count, r);
+    }
+  });
+}
+
+#endif // MATRIX_BATCH_HH
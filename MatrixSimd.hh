@@ -0,0 +1,425 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * 4x4 product and inverse kernels behind Matrix4. All of them work on raw
+ * row-major float[16] so Matrix.hh can pull them in before Matrix4 exists.
+ *
+ * The scalar kernel is the reference. The vector kernels sum the four partial
+ * products of every cell in a different order and the AVX2/AVX-512 ones fuse
+ * the multiply-adds, so they are not bit identical to it. Every cell stays
+ * within 8 ULP of the reference, measured at the magnitude of
+ * sum(|a_ik * b_kj|), i.e. |simd - scalar| <= 8 * FLT_EPSILON * sum. That is
+ * twice the worst case rounding error of a 4 term dot product, random inputs
+ * land around 2 ULP. The SIMD inverse eliminates in a different order, for
+ * well conditioned input every cell stays within 16 ULP of the largest cell
+ * of the reference inverse, random inputs land around 5. MathBench --check
+ * holds every kernel table to these bounds.
+ */
+#ifndef MATRIX_SIMD_HH
+#define MATRIX_SIMD_HH
+#include "Simd.hh"
+
+// out = a * b, out must not alias a or b. Templated so Matrix4T<double>
+// shares the reference kernels, the SIMD ones below are float only.
+template<typename T>
+constexpr void
+mat4MulScalar(const T * a, const T * b, T * out)
+{
+  out[0] = b[0] * a[0] + b[4] * a[1] + b[8] * a[2] + b[12] * a[3];
+  out[1] = b[1] * a[0] + b[5] * a[1] + b[9] * a[2] + b[13] * a[3];
+  out[2] = b[2] * a[0] + b[6] * a[1] + b[10] * a[2] + b[14] * a[3];
+  out[3] = b[3] * a[0] + b[7] * a[1] + b[11] * a[2] + b[15] * a[3];
+
+  out[4] = b[0] * a[4] + b[4] * a[5] + b[8] * a[6] + b[12] * a[7];
+  out[5] = b[1] * a[4] + b[5] * a[5] + b[9] * a[6] + b[13] * a[7];
+  out[6] = b[2] * a[4] + b[6] * a[5] + b[10] * a[6] + b[14] * a[7];
+  out[7] = b[3] * a[4] + b[7] * a[5] + b[11] * a[6] + b[15] * a[7];
+
+  out[8] = b[0] * a[8] + b[4] * a[9] + b[8] * a[10] + b[12] * a[11];
+  out[9] = b[1] * a[8] + b[5] * a[9] + b[9] * a[10] + b[13] * a[11];
+  out[10] = b[2] * a[8] + b[6] * a[9] + b[10] * a[10] + b[14] * a[11];
+  out[11] = b[3] * a[8] + b[7] * a[9] + b[11] * a[10] + b[15] * a[11];
+
+  out[12] = b[0] * a[12] + b[4] * a[13] + b[8] * a[14] + b[12] * a[15];
+  out[13] = b[1] * a[12] + b[5] * a[13] + b[9] * a[14] + b[13] * a[15];
+  out[14] = b[2] * a[12] + b[6] * a[13] + b[10] * a[14] + b[14] * a[15];
+  out[15] = b[3] * a[12] + b[7] * a[13] + b[11] * a[14] + b[15] * a[15];
+}
+
+// out = m * v, v and out are 4 scalars
+template<typename T>
+constexpr void
+mat4MulVecScalar(const T * m, const T * v, T * out)
+{
+  const T x = v[0];
+  const T y = v[1];
+  const T z = v[2];
+  const T w = v[3];
+  out[0] = m[0] * x + m[1] * y + m[2] * z + m[3] * w;
+  out[1] = m[4] * x + m[5] * y + m[6] * z + m[7] * w;
+  out[2] = m[8] * x + m[9] * y + m[10] * z + m[11] * w;
+  out[3] = m[12] * x + m[13] * y + m[14] * z + m[15] * w;
+}
+
+// Cofactor expansion, inv = adj(m) / det(m). Returns det, singular input
+// divides by (near) zero.
+template<typename T>
+inline T
+mat4InverseScalar(const T * m, T * inv)
+{
+  inv[0] =
+      m[5] * m[10] * m[15] - m[5] * m[11] * m[14] -
+      m[9] * m[6] * m[15] + m[9] * m[7] * m[14] +
+      m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+
+  inv[1] =
+      -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] +
+      m[9] * m[2] * m[15] - m[9] * m[3] * m[14] -
+      m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+
+  inv[2] =
+      m[1] * m[6] * m[15] - m[1] * m[7] * m[14] -
+      m[5] * m[2] * m[15] + m[5] * m[3] * m[14] +
+      m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+
+  inv[3] =
+      -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] +
+      m[5] * m[2] * m[11] - m[5] * m[3] * m[10] -
+      m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+
+  inv[4] =
+      -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] +
+      m[8] * m[6] * m[15] - m[8] * m[7] * m[14] -
+      m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+
+  inv[5] =
+      m[0] * m[10] * m[15] - m[0] * m[11] * m[14] -
+      m[8] * m[2] * m[15] + m[8] * m[3] * m[14] +
+      m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+
+  inv[6] =
+      -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] +
+      m[4] * m[2] * m[15] - m[4] * m[3] * m[14] -
+      m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+
+  inv[7] =
+      m[0] * m[6] * m[11] - m[0] * m[7] * m[10] -
+      m[4] * m[2] * m[11] + m[4] * m[3] * m[10] +
+      m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+
+  inv[8] =
+      m[4] * m[9] * m[15] - m[4] * m[11] * m[13] -
+      m[8] * m[5] * m[15] + m[8] * m[7] * m[13] +
+      m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+
+  inv[9] =
+      -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] +
+      m[8] * m[1] * m[15] - m[8] * m[3] * m[13] -
+      m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+
+  inv[10] =
+      m[0] * m[5] * m[15] - m[0] * m[7] * m[13] -
+      m[4] * m[1] * m[15] + m[4] * m[3] * m[13] +
+      m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+
+  inv[11] =
+      -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] +
+      m[4] * m[1] * m[11] - m[4] * m[3] * m[9] -
+      m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+
+  inv[12] =
+      -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] +
+      m[8] * m[5] * m[14] - m[8] * m[6] * m[13] -
+      m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+
+  inv[13] =
+      m[0] * m[9] * m[14] - m[0] * m[10] * m[13] -
+      m[8] * m[1] * m[14] + m[8] * m[2] * m[13] +
+      m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+
+  inv[14] =
+      -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] +
+      m[4] * m[1] * m[14] - m[4] * m[2] * m[13] -
+      m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+
+  inv[15] =
+      m[0] * m[5] * m[10] - m[0] * m[6] * m[9] -
+      m[4] * m[1] * m[10] + m[4] * m[2] * m[9] +
+      m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+  const T det =
+      m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+  const T inv_det = static_cast<T>(1) / det;
+  for (int i = 0; i < 16; ++i) {
+    inv[i] *= inv_det;
+  }
+  return det;
+}
+
+#if HB_SIMD_X86
+// Every output row is a linear combination of the rows of b, weighted by the
+// matching row of a. Broadcasting a[i][k] keeps the rows of b in registers.
+HB_TARGET_SSE41 inline void
+mat4MulSse41(const float * a, const float * b, float * out)
+{
+  const __m128 b0 = _mm_loadu_ps(b + 0);
+  const __m128 b1 = _mm_loadu_ps(b + 4);
+  const __m128 b2 = _mm_loadu_ps(b + 8);
+  const __m128 b3 = _mm_loadu_ps(b + 12);
+  for (int r = 0; r < 16; r += 4) {
+    const __m128 ar = _mm_loadu_ps(a + r);
+    __m128 acc = _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x00), b0);
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x55), b1));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xAA), b2));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xFF), b3));
+    _mm_storeu_ps(out + r, acc);
+  }
+}
+
+HB_TARGET_SSE41 inline void
+mat4MulVecSse41(const float * m, const float * v, float * out)
+{
+  const __m128 vv = _mm_loadu_ps(v);
+  const __m128 r0 = _mm_dp_ps(_mm_loadu_ps(m + 0), vv, 0xF1);
+  const __m128 r1 = _mm_dp_ps(_mm_loadu_ps(m + 4), vv, 0xF2);
+  const __m128 r2 = _mm_dp_ps(_mm_loadu_ps(m + 8), vv, 0xF4);
+  const __m128 r3 = _mm_dp_ps(_mm_loadu_ps(m + 12), vv, 0xF8);
+  _mm_storeu_ps(out, _mm_or_ps(_mm_or_ps(r0, r1), _mm_or_ps(r2, r3)));
+}
+
+/**
+ * 2x2 block inverse on SSE registers, each 2x2 block held row major in one
+ * register. With m = | A B |, the inverse is 1/|m| times the adjugates of
+ *                    | C D |
+ * X = |D|A - B(D#C), Y = |B|C - D(A#B)#, Z = |C|B - A(D#C)#, W = |A|D - C(A#B)
+ * and |m| = |A||D| + |B||C| - tr((A#B)(D#C)), where # is the 2x2 adjugate.
+ */
+HB_TARGET_SSE41 inline __m128
+mat2MulSse41(__m128 a, __m128 b)
+{
+  return _mm_add_ps(
+      _mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 3, 0))),
+      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)),
+                 _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+
+// a# * b
+HB_TARGET_SSE41 inline __m128
+mat2AdjMulSse41(__m128 a, __m128 b)
+{
+  return _mm_sub_ps(
+      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 3, 3)), b),
+      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 1, 1)),
+                 _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+// a * b#
+HB_TARGET_SSE41 inline __m128
+mat2MulAdjSse41(__m128 a, __m128 b)
+{
+  return _mm_sub_ps(
+      _mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 3, 0, 3))),
+      _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)),
+                 _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+
+HB_TARGET_SSE41 inline float
+mat4InverseSse41(const float * m, float * inv)
+{
+  const __m128 r0 = _mm_loadu_ps(m);
+  const __m128 r1 = _mm_loadu_ps(m + 4);
+  const __m128 r2 = _mm_loadu_ps(m + 8);
+  const __m128 r3 = _mm_loadu_ps(m + 12);
+  const __m128 a = _mm_movelh_ps(r0, r1);
+  const __m128 b = _mm_movehl_ps(r1, r0);
+  const __m128 c = _mm_movelh_ps(r2, r3);
+  const __m128 d = _mm_movehl_ps(r3, r2);
+
+  // |A| |B| |C| |D|
+  const __m128 det_sub = _mm_sub_ps(
+      _mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(2, 0, 2, 0)),
+                 _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(3, 1, 3, 1))),
+      _mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(3, 1, 3, 1)),
+                 _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(2, 0, 2, 0))));
+  const __m128 det_a = _mm_shuffle_ps(det_sub, det_sub, 0x00);
+  const __m128 det_b = _mm_shuffle_ps(det_sub, det_sub, 0x55);
+  const __m128 det_c = _mm_shuffle_ps(det_sub, det_sub, 0xAA);
+  const __m128 det_d = _mm_shuffle_ps(det_sub, det_sub, 0xFF);
+
+  const __m128 d_c = mat2AdjMulSse41(d, c);
+  const __m128 a_b = mat2AdjMulSse41(a, b);
+  __m128       x = _mm_sub_ps(_mm_mul_ps(det_d, a), mat2MulSse41(b, d_c));
+  __m128       w = _mm_sub_ps(_mm_mul_ps(det_a, d), mat2MulSse41(c, a_b));
+  __m128       y = _mm_sub_ps(_mm_mul_ps(det_b, c), mat2MulAdjSse41(d, a_b));
+  __m128       z = _mm_sub_ps(_mm_mul_ps(det_c, b), mat2MulAdjSse41(a, d_c));
+
+  __m128 tr =
+      _mm_mul_ps(a_b, _mm_shuffle_ps(d_c, d_c, _MM_SHUFFLE(3, 1, 2, 0)));
+  tr = _mm_hadd_ps(tr, tr);
+  tr = _mm_hadd_ps(tr, tr);
+  const __m128 det = _mm_sub_ps(
+      _mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+
+  // The adjugate of each block flips the sign of its off diagonal
+  const __m128 r_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+  x = _mm_mul_ps(x, r_det);
+  y = _mm_mul_ps(y, r_det);
+  z = _mm_mul_ps(z, r_det);
+  w = _mm_mul_ps(w, r_det);
+
+  // Adjugate shuffle and block to row shuffle in one
+  _mm_storeu_ps(inv, _mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)));
+  _mm_storeu_ps(inv + 4, _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)));
+  _mm_storeu_ps(inv + 8, _mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)));
+  _mm_storeu_ps(inv + 12, _mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2)));
+  return _mm_cvtss_f32(det);
+}
+
+// Same kernel, VEX encoded
+HB_TARGET_AVX2 inline float
+mat4InverseAvx2(const float * m, float * inv)
+{
+  return mat4InverseSse41(m, inv);
+}
+
+// Same scheme as SSE, two output rows per 256 bit register
+HB_TARGET_AVX2 inline void
+mat4MulAvx2(const float * a, const float * b, float * out)
+{
+  const __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(b));
+  const __m256 b1 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(b + 4));
+  const __m256 b2 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(b + 8));
+  const __m256 b3 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(b + 12));
+  for (int r = 0; r < 16; r += 8) {
+    const __m256 ar = _mm256_loadu_ps(a + r);
+    __m256 acc = _mm256_mul_ps(_mm256_shuffle_ps(ar, ar, 0x00), b0);
+    acc = _mm256_fmadd_ps(_mm256_shuffle_ps(ar, ar, 0x55), b1, acc);
+    acc = _mm256_fmadd_ps(_mm256_shuffle_ps(ar, ar, 0xAA), b2, acc);
+    acc = _mm256_fmadd_ps(_mm256_shuffle_ps(ar, ar, 0xFF), b3, acc);
+    _mm256_storeu_ps(out + r, acc);
+  }
+}
+
+// Products of rows (0,1) and (2,3), then two horizontal adds leave the row
+// sums as [r0 r2 r0 r2 | r1 r3 r1 r3]
+HB_TARGET_AVX2 inline __m128
+mat4RowSumsAvx2(__m256 p01, __m256 p23)
+{
+  __m256       h = _mm256_hadd_ps(p01, p23);
+  h = _mm256_hadd_ps(h, h);
+  return _mm_unpacklo_ps(_mm256_castps256_ps128(h),
+                         _mm256_extractf128_ps(h, 1));
+}
+
+HB_TARGET_AVX2 inline void
+mat4MulVecAvx2(const float * m, const float * v, float * out)
+{
+  const __m256 vv = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(v));
+  const __m256 p01 = _mm256_mul_ps(_mm256_loadu_ps(m), vv);
+  const __m256 p23 = _mm256_mul_ps(_mm256_loadu_ps(m + 8), vv);
+  _mm_storeu_ps(out, mat4RowSumsAvx2(p01, p23));
+}
+
+// GCC 12's broadcast_f32x4, permute_ps and extractf64x4_pd pass an
+// undefined register as the unused merge source and then warn that it is
+// uninitialized (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// The whole left hand matrix fits one register, permute_ps broadcasts within
+// each 128 bit lane, i.e. within each row
+HB_TARGET_AVX512 inline void
+mat4MulAvx512(const float * a, const float * b, float * out)
+{
+  const __m512 av = _mm512_loadu_ps(a);
+  const __m512 b0 = _mm512_broadcast_f32x4(_mm_loadu_ps(b));
+  const __m512 b1 = _mm512_broadcast_f32x4(_mm_loadu_ps(b + 4));
+  const __m512 b2 = _mm512_broadcast_f32x4(_mm_loadu_ps(b + 8));
+  const __m512 b3 = _mm512_broadcast_f32x4(_mm_loadu_ps(b + 12));
+  __m512       acc = _mm512_mul_ps(_mm512_permute_ps(av, 0x00), b0);
+  acc = _mm512_fmadd_ps(_mm512_permute_ps(av, 0x55), b1, acc);
+  acc = _mm512_fmadd_ps(_mm512_permute_ps(av, 0xAA), b2, acc);
+  acc = _mm512_fmadd_ps(_mm512_permute_ps(av, 0xFF), b3, acc);
+  _mm512_storeu_ps(out, acc);
+}
+
+HB_TARGET_AVX512 inline void
+mat4MulVecAvx512(const float * m, const float * v, float * out)
+{
+  const __m512 p = _mm512_mul_ps(_mm512_loadu_ps(m),
+                                 _mm512_broadcast_f32x4(_mm_loadu_ps(v)));
+  // extractf32x8 is AVX512DQ, the f64x4 flavour is plain AVX512F
+  const __m256 p23 = _mm256_castpd_ps(
+      _mm512_extractf64x4_pd(_mm512_castps_pd(p), 1));
+  _mm_storeu_ps(out, mat4RowSumsAvx2(_mm512_castps512_ps256(p), p23));
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // HB_SIMD_X86
+
+/**
+ * Kernel table for the Matrix4 products and the general inverse. active()
+ * is resolved once from the detected CPU features, forIsa() hands out any
+ * specific table, which is what the comparisons against the scalar
+ * reference in MathBench --check use.
+ */
+class Matrix4Kernels {
+  public:
+  using MulFn = void (*)(const float *, const float *, float *);
+  using MulVecFn = void (*)(const float *, const float *, float *);
+  using InverseFn = float (*)(const float *, float *);
+
+  SimdIsa   isa;
+  MulFn     mul;
+  MulVecFn  mulVec;
+  InverseFn inverse;
+
+  // Falls back to the widest supported table below isa
+  static const Matrix4Kernels &
+  forIsa(SimdIsa isa)
+  {
+    static const Matrix4Kernels scalar{
+        SimdIsa::Scalar, &mat4MulScalar, &mat4MulVecScalar, &mat4InverseScalar};
+#if HB_SIMD_X86
+    static const Matrix4Kernels sse41{
+        SimdIsa::Sse41, &mat4MulSse41, &mat4MulVecSse41, &mat4InverseSse41};
+    static const Matrix4Kernels avx2{
+        SimdIsa::Avx2, &mat4MulAvx2, &mat4MulVecAvx2, &mat4InverseAvx2};
+    static const Matrix4Kernels avx512{
+        SimdIsa::Avx512, &mat4MulAvx512, &mat4MulVecAvx512, &mat4InverseAvx2};
+
+    const SimdIsa best = CpuFeatures::get().bestIsa();
+    if (isa > best) {
+      isa = best;
+    }
+    switch (isa) {
+      case SimdIsa::Avx512: return avx512;
+      case SimdIsa::Avx2: return avx2;
+      case SimdIsa::Sse41: return sse41;
+      default: break;
+    }
+#else
+    (void)isa;
+#endif
+    return scalar;
+  }
+
+  static const Matrix4Kernels &
+  active()
+  {
+    static const Matrix4Kernels & kernels =
+        forIsa(CpuFeatures::get().bestIsa());
+    return kernels;
+  }
+};
+
+#endif // MATRIX_SIMD_HH
@@ -0,0 +1,387 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * A small work-stealing fork-join thread pool for the batch kernels.
+ * parallelFor splits [begin, end) into grain sized chunks and hands every
+ * thread, the caller included, a contiguous run of them. Threads take
+ * chunks from the front of their own run and, once it is empty, steal the
+ * back half of someone else's, so uneven chunks and late waking workers
+ * balance out while every thread mostly walks memory in order.
+ *
+ * The batch kernels (VectorSoA, QuatBatch, MatrixBatch) go through
+ * parallelBatch(), which splits inputs larger than parallelBatchGrain over
+ * ThreadPool::current() and runs smaller ones on the calling thread.
+ */
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class ThreadPool {
+  public:
+  // Whether worker i is pinned to logical core i % hardware_concurrency
+  enum class Affinity { None, PinToCores };
+
+  // workers threads besides the caller, 0 runs everything inline
+  explicit ThreadPool(unsigned workers, Affinity affinity = Affinity::None)
+      : slots(std::make_unique<Slot[]>(workers + 1u))
+  {
+    threads.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+      threads.emplace_back([this, i] { workerLoop(i + 1u); });
+      if (affinity == Affinity::PinToCores) {
+        pin(threads.back(), i);
+      }
+    }
+  }
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto & t : threads) {
+      t.join();
+    }
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &
+  operator=(const ThreadPool &) = delete;
+
+  // Shared pool, one worker per hardware thread besides the caller
+  static ThreadPool &
+  global()
+  {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) -
+                           1u);
+    return pool;
+  }
+
+  // The pool parallelFor() and the batch kernels use on this thread,
+  // global() unless a Scope is active
+  static ThreadPool &
+  current()
+  {
+    ThreadPool * pool = scoped();
+    return (pool != nullptr) ? *pool : global();
+  }
+
+  // Routes current() on this thread to pool while alive, e.g. to run the
+  // batch kernels on fewer threads than the global pool has
+  class Scope {
+    public:
+    explicit Scope(ThreadPool & pool) : previous(scoped())
+    {
+      scoped() = &pool;
+    }
+    ~Scope()
+    {
+      scoped() = previous;
+    }
+    Scope(const Scope &) = delete;
+    Scope &
+    operator=(const Scope &) = delete;
+
+    private:
+    ThreadPool * previous;
+  };
+
+  // Threads that take part in a parallelFor, the caller included
+  [[nodiscard]] unsigned
+  concurrency() const
+  {
+    return static_cast<unsigned>(threads.size()) + 1u;
+  }
+
+  /**
+   * Index of the calling thread within its pool, 1 to workers for the pool's
+   * own threads and 0 for every other thread, i.e. whoever calls
+   * parallelFor. Stable for the thread's lifetime, for per-thread scratch.
+   */
+  [[nodiscard]] static unsigned
+  threadIndex()
+  {
+    return workerIndex();
+  }
+
+  /**
+   * About 8 chunks per thread for n elements, at least min_grain each. Few
+   * enough that the per chunk cost vanishes, enough to steal from.
+   */
+  [[nodiscard]] std::size_t
+  autoGrain(std::size_t n, std::size_t min_grain) const
+  {
+    return std::max(n / (8u * concurrency()),
+                    std::max<std::size_t>(min_grain, 1));
+  }
+
+  /**
+   * Calls f(chunk_begin, chunk_end) for grain sized chunks of [begin, end)
+   * and returns when all of them ran. Calls from inside a chunk, or while
+   * another thread's loop owns the pool, run inline instead of waiting, so
+   * nesting can't deadlock. f must not throw.
+   */
+  template<typename F>
+  void
+  parallelFor(std::size_t begin, std::size_t end, std::size_t grain, F && f)
+  {
+    if (begin >= end) {
+      return;
+    }
+    grain = std::max<std::size_t>(grain, 1);
+    if (end - begin <= grain || threads.empty() || insideJob() ||
+        !submit.try_lock()) {
+      f(begin, end);
+      return;
+    }
+    std::lock_guard<std::mutex> owner(submit, std::adopt_lock);
+
+    // Chunk indices are packed two per word in the slots
+    const std::size_t max_chunks = 0xFFFFFFFFu;
+    if ((end - begin) / grain >= max_chunks) {
+      grain = (end - begin) / max_chunks + 1;
+    }
+    Job job;
+    job.begin = begin;
+    job.end = end;
+    job.grain = grain;
+    job.ctx = &f;
+    job.call = [](void * ctx, std::size_t b, std::size_t e) {
+      (*static_cast<std::remove_reference_t<F> *>(ctx))(b, e);
+    };
+    const std::uint64_t chunks = (end - begin + grain - 1) / grain;
+    const unsigned      count = concurrency();
+    for (unsigned t = 0; t < count; ++t) {
+      slots[t].range.store(pack(chunks * t / count, chunks * (t + 1) / count),
+                           std::memory_order_relaxed);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      current_job = &job;
+      ++generation;
+    }
+    wake.notify_all();
+    insideJob() = true;
+    runChunks(job, 0);
+    insideJob() = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return job.active == 0; });
+    current_job = nullptr;
+  }
+
+  private:
+  class Job {
+    public:
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    std::size_t grain = 1;
+    int         active = 0; // Workers inside, guarded by mutex
+    void *      ctx = nullptr;
+    void (*call)(void *, std::size_t, std::size_t) = nullptr;
+  };
+
+  // Chunks [lo, hi) of one thread, lo in the low half. Owners take lo,
+  // thieves move hi down, both by compare exchange of the whole word.
+  class alignas(64) Slot {
+    public:
+    std::atomic<std::uint64_t> range{0};
+  };
+
+  static std::uint64_t
+  pack(std::uint64_t lo, std::uint64_t hi)
+  {
+    return lo | (hi << 32);
+  }
+
+  static bool &
+  insideJob()
+  {
+    thread_local bool inside = false;
+    return inside;
+  }
+  static unsigned &
+  workerIndex()
+  {
+    thread_local unsigned index = 0;
+    return index;
+  }
+  static ThreadPool *&
+  scoped()
+  {
+    thread_local ThreadPool * pool = nullptr;
+    return pool;
+  }
+
+  static void
+  pin(std::thread & t, unsigned core)
+  {
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    core %= cores;
+#if defined(_WIN32)
+    if (core < 8 * sizeof(DWORD_PTR)) {
+      SetThreadAffinityMask(t.native_handle(), DWORD_PTR(1) << core);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+    (void)t;
+#endif
+  }
+
+  // Next chunk of thread self's own run
+  bool
+  popChunk(unsigned self, std::uint64_t & chunk)
+  {
+    std::atomic<std::uint64_t> & range = slots[self].range;
+    std::uint64_t                r = range.load(std::memory_order_acquire);
+    for (;;) {
+      const std::uint64_t lo = r & 0xFFFFFFFFu;
+      const std::uint64_t hi = r >> 32;
+      if (lo >= hi) {
+        return false;
+      }
+      if (range.compare_exchange_weak(r, pack(lo + 1, hi),
+                                      std::memory_order_acq_rel)) {
+        chunk = lo;
+        return true;
+      }
+    }
+  }
+
+  // Moves the back half of the first non empty run after self's into self's
+  // slot and returns its first chunk
+  bool
+  stealChunk(unsigned self, std::uint64_t & chunk)
+  {
+    const unsigned count = concurrency();
+    for (unsigned k = 1; k < count; ++k) {
+      std::atomic<std::uint64_t> & range = slots[(self + k) % count].range;
+      std::uint64_t                r = range.load(std::memory_order_acquire);
+      for (;;) {
+        const std::uint64_t lo = r & 0xFFFFFFFFu;
+        const std::uint64_t hi = r >> 32;
+        if (lo >= hi) {
+          break;
+        }
+        const std::uint64_t mid = hi - (hi - lo + 1) / 2;
+        if (range.compare_exchange_weak(r, pack(lo, mid),
+                                        std::memory_order_acq_rel)) {
+          slots[self].range.store(pack(mid + 1, hi),
+                                  std::memory_order_release);
+          chunk = mid;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void
+  runChunks(Job & job, unsigned self)
+  {
+    std::uint64_t chunk = 0;
+    while (popChunk(self, chunk) || stealChunk(self, chunk)) {
+      const std::size_t b =
+          job.begin + static_cast<std::size_t>(chunk) * job.grain;
+      job.call(job.ctx, b, std::min(b + job.grain, job.end));
+    }
+  }
+
+  void
+  workerLoop(unsigned index)
+  {
+    insideJob() = true;
+    workerIndex() = index;
+    std::uint64_t                seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+      Job * job = current_job;
+      if (job == nullptr) {
+        continue;
+      }
+      ++job->active;
+      lock.unlock();
+      runChunks(*job, index);
+      lock.lock();
+      if (--job->active == 0) {
+        done.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> threads;
+  std::unique_ptr<Slot[]>  slots; // One per thread, 0 is the caller's
+  std::mutex               submit;
+  std::mutex               mutex;
+  std::condition_variable  wake;
+  std::condition_variable  done;
+  Job *                    current_job = nullptr;
+  std::uint64_t            generation = 0;
+  bool                     stopping = false;
+};
+
+// ThreadPool::current().parallelFor
+template<typename F>
+inline void
+parallelFor(std::size_t begin, std::size_t end, std::size_t grain, F && f)
+{
+  ThreadPool::current().parallelFor(begin, end, grain, std::forward<F>(f));
+}
+
+/**
+ * Elements per chunk when the batch kernels split their input, inputs up to
+ * this size stay on the calling thread. Large enough that a chunk outweighs
+ * waking a worker, a few microseconds for the cheapest kernels.
+ */
+inline std::size_t parallelBatchGrain = 16384;
+
+/**
+ * f(begin, end) over [0, n) in chunks of parallelBatchGrain rounded up to
+ * 64 elements, so every chunk starts on a whole register of any FloatV
+ * width and on a whole 32 bit mask word.
+ */
+template<typename F>
+inline void
+parallelBatch(std::size_t n, F && f)
+{
+  const std::size_t grain =
+      (std::max<std::size_t>(parallelBatchGrain, 1) + 63) &
+      ~static_cast<std::size_t>(63);
+  if (n <= grain) {
+    f(std::size_t(0), n);
+    return;
+  }
+  parallelFor(0, n, grain, std::forward<F>(f));
+}
+
+#endif // PARALLEL_HH
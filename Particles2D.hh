@@ -0,0 +1,349 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * 2D particles as position and velocity SoA streams, integrated with
+ * semi-implicit Euler and bounced off half-plane lines and an axis aligned
+ * box. The bounce is Vector2::reflected() run on FloatV registers: the
+ * dotp / fscalp / vecSub chain of every line is evaluated for FloatV::width
+ * particles at once, with the divide by the line's squared length hoisted
+ * out of the loop. Every kernel goes through forEachLaneBlock, so large
+ * systems split over ThreadPool::current(), and step() fuses integration
+ * and all boundaries into one pass over memory.
+ */
+#ifndef PARTICLES_2D_HH
+#define PARTICLES_2D_HH
+#include "Simd.hh"
+#include "Vector.hh"
+#include "VectorSoA.hh"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/**
+ * The line through point along direction, particles live on its left, the
+ * side (-direction.y, direction.x) points to. direction needs no unit length
+ * but must not be zero.
+ */
+class ParticleLine {
+  public:
+  Vector2 point;
+  Vector2 direction;
+};
+
+// Particles live inside [min, max]
+class ParticleBox {
+  public:
+  Vector2 min;
+  Vector2 max;
+};
+
+class Particles2D {
+  public:
+  Particles2D() = default;
+  explicit Particles2D(std::size_t n) : data(n)
+  {
+  }
+
+  // Components
+  [[nodiscard]] float *
+  px()
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] float *
+  py()
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] float *
+  vx()
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] float *
+  vy()
+  {
+    return data.comp[3];
+  }
+  [[nodiscard]] const float *
+  px() const
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] const float *
+  py() const
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] const float *
+  vx() const
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] const float *
+  vy() const
+  {
+    return data.comp[3];
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return data.count;
+  }
+  // New particles are at rest at the origin
+  void
+  resize(std::size_t n)
+  {
+    data.resize(n);
+  }
+
+  // Element access
+  [[nodiscard]] Vector2
+  position(std::size_t i) const
+  {
+    return Vector2(px()[i], py()[i]);
+  }
+  [[nodiscard]] Vector2
+  velocity(std::size_t i) const
+  {
+    return Vector2(vx()[i], vy()[i]);
+  }
+  void
+  set(std::size_t i, const Vector2 & position, const Vector2 & velocity)
+  {
+    px()[i] = position.x;
+    py()[i] = position.y;
+    vx()[i] = velocity.x;
+    vy()[i] = velocity.y;
+  }
+
+  SoAStorage<4> data;
+};
+
+// Registers of one lane block, shared by integrate(), reflect() and step()
+class ParticleLanes {
+  public:
+  FloatV px, py, vx, vy;
+
+  ParticleLanes(const Particles2D & p, std::size_t i)
+      : px(FloatV::load(p.px() + i)), py(FloatV::load(p.py() + i)),
+        vx(FloatV::load(p.vx() + i)), vy(FloatV::load(p.vy() + i))
+  {
+  }
+  void
+  store(Particles2D & p, std::size_t i) const
+  {
+    px.store(p.px() + i);
+    py.store(p.py() + i);
+    vx.store(p.vx() + i);
+    vy.store(p.vy() + i);
+  }
+
+  // v += a dt, then p += v dt
+  void
+  integrate(FloatV ax_dt, FloatV ay_dt, FloatV dt)
+  {
+    vx += ax_dt;
+    vy += ay_dt;
+    px = FloatV::mulAdd(vx, dt, px);
+    py = FloatV::mulAdd(vy, dt, py);
+  }
+};
+
+// A ParticleLine with everything the lanes need precomputed
+class ParticleLineLanes {
+  public:
+  FloatV dx, dy;     // direction
+  FloatV two_inv_sq; // 2 / direction.magSq(), the hoisted divide
+  FloatV nx, ny, c;  // Unit left normal, n.p - c is the signed distance
+
+  explicit ParticleLineLanes(const ParticleLine & line)
+  {
+    const float sq = line.direction.magSq();
+    assert(sq > 0.0f);
+    const float inv = 1.0f / std::sqrt(sq);
+    const float n_x = -line.direction.y * inv;
+    const float n_y = line.direction.x * inv;
+    dx = FloatV::set1(line.direction.x);
+    dy = FloatV::set1(line.direction.y);
+    two_inv_sq = FloatV::set1(2.0f / sq);
+    nx = FloatV::set1(n_x);
+    ny = FloatV::set1(n_y);
+    c = FloatV::set1(n_x * line.point.x + n_y * line.point.y);
+  }
+};
+
+/**
+ * Bounce factors for restitution e, 1 keeps the speed and 0 stops the
+ * normal motion. keep + bounce = 1, so e = 1 gives reflected() exactly.
+ */
+class ParticleRestitution {
+  public:
+  FloatV bounce; // (1 + e) / 2, weight of the reflected velocity
+  FloatV keep;   // (1 - e) / 2, weight of the incoming one
+  FloatV push;   // 1 + e, how far back through the boundary a position goes
+  FloatV e;
+
+  explicit ParticleRestitution(float restitution)
+      : bounce(FloatV::set1(0.5f * (1.0f + restitution))),
+        keep(FloatV::set1(0.5f * (1.0f - restitution))),
+        push(FloatV::set1(1.0f + restitution)),
+        e(FloatV::set1(restitution))
+  {
+  }
+};
+
+/**
+ * Particles behind the line go back by (1 + e) times their depth, and those
+ * still moving into it get direction.reflected(velocity), the velocity
+ * mirrored about the line, blended with the incoming one for e < 1.
+ */
+inline void
+reflectLanes(ParticleLanes & p, const ParticleLineLanes & l,
+             const ParticleRestitution & r)
+{
+  const FloatV zero = FloatV::zero();
+  const FloatV dist = FloatV::mulAdd(l.nx, p.px, l.ny * p.py) - l.c;
+  const MaskV  behind = dist < zero;
+  const MaskV  into = FloatV::mulAdd(l.nx, p.vx, l.ny * p.vy) < zero;
+
+  // reflected(): (d * (2 * d.v / d.d)) - v
+  const FloatV k = FloatV::mulAdd(l.dx, p.vx, l.dy * p.vy) * l.two_inv_sq;
+  const FloatV rx = l.dx * k - p.vx;
+  const FloatV ry = l.dy * k - p.vy;
+
+  const MaskV  bounce = behind & into;
+  const FloatV depth = r.push * dist;
+  p.px = FloatV::select(behind, p.px - depth * l.nx, p.px);
+  p.py = FloatV::select(behind, p.py - depth * l.ny, p.py);
+  p.vx = FloatV::select(bounce, FloatV::mulAdd(r.bounce, rx, r.keep * p.vx),
+                        p.vx);
+  p.vy = FloatV::select(bounce, FloatV::mulAdd(r.bounce, ry, r.keep * p.vy),
+                        p.vy);
+}
+
+/**
+ * One axis of a box, reflected() against an axis direction reduces to
+ * negating the velocity component across it. Positions are clamped after
+ * the push back, so particles faster than the box is wide stay inside.
+ */
+inline void
+reflectAxisLanes(FloatV & p, FloatV & v, FloatV lo, FloatV hi,
+                 const ParticleRestitution & r)
+{
+  const FloatV zero = FloatV::zero();
+  const MaskV  below = p < lo;
+  const MaskV  above = p > hi;
+  const MaskV  bounce = (below & (v < zero)) | (above & (v > zero));
+  p = FloatV::select(below, FloatV::mulAdd(r.push, lo - p, p), p);
+  p = FloatV::select(above, FloatV::mulAdd(r.push, hi - p, p), p);
+  p = FloatV::min(FloatV::max(p, lo), hi);
+  v = FloatV::select(bounce, -(r.e * v), v);
+}
+
+// A ParticleBox broadcast to registers
+class ParticleBoxLanes {
+  public:
+  FloatV min_x, min_y, max_x, max_y;
+
+  explicit ParticleBoxLanes(const ParticleBox & box)
+      : min_x(FloatV::set1(box.min.x)), min_y(FloatV::set1(box.min.y)),
+        max_x(FloatV::set1(box.max.x)), max_y(FloatV::set1(box.max.y))
+  {
+    assert(box.min.x <= box.max.x && box.min.y <= box.max.y);
+  }
+};
+
+inline void
+reflectLanes(ParticleLanes & p, const ParticleBoxLanes & box,
+             const ParticleRestitution & r)
+{
+  reflectAxisLanes(p.px, p.vx, box.min_x, box.max_x, r);
+  reflectAxisLanes(p.py, p.vy, box.min_y, box.max_y, r);
+}
+
+/**
+ * f(lanes) for every lane block of p, the block loaded before and stored
+ * after, split over the pool like every forEachLaneBlock kernel.
+ */
+template<typename F>
+inline void
+forEachParticleBlock(Particles2D & p, F && f)
+{
+  forEachLaneBlock(p.size(), [&](std::size_t i) {
+    ParticleLanes lanes(p, i);
+    f(lanes);
+    lanes.store(p, i);
+  });
+}
+
+// velocity += acceleration * dt, then position += velocity * dt
+inline void
+integrate(Particles2D & p, const Vector2 & acceleration, float dt)
+{
+  const FloatV ax_dt = FloatV::set1(acceleration.x * dt);
+  const FloatV ay_dt = FloatV::set1(acceleration.y * dt);
+  const FloatV dt_v = FloatV::set1(dt);
+  forEachParticleBlock(p, [&](ParticleLanes & lanes) {
+    lanes.integrate(ax_dt, ay_dt, dt_v);
+  });
+}
+
+// Keeps every particle inside box, restitution as in ParticleRestitution
+inline void
+reflect(Particles2D & p, const ParticleBox & box, float restitution = 1.0f)
+{
+  const ParticleBoxLanes    box_lanes(box);
+  const ParticleRestitution r(restitution);
+  forEachParticleBlock(p, [&](ParticleLanes & lanes) {
+    reflectLanes(lanes, box_lanes, r);
+  });
+}
+
+// Bounces off the lines in order, each lane block loaded once for all
+inline void
+reflect(Particles2D & p, const ParticleLine * lines, std::size_t count,
+        float restitution = 1.0f)
+{
+  const std::vector<ParticleLineLanes> line_lanes(lines, lines + count);
+  const ParticleRestitution            r(restitution);
+  forEachParticleBlock(p, [&](ParticleLanes & lanes) {
+    for (const ParticleLineLanes & l : line_lanes) {
+      reflectLanes(lanes, l, r);
+    }
+  });
+}
+
+/**
+ * integrate(), then reflect() off box unless it is null, then off the
+ * lines, in one pass so the particles cross memory once per frame instead
+ * of once per kernel.
+ */
+inline void
+step(Particles2D & p, const Vector2 & acceleration, float dt,
+     const ParticleBox * box, const ParticleLine * lines, std::size_t count,
+     float restitution = 1.0f)
+{
+  const ParticleBoxLanes box_lanes(
+      (box != nullptr) ? *box : ParticleBox{Vector2(0.0f), Vector2(0.0f)});
+  const std::vector<ParticleLineLanes> line_lanes(lines, lines + count);
+  const ParticleRestitution            r(restitution);
+  const FloatV ax_dt = FloatV::set1(acceleration.x * dt);
+  const FloatV ay_dt = FloatV::set1(acceleration.y * dt);
+  const FloatV dt_v = FloatV::set1(dt);
+  forEachParticleBlock(p, [&](ParticleLanes & lanes) {
+    lanes.integrate(ax_dt, ay_dt, dt_v);
+    if (box != nullptr) {
+      reflectLanes(lanes, box_lanes, r);
+    }
+    for (const ParticleLineLanes & l : line_lanes) {
+      reflectLanes(lanes, l, r);
+    }
+  });
+}
+
+#endif // PARTICLES_2D_HH
@@ -8,8 +8,11 @@
  */
 #ifndef QUATERNION_HH
 #define QUATERNION_HH
+#include "Matrix.hh"
 #include "Vector.hh"
 
+#include <cmath>
+
 template<typename T>
 class Quat {
   public:
@@ -17,8 +20,8 @@ class Quat {
    * Construct a Quaternion from at most 4 components of type T.
    * Specifying only a != 0 makes the Quaternion a real quat.
    */
-  explicit Quat(T xx = 0, T yy = 0, T zz = 0, T ww = 0)
-      : x{xx}, y{yy}, z{zz}, w{ww}
+  constexpr explicit Quat(T xx = 0, T yy = 0, T zz = 0, T ww = 0)
+      : w{ww}, x{xx}, y{yy}, z{zz}
   {
   }
 
@@ -28,22 +31,22 @@ class Quat {
    * @param     vectorA, vectorB
    */
   template<bool unitlength>
-  Quat(Vector3 vector_a, Vector3 vector_b)
+  Quat(Vector3T<T> vector_a, Vector3T<T> vector_b)
   {
     if constexpr (unitlength == false) {
       vector_a.normalize();
       vector_b.normalize();
     }
 
-    Vector3 rot_axis = vector_a.cross(vector_b);
-    float   rad_angle = vector_a.dotp(vector_b);
+    Vector3T<T> rot_axis = vector_a.cross(vector_b);
+    T           rad_angle = vector_a.dotp(vector_b);
 
     if ((rad_angle < 1e-6) && (rad_angle > -(1e-6))) {
       x = y = z = 0.0;
       w = 1.0;
       return;
     }
-    Vector4 && temp{rot_axis.x, rot_axis.y, rot_axis.z, 1 + rad_angle};
+    Vector4T<T> && temp{rot_axis.x, rot_axis.y, rot_axis.z, 1 + rad_angle};
     temp.normalize();
 
     x = temp.x;
@@ -57,15 +60,15 @@ class Quat {
    * Does not assume the vector size, evaluates at runtime
    * @param     vectorA, vectorB
    */
-  Quat(Vector3 vector_a, Vector3 vector_b)
+  Quat(Vector3T<T> vector_a, Vector3T<T> vector_b)
   {
     if (!vector_a.isNorm())
       vector_a.normalize();
     if (!vector_b.isNorm())
       vector_b.normalize();
 
-    Vector3 rot_axis = vector_b.cross(vector_a);
-    float   rad_angle = vector_a.dotp(vector_b);
+    Vector3T<T> rot_axis = vector_b.cross(vector_a);
+    T           rad_angle = vector_a.dotp(vector_b);
 
     if ((rad_angle < 1e-6) && (rad_angle > -(1e-6))) {
       x = y = z = 0.0;
@@ -73,7 +76,7 @@ class Quat {
       return;
     }
 
-    Vector4 && temp{rot_axis.x, rot_axis.y, rot_axis.z, 1 + rad_angle};
+    Vector4T<T> && temp{rot_axis.x, rot_axis.y, rot_axis.z, 1 + rad_angle};
     temp.normalize();
 
     x = temp.x;
@@ -87,7 +90,7 @@ class Quat {
    * Assumed initial vectors were normalized
    * @param     rot/axis, rad_angle
    */
-  Quat(Vector3 rot_axis, float rad_angle)
+  Quat(Vector3T<T> rot_axis, T rad_angle)
   {
     if ((rad_angle < 1e-6) && (rad_angle > -(1e-6))) {
       x = y = z = 0.0;
@@ -95,7 +98,7 @@ class Quat {
       return;
     }
 
-    Vector4 && temp{rot_axis.x, rot_axis.y, rot_axis.z, 1 + rad_angle};
+    Vector4T<T> && temp{rot_axis.x, rot_axis.y, rot_axis.z, 1 + rad_angle};
     temp.normalize();
 
     x = temp.x;
@@ -109,19 +112,19 @@ class Quat {
    * The inverse of a quaternion,
    * Qinverse = Qconj / Qmag^2
    */
-  Quat
-  invQuat()
+  [[nodiscard]] constexpr Quat
+  invQuat() const
   {
-    return Quat{conjugateQuat() / squaredCompSums()};
+    return conjugateQuat() / squaredCompSums();
   }
 
   /**
    * q* = q4 ,-q1, -q2, -q3
    */
-  Quat
-  conjugateQuat()
+  [[nodiscard]] constexpr Quat
+  conjugateQuat() const
   {
-    return Quat{w, -x, -y, -z};
+    return Quat(-x, -y, -z, w);
   }
 
   /*
@@ -134,42 +137,142 @@ class Quat {
     operations. Doing that to get something like the Euler-Rodriguez Formula
     (Eq. 3) v' = v + 2 * r X (s * v + r X v) / m
   */
-  Vector3
-  rotateVector(Vector3 in_vec)
-  {
-#define MOV(A) std::move(A) // NOLINT
-    Vector4 && quatvec4 = vectorizeSelf4d();
-    Vector3 && quatvec3{MOV(quatvec4.x), MOV(quatvec4.y), MOV(quatvec4.z)};
-    float &&   quatscalar = MOV(quatvec4.w);
-    delete quatvec4; // nasty, I know
-
-    float sum_quat = squaredCompSums();
-    auto  v_rv = (in_vec * quatscalar) + (quatvec3.cross(in_vec));
-    return (in_vec + 2) * (MOV(quatvec3).cross(v_rv) / sum_quat);
+  [[nodiscard]] constexpr Vector3T<T>
+  rotateVector(const Vector3T<T> & in_vec) const
+  {
+    const Vector3T<T> quatvec3 = vectorizeSelf3d();
+    const T           quatscalar = w;
+    const T           sum_quat = squaredCompSums();
+    const Vector3T<T> v_rv = (in_vec * quatscalar) + quatvec3.cross(in_vec);
+    return in_vec + quatvec3.cross(v_rv) * (2.0f / sum_quat);
     // Returns rotated vector
-#undef MOV
   }
 
-  Vector4 &&
-  vectorizeSelf4d()
+  [[nodiscard]] constexpr Vector4T<T>
+  vectorizeSelf4d() const
   {
-    Vector4 && vectorized{x, y, z, w};
-    return std::move(vectorized);
+    return Vector4T<T>(x, y, z, w);
   }
 
-  Vector3 &&
-  vectorizeSelf3d()
+  [[nodiscard]] constexpr Vector3T<T>
+  vectorizeSelf3d() const
   {
-    Vector3 && vectorized{x, y, z};
-    return std::move(vectorized);
+    return Vector3T<T>(x, y, z);
   }
 
-  float
-  squaredCompSums()
+  [[nodiscard]] constexpr T
+  squaredCompSums() const
   {
     return (x * x) + (y * y) + (z * z) + (w * w);
   }
 
+  [[nodiscard]] constexpr T
+  dotp(const Quat & b) const
+  {
+    return (x * b.x) + (y * b.y) + (z * b.z) + (w * b.w);
+  }
+
+  // Matrix conversions
+  /**
+   * T * R * S of this unit quaternion, translation t and scale s, built in
+   * one go rather than as three matrix products. Straight line, no trig.
+   */
+  [[nodiscard]] constexpr Matrix4T<T>
+  toMatrix4(const Vector3T<T> & t = Vector3T<T>(0.0f),
+            const Vector3T<T> & s = Vector3T<T>(1.0f)) const
+  {
+    const T xx = x * (x + x);
+    const T yy = y * (y + y);
+    const T zz = z * (z + z);
+    const T xy = x * (y + y);
+    const T xz = x * (z + z);
+    const T yz = y * (z + z);
+    const T wx = w * (x + x);
+    const T wy = w * (y + y);
+    const T wz = w * (z + z);
+
+    Matrix4T<T> m;
+    m.cells[0] = (1.0f - (yy + zz)) * s.x;
+    m.cells[1] = (xy - wz) * s.y;
+    m.cells[2] = (xz + wy) * s.z;
+    m.cells[3] = t.x;
+    m.cells[4] = (xy + wz) * s.x;
+    m.cells[5] = (1.0f - (xx + zz)) * s.y;
+    m.cells[6] = (yz - wx) * s.z;
+    m.cells[7] = t.y;
+    m.cells[8] = (xz - wy) * s.x;
+    m.cells[9] = (yz + wx) * s.y;
+    m.cells[10] = (1.0f - (xx + yy)) * s.z;
+    m.cells[11] = t.z;
+    m.cells[15] = 1.0f;
+    return m;
+  }
+
+  /**
+   * Rotation of the upper 3x3 of m by Shepperd's method: the largest of
+   * w, x, y, z comes from the diagonal, the others from off diagonal sums
+   * divided by it, which stays accurate near half turns where the trace
+   * formula alone breaks down. Matrix4T::scale() is divided out first so
+   * TRS matrices work, mirrored ones give the rotation left after negating
+   * the x axis.
+   */
+  static Quat
+  fromMatrix4(const Matrix4T<T> & m)
+  {
+    return fromMatrix4(m, m.scale());
+  }
+  // s = m.scale(), for callers that need it as well
+  static Quat
+  fromMatrix4(const Matrix4T<T> & m, const Vector3T<T> & s)
+  {
+    const T inv_sx = 1.0f / s.x;
+    const T inv_sy = 1.0f / s.y;
+    const T inv_sz = 1.0f / s.z;
+    const T m00 = m.cells[0] * inv_sx;
+    const T m01 = m.cells[1] * inv_sy;
+    const T m02 = m.cells[2] * inv_sz;
+    const T m10 = m.cells[4] * inv_sx;
+    const T m11 = m.cells[5] * inv_sy;
+    const T m12 = m.cells[6] * inv_sz;
+    const T m20 = m.cells[8] * inv_sx;
+    const T m21 = m.cells[9] * inv_sy;
+    const T m22 = m.cells[10] * inv_sz;
+
+    const T trace = m00 + m11 + m22;
+    T       qx, qy, qz, qw;
+    if (trace >= m00 && trace >= m11 && trace >= m22) {
+      const T r = std::sqrt(1.0f + trace);
+      const T inv = 0.5f / r;
+      qx = (m21 - m12) * inv;
+      qy = (m02 - m20) * inv;
+      qz = (m10 - m01) * inv;
+      qw = 0.5f * r;
+    } else if (m00 >= m11 && m00 >= m22) {
+      const T r = std::sqrt(1.0f + m00 - m11 - m22);
+      const T inv = 0.5f / r;
+      qx = 0.5f * r;
+      qy = (m01 + m10) * inv;
+      qz = (m02 + m20) * inv;
+      qw = (m21 - m12) * inv;
+    } else if (m11 >= m22) {
+      const T r = std::sqrt(1.0f - m00 + m11 - m22);
+      const T inv = 0.5f / r;
+      qx = (m01 + m10) * inv;
+      qy = 0.5f * r;
+      qz = (m12 + m21) * inv;
+      qw = (m02 - m20) * inv;
+    } else {
+      const T r = std::sqrt(1.0f - m00 - m11 + m22);
+      const T inv = 0.5f / r;
+      qx = (m02 + m20) * inv;
+      qy = (m12 + m21) * inv;
+      qz = 0.5f * r;
+      qw = (m10 - m01) * inv;
+    }
+    const T inv_len = invSqrt(qx * qx + qy * qy + qz * qz + qw * qw);
+    return Quat(qx * inv_len, qy * inv_len, qz * inv_len, qw * inv_len);
+  }
+
   // Quat multiplications, also implemented as operator overrides below
   Quat
   Mul(Quat & a, Quat & b)
@@ -185,29 +288,29 @@ class Quat {
   }
 
   // General static inits
-  static Quat
+  static constexpr Quat
   unitX()
   {
     return Quat<T>(1, 0, 0, 0);
   }
-  static Quat
+  static constexpr Quat
   unitY()
   {
     return Quat<T>(0, 1, 0, 0);
   }
-  static Quat
+  static constexpr Quat
   unitZ()
   {
     return Quat<T>(0, 0, 1, 0);
   }
-  static Quat
+  static constexpr Quat
   unitW()
   {
     return Quat<T>(0, 0, 0, 1);
   }
 
   // Some general setters
-  void
+  constexpr void
   set(T xin, T yin, T zin, T win)
   {
     x = xin;
@@ -217,7 +320,7 @@ class Quat {
   }
 
   template<int SWITCH>
-  void
+  constexpr void
   setUnit()
   {
     x = 0.0f;
@@ -237,48 +340,48 @@ class Quat {
   }
 
   // Basic operation overrides
-  Quat
+  constexpr Quat
   operator+(T b) const
   {
     return Quat(x + b, y + b, z + b, w + b);
   }
 
-  Quat
+  constexpr Quat
   operator-(T b) const
   {
     return Quat(x - b, y - b, z - b, w - b);
   }
 
-  Quat
+  constexpr Quat
   operator*(T b) const
   {
     return Quat(x * b, y * b, z * b, w * b);
   }
 
-  Quat
+  constexpr Quat
   operator/(T b) const
   {
     return Quat(x / b, y / b, z / b, w / b);
   }
 
-  Quat
+  constexpr Quat
   operator+(const Quat & b) const
   {
     return Quat((x + b.x), (y + b.y), (z + b.z), (w + b.w));
   }
 
-  Quat
+  constexpr Quat
   operator-(const Quat & b) const
   {
     return Quat((x - b.x), (y - b.y), (z - b.z), (w - b.w));
   }
 
   // Multiplied = SaSb - vecA(dot)vecB; Sa*vecB  +  Sb*vecA  +  vecA x vecB;
-  Quat
+  constexpr Quat
   operator*(const Quat & b) const
   {
-    auto a_as_vec3 = vectorizeSelf3d();
-    auto b_as_vec3 = b.vectorizeSelf3d();
+    const Vector3T<T> a_as_vec3(x, y, z);
+    const Vector3T<T> b_as_vec3(b.x, b.y, b.z);
     auto mul3comp =
         ((b_as_vec3 * w) + (a_as_vec3 * b.w) + a_as_vec3.cross(b_as_vec3));
     return Quat{mul3comp.x,
@@ -287,7 +390,7 @@ class Quat {
                 (w * b.w) - a_as_vec3.dotp(b_as_vec3)};
   }
 
-  void
+  constexpr void
   operator+=(T b)
   {
     x += b;
@@ -296,7 +399,7 @@ class Quat {
     w += b;
   }
 
-  void
+  constexpr void
   operator-=(T b)
   {
     x -= b;
@@ -305,7 +408,7 @@ class Quat {
     w -= b;
   }
 
-  void
+  constexpr void
   operator*=(T b)
   {
     x *= b;
@@ -314,7 +417,7 @@ class Quat {
     w *= b;
   }
 
-  void
+  constexpr void
   operator/=(T b)
   {
     x /= b;
@@ -323,7 +426,7 @@ class Quat {
     w /= b;
   }
 
-  void
+  constexpr void
   operator+=(const Quat & b)
   {
     x += b.x;
@@ -332,7 +435,7 @@ class Quat {
     w += b.w;
   }
 
-  void
+  constexpr void
   operator-=(const Quat & b)
   {
     x -= b.x;
@@ -342,20 +445,13 @@ class Quat {
   }
 
   // Multiplied = SaSb - vecA(dot)vecB; Sa*vecB  +  Sb*vecA  +  vecA x vecB;
-  void
+  constexpr void
   operator*=(const Quat & b)
   {
-    auto a_as_vec3 = vectorizeSelf3d();
-    auto b_as_vec3 = b.vectorizeSelf3d();
-    auto mul3comp =
-        ((b_as_vec3 * w) + (a_as_vec3 * b.w) + a_as_vec3.cross(b_as_vec3));
-    *this = Quat{mul3comp.x,
-                 mul3comp.y,
-                 mul3comp.z,
-                 (w * b.w) - a_as_vec3.dotp(b_as_vec3)};
+    *this = operator*(b);
   }
 
-  Quat
+  constexpr Quat
   operator-() const
   {
     return Quat(-x, -y, -z, -w);
@@ -364,4 +460,26 @@ class Quat {
   T w, x, y, z;
 };
 
+// T * R * S in one pass, the argument order of decomposeTRS
+template<typename T>
+constexpr Matrix4T<T>
+composeTRS(const Vector3T<T> & t, const Quat<T> & r, const Vector3T<T> & s)
+{
+  return r.toMatrix4(t, s);
+}
+
+/**
+ * Splits m = T * R * S back into t, unit r and s. Mirrored matrices come
+ * back with s.x < 0, shear has no TRS form and is lost.
+ */
+template<typename T>
+inline void
+decomposeTRS(const Matrix4T<T> & m, Vector3T<T> & t, Quat<T> & r,
+             Vector3T<T> & s)
+{
+  t = m.translation();
+  s = m.scale();
+  r = Quat<T>::fromMatrix4(m, s);
+}
+
 #endif // QUATERNION_HH
@@ -0,0 +1,538 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Structure-of-arrays Quat<float> streams and the interpolation kernels used
+ * for animation blending. Storage and padding follow VectorSoA.hh, every
+ * kernel is a single pass over its streams so blending whole skeletons stays
+ * bound by memory rather than arithmetic. Inputs are assumed unit length.
+ * The Matrix4 conversions at the end mirror Quat::toMatrix4/fromMatrix4.
+ */
+#ifndef QUAT_BATCH_HH
+#define QUAT_BATCH_HH
+#include "Quat.hh"
+#include "Simd.hh"
+#include "VectorSoA.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+class QuatSoA {
+  public:
+  QuatSoA() = default;
+  explicit QuatSoA(std::size_t n) : data(n)
+  {
+  }
+  explicit QuatSoA(const Quat<float> * in, std::size_t n) : data(n)
+  {
+    for (std::size_t i = 0; i < n; ++i) {
+      set(i, in[i]);
+    }
+  }
+
+  // Components
+  [[nodiscard]] float *
+  x()
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] float *
+  y()
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] float *
+  z()
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] float *
+  w()
+  {
+    return data.comp[3];
+  }
+  [[nodiscard]] const float *
+  x() const
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] const float *
+  y() const
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] const float *
+  z() const
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] const float *
+  w() const
+  {
+    return data.comp[3];
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return data.count;
+  }
+  [[nodiscard]] std::size_t
+  paddedSize() const
+  {
+    return data.stride;
+  }
+  void
+  resize(std::size_t n)
+  {
+    data.resize(n);
+  }
+
+  // Element access
+  [[nodiscard]] Quat<float>
+  get(std::size_t i) const
+  {
+    return Quat<float>(x()[i], y()[i], z()[i], w()[i]);
+  }
+  void
+  set(std::size_t i, const Quat<float> & q)
+  {
+    x()[i] = q.x;
+    y()[i] = q.y;
+    z()[i] = q.z;
+    w()[i] = q.w;
+  }
+  void
+  toAoS(Quat<float> * out) const
+  {
+    for (std::size_t i = 0; i < size(); ++i) {
+      out[i] = get(i);
+    }
+  }
+
+  SoAStorage<4> data;
+};
+
+// One register of quaternions
+class QuatLanes {
+  public:
+  FloatV x, y, z, w;
+
+  static QuatLanes
+  load(const QuatSoA & q, std::size_t i)
+  {
+    return QuatLanes{FloatV::load(q.x() + i), FloatV::load(q.y() + i),
+                     FloatV::load(q.z() + i), FloatV::load(q.w() + i)};
+  }
+  void
+  store(QuatSoA & q, std::size_t i) const
+  {
+    x.store(q.x() + i);
+    y.store(q.y() + i);
+    z.store(q.z() + i);
+    w.store(q.w() + i);
+  }
+
+  [[nodiscard]] FloatV
+  dotp(const QuatLanes & b) const
+  {
+    return FloatV::mulAdd(
+        x, b.x, FloatV::mulAdd(y, b.y, FloatV::mulAdd(z, b.z, w * b.w)));
+  }
+
+  // a * wa + b * wb
+  static QuatLanes
+  combine(const QuatLanes & a, FloatV wa, const QuatLanes & b, FloatV wb)
+  {
+    return QuatLanes{FloatV::mulAdd(a.x, wa, b.x * wb),
+                     FloatV::mulAdd(a.y, wa, b.y * wb),
+                     FloatV::mulAdd(a.z, wa, b.z * wb),
+                     FloatV::mulAdd(a.w, wa, b.w * wb)};
+  }
+
+  void
+  normalize()
+  {
+    const FloatV inv = invSqrt(dotp(*this));
+    x *= inv;
+    y *= inv;
+    z *= inv;
+    w *= inv;
+  }
+};
+
+/**
+ * sin(a) for a in [0, pi/2], Taylor series to a^11. |error| <= 6e-8 before
+ * float rounding, the interval slerp needs after the hemisphere flip.
+ */
+inline FloatV
+sinLanesHalfPi(FloatV a)
+{
+  const FloatV a2 = a * a;
+  FloatV       p = FloatV::set1(-2.5052108e-8f);
+  p = FloatV::mulAdd(p, a2, FloatV::set1(2.7557319e-6f));
+  p = FloatV::mulAdd(p, a2, FloatV::set1(-1.9841270e-4f));
+  p = FloatV::mulAdd(p, a2, FloatV::set1(8.3333333e-3f));
+  p = FloatV::mulAdd(p, a2, FloatV::set1(-1.6666667e-1f));
+  return FloatV::mulAdd(p * a2, a, a);
+}
+
+/**
+ * Normalized lerp from a to b. b is negated where a.b < 0, so the blend
+ * always takes the short arc. out may alias a or b.
+ */
+inline void
+nlerp(const QuatSoA & a, const QuatSoA & b, float t, QuatSoA & out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  const FloatV zero = FloatV::zero();
+  const FloatV ta = FloatV::set1(1.0f - t);
+  const FloatV tb = FloatV::set1(t);
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const QuatLanes qa = QuatLanes::load(a, i);
+    const QuatLanes qb = QuatLanes::load(b, i);
+    const FloatV    wb = FloatV::select(qa.dotp(qb) < zero, -tb, tb);
+    QuatLanes       r = QuatLanes::combine(qa, ta, qb, wb);
+    r.normalize();
+    r.store(out, i);
+  });
+}
+
+/**
+ * Spherical linear interpolation from a to b, t per lane, along the short
+ * arc unless short_arc is false (squad needs the plain great arc). Lanes
+ * closer than about 0.8 degrees fall back to nlerp, where sin(theta) stops
+ * being a safe divisor. For unit inputs each component is within 2e-7 of
+ * a double precision slerp, 5.5e-7 when HB_FAST_NORMALIZE puts rsqrtFast
+ * in the final normalize. That is absolute, small components are off by
+ * far more ULP than large ones.
+ */
+inline QuatLanes
+slerpLanes(const QuatLanes & qa, const QuatLanes & qb, FloatV tb,
+           bool short_arc = true)
+{
+  const FloatV zero = FloatV::zero();
+  const FloatV one = FloatV::set1(1.0f);
+  const FloatV near = FloatV::set1(1.0f - 1e-4f);
+  const FloatV ta = one - tb;
+  const FloatV d = qa.dotp(qb);
+  const FloatV sign = short_arc ? FloatV::select(d < zero, -one, one) : one;
+  const FloatV cos_theta = d * sign;
+  const MaskV  linear = cos_theta > near;
+
+  const FloatV theta = FloatV::acos(cos_theta);
+  const FloatV sin_theta = FloatV::sqrt(one - cos_theta * cos_theta);
+  const FloatV inv_sin = one / FloatV::select(linear, one, sin_theta);
+  FloatV       a = ta * theta;
+  FloatV       b = tb * theta;
+  if (!short_arc) {
+    // Angles reach pi, fold them into [0, pi/2] with sin(pi - x) = sin(x)
+    const FloatV pi = FloatV::set1(3.14159265358979f);
+    a = FloatV::min(a, pi - a);
+    b = FloatV::min(b, pi - b);
+  }
+  const FloatV wa =
+      FloatV::select(linear, ta, sinLanesHalfPi(a) * inv_sin);
+  const FloatV wb =
+      FloatV::select(linear, tb, sinLanesHalfPi(b) * inv_sin);
+
+  // Exact lanes are unit already, renormalizing absorbs the acos error
+  QuatLanes r = QuatLanes::combine(qa, wa, qb, wb * sign);
+  r.normalize();
+  return r;
+}
+
+// slerpLanes over whole streams with one t. out may alias a or b.
+inline void
+slerp(const QuatSoA & a, const QuatSoA & b, float t, QuatSoA & out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  const FloatV tb = FloatV::set1(t);
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    slerpLanes(QuatLanes::load(a, i), QuatLanes::load(b, i), tb)
+        .store(out, i);
+  });
+}
+
+/**
+ * Approximate slerp: nlerp with t reshaped by a cubic whose strength is fit
+ * to the arc length, after Kapoulkine's "onlerp". About half the cost of
+ * slerp and no acos. Measured over random unit quaternions and t in [0, 1]
+ * the rotation differs from the exact slerp one by at most 1.3e-3 rad
+ * (0.075 degrees), against 0.14 rad for plain nlerp.
+ */
+inline void
+slerpFast(const QuatSoA & a, const QuatSoA & b, float t, QuatSoA & out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  const FloatV zero = FloatV::zero();
+  const FloatV one = FloatV::set1(1.0f);
+  const float  th = t - 0.5f;
+  const FloatV tv = FloatV::set1(t);
+  const FloatV th_sq = FloatV::set1(th * th);
+  const FloatV bend = FloatV::set1(t * th * (t - 1.0f));
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const QuatLanes qa = QuatLanes::load(a, i);
+    const QuatLanes qb = QuatLanes::load(b, i);
+    const FloatV    d = qa.dotp(qb);
+    const FloatV    ad = FloatV::abs(d);
+
+    FloatV k_a = FloatV::mulAdd(ad, FloatV::set1(-1.43519f),
+                                FloatV::set1(3.55645f));
+    k_a = FloatV::mulAdd(ad, k_a, FloatV::set1(-3.2452f));
+    k_a = FloatV::mulAdd(ad, k_a, FloatV::set1(1.0904f));
+    FloatV k_b = FloatV::mulAdd(ad, FloatV::set1(0.215638f),
+                                FloatV::set1(-1.06021f));
+    k_b = FloatV::mulAdd(ad, k_b, FloatV::set1(0.848013f));
+    const FloatV k = FloatV::mulAdd(k_a, th_sq, k_b);
+    const FloatV ot = FloatV::mulAdd(bend, k, tv);
+
+    const FloatV wb = FloatV::select(d < zero, -ot, ot);
+    QuatLanes    r = QuatLanes::combine(qa, one - ot, qb, wb);
+    r.normalize();
+    r.store(out, i);
+  });
+}
+
+/**
+ * Weighted blend of count poses of equal size, the normalized sum of
+ * weights[p] * poses[p] with every pose flipped into the hemisphere of
+ * poses[0]. Poses with weight 0 are skipped entirely. Where the weighted sum
+ * vanishes the result is the identity. out may alias any pose.
+ */
+inline void
+blend(const QuatSoA * const * poses, const float * weights, std::size_t count,
+      QuatSoA & out)
+{
+  assert(count > 0);
+  const std::size_t n = poses[0]->size();
+  out.resize(n);
+  const FloatV zero = FloatV::zero();
+  const FloatV one = FloatV::set1(1.0f);
+  const FloatV tiny = FloatV::set1(1e-12f);
+  forEachLaneBlock(n, [&](std::size_t i) {
+    const QuatLanes ref = QuatLanes::load(*poses[0], i);
+    const FloatV    w0 = FloatV::set1(weights[0]);
+    QuatLanes       acc{ref.x * w0, ref.y * w0, ref.z * w0, ref.w * w0};
+    for (std::size_t p = 1; p < count; ++p) {
+      if (weights[p] == 0.0f) {
+        continue;
+      }
+      assert(poses[p]->size() == n);
+      const QuatLanes q = QuatLanes::load(*poses[p], i);
+      const FloatV    wp = FloatV::set1(weights[p]);
+      acc = QuatLanes::combine(
+          q, FloatV::select(ref.dotp(q) < zero, -wp, wp), acc, one);
+    }
+    const FloatV len_sq = acc.dotp(acc);
+    const MaskV  degenerate = len_sq <= tiny;
+    const FloatV inv =
+        one / FloatV::sqrt(FloatV::select(degenerate, one, len_sq));
+    QuatLanes r{FloatV::select(degenerate, zero, acc.x * inv),
+                FloatV::select(degenerate, zero, acc.y * inv),
+                FloatV::select(degenerate, zero, acc.z * inv),
+                FloatV::select(degenerate, one, acc.w * inv)};
+    r.store(out, i);
+  });
+}
+
+/**
+ * out[i] = q[i].toMatrix4(t[i], s[i]), t and s may be null for no
+ * translation and unit scale. Rows are assembled in registers and written
+ * transposed, width matrices per iteration. Cells are within 4 ULP of the
+ * scalar toMatrix4, measured at the largest |s[i]| component.
+ */
+inline void
+quatToMatrix4Batch(const QuatSoA & q, Matrix4 * out,
+                   const Vector3SoA * t = nullptr,
+                   const Vector3SoA * s = nullptr)
+{
+  assert(t == nullptr || t->size() == q.size());
+  assert(s == nullptr || s->size() == q.size());
+  constexpr std::size_t w = FloatV::width;
+  const std::size_t     n = q.size();
+  const FloatV          zero = FloatV::zero();
+  const FloatV          one = FloatV::set1(1.0f);
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    // Left uninitialized, only the final partial group goes through it
+    alignas(simdAlignment) float tail[16 * w];
+    for (std::size_t i = b; i < e; i += w) {
+      const QuatLanes l = QuatLanes::load(q, i);
+      const FloatV    x2 = l.x + l.x;
+      const FloatV    y2 = l.y + l.y;
+      const FloatV    z2 = l.z + l.z;
+      const FloatV    xx = l.x * x2;
+      const FloatV    yy = l.y * y2;
+      const FloatV    zz = l.z * z2;
+      const FloatV    xy = l.x * y2;
+      const FloatV    xz = l.x * z2;
+      const FloatV    yz = l.y * z2;
+      const FloatV    wx = l.w * x2;
+      const FloatV    wy = l.w * y2;
+      const FloatV    wz = l.w * z2;
+
+      FloatV sx = one, sy = one, sz = one;
+      if (s != nullptr) {
+        sx = FloatV::load(s->x() + i);
+        sy = FloatV::load(s->y() + i);
+        sz = FloatV::load(s->z() + i);
+      }
+      FloatV tx = zero, ty = zero, tz = zero;
+      if (t != nullptr) {
+        tx = FloatV::load(t->x() + i);
+        ty = FloatV::load(t->y() + i);
+        tz = FloatV::load(t->z() + i);
+      }
+
+      float * dst = (n - i < w) ? tail : out[i].cells;
+      FloatV::storeTransposed4(dst, 16, (one - (yy + zz)) * sx, (xy - wz) * sy,
+                               (xz + wy) * sz, tx);
+      FloatV::storeTransposed4(dst + 4, 16, (xy + wz) * sx,
+                               (one - (xx + zz)) * sy, (yz - wx) * sz, ty);
+      FloatV::storeTransposed4(dst + 8, 16, (xz - wy) * sx, (yz + wx) * sy,
+                               (one - (xx + yy)) * sz, tz);
+      FloatV::storeTransposed4(dst + 12, 16, zero, zero, zero, one);
+      if (n - i < w) {
+        std::memcpy(out[i].cells, tail, (n - i) * sizeof(Matrix4));
+      }
+    }
+  });
+}
+
+// composeTRS over streams, out[i] = r[i].toMatrix4(t[i], s[i])
+inline void
+composeTRSBatch(const Vector3SoA & t, const QuatSoA & r, const Vector3SoA & s,
+                Matrix4 * out)
+{
+  quatToMatrix4Batch(r, out, &t, &s);
+}
+
+/**
+ * decomposeTRS(in[i], t[i], r[i], s[i]) without the branches: all four
+ * Shepperd cases are formed per lane and the one for the largest of
+ * trace, m00, m11, m22 is selected. t and s may be null when only the
+ * rotation is wanted, the others are resized to n. Against decomposeTRS, t
+ * is exact, s within 4 ULP and each component of r within 4e-7, up to the
+ * sign of r.
+ */
+inline void
+decomposeTRSBatch(const Matrix4 * in, std::size_t n, Vector3SoA * t,
+                  QuatSoA & out, Vector3SoA * s)
+{
+  constexpr std::size_t w = FloatV::width;
+  out.resize(n);
+  if (t != nullptr) {
+    t->resize(n);
+  }
+  if (s != nullptr) {
+    s->resize(n);
+  }
+  const FloatV zero = FloatV::zero();
+  const FloatV one = FloatV::set1(1.0f);
+  const FloatV half = FloatV::set1(0.5f);
+  parallelBatch(n, [&](std::size_t b, std::size_t e) {
+    // Left uninitialized, only the final partial group goes through it
+    alignas(simdAlignment) float tail[16 * w];
+    for (std::size_t i = b; i < e; i += w) {
+      const float * src = in[i].cells;
+      if (n - i < w) {
+        // Identity padding keeps the unused lanes finite
+        std::memcpy(tail, src, (n - i) * sizeof(Matrix4));
+        for (std::size_t k = n - i; k < w; ++k) {
+          float * m = tail + 16 * k;
+          std::fill(m, m + 16, 0.0f);
+          m[0] = m[5] = m[10] = m[15] = 1.0f;
+        }
+        src = tail;
+      }
+      FloatV m[3][4];
+      for (int r = 0; r < 3; ++r) {
+        FloatV::loadTransposed4(src + 4 * r, 16, m[r][0], m[r][1], m[r][2],
+                                m[r][3]);
+      }
+      if (t != nullptr) {
+        m[0][3].store(t->x() + i);
+        m[1][3].store(t->y() + i);
+        m[2][3].store(t->z() + i);
+      }
+
+      // Matrix4::scale(), x is negative where the 3x3 mirrors
+      const FloatV det = FloatV::mulAdd(
+          m[0][0], m[1][1] * m[2][2] - m[2][1] * m[1][2],
+          FloatV::mulAdd(m[1][0], m[2][1] * m[0][2] - m[0][1] * m[2][2],
+                         m[2][0] * (m[0][1] * m[1][2] - m[1][1] * m[0][2])));
+      FloatV scale[3];
+      for (int c = 0; c < 3; ++c) {
+        scale[c] = FloatV::sqrt(FloatV::mulAdd(
+            m[0][c], m[0][c],
+            FloatV::mulAdd(m[1][c], m[1][c], m[2][c] * m[2][c])));
+      }
+      scale[0] = FloatV::select(det < zero, -scale[0], scale[0]);
+      if (s != nullptr) {
+        scale[0].store(s->x() + i);
+        scale[1].store(s->y() + i);
+        scale[2].store(s->z() + i);
+      }
+      for (int c = 0; c < 3; ++c) {
+        const FloatV inv = one / scale[c];
+        for (auto & row : m) {
+          row[c] *= inv;
+        }
+      }
+
+      const FloatV d0 = m[0][0];
+      const FloatV d1 = m[1][1];
+      const FloatV d2 = m[2][2];
+      const FloatV trace = d0 + d1 + d2;
+      const MaskV  case_w = (trace >= d0) & (trace >= d1) & (trace >= d2);
+      const MaskV  case_x = (!case_w) & (d0 >= d1) & (d0 >= d2);
+      const MaskV  case_y = (!case_w) & (!case_x) & (d1 >= d2);
+      const MaskV  case_z = !(case_w | case_x | case_y);
+
+      // 1 +- d0 +- d1 +- d2 with the signs of the selected case
+      const FloatV s0 = FloatV::select(case_w | case_x, d0, -d0);
+      const FloatV s1 = FloatV::select(case_w | case_y, d1, -d1);
+      const FloatV s2 = FloatV::select(case_w | case_z, d2, -d2);
+      const FloatV r = FloatV::sqrt(one + s0 + s1 + s2);
+      const FloatV big = half * r;
+      const FloatV inv = half / r;
+
+      const FloatV dx = (m[2][1] - m[1][2]) * inv;
+      const FloatV dy = (m[0][2] - m[2][0]) * inv;
+      const FloatV dz = (m[1][0] - m[0][1]) * inv;
+      const FloatV sxy = (m[0][1] + m[1][0]) * inv;
+      const FloatV sxz = (m[0][2] + m[2][0]) * inv;
+      const FloatV syz = (m[1][2] + m[2][1]) * inv;
+
+      QuatLanes q{
+          FloatV::select(case_w, dx,
+                         FloatV::select(case_x, big,
+                                        FloatV::select(case_y, sxy, sxz))),
+          FloatV::select(case_w, dy,
+                         FloatV::select(case_x, sxy,
+                                        FloatV::select(case_y, big, syz))),
+          FloatV::select(case_w, dz,
+                         FloatV::select(case_x, sxz,
+                                        FloatV::select(case_y, syz, big))),
+          FloatV::select(case_w, big,
+                         FloatV::select(case_x, dx,
+                                        FloatV::select(case_y, dy, dz)))};
+      q.normalize();
+      q.store(out, i);
+    }
+  });
+}
+
+// out[i] = Quat<float>::fromMatrix4(in[i])
+inline void
+matrix4ToQuatBatch(const Matrix4 * in, std::size_t n, QuatSoA & out)
+{
+  decomposeTRSBatch(in, n, nullptr, out, nullptr);
+}
+
+#endif // QUAT_BATCH_HH
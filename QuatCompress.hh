@@ -0,0 +1,259 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Smallest three quaternion compression. The component with the largest
+ * magnitude is dropped and rebuilt from the unit length constraint, the sign
+ * is folded in by negating q when that component is negative (q and -q are
+ * the same rotation). The other three lie in [-1/sqrt(2), 1/sqrt(2)] and are
+ * quantized to Bits each, plus 2 bits for the dropped index.
+ *
+ * Bit layout, lowest first: first kept component, second, third, index.
+ * Records are little endian, bytes = ceil((3 * Bits + 2) / 8) long.
+ */
+#ifndef QUAT_COMPRESS_HH
+#define QUAT_COMPRESS_HH
+#include "Quat.hh"
+#include "QuatBatch.hh"
+#include "Simd.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+template<int Bits>
+class SmallestThree {
+  public:
+  static_assert(Bits >= 4 && Bits <= 20, "3 * Bits + 2 must fit 64 bits");
+
+  static constexpr int         totalBits = 3 * Bits + 2;
+  static constexpr std::size_t bytes = (totalBits + 7) / 8;
+  using Word =
+      std::conditional_t<totalBits <= 32, std::uint32_t, std::uint64_t>;
+
+  static constexpr std::uint32_t steps = (1u << Bits) - 1u;
+  static constexpr float         range = 0.70710678118654752f; // 1 / sqrt(2)
+
+  // Largest error of one kept component, half a quantization step
+  static constexpr float maxComponentError = range / static_cast<float>(steps);
+
+  /**
+   * Largest rotation angle in radians between a unit q and
+   * decode(encode(q)). Kept errors e_i move the rebuilt component c by
+   * sum(c_i * e_i) / c to first order, at most 3 e with all four at 0.5,
+   * so |q - q'| <= sqrt(3 + 9) e and the angle is 2 |q - q'|. Exact worst
+   * cases stay just under the first order term, the rest covers float
+   * rounding: 9 bits 0.55 deg, 10 bits 0.27 deg, 15 bits 0.0086 deg.
+   */
+  static constexpr float maxAngleError =
+      6.92820323f * maxComponentError + 1e-6f; // 4 sqrt(3)
+
+  // Scalar reference, q must be unit length
+  static Word
+  encode(const Quat<float> & q)
+  {
+    const float c[4] = {q.x, q.y, q.z, q.w};
+    int         largest = 0;
+    for (int i = 1; i < 4; ++i) {
+      if (std::fabs(c[i]) > std::fabs(c[largest])) {
+        largest = i;
+      }
+    }
+    const float sign = (c[largest] < 0.0f) ? -1.0f : 1.0f;
+    Word        word = static_cast<Word>(largest) << (3 * Bits);
+    int         shift = 0;
+    for (int i = 0; i < 4; ++i) {
+      if (i != largest) {
+        word |= static_cast<Word>(quantize(c[i] * sign)) << shift;
+        shift += Bits;
+      }
+    }
+    return word;
+  }
+
+  // Unit length, up to the quantization error
+  static Quat<float>
+  decode(Word word)
+  {
+    const int largest = static_cast<int>(word >> (3 * Bits)) & 3;
+    float     c[4];
+    float     sum_sq = 0.0f;
+    int       shift = 0;
+    for (int i = 0; i < 4; ++i) {
+      if (i != largest) {
+        c[i] = dequantize(static_cast<std::uint32_t>(word >> shift) & steps);
+        sum_sq += c[i] * c[i];
+        shift += Bits;
+      }
+    }
+    c[largest] = std::sqrt(std::fmax(1.0f - sum_sq, 0.0f));
+    return Quat<float>(c[0], c[1], c[2], c[3]);
+  }
+
+  // Records as bytes, the low bytes of the Word
+  static void
+  write(Word word, std::uint8_t * out)
+  {
+    for (std::size_t b = 0; b < bytes; ++b) {
+      out[b] = static_cast<std::uint8_t>(word >> (8 * b));
+    }
+  }
+  [[nodiscard]] static Word
+  read(const std::uint8_t * in)
+  {
+    Word word = 0;
+    for (std::size_t b = 0; b < bytes; ++b) {
+      word |= static_cast<Word>(in[b]) << (8 * b);
+    }
+    return word;
+  }
+
+  // [-range, range] to [0, steps], nearest even like the 2^23 add in the
+  // batch code
+  static std::uint32_t
+  quantize(float v)
+  {
+    const float scaled =
+        (v * (0.5f / range) + 0.5f) * static_cast<float>(steps);
+    return static_cast<std::uint32_t>(std::nearbyint(
+        std::fmin(std::fmax(scaled, 0.0f), static_cast<float>(steps))));
+  }
+  static float
+  dequantize(std::uint32_t q)
+  {
+    return static_cast<float>(q) * (2.0f * range / static_cast<float>(steps)) -
+           range;
+  }
+};
+
+// 4, 4 and 6 byte records, 4x, 4x and 2.7x smaller than Quat<float>
+using QuatPacked29 = SmallestThree<9>;
+using QuatPacked32 = SmallestThree<10>;
+using QuatPacked48 = SmallestThree<15>;
+
+/**
+ * Encodes q.size() unit quaternions into out, Codec::bytes per record. The
+ * selection, sign folding and quantization run on FloatV registers, only
+ * the final shifts into the record are per element, with no branches.
+ */
+template<typename Codec>
+inline void
+encodeBatch(const QuatSoA & q, std::uint8_t * out)
+{
+  using Word = typename Codec::Word;
+  constexpr std::size_t w = FloatV::width;
+  constexpr int         bits = (Codec::totalBits - 2) / 3;
+  const FloatV          zero = FloatV::zero();
+  const FloatV          one = FloatV::set1(1.0f);
+  const FloatV          scale = FloatV::set1(0.5f / Codec::range);
+  const FloatV          half = FloatV::set1(0.5f);
+  const FloatV          steps = FloatV::set1(static_cast<float>(Codec::steps));
+  const FloatV          shifter = FloatV::set1(8388608.0f);
+
+  alignas(simdAlignment) float lanes[4][w];
+  const std::size_t n = q.size();
+  for (std::size_t i = 0; i < n; i += w) {
+    const QuatLanes l = QuatLanes::load(q, i);
+    const FloatV    ax = FloatV::abs(l.x);
+    const FloatV    ay = FloatV::abs(l.y);
+    const FloatV    az = FloatV::abs(l.z);
+    const FloatV    aw = FloatV::abs(l.w);
+
+    // Lowest index wins ties, like the scalar loop
+    const MaskV is_x = (ax >= ay) & (ax >= az) & (ax >= aw);
+    const MaskV is_y = !is_x & (ay >= az) & (ay >= aw);
+    const MaskV is_w = !is_x & !is_y & (aw > az);
+    const MaskV is_z = !is_x & !is_y & !is_w;
+
+    const FloatV largest = FloatV::select(
+        is_x, l.x,
+        FloatV::select(is_y, l.y, FloatV::select(is_z, l.z, l.w)));
+    const FloatV sign = FloatV::select(largest < zero, -one, one);
+    const FloatV index = FloatV::select(
+        is_x, zero,
+        FloatV::select(is_y, one,
+                       FloatV::select(is_z, FloatV::set1(2.0f),
+                                      FloatV::set1(3.0f))));
+
+    // Kept components in index order
+    const FloatV kept[3] = {
+        FloatV::select(is_x, l.y, l.x),
+        FloatV::select(is_x | is_y, l.z, l.y),
+        FloatV::select(is_w, l.z, l.w),
+    };
+    for (int k = 0; k < 3; ++k) {
+      const FloatV scaled = (kept[k] * sign * scale + half) * steps;
+      const FloatV clamped = FloatV::min(FloatV::max(scaled, zero), steps);
+      // Adding 2^23 pushes the fraction out, rounding to nearest even
+      ((clamped + shifter) - shifter).store(lanes[k]);
+    }
+    index.store(lanes[3]);
+
+    const std::size_t count = std::min(w, n - i);
+    for (std::size_t k = 0; k < count; ++k) {
+      const Word word =
+          static_cast<Word>(lanes[0][k]) |
+          (static_cast<Word>(lanes[1][k]) << bits) |
+          (static_cast<Word>(lanes[2][k]) << (2 * bits)) |
+          (static_cast<Word>(lanes[3][k]) << (3 * bits));
+      Codec::write(word, out + (i + k) * Codec::bytes);
+    }
+  }
+}
+
+/**
+ * Decodes n records written by encodeBatch or Codec::write into out, which
+ * is resized to n. The inverse split of encodeBatch: fields are unpacked
+ * per element, dequantization, the rebuilt component and the scatter back
+ * into x, y, z, w run on FloatV registers.
+ */
+template<typename Codec>
+inline void
+decodeBatch(const std::uint8_t * in, std::size_t n, QuatSoA & out)
+{
+  using Word = typename Codec::Word;
+  constexpr std::size_t w = FloatV::width;
+  constexpr int         bits = (Codec::totalBits - 2) / 3;
+  const FloatV          zero = FloatV::zero();
+  const FloatV          one = FloatV::set1(1.0f);
+  const FloatV          step = FloatV::set1(2.0f * Codec::range /
+                                            static_cast<float>(Codec::steps));
+  const FloatV          range = FloatV::set1(Codec::range);
+
+  out.resize(n);
+  alignas(simdAlignment) float lanes[4][w];
+  for (std::size_t i = 0; i < n; i += w) {
+    const std::size_t count = std::min(w, n - i);
+    for (std::size_t k = 0; k < w; ++k) {
+      const Word word = (k < count) ? Codec::read(in + (i + k) * Codec::bytes)
+                                    : Word(0);
+      lanes[0][k] = static_cast<float>(word & Codec::steps);
+      lanes[1][k] = static_cast<float>((word >> bits) & Codec::steps);
+      lanes[2][k] = static_cast<float>((word >> (2 * bits)) & Codec::steps);
+      lanes[3][k] = static_cast<float>((word >> (3 * bits)) & 3u);
+    }
+
+    const FloatV v0 = FloatV::mulAdd(FloatV::load(lanes[0]), step, -range);
+    const FloatV v1 = FloatV::mulAdd(FloatV::load(lanes[1]), step, -range);
+    const FloatV v2 = FloatV::mulAdd(FloatV::load(lanes[2]), step, -range);
+    const FloatV index = FloatV::load(lanes[3]);
+    const FloatV sum_sq =
+        FloatV::mulAdd(v0, v0, FloatV::mulAdd(v1, v1, v2 * v2));
+    const FloatV big = FloatV::sqrt(FloatV::max(one - sum_sq, zero));
+
+    const MaskV is_x = index < FloatV::set1(0.5f);
+    const MaskV is_y = !is_x & (index < FloatV::set1(1.5f));
+    const MaskV is_w = index > FloatV::set1(2.5f);
+    const MaskV is_z = !is_x & !is_y & !is_w;
+    QuatLanes   l;
+    l.x = FloatV::select(is_x, big, v0);
+    l.y = FloatV::select(is_y, big, FloatV::select(is_x, v0, v1));
+    l.z = FloatV::select(is_z, big, FloatV::select(is_w, v2, v1));
+    l.w = FloatV::select(is_w, big, v2);
+    l.store(out, i);
+  }
+}
+
+#endif // QUAT_COMPRESS_HH
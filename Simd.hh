@@ -0,0 +1,1035 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Instruction set detection and per-function target attributes, so the math
+ * headers can carry SSE4.1/AVX2/AVX-512 kernels side by side and pick one at
+ * runtime without the whole engine being built with -mavx2 and friends.
+ * Also home of the FloatV lane wrappers the batch kernels are written in.
+ */
+#ifndef SIMD_HH
+#define SIMD_HH
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+#define HB_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#else
+#define HB_SIMD_X86 0
+#endif
+
+// Lets a single function be compiled for a wider ISA than the TU. MSVC
+// exposes every intrinsic regardless of /arch, so it needs no attribute.
+#if defined(__GNUC__) || defined(__clang__)
+#define HB_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HB_TARGET(isa)
+#endif
+
+#define HB_TARGET_SSE41 HB_TARGET("sse4.1")
+#define HB_TARGET_AVX2 HB_TARGET("avx2,fma")
+#define HB_TARGET_AVX512 HB_TARGET("avx512f,avx2,fma")
+
+// Ordered from narrowest to widest, so they can be compared.
+enum class SimdIsa { Scalar = 0, Sse41, Avx2, Avx512 };
+
+[[nodiscard]] inline const char *
+simdIsaName(SimdIsa isa)
+{
+  switch (isa) {
+    case SimdIsa::Sse41: return "sse4.1";
+    case SimdIsa::Avx2: return "avx2+fma";
+    case SimdIsa::Avx512: return "avx512f";
+    default: return "scalar";
+  }
+}
+
+class CpuFeatures {
+  public:
+  bool sse41 = false;
+  bool avx2 = false;
+  bool fma = false;
+  bool avx512f = false;
+  bool f16c = false; // Half <-> float conversions, see Half.hh
+
+  // Detected once, on first use
+  static const CpuFeatures &
+  get()
+  {
+    static const CpuFeatures features = detect();
+    return features;
+  }
+
+  [[nodiscard]] SimdIsa
+  bestIsa() const
+  {
+    if (avx512f && avx2 && fma) {
+      return SimdIsa::Avx512;
+    }
+    if (avx2 && fma) {
+      return SimdIsa::Avx2;
+    }
+    if (sse41) {
+      return SimdIsa::Sse41;
+    }
+    return SimdIsa::Scalar;
+  }
+
+  [[nodiscard]] bool
+  supports(SimdIsa isa) const
+  {
+    return isa <= bestIsa();
+  }
+
+  private:
+  static CpuFeatures
+  detect()
+  {
+    CpuFeatures out;
+#if HB_SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+    // libgcc/compiler-rt also check that the OS saves the wide registers
+    __builtin_cpu_init();
+    out.sse41 = __builtin_cpu_supports("sse4.1");
+    out.avx2 = __builtin_cpu_supports("avx2");
+    out.fma = __builtin_cpu_supports("fma");
+    out.avx512f = __builtin_cpu_supports("avx512f");
+    out.f16c = __builtin_cpu_supports("f16c");
+#elif HB_SIMD_X86 && defined(_MSC_VER)
+    int regs[4] = {0};
+    __cpuid(regs, 0);
+    const int max_leaf = regs[0];
+    __cpuid(regs, 1);
+    const bool osxsave = (regs[2] & (1 << 27)) != 0;
+    out.sse41 = (regs[2] & (1 << 19)) != 0;
+    out.fma = (regs[2] & (1 << 12)) != 0;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool os_ymm = (xcr0 & 0x6) == 0x6;
+    const bool os_zmm = (xcr0 & 0xE6) == 0xE6;
+    out.fma = out.fma && os_ymm;
+    out.f16c = os_ymm && (regs[2] & (1 << 29)) != 0;
+    if (max_leaf >= 7) {
+      __cpuidex(regs, 7, 0);
+      out.avx2 = os_ymm && (regs[1] & (1 << 5)) != 0;
+      out.avx512f = os_zmm && (regs[1] & (1 << 16)) != 0;
+    }
+#endif
+    return out;
+  }
+};
+
+/**
+ * Lane wrappers for the batch kernels. Unlike the Matrix4 kernel tables the
+ * batch code is written once against FloatV, so its width follows the flags
+ * of the translation unit: 16 lanes with -mavx512f, 8 with -mavx/-mavx2, 4 on
+ * any other x86 and 1 elsewhere. Define HB_SIMD_WIDTH up front to force a
+ * narrower width.
+ */
+#ifndef HB_SIMD_WIDTH
+#if HB_SIMD_X86 && defined(__AVX512F__)
+#define HB_SIMD_WIDTH 16
+#elif HB_SIMD_X86 && defined(__AVX__)
+#define HB_SIMD_WIDTH 8
+#elif HB_SIMD_X86 && (defined(__SSE2__) || defined(_M_X64) ||                 \
+                      (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HB_SIMD_WIDTH 4
+#else
+#define HB_SIMD_WIDTH 1
+#endif
+#endif
+
+#if HB_SIMD_WIDTH == 16
+using HbNativeF = __m512;
+using HbNativeM = __mmask16;
+#elif HB_SIMD_WIDTH == 8
+using HbNativeF = __m256;
+using HbNativeM = __m256;
+#elif HB_SIMD_WIDTH == 4
+using HbNativeF = __m128;
+using HbNativeM = __m128;
+#else
+using HbNativeF = float;
+using HbNativeM = bool;
+#endif
+
+/**
+ * HB_FAST_NORMALIZE 1 makes invSqrt(), and with it every float normalize,
+ * normalized and clipMag (objects, Quat, SoA and QuatLanes), use rsqrtFast
+ * instead of 1 / sqrt. Off by default, and then the Vector objects divide
+ * by the length as they always have.
+ */
+#ifndef HB_FAST_NORMALIZE
+#define HB_FAST_NORMALIZE 0
+#endif
+
+#if HB_SIMD_X86 && (defined(__SSE__) || defined(_M_X64) ||                    \
+                    (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define HB_HAS_RSQRT 1
+#else
+#define HB_HAS_RSQRT 0
+#endif
+
+/**
+ * 1 / sqrt(a) from the 12 bit rsqrtss estimate and one Newton-Raphson step,
+ * relative error <= 3.5e-7 (about 3 ULP) for normal a. 0 and denormals give
+ * NaN or inf, use the Safe normalizations when lengths can be 0. Exact
+ * 1 / sqrt where there is no estimate instruction.
+ */
+inline float
+rsqrtFast(float a)
+{
+#if HB_HAS_RSQRT
+  const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(a)));
+  return y * (1.5f - (0.5f * a * y) * y);
+#else
+  return 1.0f / std::sqrt(a);
+#endif
+}
+
+// Per lane comparison result
+class MaskV {
+  public:
+  HbNativeM m;
+
+  MaskV
+  operator&(MaskV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return MaskV{static_cast<__mmask16>(m & b.m)};
+#elif HB_SIMD_WIDTH == 8
+    return MaskV{_mm256_and_ps(m, b.m)};
+#elif HB_SIMD_WIDTH == 4
+    return MaskV{_mm_and_ps(m, b.m)};
+#else
+    return MaskV{m && b.m};
+#endif
+  }
+  MaskV
+  operator|(MaskV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return MaskV{static_cast<__mmask16>(m | b.m)};
+#elif HB_SIMD_WIDTH == 8
+    return MaskV{_mm256_or_ps(m, b.m)};
+#elif HB_SIMD_WIDTH == 4
+    return MaskV{_mm_or_ps(m, b.m)};
+#else
+    return MaskV{m || b.m};
+#endif
+  }
+  MaskV
+  operator!() const
+  {
+#if HB_SIMD_WIDTH == 16
+    return MaskV{static_cast<__mmask16>(~m)};
+#elif HB_SIMD_WIDTH == 8
+    return MaskV{_mm256_xor_ps(m, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))};
+#elif HB_SIMD_WIDTH == 4
+    return MaskV{_mm_xor_ps(m, _mm_castsi128_ps(_mm_set1_epi32(-1)))};
+#else
+    return MaskV{!m};
+#endif
+  }
+
+  // One bit per lane, lane 0 in bit 0
+  [[nodiscard]] unsigned
+  bits() const
+  {
+#if HB_SIMD_WIDTH == 16
+    return m;
+#elif HB_SIMD_WIDTH == 8
+    return static_cast<unsigned>(_mm256_movemask_ps(m));
+#elif HB_SIMD_WIDTH == 4
+    return static_cast<unsigned>(_mm_movemask_ps(m));
+#else
+    return m ? 1u : 0u;
+#endif
+  }
+  [[nodiscard]] bool
+  any() const
+  {
+    return bits() != 0;
+  }
+  [[nodiscard]] bool
+  all() const
+  {
+    return bits() == (1u << HB_SIMD_WIDTH) - 1u;
+  }
+};
+
+// GCC 12 expands several AVX-512 intrinsics (sqrt, min, max, unpack,
+// extract) with an undefined merge register and then warns that it is
+// uninitialized wherever they inline (GCC bug 105593)
+#if HB_SIMD_WIDTH == 16 && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// HB_SIMD_WIDTH floats
+class FloatV {
+  public:
+  static constexpr int width = HB_SIMD_WIDTH;
+
+  HbNativeF v;
+
+  // Loads and stores, the aligned flavours need alignof(FloatV)
+  static FloatV
+  set1(float b)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_set1_ps(b)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_set1_ps(b)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_set1_ps(b)};
+#else
+    return FloatV{b};
+#endif
+  }
+  static FloatV
+  zero()
+  {
+    return set1(0.0f);
+  }
+  static FloatV
+  load(const float * p)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_load_ps(p)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_load_ps(p)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_load_ps(p)};
+#else
+    return FloatV{*p};
+#endif
+  }
+  static FloatV
+  loadu(const float * p)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_loadu_ps(p)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_loadu_ps(p)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_loadu_ps(p)};
+#else
+    return FloatV{*p};
+#endif
+  }
+  void
+  store(float * p) const
+  {
+#if HB_SIMD_WIDTH == 16
+    _mm512_store_ps(p, v);
+#elif HB_SIMD_WIDTH == 8
+    _mm256_store_ps(p, v);
+#elif HB_SIMD_WIDTH == 4
+    _mm_store_ps(p, v);
+#else
+    *p = v;
+#endif
+  }
+  void
+  storeu(float * p) const
+  {
+#if HB_SIMD_WIDTH == 16
+    _mm512_storeu_ps(p, v);
+#elif HB_SIMD_WIDTH == 8
+    _mm256_storeu_ps(p, v);
+#elif HB_SIMD_WIDTH == 4
+    _mm_storeu_ps(p, v);
+#else
+    *p = v;
+#endif
+  }
+
+  /**
+   * width consecutive xyz triples <-> one register per component, e.g.
+   * mesh positions stored as Vector3 arrays.
+   */
+  static void
+  loadInterleaved3(const float * p, FloatV & x, FloatV & y, FloatV & z)
+  {
+#if HB_SIMD_WIDTH == 16
+    alignas(64) static const int k_idx[6][16] = {
+        {0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 0, 0, 0, 0, 0},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 17, 20, 23, 26, 29},
+        {1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 0, 0, 0, 0, 0},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 18, 21, 24, 27, 30},
+        {2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 0, 0, 0, 0, 0, 0},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 19, 22, 25, 28, 31}};
+    const __m512 m0 = _mm512_loadu_ps(p);
+    const __m512 m1 = _mm512_loadu_ps(p + 16);
+    const __m512 m2 = _mm512_loadu_ps(p + 32);
+    FloatV * out[3] = {&x, &y, &z};
+    for (int k = 0; k < 3; ++k) {
+      const __m512 t = _mm512_permutex2var_ps(
+          m0, _mm512_load_si512(k_idx[2 * k]), m1);
+      out[k]->v = _mm512_permutex2var_ps(
+          t, _mm512_load_si512(k_idx[2 * k + 1]), m2);
+    }
+#elif HB_SIMD_WIDTH == 8
+    // Regroup so each 128 bit lane holds 4 whole points, then the SSE
+    // shuffles below work per lane
+    const __m256 m0 = _mm256_loadu_ps(p);
+    const __m256 m1 = _mm256_loadu_ps(p + 8);
+    const __m256 m2 = _mm256_loadu_ps(p + 16);
+    const __m256 a = _mm256_permute2f128_ps(m0, m1, 0x30);
+    const __m256 b = _mm256_permute2f128_ps(m0, m2, 0x21);
+    const __m256 c = _mm256_permute2f128_ps(m1, m2, 0x30);
+    x.v = _mm256_shuffle_ps(
+        a, _mm256_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)),
+        _MM_SHUFFLE(2, 0, 3, 0));
+    y.v = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                            _mm256_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+                            _MM_SHUFFLE(2, 0, 2, 0));
+    z.v = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                            c, _MM_SHUFFLE(3, 0, 2, 0));
+#elif HB_SIMD_WIDTH == 4
+    // a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3
+    const __m128 a = _mm_loadu_ps(p);
+    const __m128 b = _mm_loadu_ps(p + 4);
+    const __m128 c = _mm_loadu_ps(p + 8);
+    x.v = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)),
+                         _MM_SHUFFLE(2, 0, 3, 0));
+    y.v = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                         _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+                         _MM_SHUFFLE(2, 0, 2, 0));
+    z.v = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c,
+                         _MM_SHUFFLE(3, 0, 2, 0));
+#else
+    x.v = p[0];
+    y.v = p[1];
+    z.v = p[2];
+#endif
+  }
+  static void
+  storeInterleaved3(float * p, FloatV x, FloatV y, FloatV z)
+  {
+#if HB_SIMD_WIDTH == 16
+    alignas(64) static const int k_idx[6][16] = {
+        {0, 16, 0, 1, 17, 0, 2, 18, 0, 3, 19, 0, 4, 20, 0, 5},
+        {0, 1, 16, 3, 4, 17, 6, 7, 18, 9, 10, 19, 12, 13, 20, 15},
+        {21, 0, 6, 22, 0, 7, 23, 0, 8, 24, 0, 9, 25, 0, 10, 26},
+        {0, 21, 2, 3, 22, 5, 6, 23, 8, 9, 24, 11, 12, 25, 14, 15},
+        {0, 11, 27, 0, 12, 28, 0, 13, 29, 0, 14, 30, 0, 15, 31, 0},
+        {26, 1, 2, 27, 4, 5, 28, 7, 8, 29, 10, 11, 30, 13, 14, 31}};
+    for (int k = 0; k < 3; ++k) {
+      const __m512 t = _mm512_permutex2var_ps(
+          x.v, _mm512_load_si512(k_idx[2 * k]), y.v);
+      _mm512_storeu_ps(p + 16 * k,
+                       _mm512_permutex2var_ps(
+                           t, _mm512_load_si512(k_idx[2 * k + 1]), z.v));
+    }
+#elif HB_SIMD_WIDTH == 8
+    const __m256 a = _mm256_shuffle_ps(
+        _mm256_shuffle_ps(x.v, y.v, _MM_SHUFFLE(0, 0, 0, 0)),
+        _mm256_shuffle_ps(z.v, x.v, _MM_SHUFFLE(1, 1, 0, 0)),
+        _MM_SHUFFLE(2, 0, 2, 0));
+    const __m256 b = _mm256_shuffle_ps(
+        _mm256_shuffle_ps(y.v, z.v, _MM_SHUFFLE(1, 1, 1, 1)),
+        _mm256_shuffle_ps(x.v, y.v, _MM_SHUFFLE(2, 2, 2, 2)),
+        _MM_SHUFFLE(2, 0, 2, 0));
+    const __m256 c = _mm256_shuffle_ps(
+        _mm256_shuffle_ps(z.v, x.v, _MM_SHUFFLE(3, 3, 2, 2)),
+        _mm256_shuffle_ps(y.v, z.v, _MM_SHUFFLE(3, 3, 3, 3)),
+        _MM_SHUFFLE(2, 0, 2, 0));
+    _mm256_storeu_ps(p, _mm256_permute2f128_ps(a, b, 0x20));
+    _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(c, a, 0x30));
+    _mm256_storeu_ps(p + 16, _mm256_permute2f128_ps(b, c, 0x31));
+#elif HB_SIMD_WIDTH == 4
+    const __m128 a =
+        _mm_shuffle_ps(_mm_shuffle_ps(x.v, y.v, _MM_SHUFFLE(0, 0, 0, 0)),
+                       _mm_shuffle_ps(z.v, x.v, _MM_SHUFFLE(1, 1, 0, 0)),
+                       _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 b =
+        _mm_shuffle_ps(_mm_shuffle_ps(y.v, z.v, _MM_SHUFFLE(1, 1, 1, 1)),
+                       _mm_shuffle_ps(x.v, y.v, _MM_SHUFFLE(2, 2, 2, 2)),
+                       _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 c =
+        _mm_shuffle_ps(_mm_shuffle_ps(z.v, x.v, _MM_SHUFFLE(3, 3, 2, 2)),
+                       _mm_shuffle_ps(y.v, z.v, _MM_SHUFFLE(3, 3, 3, 3)),
+                       _MM_SHUFFLE(2, 0, 2, 0));
+    _mm_storeu_ps(p, a);
+    _mm_storeu_ps(p + 4, b);
+    _mm_storeu_ps(p + 8, c);
+#else
+    p[0] = x.v;
+    p[1] = y.v;
+    p[2] = z.v;
+#endif
+  }
+
+  /**
+   * Four consecutive floats from each of width records stride floats apart
+   * <-> one register per float, e.g. a row of width matrices at once.
+   */
+  static void
+  loadTransposed4(const float * p, std::size_t stride, FloatV & a, FloatV & b,
+                  FloatV & c, FloatV & d)
+  {
+#if HB_SIMD_WIDTH == 16
+    __m512 r[4];
+    for (int i = 0; i < 4; ++i) {
+      __m512 t = _mm512_castps128_ps512(_mm_loadu_ps(p + i * stride));
+      t = _mm512_insertf32x4(t, _mm_loadu_ps(p + (i + 4) * stride), 1);
+      t = _mm512_insertf32x4(t, _mm_loadu_ps(p + (i + 8) * stride), 2);
+      r[i] = _mm512_insertf32x4(t, _mm_loadu_ps(p + (i + 12) * stride), 3);
+    }
+    const __m512 t0 = _mm512_unpacklo_ps(r[0], r[1]);
+    const __m512 t1 = _mm512_unpacklo_ps(r[2], r[3]);
+    const __m512 t2 = _mm512_unpackhi_ps(r[0], r[1]);
+    const __m512 t3 = _mm512_unpackhi_ps(r[2], r[3]);
+    a.v = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    b.v = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    c.v = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    d.v = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+#elif HB_SIMD_WIDTH == 8
+    __m256 r[4];
+    for (int i = 0; i < 4; ++i) {
+      r[i] = _mm256_insertf128_ps(
+          _mm256_castps128_ps256(_mm_loadu_ps(p + i * stride)),
+          _mm_loadu_ps(p + (i + 4) * stride), 1);
+    }
+    const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    const __m256 t1 = _mm256_unpacklo_ps(r[2], r[3]);
+    const __m256 t2 = _mm256_unpackhi_ps(r[0], r[1]);
+    const __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    a.v = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    b.v = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    c.v = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    d.v = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+#elif HB_SIMD_WIDTH == 4
+    a.v = _mm_loadu_ps(p);
+    b.v = _mm_loadu_ps(p + stride);
+    c.v = _mm_loadu_ps(p + 2 * stride);
+    d.v = _mm_loadu_ps(p + 3 * stride);
+    _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+#else
+    (void)stride;
+    a.v = p[0];
+    b.v = p[1];
+    c.v = p[2];
+    d.v = p[3];
+#endif
+  }
+  static void
+  storeTransposed4(float * p, std::size_t stride, FloatV a, FloatV b,
+                   FloatV c, FloatV d)
+  {
+#if HB_SIMD_WIDTH == 16
+    const __m512 t0 = _mm512_unpacklo_ps(a.v, b.v);
+    const __m512 t1 = _mm512_unpacklo_ps(c.v, d.v);
+    const __m512 t2 = _mm512_unpackhi_ps(a.v, b.v);
+    const __m512 t3 = _mm512_unpackhi_ps(c.v, d.v);
+    const __m512 r[4] = {_mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0)),
+                         _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2)),
+                         _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+                         _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2))};
+    for (int i = 0; i < 4; ++i) {
+      _mm_storeu_ps(p + i * stride, _mm512_castps512_ps128(r[i]));
+      _mm_storeu_ps(p + (i + 4) * stride, _mm512_extractf32x4_ps(r[i], 1));
+      _mm_storeu_ps(p + (i + 8) * stride, _mm512_extractf32x4_ps(r[i], 2));
+      _mm_storeu_ps(p + (i + 12) * stride, _mm512_extractf32x4_ps(r[i], 3));
+    }
+#elif HB_SIMD_WIDTH == 8
+    const __m256 t0 = _mm256_unpacklo_ps(a.v, b.v);
+    const __m256 t1 = _mm256_unpacklo_ps(c.v, d.v);
+    const __m256 t2 = _mm256_unpackhi_ps(a.v, b.v);
+    const __m256 t3 = _mm256_unpackhi_ps(c.v, d.v);
+    const __m256 r[4] = {_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0)),
+                         _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2)),
+                         _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+                         _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2))};
+    for (int i = 0; i < 4; ++i) {
+      _mm_storeu_ps(p + i * stride, _mm256_castps256_ps128(r[i]));
+      _mm_storeu_ps(p + (i + 4) * stride, _mm256_extractf128_ps(r[i], 1));
+    }
+#elif HB_SIMD_WIDTH == 4
+    _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+    _mm_storeu_ps(p, a.v);
+    _mm_storeu_ps(p + stride, b.v);
+    _mm_storeu_ps(p + 2 * stride, c.v);
+    _mm_storeu_ps(p + 3 * stride, d.v);
+#else
+    (void)stride;
+    p[0] = a.v;
+    p[1] = b.v;
+    p[2] = c.v;
+    p[3] = d.v;
+#endif
+  }
+
+  // Arithmetic
+  FloatV
+  operator+(FloatV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_add_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_add_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_add_ps(v, b.v)};
+#else
+    return FloatV{v + b.v};
+#endif
+  }
+  FloatV
+  operator-(FloatV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_sub_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_sub_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_sub_ps(v, b.v)};
+#else
+    return FloatV{v - b.v};
+#endif
+  }
+  FloatV
+  operator*(FloatV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_mul_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_mul_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_mul_ps(v, b.v)};
+#else
+    return FloatV{v * b.v};
+#endif
+  }
+  FloatV
+  operator/(FloatV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_div_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_div_ps(v, b.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_div_ps(v, b.v)};
+#else
+    return FloatV{v / b.v};
+#endif
+  }
+  FloatV
+  operator-() const
+  {
+    return zero() - *this;
+  }
+  void
+  operator+=(FloatV b)
+  {
+    *this = *this + b;
+  }
+  void
+  operator-=(FloatV b)
+  {
+    *this = *this - b;
+  }
+  void
+  operator*=(FloatV b)
+  {
+    *this = *this * b;
+  }
+
+  // a * b + c, fused when the target has FMA
+  static FloatV
+  mulAdd(FloatV a, FloatV b, FloatV c)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_fmadd_ps(a.v, b.v, c.v)};
+#elif HB_SIMD_WIDTH == 8 && defined(__FMA__)
+    return FloatV{_mm256_fmadd_ps(a.v, b.v, c.v)};
+#else
+    return (a * b) + c;
+#endif
+  }
+  static FloatV
+  min(FloatV a, FloatV b)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_min_ps(a.v, b.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_min_ps(a.v, b.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_min_ps(a.v, b.v)};
+#else
+    return FloatV{a.v < b.v ? a.v : b.v};
+#endif
+  }
+  static FloatV
+  max(FloatV a, FloatV b)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_max_ps(a.v, b.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_max_ps(a.v, b.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_max_ps(a.v, b.v)};
+#else
+    return FloatV{a.v > b.v ? a.v : b.v};
+#endif
+  }
+  static FloatV
+  sqrt(FloatV a)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_sqrt_ps(a.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_sqrt_ps(a.v)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_sqrt_ps(a.v)};
+#else
+    return FloatV{std::sqrt(a.v)};
+#endif
+  }
+  // rsqrtFast per lane, AVX-512 starts from a 14 bit estimate: <= 1.4e-7
+  static FloatV
+  rsqrt(FloatV a)
+  {
+#if HB_SIMD_WIDTH == 1
+    return FloatV{rsqrtFast(a.v)};
+#else
+#if HB_SIMD_WIDTH == 16
+    const FloatV y{_mm512_rsqrt14_ps(a.v)};
+#elif HB_SIMD_WIDTH == 8
+    const FloatV y{_mm256_rsqrt_ps(a.v)};
+#else
+    const FloatV y{_mm_rsqrt_ps(a.v)};
+#endif
+    const FloatV half_ay = set1(0.5f) * a * y;
+    return y * mulAdd(-half_ay, y, set1(1.5f));
+#endif
+  }
+  static FloatV
+  abs(FloatV a)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_castsi512_ps(_mm512_and_si512(
+        _mm512_castps_si512(a.v), _mm512_set1_epi32(0x7FFFFFFF)))};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_and_ps(
+        a.v, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF)))};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{
+        _mm_and_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)))};
+#else
+    return FloatV{std::fabs(a.v)};
+#endif
+  }
+
+  // Comparisons
+  MaskV
+  operator<(FloatV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return MaskV{_mm512_cmp_ps_mask(v, b.v, _CMP_LT_OQ)};
+#elif HB_SIMD_WIDTH == 8
+    return MaskV{_mm256_cmp_ps(v, b.v, _CMP_LT_OQ)};
+#elif HB_SIMD_WIDTH == 4
+    return MaskV{_mm_cmplt_ps(v, b.v)};
+#else
+    return MaskV{v < b.v};
+#endif
+  }
+  MaskV
+  operator<=(FloatV b) const
+  {
+#if HB_SIMD_WIDTH == 16
+    return MaskV{_mm512_cmp_ps_mask(v, b.v, _CMP_LE_OQ)};
+#elif HB_SIMD_WIDTH == 8
+    return MaskV{_mm256_cmp_ps(v, b.v, _CMP_LE_OQ)};
+#elif HB_SIMD_WIDTH == 4
+    return MaskV{_mm_cmple_ps(v, b.v)};
+#else
+    return MaskV{v <= b.v};
+#endif
+  }
+  MaskV
+  operator>(FloatV b) const
+  {
+    return b < *this;
+  }
+  MaskV
+  operator>=(FloatV b) const
+  {
+    return b <= *this;
+  }
+
+  // Lane wise m ? a : b
+  static FloatV
+  select(MaskV m, FloatV a, FloatV b)
+  {
+#if HB_SIMD_WIDTH == 16
+    return FloatV{_mm512_mask_blend_ps(m.m, b.v, a.v)};
+#elif HB_SIMD_WIDTH == 8
+    return FloatV{_mm256_blendv_ps(b.v, a.v, m.m)};
+#elif HB_SIMD_WIDTH == 4
+    return FloatV{_mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v))};
+#else
+    return FloatV{m.m ? a.v : b.v};
+#endif
+  }
+
+  // Elementary functions
+  /**
+   * acos(a) for a in [-1, 1], inputs outside are clamped.
+   * Abramowitz & Stegun 4.4.46, |error| <= 2e-8 before float rounding.
+   */
+  static FloatV
+  acos(FloatV a)
+  {
+    const FloatV one = set1(1.0f);
+    const FloatV x = min(abs(a), one);
+    FloatV       p = set1(-0.0012624911f);
+    p = mulAdd(p, x, set1(0.0066700901f));
+    p = mulAdd(p, x, set1(-0.0170881256f));
+    p = mulAdd(p, x, set1(0.0308918810f));
+    p = mulAdd(p, x, set1(-0.0501743046f));
+    p = mulAdd(p, x, set1(0.0889789874f));
+    p = mulAdd(p, x, set1(-0.2145988016f));
+    p = mulAdd(p, x, set1(1.5707963050f));
+    const FloatV r = sqrt(one - x) * p;
+    return select(a < zero(), set1(3.14159265358979f) - r, r);
+  }
+
+  /**
+   * sin(a) and cos(a) from one range reduction: a - k pi/2 in three parts
+   * (Cody-Waite), then the Cephes polynomials on [-pi/4, pi/4] and k mod 4
+   * picks the quadrant. |error| <= 1.2e-7 for |a| <= 8192, the accuracy
+   * falls off beyond that.
+   */
+  static void
+  sincos(FloatV a, FloatV & s, FloatV & c)
+  {
+    const FloatV one = set1(1.0f);
+    const FloatV shifter = set1(12582912.0f); // 1.5 * 2^23, round to nearest
+    const FloatV k = (a * set1(0.636619772f) + shifter) - shifter;
+    FloatV       r = mulAdd(-k, set1(1.5703125f), a);
+    r = mulAdd(-k, set1(4.837512969970703125e-4f), r);
+    r = mulAdd(-k, set1(7.54978995489188216e-8f), r);
+
+    const FloatV r2 = r * r;
+    FloatV       ps = set1(-1.9515295891e-4f);
+    ps = mulAdd(ps, r2, set1(8.3321608736e-3f));
+    ps = mulAdd(ps, r2, set1(-1.6666654611e-1f));
+    const FloatV sin_r = mulAdd(ps * r2, r, r);
+    FloatV       pc = set1(2.443315711809948e-5f);
+    pc = mulAdd(pc, r2, set1(-1.388731625493765e-3f));
+    pc = mulAdd(pc, r2, set1(4.166664568298827e-2f));
+    const FloatV cos_r = mulAdd(pc * r2, r2, mulAdd(set1(-0.5f), r2, one));
+
+    // k mod 4 without integer lanes, floor(k / 4) = round((k - 1.5) / 4)
+    const FloatV k4 =
+        (mulAdd(k, set1(0.25f), set1(-0.375f)) + shifter) - shifter;
+    const FloatV quadrant = mulAdd(k4, set1(-4.0f), k);
+    const MaskV  above_0 = quadrant > set1(0.5f);
+    const MaskV  above_1 = quadrant > set1(1.5f);
+    const MaskV  above_2 = quadrant > set1(2.5f);
+    const MaskV  swap = (above_0 & !above_1) | above_2;
+    const FloatV s0 = select(swap, cos_r, sin_r);
+    const FloatV c0 = select(swap, sin_r, cos_r);
+    s = select(above_1, -s0, s0);
+    c = select(above_0 & !above_2, -c0, c0);
+  }
+};
+
+#if HB_SIMD_WIDTH == 16 && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// 1 / sqrt(a) for the normalizations, see HB_FAST_NORMALIZE
+template<typename T>
+inline T
+invSqrt(T a)
+{
+  return T(1) / std::sqrt(a);
+}
+template<>
+inline float
+invSqrt(float a)
+{
+#if HB_FAST_NORMALIZE
+  return rsqrtFast(a);
+#else
+  return 1.0f / std::sqrt(a);
+#endif
+}
+inline FloatV
+invSqrt(FloatV a)
+{
+#if HB_FAST_NORMALIZE
+  return FloatV::rsqrt(a);
+#else
+  return FloatV::set1(1.0f) / FloatV::sqrt(a);
+#endif
+}
+
+/**
+ * Exactly four floats, for work that is 4 wide by nature rather than by
+ * target, e.g. blending a quaternion or a matrix column per element. SSE
+ * whenever FloatV is at least that wide, plain floats otherwise.
+ */
+class Float4 {
+  public:
+#if HB_SIMD_WIDTH >= 4
+  __m128 v;
+#else
+  float v[4];
+#endif
+
+  static Float4
+  set1(float a)
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_set1_ps(a)};
+#else
+    return Float4{{a, a, a, a}};
+#endif
+  }
+  static Float4
+  zero()
+  {
+    return set1(0.0f);
+  }
+  static Float4
+  loadu(const float * p)
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_loadu_ps(p)};
+#else
+    return Float4{{p[0], p[1], p[2], p[3]}};
+#endif
+  }
+  void
+  storeu(float * p) const
+  {
+#if HB_SIMD_WIDTH >= 4
+    _mm_storeu_ps(p, v);
+#else
+    for (int i = 0; i < 4; ++i) {
+      p[i] = v[i];
+    }
+#endif
+  }
+
+  Float4
+  operator+(Float4 b) const
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_add_ps(v, b.v)};
+#else
+    return Float4{{v[0] + b.v[0], v[1] + b.v[1], v[2] + b.v[2], v[3] + b.v[3]}};
+#endif
+  }
+  Float4
+  operator-(Float4 b) const
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_sub_ps(v, b.v)};
+#else
+    return Float4{{v[0] - b.v[0], v[1] - b.v[1], v[2] - b.v[2], v[3] - b.v[3]}};
+#endif
+  }
+  Float4
+  operator*(Float4 b) const
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_mul_ps(v, b.v)};
+#else
+    return Float4{{v[0] * b.v[0], v[1] * b.v[1], v[2] * b.v[2], v[3] * b.v[3]}};
+#endif
+  }
+
+  static Float4
+  min(Float4 a, Float4 b)
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_min_ps(a.v, b.v)};
+#else
+    Float4 r;
+    for (int i = 0; i < 4; ++i) {
+      r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    }
+    return r;
+#endif
+  }
+  static Float4
+  max(Float4 a, Float4 b)
+  {
+#if HB_SIMD_WIDTH >= 4
+    return Float4{_mm_max_ps(a.v, b.v)};
+#else
+    Float4 r;
+    for (int i = 0; i < 4; ++i) {
+      r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    }
+    return r;
+#endif
+  }
+
+  // One bit per lane where a <= b, lane 0 in bit 0
+  static unsigned
+  lessEqualBits(Float4 a, Float4 b)
+  {
+#if HB_SIMD_WIDTH >= 4
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(a.v, b.v)));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < 4; ++i) {
+      bits |= (a.v[i] <= b.v[i]) ? 1u << i : 0u;
+    }
+    return bits;
+#endif
+  }
+
+  // a * b + c, fused when the target has FMA
+  static Float4
+  mulAdd(Float4 a, Float4 b, Float4 c)
+  {
+#if HB_SIMD_WIDTH >= 4 && defined(__FMA__)
+    return Float4{_mm_fmadd_ps(a.v, b.v, c.v)};
+#else
+    return (a * b) + c;
+#endif
+  }
+};
+
+// Allocation granularity of everything the batch kernels stream over
+constexpr std::size_t simdAlignment = 64;
+
+[[nodiscard]] inline void *
+simdAlignedAlloc(std::size_t bytes)
+{
+  bytes = (bytes + simdAlignment - 1) & ~(simdAlignment - 1);
+#if defined(_MSC_VER)
+  return _aligned_malloc(bytes, simdAlignment);
+#else
+  return std::aligned_alloc(simdAlignment, bytes);
+#endif
+}
+
+inline void
+simdAlignedFree(void * p)
+{
+#if defined(_MSC_VER)
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+#endif // SIMD_HH
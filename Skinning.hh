@@ -0,0 +1,307 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Skinning over a packed vertex stream. Each vertex blends its bone
+ * transforms once, 4 wide, then FloatV::width vertices are transformed per
+ * iteration. Meshes are split into chunks over the shared ThreadPool, and
+ * skinJobs() spreads the chunks of many meshes over it in one go.
+ */
+#ifndef SKINNING_HH
+#define SKINNING_HH
+#include "DualQuat.hh"
+#include "Matrix.hh"
+#include "Parallel.hh"
+#include "Simd.hh"
+#include "Vector.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * Up to 4 influences per vertex. Unused slots have weight 0 and any valid
+ * bone index, weights are expected to sum to 1.
+ */
+class SkinVertex {
+  public:
+  Vector3       position;
+  Vector3       normal;
+  std::uint16_t bones[4] = {0};
+  float         weights[4] = {0};
+};
+
+static_assert(sizeof(SkinVertex) == 12 * sizeof(float),
+              "Skinning kernels read SkinVertex records as 12 floats");
+static_assert(sizeof(DualQuat<float>) == 8 * sizeof(float),
+              "Skinning kernels read DualQuat<float> as 8 packed floats");
+
+// Vertices per parallelFor chunk, about 100KB of input and output
+constexpr std::size_t skinChunkSize = 1024;
+
+/**
+ * Weighted sum of the vertex's dual quaternions into out as w, x, y, z of
+ * the real then the dual part. Bones in the other hemisphere than the first
+ * one have their weight negated.
+ */
+inline void
+blendDualQuat(const SkinVertex & v, const DualQuat<float> * palette,
+              float * out)
+{
+  const Quat<float> & pivot = palette[v.bones[0]].real;
+  Float4              real = Float4::zero();
+  Float4              dual = Float4::zero();
+  for (int k = 0; k < 4; ++k) {
+    const DualQuat<float> & b = palette[v.bones[k]];
+    const Float4            wk = Float4::set1(
+        pivot.dotp(b.real) < 0.0f ? -v.weights[k] : v.weights[k]);
+    real = Float4::mulAdd(Float4::loadu(&b.real.w), wk, real);
+    dual = Float4::mulAdd(Float4::loadu(&b.dual.w), wk, dual);
+  }
+  real.storeu(out);
+  dual.storeu(out + 4);
+}
+
+/**
+ * Runs block(src, px, py, pz, nx, ny, nz) over in[begin, end), FloatV::width
+ * vertices at a time, with src the records of the current group. block
+ * transforms the loaded positions and normals in place, they are written
+ * to out_positions and, unless it is null, out_normals.
+ */
+template<typename Block>
+inline void
+forEachSkinBlock(const SkinVertex * in, std::size_t begin, std::size_t end,
+                 Vector3 * out_positions, Vector3 * out_normals,
+                 Block && block)
+{
+  constexpr std::size_t w = FloatV::width;
+  for (std::size_t i = begin; i < end; i += w) {
+    const std::size_t  count = std::min(w, end - i);
+    const SkinVertex * src = in + i;
+    SkinVertex         tail[w];
+    if (count < w) {
+      std::copy(in + i, in + end, tail);
+      src = tail;
+    }
+
+    // Position and normal, floats 0-2 and 3-5 of every record
+    const float * fsrc = &src->position.x;
+    FloatV        px, py, pz, nx, ny, nz, unused0, unused1;
+    FloatV::loadTransposed4(fsrc, 12, px, py, pz, nx);
+    FloatV::loadTransposed4(fsrc + 2, 12, unused0, unused1, ny, nz);
+    block(src, px, py, pz, nx, ny, nz);
+
+    const auto write = [&](Vector3 * out, FloatV x, FloatV y, FloatV z) {
+      if (count == w) {
+        FloatV::storeInterleaved3(&out[i].x, x, y, z);
+      } else {
+        float staged[3 * w];
+        FloatV::storeInterleaved3(staged, x, y, z);
+        std::memcpy(&out[i].x, staged, count * sizeof(Vector3));
+      }
+    };
+    write(out_positions, px, py, pz);
+    if (out_normals != nullptr) {
+      write(out_normals, nx, ny, nz);
+    }
+  }
+}
+
+// Dual quaternion skinning of in[begin, end), single threaded
+inline void
+skinRange(const SkinVertex * in, std::size_t begin, std::size_t end,
+          const DualQuat<float> * palette, Vector3 * out_positions,
+          Vector3 * out_normals)
+{
+  constexpr std::size_t w = FloatV::width;
+  const FloatV          zero = FloatV::zero();
+  const FloatV          one = FloatV::set1(1.0f);
+  const FloatV          two = FloatV::set1(2.0f);
+  const FloatV          tiny = FloatV::set1(1e-12f);
+  forEachSkinBlock(
+      in, begin, end, out_positions, out_normals,
+      [&](const SkinVertex * src, FloatV & px, FloatV & py, FloatV & pz,
+          FloatV & nx, FloatV & ny, FloatV & nz) {
+        alignas(simdAlignment) float blended[8 * w];
+        for (std::size_t k = 0; k < w; ++k) {
+          blendDualQuat(src[k], palette, blended + 8 * k);
+        }
+        FloatV rw, rx, ry, rz, dw, dx, dy, dz;
+        FloatV::loadTransposed4(blended, 8, rw, rx, ry, rz);
+        FloatV::loadTransposed4(blended + 4, 8, dw, dx, dy, dz);
+
+        // Divide by |real|, vertices without weight keep their rest pose
+        const FloatV len_sq = FloatV::mulAdd(
+            rw, rw, FloatV::mulAdd(rx, rx, FloatV::mulAdd(ry, ry, rz * rz)));
+        const MaskV  rest = len_sq <= tiny;
+        const FloatV inv = FloatV::select(
+            rest, zero,
+            one / FloatV::sqrt(FloatV::select(rest, one, len_sq)));
+        rw = FloatV::select(rest, one, rw * inv);
+        rx *= inv;
+        ry *= inv;
+        rz *= inv;
+        dw *= inv;
+        dx *= inv;
+        dy *= inv;
+        dz *= inv;
+
+        // v' = v + 2 * r x (r x v + rw * v)
+        const auto rotate = [&](FloatV & x, FloatV & y, FloatV & z) {
+          const FloatV ax = FloatV::mulAdd(rw, x, ry * z - rz * y);
+          const FloatV ay = FloatV::mulAdd(rw, y, rz * x - rx * z);
+          const FloatV az = FloatV::mulAdd(rw, z, rx * y - ry * x);
+          x = FloatV::mulAdd(two, ry * az - rz * ay, x);
+          y = FloatV::mulAdd(two, rz * ax - rx * az, y);
+          z = FloatV::mulAdd(two, rx * ay - ry * ax, z);
+        };
+        rotate(px, py, pz);
+        rotate(nx, ny, nz);
+        // t = 2 * (rw * d - dw * r + r x d)
+        px = FloatV::mulAdd(
+            two, FloatV::mulAdd(rw, dx, ry * dz - rz * dy) - dw * rx, px);
+        py = FloatV::mulAdd(
+            two, FloatV::mulAdd(rw, dy, rz * dx - rx * dz) - dw * ry, py);
+        pz = FloatV::mulAdd(
+            two, FloatV::mulAdd(rw, dz, rx * dy - ry * dx) - dw * rz, pz);
+      });
+}
+
+// Weighted sum of the upper 3x4 of the vertex's bone matrices, row major
+inline void
+blendMatrix4(const SkinVertex & v, const Matrix4 * palette, float * out)
+{
+  Float4 rows[3] = {Float4::zero(), Float4::zero(), Float4::zero()};
+  for (int k = 0; k < 4; ++k) {
+    const float * cells = palette[v.bones[k]].cells;
+    const Float4  wk = Float4::set1(v.weights[k]);
+    for (int r = 0; r < 3; ++r) {
+      rows[r] = Float4::mulAdd(Float4::loadu(cells + 4 * r), wk, rows[r]);
+    }
+  }
+  for (int r = 0; r < 3; ++r) {
+    rows[r].storeu(out + 4 * r);
+  }
+}
+
+/**
+ * Linear blend skinning of in[begin, end), single threaded. Palette
+ * matrices are affine, normals go through the blended upper 3x3 and are
+ * renormalized, exact for bones without non-uniform scale.
+ */
+inline void
+skinRange(const SkinVertex * in, std::size_t begin, std::size_t end,
+          const Matrix4 * palette, Vector3 * out_positions,
+          Vector3 * out_normals)
+{
+  constexpr std::size_t w = FloatV::width;
+  const FloatV          one = FloatV::set1(1.0f);
+  const FloatV          tiny = FloatV::set1(1e-24f);
+  forEachSkinBlock(
+      in, begin, end, out_positions, out_normals,
+      [&](const SkinVertex * src, FloatV & px, FloatV & py, FloatV & pz,
+          FloatV & nx, FloatV & ny, FloatV & nz) {
+        alignas(simdAlignment) float blended[12 * w];
+        for (std::size_t k = 0; k < w; ++k) {
+          blendMatrix4(src[k], palette, blended + 12 * k);
+        }
+        FloatV m[3][4];
+        for (int r = 0; r < 3; ++r) {
+          FloatV::loadTransposed4(blended + 4 * r, 12, m[r][0], m[r][1],
+                                  m[r][2], m[r][3]);
+        }
+        const auto row = [&](int r, FloatV x, FloatV y, FloatV z) {
+          return FloatV::mulAdd(m[r][0], x,
+                                FloatV::mulAdd(m[r][1], y, m[r][2] * z));
+        };
+        const FloatV tx = row(0, px, py, pz) + m[0][3];
+        const FloatV ty = row(1, px, py, pz) + m[1][3];
+        pz = row(2, px, py, pz) + m[2][3];
+        px = tx;
+        py = ty;
+
+        const FloatV dx = row(0, nx, ny, nz);
+        const FloatV dy = row(1, nx, ny, nz);
+        const FloatV dz = row(2, nx, ny, nz);
+        const FloatV len_sq =
+            FloatV::mulAdd(dx, dx, FloatV::mulAdd(dy, dy, dz * dz));
+        const FloatV inv =
+            one / FloatV::sqrt(FloatV::max(len_sq, tiny));
+        nx = dx * inv;
+        ny = dy * inv;
+        nz = dz * inv;
+      });
+}
+
+/**
+ * Dual quaternion skinning of n vertices against palette, one unit
+ * DualQuat<float> per bone. out_normals may be null to skip normals.
+ * Chunks of skinChunkSize vertices run on the shared ThreadPool.
+ */
+inline void
+skinDualQuat(const SkinVertex * in, std::size_t n,
+             const DualQuat<float> * palette, Vector3 * out_positions,
+             Vector3 * out_normals)
+{
+  parallelFor(0, n, skinChunkSize, [&](std::size_t b, std::size_t e) {
+    skinRange(in, b, e, palette, out_positions, out_normals);
+  });
+}
+
+// Linear blend counterpart of skinDualQuat, palette of affine Matrix4
+inline void
+skinLinear(const SkinVertex * in, std::size_t n, const Matrix4 * palette,
+           Vector3 * out_positions, Vector3 * out_normals)
+{
+  parallelFor(0, n, skinChunkSize, [&](std::size_t b, std::size_t e) {
+    skinRange(in, b, e, palette, out_positions, out_normals);
+  });
+}
+
+// One mesh for skinJobs(), Bone is Matrix4 or DualQuat<float>
+template<typename Bone>
+class SkinJob {
+  public:
+  const SkinVertex * vertices = nullptr;
+  std::size_t        count = 0;
+  const Bone *       palette = nullptr;
+  Vector3 *          positions = nullptr;
+  Vector3 *          normals = nullptr;
+};
+
+/**
+ * Skins every job, with the chunks of all meshes in one parallelFor so
+ * lots of small characters keep the workers as busy as one large mesh.
+ */
+template<typename Bone>
+inline void
+skinJobs(const SkinJob<Bone> * jobs, std::size_t count)
+{
+  // first_chunk[j] is the global index of job j's first chunk. Kept per
+  // thread so a steady state frame reuses its capacity instead of the heap.
+  // Workers have their own, empty thread_local, so the lambda reaches the
+  // caller's table only through first.
+  thread_local std::vector<std::size_t> first_chunk;
+  first_chunk.assign(count + 1, 0);
+  for (std::size_t j = 0; j < count; ++j) {
+    first_chunk[j + 1] = first_chunk[j] +
+                         (jobs[j].count + skinChunkSize - 1) / skinChunkSize;
+  }
+  const std::size_t * first = first_chunk.data();
+  parallelFor(0, first[count], 1, [=](std::size_t b, std::size_t e) {
+    for (std::size_t c = b; c < e; ++c) {
+      const std::size_t j =
+          static_cast<std::size_t>(
+              std::upper_bound(first, first + count + 1, c) - first) -
+          1;
+      const SkinJob<Bone> & job = jobs[j];
+      const std::size_t     v = (c - first[j]) * skinChunkSize;
+      skinRange(job.vertices, v, std::min(v + skinChunkSize, job.count),
+                job.palette, job.positions, job.normals);
+    }
+  });
+}
+
+#endif // SKINNING_HH
@@ -0,0 +1,186 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Flat transform hierarchy. Nodes are stored breadth first, so a parent
+ * always precedes its children and every depth level is one contiguous
+ * range. update() walks the levels top down and only multiplies nodes whose
+ * local matrix was set or whose parent's world matrix changed, each level
+ * split over the shared ThreadPool.
+ */
+#ifndef TRANSFORM_HIERARCHY_HH
+#define TRANSFORM_HIERARCHY_HH
+#include "Matrix.hh"
+#include "Parallel.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TransformHierarchy {
+  public:
+  static constexpr std::uint32_t noParent = 0xFFFFFFFFu;
+
+  // Nodes per parallelFor chunk within a level
+  static constexpr std::size_t grain = 1024;
+
+  TransformHierarchy() = default;
+
+  /**
+   * n nodes, node i hangs below parents[i] or is a root for noParent. Ids
+   * stay the caller's, any order works as long as there are no cycles.
+   * Locals start as identity and everything is dirty.
+   */
+  TransformHierarchy(const std::uint32_t * parents, std::size_t n)
+      : parent(n), local(n, Matrix4::identity()), world(n), dirty(n, 1),
+        changed(n, 0), slot_of(n), id_of(n)
+  {
+    // Children of every node, counting sort by parent, roots under n
+    std::vector<std::uint32_t> first_child(n + 2, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+      assert(parents[i] == noParent || parents[i] < n);
+      ++first_child[(parents[i] == noParent ? n : parents[i]) + 1];
+    }
+    for (std::size_t i = 0; i <= n; ++i) {
+      first_child[i + 1] += first_child[i];
+    }
+    std::vector<std::uint32_t> children(n);
+    std::vector<std::uint32_t> fill(first_child.begin(), first_child.end() - 1);
+    for (std::size_t i = 0; i < n; ++i) {
+      children[fill[parents[i] == noParent ? n : parents[i]]++] =
+          static_cast<std::uint32_t>(i);
+    }
+
+    // Breadth first, one level at a time
+    std::size_t placed = 0;
+    for (std::uint32_t k = first_child[n]; k < first_child[n + 1]; ++k) {
+      place(children[k], noParent, placed++);
+    }
+    while (level_begin.back() != placed) {
+      const std::size_t begin = level_begin.back();
+      const std::size_t end = placed;
+      level_begin.push_back(end);
+      for (std::size_t s = begin; s < end; ++s) {
+        const std::uint32_t id = id_of[s];
+        for (std::uint32_t k = first_child[id]; k < first_child[id + 1]; ++k) {
+          place(children[k], static_cast<std::uint32_t>(s), placed++);
+        }
+      }
+    }
+    assert(placed == n && "parent indices contain a cycle");
+    any_dirty = n != 0;
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return parent.size();
+  }
+  [[nodiscard]] std::size_t
+  levels() const
+  {
+    return level_begin.size() - 1;
+  }
+
+  // Local matrix of node id, marks its subtree for the next update()
+  void
+  setLocal(std::uint32_t id, const Matrix4 & m)
+  {
+    const std::uint32_t s = slot_of[id];
+    local[s] = m;
+    dirty[s] = 1;
+    any_dirty = true;
+  }
+  [[nodiscard]] const Matrix4 &
+  getLocal(std::uint32_t id) const
+  {
+    return local[slot_of[id]];
+  }
+
+  // As of the last update()
+  [[nodiscard]] const Matrix4 &
+  getWorld(std::uint32_t id) const
+  {
+    return world[slot_of[id]];
+  }
+  // Whether the last update() rewrote the world matrix of node id
+  [[nodiscard]] bool
+  worldChanged(std::uint32_t id) const
+  {
+    return changed[slot_of[id]] != 0;
+  }
+
+  // Storage order, for streaming all world matrices at once
+  [[nodiscard]] const Matrix4 *
+  worlds() const
+  {
+    return world.data();
+  }
+  [[nodiscard]] std::uint32_t
+  slot(std::uint32_t id) const
+  {
+    return slot_of[id];
+  }
+  [[nodiscard]] std::uint32_t
+  idAt(std::uint32_t slot) const
+  {
+    return id_of[slot];
+  }
+
+  /**
+   * world = parent world * local for every node that is dirty or below a
+   * node whose world changed, level by level. Does nothing when no local
+   * was set since the last call.
+   */
+  void
+  update()
+  {
+    if (!any_dirty) {
+      std::fill(changed.begin(), changed.end(), 0);
+      return;
+    }
+    for (std::size_t l = 0; l < levels(); ++l) {
+      parallelFor(level_begin[l], level_begin[l + 1], grain,
+                  [&](std::size_t b, std::size_t e) { updateRange(b, e); });
+    }
+    any_dirty = false;
+  }
+
+  private:
+  void
+  place(std::uint32_t id, std::uint32_t parent_slot, std::size_t s)
+  {
+    slot_of[id] = static_cast<std::uint32_t>(s);
+    id_of[s] = id;
+    parent[s] = parent_slot;
+  }
+
+  void
+  updateRange(std::size_t begin, std::size_t end)
+  {
+    for (std::size_t s = begin; s < end; ++s) {
+      const std::uint32_t p = parent[s];
+      const bool          stale = dirty[s] != 0 ||
+                         (p != noParent && changed[p] != 0);
+      if (stale) {
+        world[s] = (p == noParent) ? local[s] : world[p] * local[s];
+      }
+      changed[s] = stale ? 1 : 0;
+      dirty[s] = 0;
+    }
+  }
+
+  std::vector<std::uint32_t> parent; // Slot of the parent, by slot
+  std::vector<Matrix4>       local;
+  std::vector<Matrix4>       world;
+  std::vector<std::uint8_t>  dirty;
+  std::vector<std::uint8_t>  changed;
+  std::vector<std::uint32_t> slot_of;
+  std::vector<std::uint32_t> id_of;
+  std::vector<std::size_t>   level_begin{0};
+  bool                       any_dirty = false;
+};
+
+#endif // TRANSFORM_HIERARCHY_HH
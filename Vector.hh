@@ -6,20 +6,45 @@
 #ifndef VECTOR_HH
 #define VECTOR_HH
 
+#include "Half.hh"
+
 #include <cassert>
 #include <cfloat>
 #include <cmath>
+#include <limits>
 
-class Vector2 {
+/**
+ * v / sqrt(sq) for the object normalizations. HB_FAST_NORMALIZE makes it
+ * v * invSqrt(sq), otherwise it divides and rounds once, as they always did.
+ */
+template<typename V, typename T>
+inline V
+divBySqrt(const V & v, T sq)
+{
+#if HB_FAST_NORMALIZE
+  return v * invSqrt(sq);
+#else
+  return v / std::sqrt(sq);
+#endif
+}
+
+template<typename T>
+class Vector2T {
   public:
   // Components
-  float x = 0;
-  float y = 0;
+  T x{};
+  T y{};
 
   // Constructors
-  Vector2() = default;
-  explicit Vector2(float b) : x(b), y(b) {}
-  explicit Vector2(float x, float y) : x(x), y(y) {}
+  Vector2T() = default;
+  constexpr explicit Vector2T(T b) : x(b), y(b) {}
+  constexpr explicit Vector2T(T x, T y) : x(x), y(y) {}
+  // Precision conversion, arrays go through convertPrecision()
+  template<typename U>
+  constexpr explicit Vector2T(const Vector2T<U> & b)
+      : x(static_cast<T>(b.x)), y(static_cast<T>(b.y))
+  {
+  }
 
    // Vector algebra
   /** Vector reflection, much simpler to create my own instead of bloating with
@@ -33,323 +58,363 @@ class Vector2 {
    * 2 * ((dotp(b,a) /  sqr(sqrt(v|))) * v|)
    * reflected = (K * u) - u
    **/
-  [[nodiscard]] float
-  dotp(Vector2 vector_b) const
+  [[nodiscard]] constexpr T
+  dotp(Vector2T vector_b) const
   {
     return (x * vector_b.x) + (y * vector_b.y);
   }
 
-  [[nodiscard]] Vector2
-  iscalp(int b) // Int scalar product
+  [[nodiscard]] constexpr Vector2T
+  iscalp(int b) const // Int scalar product
   {
-    return Vector2{x * static_cast<float>(b), y * static_cast<float>(b)};
+    return Vector2T{x * static_cast<T>(b), y * static_cast<T>(b)};
   }
 
-  [[nodiscard]] Vector2
-  fscalp(float b) // Float scalar product
+  [[nodiscard]] constexpr Vector2T
+  fscalp(T b) const // Float scalar product
   {
-    return Vector2{(x * b), (y * b)};
+    return Vector2T{(x * b), (y * b)};
   }
 
-  [[nodiscard]] Vector2
-  vecSub(Vector2 & vector_b)
+  [[nodiscard]] constexpr Vector2T
+  vecSub(const Vector2T & vector_b) const
   {
-    return Vector2{(x - vector_b.x), (y - vector_b.y)};
+    return Vector2T{(x - vector_b.x), (y - vector_b.y)};
   }
-  
-  [[nodiscard]] Vector2
-  reflected(Vector2 & reflect_against)
+
+  // reflect_against mirrored about this, which must not be zero. The batch
+  // version for particles is reflectLanes() in Particles2D.hh
+  [[nodiscard]] constexpr Vector2T
+  reflected(const Vector2T & reflect_against) const
   {
     auto vdist_sqr = (x * x) + (y * y);
     auto projv_u = this->fscalp(this->dotp(reflect_against) / vdist_sqr);
-    return projv_u.iscalp(0x2).vecsub(reflect_against);
+    return projv_u.iscalp(0x2).vecSub(reflect_against);
   }
 
-  [[nodiscard]] float
+  [[nodiscard]] constexpr T
   magSq() const
   {
     return x * x + y * y;
   }
-  [[nodiscard]] float
+  [[nodiscard]] T
   mag() const
   {
     return std::sqrt(magSq());
   }
 
-  // Normalization
+  // Normalization, divBySqrt() follows HB_FAST_NORMALIZE
   void 
   normalize() // Unsafe
   {
-    (*this) /= mag();
+    (*this) = divBySqrt(*this, magSq());
   }
-  [[nodiscard]] Vector2
+  [[nodiscard]] Vector2T
   normalized() const // Unsafe
   {
-    return (*this) / mag();
+    return divBySqrt(*this, magSq());
+  }
+  // Zero length stays zero instead of becoming NaN
+  void
+  normalizeSafe()
+  {
+    (*this) *= safeInvMag();
+  }
+  [[nodiscard]] Vector2T
+  normalizedSafe() const
+  {
+    return (*this) * safeInvMag();
   }
   [[nodiscard]] bool
   isNorm() const
   {
-    auto temp = mag() - 1;
-    return (temp < 1e-6) && (temp > -(1e-6));
+    // |mag - 1| < 1e-6 without the sqrt, mag^2 - 1 ~= 2 (mag - 1)
+    auto temp = magSq() - 1;
+    return (temp < 2e-6) && (temp > -(2e-6));
   }
 
-  [[nodiscard]] float
-  angle(const Vector2 & b) const
+  [[nodiscard]] T
+  angle(const Vector2T & b) const
   {
     auto  s = *this * b;
-    float p = s.x + s.y;
-    float q = this->mag() * b.mag();
+    T p = s.x + s.y;
+    T q = this->mag() * b.mag();
 
     return std::acos(p / q);
   }
   void
-  clipMag(float clipm)
+  clipMag(T clipm)
   {
     assert(clipm > 0.0f);
-    const float rad = magSq() / (clipm * clipm);
+    const T rad = magSq() / (clipm * clipm);
     if (rad > 1.0f) {
-      (*this) /= std::sqrt(rad);
+      (*this) = divBySqrt(*this, rad);
     }
   }
 
   // General static inits.
-  static Vector2
+  static constexpr Vector2T
   zero()
   {
-    return Vector2(0.0f);
+    return Vector2T(T(0));
   }
-  static Vector2
+  static constexpr Vector2T
   ones()
   {
-    return Vector2(1.0f);
+    return Vector2T(T(1));
   }
-  static Vector2
+  static constexpr Vector2T
   unitX()
   {
-    return Vector2(1, 0);
+    return Vector2T(T(1), T(0));
   }
-  static Vector2
+  static constexpr Vector2T
   unitY()
   {
-    return Vector2(0, 1);
+    return Vector2T(T(0), T(1));
   }
 
   // General value-setters
-  void
-  set(float xin, float yin)
+  constexpr void
+  set(T xin, T yin)
   {
     x = xin;
     y = yin;
   }
-  void
+  constexpr void
   setZero()
   {
-    x = 0.0f;
-    y = 0.0f;
+    x = T(0);
+    y = T(0);
   }
-  void
+  constexpr void
   setOnes()
   {
-    x = 1.0f;
-    y = 1.0f;
+    x = T(1);
+    y = T(1);
   }
-  void
+  constexpr void
   setUnitX()
   {
-    x = 1.0f;
-    y = 0.0f;
+    x = T(1);
+    y = T(0);
   }
-  void
+  constexpr void
   setUnitY()
   {
-    x = 0.0f;
-    y = 1.0f;
+    x = T(0);
+    y = T(1);
   }
 
   // Basic operations
-  Vector2
-  operator+(float b) const
+  constexpr Vector2T
+  operator+(T b) const
   {
-    return Vector2(x + b, y + b);
+    return Vector2T(x + b, y + b);
   }
-  Vector2
-  operator-(float b) const
+  constexpr Vector2T
+  operator-(T b) const
   {
-    return Vector2(x - b, y - b);
+    return Vector2T(x - b, y - b);
   }
-  Vector2
-  operator*(float b) const
+  constexpr Vector2T
+  operator*(T b) const
   {
-    return Vector2(x * b, y * b);
+    return Vector2T(x * b, y * b);
   }
-  Vector2
-  operator/(float b) const
+  constexpr Vector2T
+  operator/(T b) const
   {
-    return Vector2(x / b, y / b);
+    return Vector2T(x / b, y / b);
   }
-  Vector2
-  operator+(const Vector2 & b) const
+  constexpr Vector2T
+  operator+(const Vector2T & b) const
   {
-    return Vector2(x + b.x, y + b.y);
+    return Vector2T(x + b.x, y + b.y);
   }
-  Vector2
-  operator-(const Vector2 & b) const
+  constexpr Vector2T
+  operator-(const Vector2T & b) const
   {
-    return Vector2(x - b.x, y - b.y);
+    return Vector2T(x - b.x, y - b.y);
   }
-  Vector2
-  operator*(const Vector2 & b) const
+  constexpr Vector2T
+  operator*(const Vector2T & b) const
   {
-    return Vector2(x * b.x, y * b.y);
+    return Vector2T(x * b.x, y * b.y);
   }
-  Vector2
-  operator/(const Vector2 & b) const
+  constexpr Vector2T
+  operator/(const Vector2T & b) const
   {
-    return Vector2(x / b.x, y / b.y);
+    return Vector2T(x / b.x, y / b.y);
   }
-  void
-  operator+=(float b)
+  constexpr void
+  operator+=(T b)
   {
     x += b;
     y += b;
   }
-  void
-  operator-=(float b)
+  constexpr void
+  operator-=(T b)
   {
     x -= b;
     y -= b;
   }
-  void
-  operator*=(float b)
+  constexpr void
+  operator*=(T b)
   {
     x *= b;
     y *= b;
   }
-  void
-  operator/=(float b)
+  constexpr void
+  operator/=(T b)
   {
     x /= b;
     y /= b;
   }
-  void
-  operator+=(const Vector2 & b)
+  constexpr void
+  operator+=(const Vector2T & b)
   {
     x += b.x;
     y += b.y;
   }
-  void
-  operator-=(const Vector2 & b)
+  constexpr void
+  operator-=(const Vector2T & b)
   {
     x -= b.x;
     y -= b.y;
   }
-  void
-  operator*=(const Vector2 & b)
+  constexpr void
+  operator*=(const Vector2T & b)
   {
     x *= b.x;
     y *= b.y;
   }
-  void
-  operator/=(const Vector2 & b)
+  constexpr void
+  operator/=(const Vector2T & b)
   {
     x /= b.x;
     y /= b.y;
   }
-  Vector2
+  constexpr Vector2T
   operator-() const
   {
-    return Vector2(-x, -y);
+    return Vector2T(-x, -y);
+  }
+
+  private:
+  // 1 / mag, 0 when mag^2 is 0 or denormal so rsqrt never sees it
+  [[nodiscard]] T
+  safeInvMag() const
+  {
+    const T sq = magSq();
+    return (sq >= std::numeric_limits<T>::min()) ? invSqrt(sq) : T(0);
   }
 };
 
-class Vector3 {
+template<typename T>
+class Vector3T {
   public:
   // Components
-  float x = 0.0f;
-  float y = 0.0f;
-  float z = 0.0f;
+  T x{};
+  T y{};
+  T z{};
 
   // Constructors
-  Vector3() = default;
-  explicit Vector3(float b) : x(b), y(b), z(b) {}
-  explicit Vector3(const Vector2 & xy, float z) : x(xy.x), y(xy.y), z(z) {}
-  explicit Vector3(float x, float y, float z) : x(x), y(y), z(z) {}
+  Vector3T() = default;
+  constexpr explicit Vector3T(T b) : x(b), y(b), z(b) {}
+  constexpr explicit Vector3T(const Vector2T<T> & xy, T z) : x(xy.x), y(xy.y), z(z) {}
+  constexpr explicit Vector3T(T x, T y, T z) : x(x), y(y), z(z) {}
+  template<typename U>
+  constexpr explicit Vector3T(const Vector3T<U> & b)
+      : x(static_cast<T>(b.x)), y(static_cast<T>(b.y)), z(static_cast<T>(b.z))
+  {
+  }
 
   // General
   // Get point on local XY plane
-  [[nodiscard]] Vector2
+  [[nodiscard]] constexpr Vector2T<T>
   xy() const
   {
-    return Vector2(x, y);
+    return Vector2T<T>(x, y);
   }
 
   // Get point on local XZ plane
-  [[nodiscard]] Vector2
+  [[nodiscard]] constexpr Vector2T<T>
   xz() const
   {
-    return Vector2(x, z);
+    return Vector2T<T>(x, z);
   }
 
   // Get point on local XZ plane
-  [[nodiscard]] Vector2
+  [[nodiscard]] constexpr Vector2T<T>
   yz() const
   {
-    return Vector2(y, z);
+    return Vector2T<T>(y, z);
   }
 
   // Vector operations
-  [[nodiscard]] float
-  dotp(const Vector3 & b) const
+  [[nodiscard]] constexpr T
+  dotp(const Vector3T & b) const
   {
     return (x * b.x) + (y * b.y) + (z * b.z);
   }
-  [[nodiscard]] Vector3
-  cross(const Vector3 & b) const
+  [[nodiscard]] constexpr Vector3T
+  cross(const Vector3T & b) const
   {
-    return Vector3(
+    return Vector3T(
         (y * b.z - z * b.y), (z * b.x - x * b.z), (x * b.y - y * b.x));
   }
-  [[nodiscard]] float
+  [[nodiscard]] constexpr T
   magSq() const
   {
     return (x * x) + (y * y) + (z * z);
   }
-  [[nodiscard]] float
+  [[nodiscard]] T
   mag() const
   {
     return std::sqrt(magSq());
   }
 
-  // Vectors normalization
+  // Vectors normalization, divBySqrt() follows HB_FAST_NORMALIZE
+  void
+  normalize() // Unsafe
+  {
+    (*this) = divBySqrt(*this, magSq());
+  }
+  [[nodiscard]] Vector3T
+  normalized() const // Unsafe
+  {
+    return divBySqrt(*this, magSq());
+  }
+  // Zero length stays zero instead of becoming NaN
   void
-  normalize()
+  normalizeSafe()
   {
-    (*this) /= mag();
+    (*this) *= safeInvMag();
   }
-  [[nodiscard]] Vector3
-  normalized() const
+  [[nodiscard]] Vector3T
+  normalizedSafe() const
   {
-    return (*this) / mag();
+    return (*this) * safeInvMag();
   }
 
-  [[nodiscard]] float
-  angle(const Vector3 & b) const
+  [[nodiscard]] T
+  angle(const Vector3T & b) const
   {
     return std::acos(normalized().dotp(b.normalized()));
   }
 
   void
-  clipMag(float clipm)
+  clipMag(T clipm)
   {
     assert(clipm > 0.0f);
-    const float rad = magSq() / (clipm * clipm);
+    const T rad = magSq() / (clipm * clipm);
     if (rad > 1.0f) {
-      (*this) /= std::sqrt(rad);
+      (*this) = divBySqrt(*this, rad);
     }
   }
 
-  [[nodiscard]] bool
+  [[nodiscard]] constexpr bool
   isNormDeviceCoords() const
   {
     return (x > -1.0f && x < 1.0f && y > -1.0f && y < 1.0f && z > -1.0f &&
@@ -359,135 +424,136 @@ class Vector3 {
   [[nodiscard]] bool
   isNorm() const
   {
-    auto temp = mag() - 1.0f;
-    return (temp < 1e-6f) && (temp > -(1e-6f));
+    // |mag - 1| < 1e-6 without the sqrt, mag^2 - 1 ~= 2 (mag - 1)
+    auto temp = magSq() - 1.0f;
+    return (temp < 2e-6f) && (temp > -(2e-6f));
   }
 
   // General static inits
   // zero init Vector 3
-  static Vector3
+  static constexpr Vector3T
   zero()
   {
-    return Vector3(0.0f);
+    return Vector3T(T(0));
   }
 
   // Fill-init vector3 with 1
-  static Vector3
+  static constexpr Vector3T
   ones()
   {
-    return Vector3(1.0f);
+    return Vector3T(T(1));
   }
 
   // Init vector3 unitvector; x
-  static Vector3
+  static constexpr Vector3T
   unitX()
   {
-    return Vector3(1.0f, 0.0f, 0.0f);
+    return Vector3T(T(1), T(0), T(0));
   }
 
   // Init vector3 unitvector; y
-  static Vector3
+  static constexpr Vector3T
   unitY()
   {
-    return Vector3(0.0f, 1.0f, 0.0f);
+    return Vector3T(T(0), T(1), T(0));
   }
 
   // Init vector3 unitvector; z
-  static Vector3
+  static constexpr Vector3T
   unitZ()
   {
-    return Vector3(0.0f, 0.0f, 1.0f);
+    return Vector3T(T(0), T(0), T(1));
   }
 
   // General setters
-  void
-  set(float xin, float yin, float zin)
+  constexpr void
+  set(T xin, T yin, T zin)
   {
     x = xin;
     y = yin;
     z = zin;
   }
-  void
+  constexpr void
   setZero()
   {
-    x = 0.0f;
-    y = 0.0f;
-    z = 0.0f;
+    x = T(0);
+    y = T(0);
+    z = T(0);
   }
-  void
+  constexpr void
   setOnes()
   {
-    x = 1.0f;
-    y = 1.0f;
-    z = 1.0f;
+    x = T(1);
+    y = T(1);
+    z = T(1);
   }
-  void
+  constexpr void
   setUnitX()
   {
-    x = 1.0f;
-    y = 0.0f;
-    z = 0.0f;
+    x = T(1);
+    y = T(0);
+    z = T(0);
   }
-  void
+  constexpr void
   setUnitY()
   {
-    x = 0.0f;
-    y = 1.0f;
-    z = 0.0f;
+    x = T(0);
+    y = T(1);
+    z = T(0);
   }
-  void
+  constexpr void
   setUnitZ()
   {
-    x = 0.0f;
-    y = 0.0f;
-    z = 1.0f;
+    x = T(0);
+    y = T(0);
+    z = T(1);
   }
 
   // Operation overrides, Operations with a scalar
-  Vector3
-  operator+(float b) const
+  constexpr Vector3T
+  operator+(T b) const
   {
-    return Vector3((x + b), (y + b), (z + b));
+    return Vector3T((x + b), (y + b), (z + b));
   }
-  Vector3
-  operator-(float b) const
+  constexpr Vector3T
+  operator-(T b) const
   {
-    return Vector3((x - b), (y - b), (z - b));
+    return Vector3T((x - b), (y - b), (z - b));
   }
-  Vector3
-  operator*(float b) const
+  constexpr Vector3T
+  operator*(T b) const
   {
-    return Vector3((x * b), (y * b), (z * b));
+    return Vector3T((x * b), (y * b), (z * b));
   }
-  Vector3
-  operator/(float b) const
+  constexpr Vector3T
+  operator/(T b) const
   {
-    return Vector3((x / b), (y / b), (z / b));
+    return Vector3T((x / b), (y / b), (z / b));
   }
 
-  void
-  operator+=(float b)
+  constexpr void
+  operator+=(T b)
   {
     x += b;
     y += b;
     z += b;
   }
-  void
-  operator-=(float b)
+  constexpr void
+  operator-=(T b)
   {
     x -= b;
     y -= b;
     z -= b;
   }
-  void
-  operator*=(float b)
+  constexpr void
+  operator*=(T b)
   {
     x *= b;
     y *= b;
     z *= b;
   }
-  void
-  operator/=(float b)
+  constexpr void
+  operator/=(T b)
   {
     x /= b;
     y /= b;
@@ -495,50 +561,50 @@ class Vector3 {
   }
 
   // Operation overrides, Operations with another vector
-  Vector3
-  operator+(const Vector3 & b) const
+  constexpr Vector3T
+  operator+(const Vector3T & b) const
   {
-    return Vector3((x + b.x), (y + b.y), (z + b.z));
+    return Vector3T((x + b.x), (y + b.y), (z + b.z));
   }
-  Vector3
-  operator-(const Vector3 & b) const
+  constexpr Vector3T
+  operator-(const Vector3T & b) const
   {
-    return Vector3((x - b.x), (y - b.y), (z - b.z));
+    return Vector3T((x - b.x), (y - b.y), (z - b.z));
   }
-  Vector3
-  operator*(const Vector3 & b) const
+  constexpr Vector3T
+  operator*(const Vector3T & b) const
   {
-    return Vector3((x * b.x), (y * b.y), (z * b.z));
+    return Vector3T((x * b.x), (y * b.y), (z * b.z));
   }
-  Vector3
-  operator/(const Vector3 & b) const
+  constexpr Vector3T
+  operator/(const Vector3T & b) const
   {
-    return Vector3((x / b.x), (y / b.y), (z / b.z));
+    return Vector3T((x / b.x), (y / b.y), (z / b.z));
   }
 
-  void
-  operator+=(const Vector3 & b)
+  constexpr void
+  operator+=(const Vector3T & b)
   {
     x += b.x;
     y += b.y;
     z += b.z;
   }
-  void
-  operator-=(const Vector3 & b)
+  constexpr void
+  operator-=(const Vector3T & b)
   {
     x -= b.x;
     y -= b.y;
     z -= b.z;
   }
-  void
-  operator*=(const Vector3 & b)
+  constexpr void
+  operator*=(const Vector3T & b)
   {
     x *= b.x;
     y *= b.y;
     z *= b.z;
   }
-  void
-  operator/=(const Vector3 & b)
+  constexpr void
+  operator/=(const Vector3T & b)
   {
     x /= b.x;
     y /= b.y;
@@ -546,102 +612,131 @@ class Vector3 {
   }
 
   // Misc. operations
-  Vector3
+  constexpr Vector3T
   operator-() const
   {
-    return Vector3(-x, -y, -z);
+    return Vector3T(-x, -y, -z);
   }
 
-  Vector3
-  operator>(const Vector3 & b) const
+  constexpr Vector3T
+  operator>(const Vector3T & b) const
   {
     // Cross
-    return Vector3(
+    return Vector3T(
         (y * b.z - z * b.y), (z * b.x - x * b.z), (x * b.y - y * b.x));
   }
 
-  float
-  operator<(const Vector3 & b) const
+  constexpr T
+  operator<(const Vector3T & b) const
   {
     // Dot
     return (x * b.x) + (y * b.y) + (z * b.z);
   }
+
+  private:
+  // 1 / mag, 0 when mag^2 is 0 or denormal so rsqrt never sees it
+  [[nodiscard]] T
+  safeInvMag() const
+  {
+    const T sq = magSq();
+    return (sq >= std::numeric_limits<T>::min()) ? invSqrt(sq) : T(0);
+  }
 };
 
-class Vector4 {
+template<typename T>
+class Vector4T {
   public:
   // Components
-  float x = 0.0f;
-  float y = 0.0f;
-  float z = 0.0f;
-  float w = 0.0f;
-
-  Vector4() = default;
-  explicit Vector4(float b) : x(b), y(b), z(b), w(b) {}
-  explicit Vector4(const Vector3 & xyz, float w)
+  T x{};
+  T y{};
+  T z{};
+  T w{};
+
+  Vector4T() = default;
+  constexpr explicit Vector4T(T b) : x(b), y(b), z(b), w(b) {}
+  constexpr explicit Vector4T(const Vector3T<T> & xyz, T w)
       : x(xyz.x), y(xyz.y), z(xyz.z), w(w)
   {
   }
-  explicit Vector4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w)
+  constexpr explicit Vector4T(T x, T y, T z, T w) : x(x), y(y), z(z), w(w)
+  {
+  }
+  template<typename U>
+  constexpr explicit Vector4T(const Vector4T<U> & b)
+      : x(static_cast<T>(b.x)), y(static_cast<T>(b.y)), z(static_cast<T>(b.z)),
+        w(static_cast<T>(b.w))
   {
   }
 
   // Magnitude and Magnitude squared
-  [[nodiscard]] float
+  [[nodiscard]] constexpr T
   magSq() const
   {
     return (x * x) + (y * y) + (z * z) + (w * w);
   }
-  [[nodiscard]] float
+  [[nodiscard]] T
   mag() const
   {
     return std::sqrt(magSq());
   }
 
-  // Normalization
+  // Normalization, divBySqrt() follows HB_FAST_NORMALIZE
   void
-  normalize()
+  normalize() // Unsafe
   {
-    (*this) /= mag();
+    (*this) = divBySqrt(*this, magSq());
+  }
+  // Zero length stays zero instead of becoming NaN
+  void
+  normalizeSafe()
+  {
+    (*this) *= safeInvMag();
+  }
+  [[nodiscard]] bool
+  isNorm() const
+  {
+    // |mag - 1| < 1e-6 without the sqrt, mag^2 - 1 ~= 2 (mag - 1)
+    auto temp = magSq() - 1.0f;
+    return (temp < 2e-6f) && (temp > -(2e-6f));
   }
 
-  [[nodiscard]] Vector3
+  [[nodiscard]] constexpr Vector3T<T>
   xyz() const
   {
-    return Vector3(x, y, z);
+    return Vector3T<T>(x, y, z);
   }
-  [[nodiscard]] Vector3
+  [[nodiscard]] Vector3T<T>
   xyzNormalized() const
   {
-    return Vector3(x, y, z).normalized();
+    return Vector3T<T>(x, y, z).normalized();
   }
-  [[nodiscard]] Vector3
+  [[nodiscard]] constexpr Vector3T<T>
   homogenized() const
   {
-    return Vector3((x / w), (y / w), (z / w));
+    return Vector3T<T>((x / w), (y / w), (z / w));
   }
 
   // Operation overrides
-  Vector4
-  operator*(float b) const
+  constexpr Vector4T
+  operator*(T b) const
   {
-    return Vector4((x * b), (y * b), (z * b), (w * b));
+    return Vector4T((x * b), (y * b), (z * b), (w * b));
   }
-  Vector4
-  operator/(float b) const
+  constexpr Vector4T
+  operator/(T b) const
   {
-    return Vector4((x / b), (y / b), (z / b), (w / b));
+    return Vector4T((x / b), (y / b), (z / b), (w / b));
   }
-  void
-  operator*=(float b)
+  constexpr void
+  operator*=(T b)
   {
     x *= b;
     y *= b;
     z *= b;
     w *= b;
   }
-  void
-  operator/=(float b)
+  constexpr void
+  operator/=(T b)
   {
     x /= b;
     y /= b;
@@ -649,11 +744,34 @@ class Vector4 {
     w /= b;
   }
 
-  [[nodiscard]] float
-  dotp(const Vector4 & b) const
+  [[nodiscard]] constexpr T
+  dotp(const Vector4T & b) const
   {
     return (x * b.x) + (y * b.y) + (z * b.z) + (w * b.w);
   }
+
+  private:
+  // 1 / mag, 0 when mag^2 is 0 or denormal so rsqrt never sees it
+  [[nodiscard]] T
+  safeInvMag() const
+  {
+    const T sq = magSq();
+    return (sq >= std::numeric_limits<T>::min()) ? invSqrt(sq) : T(0);
+  }
 };
 
+// float is what the rest of the engine computes in. Half is storage only,
+// widen it with the converting constructors or convertPrecision() first.
+// The builders and setters spell constants as T(0) and T(1), so zero(),
+// unitX(), setZero() and the like work on Half too.
+using Vector2 = Vector2T<float>;
+using Vector3 = Vector3T<float>;
+using Vector4 = Vector4T<float>;
+using Vector2d = Vector2T<double>;
+using Vector3d = Vector3T<double>;
+using Vector4d = Vector4T<double>;
+using Vector2h = Vector2T<Half>;
+using Vector3h = Vector3T<Half>;
+using Vector4h = Vector4T<Half>;
+
 #endif // VECTOR_HH
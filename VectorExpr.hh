@@ -0,0 +1,455 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Opt-in expression templates over Vector2/3/4 and Matrix4. Wrapping an
+ * operand in lazy() makes the operators build a small expression tree
+ * instead of a temporary per step, the whole tree is evaluated component by
+ * component when it is converted back to the vector/matrix type:
+ *
+ *   Vector3 v = lazy(a) * s + lazy(b).cross(c) - d;  // one pass, no temps
+ *
+ * Expressions hold references to their leaves, so evaluate them within the
+ * full expression that built them, never keep one in an auto variable.
+ * cross() reads every operand component twice, so nested crosses redo the
+ * inner arithmetic rather than spilling it, which is still cheaper than the
+ * temporaries for the shallow expressions this is meant for.
+ */
+#ifndef VECTOR_EXPR_HH
+#define VECTOR_EXPR_HH
+#include "Matrix.hh"
+#include "Vector.hh"
+
+#include <utility>
+
+template<typename V>
+class VecSize;
+template<>
+class VecSize<Vector2> {
+  public:
+  static constexpr int value = 2;
+};
+template<>
+class VecSize<Vector3> {
+  public:
+  static constexpr int value = 3;
+};
+template<>
+class VecSize<Vector4> {
+  public:
+  static constexpr int value = 4;
+};
+
+template<int I, typename V>
+constexpr float
+vecComponent(const V & v)
+{
+  if constexpr (I == 0) {
+    return v.x;
+  } else if constexpr (I == 1) {
+    return v.y;
+  } else if constexpr (I == 2) {
+    return v.z;
+  } else {
+    return v.w;
+  }
+}
+
+// Element wise operations shared by the vector and matrix nodes
+class ExprAdd {
+  public:
+  static constexpr float
+  apply(float a, float b)
+  {
+    return a + b;
+  }
+};
+class ExprSub {
+  public:
+  static constexpr float
+  apply(float a, float b)
+  {
+    return a - b;
+  }
+};
+class ExprMul {
+  public:
+  static constexpr float
+  apply(float a, float b)
+  {
+    return a * b;
+  }
+};
+class ExprDiv {
+  public:
+  static constexpr float
+  apply(float a, float b)
+  {
+    return a / b;
+  }
+};
+
+template<typename V>
+class VecLeaf;
+template<typename L, typename R>
+class VecCross;
+
+/**
+ * Base of every vector expression node, E is the node, V the vector type it
+ * evaluates to. Nodes provide template<int I> float at() const.
+ */
+template<typename E, typename V>
+class VecExpr {
+  public:
+  static constexpr int size = VecSize<V>::value;
+
+  [[nodiscard]] constexpr const E &
+  self() const
+  {
+    return static_cast<const E &>(*this);
+  }
+
+  [[nodiscard]] constexpr V
+  eval() const
+  {
+    return evalImpl(std::make_integer_sequence<int, size>{});
+  }
+  constexpr operator V() const // NOLINT, implicit on purpose
+  {
+    return eval();
+  }
+
+  // Vector operations
+  template<typename R>
+  [[nodiscard]] constexpr float
+  dotp(const VecExpr<R, V> & b) const
+  {
+    return dotpImpl(b.self(), std::make_integer_sequence<int, size>{});
+  }
+  [[nodiscard]] constexpr float
+  magSq() const
+  {
+    return dotp(*this);
+  }
+  [[nodiscard]] constexpr float
+  dotp(const V & b) const
+  {
+    return dotpImpl(VecLeaf<V>(b), std::make_integer_sequence<int, size>{});
+  }
+  template<typename R>
+  [[nodiscard]] constexpr VecCross<E, R>
+  cross(const VecExpr<R, V> & b) const
+  {
+    static_assert(size == 3, "cross is only defined for Vector3");
+    return VecCross<E, R>(self(), b.self());
+  }
+  [[nodiscard]] constexpr VecCross<E, VecLeaf<V>>
+  cross(const V & b) const
+  {
+    static_assert(size == 3, "cross is only defined for Vector3");
+    return VecCross<E, VecLeaf<V>>(self(), VecLeaf<V>(b));
+  }
+
+  private:
+  template<int... I>
+  constexpr V
+  evalImpl(std::integer_sequence<int, I...>) const
+  {
+    return V(self().template at<I>()...);
+  }
+  template<typename R, int... I>
+  constexpr float
+  dotpImpl(const R & b, std::integer_sequence<int, I...>) const
+  {
+    return ((self().template at<I>() * b.template at<I>()) + ...);
+  }
+};
+
+template<typename V>
+class VecLeaf : public VecExpr<VecLeaf<V>, V> {
+  public:
+  constexpr explicit VecLeaf(const V & v) : v(v) {}
+
+  template<int I>
+  [[nodiscard]] constexpr float
+  at() const
+  {
+    return vecComponent<I>(v);
+  }
+
+  const V & v;
+};
+
+template<typename L, typename R, typename Op, typename V>
+class VecBinary : public VecExpr<VecBinary<L, R, Op, V>, V> {
+  public:
+  constexpr VecBinary(const L & l, const R & r) : l(l), r(r) {}
+
+  template<int I>
+  [[nodiscard]] constexpr float
+  at() const
+  {
+    return Op::apply(l.template at<I>(), r.template at<I>());
+  }
+
+  L l;
+  R r;
+};
+
+template<typename L, typename Op, typename V>
+class VecScalar : public VecExpr<VecScalar<L, Op, V>, V> {
+  public:
+  constexpr VecScalar(const L & l, float s) : l(l), s(s) {}
+
+  template<int I>
+  [[nodiscard]] constexpr float
+  at() const
+  {
+    return Op::apply(l.template at<I>(), s);
+  }
+
+  L     l;
+  float s;
+};
+
+template<typename L, typename V>
+class VecNeg : public VecExpr<VecNeg<L, V>, V> {
+  public:
+  constexpr explicit VecNeg(const L & l) : l(l) {}
+
+  template<int I>
+  [[nodiscard]] constexpr float
+  at() const
+  {
+    return -l.template at<I>();
+  }
+
+  L l;
+};
+
+template<typename L, typename R>
+class VecCross : public VecExpr<VecCross<L, R>, Vector3> {
+  public:
+  constexpr VecCross(const L & l, const R & r) : l(l), r(r) {}
+
+  template<int I>
+  [[nodiscard]] constexpr float
+  at() const
+  {
+    constexpr int j = (I + 1) % 3;
+    constexpr int k = (I + 2) % 3;
+    return l.template at<j>() * r.template at<k>() -
+           l.template at<k>() * r.template at<j>();
+  }
+
+  L l;
+  R r;
+};
+
+// Entry points
+[[nodiscard]] constexpr VecLeaf<Vector2>
+lazy(const Vector2 & v)
+{
+  return VecLeaf<Vector2>(v);
+}
+[[nodiscard]] constexpr VecLeaf<Vector3>
+lazy(const Vector3 & v)
+{
+  return VecLeaf<Vector3>(v);
+}
+[[nodiscard]] constexpr VecLeaf<Vector4>
+lazy(const Vector4 & v)
+{
+  return VecLeaf<Vector4>(v);
+}
+
+// Vector expression operators, at least one side is already an expression
+#define HB_VEC_EXPR_BINARY(OP, NAME)                                          \
+  template<typename L, typename R, typename V>                                \
+  constexpr VecBinary<L, R, NAME, V> operator OP(const VecExpr<L, V> & a,     \
+                                                 const VecExpr<R, V> & b)     \
+  {                                                                           \
+    return VecBinary<L, R, NAME, V>(a.self(), b.self());                      \
+  }                                                                           \
+  template<typename L, typename V>                                            \
+  constexpr VecBinary<L, VecLeaf<V>, NAME, V> operator OP(                    \
+      const VecExpr<L, V> & a, const V & b)                                   \
+  {                                                                           \
+    return VecBinary<L, VecLeaf<V>, NAME, V>(a.self(), VecLeaf<V>(b));        \
+  }                                                                           \
+  template<typename R, typename V>                                            \
+  constexpr VecBinary<VecLeaf<V>, R, NAME, V> operator OP(                    \
+      const V & a, const VecExpr<R, V> & b)                                   \
+  {                                                                           \
+    return VecBinary<VecLeaf<V>, R, NAME, V>(VecLeaf<V>(a), b.self());        \
+  }                                                                           \
+  template<typename L, typename V>                                            \
+  constexpr VecScalar<L, NAME, V> operator OP(const VecExpr<L, V> & a,        \
+                                              float b)                        \
+  {                                                                           \
+    return VecScalar<L, NAME, V>(a.self(), b);                                \
+  }
+
+HB_VEC_EXPR_BINARY(+, ExprAdd)
+HB_VEC_EXPR_BINARY(-, ExprSub)
+HB_VEC_EXPR_BINARY(*, ExprMul)
+HB_VEC_EXPR_BINARY(/, ExprDiv)
+#undef HB_VEC_EXPR_BINARY
+
+template<typename R, typename V>
+constexpr VecScalar<R, ExprMul, V>
+operator*(float a, const VecExpr<R, V> & b)
+{
+  return VecScalar<R, ExprMul, V>(b.self(), a);
+}
+template<typename L, typename V>
+constexpr VecNeg<L, V>
+operator-(const VecExpr<L, V> & a)
+{
+  return VecNeg<L, V>(a.self());
+}
+
+/**
+ * Matrix4 expressions: element wise sums, differences and scaling. Products
+ * are left to Matrix4::operator*, whose SIMD kernels beat a per cell dot
+ * product, wrap its result in lazy() to keep going. Nodes provide
+ * float at(int cell) const.
+ */
+template<typename E>
+class MatExpr {
+  public:
+  [[nodiscard]] constexpr const E &
+  self() const
+  {
+    return static_cast<const E &>(*this);
+  }
+
+  [[nodiscard]] constexpr Matrix4
+  eval() const
+  {
+    Matrix4 out;
+    for (int i = 0; i < 16; ++i) {
+      out.cells[i] = self().at(i);
+    }
+    return out;
+  }
+  constexpr operator Matrix4() const // NOLINT, implicit on purpose
+  {
+    return eval();
+  }
+};
+
+class MatLeaf : public MatExpr<MatLeaf> {
+  public:
+  constexpr explicit MatLeaf(const Matrix4 & m) : m(m) {}
+
+  [[nodiscard]] constexpr float
+  at(int i) const
+  {
+    return m.cells[i];
+  }
+
+  const Matrix4 & m;
+};
+
+template<typename L, typename R, typename Op>
+class MatBinary : public MatExpr<MatBinary<L, R, Op>> {
+  public:
+  constexpr MatBinary(const L & l, const R & r) : l(l), r(r) {}
+
+  [[nodiscard]] constexpr float
+  at(int i) const
+  {
+    return Op::apply(l.at(i), r.at(i));
+  }
+
+  L l;
+  R r;
+};
+
+template<typename L, typename Op>
+class MatScalar : public MatExpr<MatScalar<L, Op>> {
+  public:
+  constexpr MatScalar(const L & l, float s) : l(l), s(s) {}
+
+  [[nodiscard]] constexpr float
+  at(int i) const
+  {
+    return Op::apply(l.at(i), s);
+  }
+
+  L     l;
+  float s;
+};
+
+template<typename L>
+class MatNeg : public MatExpr<MatNeg<L>> {
+  public:
+  constexpr explicit MatNeg(const L & l) : l(l) {}
+
+  [[nodiscard]] constexpr float
+  at(int i) const
+  {
+    return -l.at(i);
+  }
+
+  L l;
+};
+
+[[nodiscard]] constexpr MatLeaf
+lazy(const Matrix4 & m)
+{
+  return MatLeaf(m);
+}
+
+#define HB_MAT_EXPR_BINARY(OP, NAME)                                          \
+  template<typename L, typename R>                                            \
+  constexpr MatBinary<L, R, NAME> operator OP(const MatExpr<L> & a,           \
+                                              const MatExpr<R> & b)           \
+  {                                                                           \
+    return MatBinary<L, R, NAME>(a.self(), b.self());                         \
+  }                                                                           \
+  template<typename L>                                                        \
+  constexpr MatBinary<L, MatLeaf, NAME> operator OP(const MatExpr<L> & a,     \
+                                                    const Matrix4 & b)        \
+  {                                                                           \
+    return MatBinary<L, MatLeaf, NAME>(a.self(), MatLeaf(b));                 \
+  }                                                                           \
+  template<typename R>                                                        \
+  constexpr MatBinary<MatLeaf, R, NAME> operator OP(const Matrix4 & a,        \
+                                                    const MatExpr<R> & b)     \
+  {                                                                           \
+    return MatBinary<MatLeaf, R, NAME>(MatLeaf(a), b.self());                 \
+  }
+
+HB_MAT_EXPR_BINARY(+, ExprAdd)
+HB_MAT_EXPR_BINARY(-, ExprSub)
+#undef HB_MAT_EXPR_BINARY
+
+template<typename L>
+constexpr MatScalar<L, ExprMul>
+operator*(const MatExpr<L> & a, float b)
+{
+  return MatScalar<L, ExprMul>(a.self(), b);
+}
+template<typename R>
+constexpr MatScalar<R, ExprMul>
+operator*(float a, const MatExpr<R> & b)
+{
+  return MatScalar<R, ExprMul>(b.self(), a);
+}
+// Times 1 / b like Matrix4::operator/=, so lazy and plain round the same
+template<typename L>
+constexpr MatScalar<L, ExprMul>
+operator/(const MatExpr<L> & a, float b)
+{
+  return MatScalar<L, ExprMul>(a.self(), 1.0f / b);
+}
+template<typename L>
+constexpr MatNeg<L>
+operator-(const MatExpr<L> & a)
+{
+  return MatNeg<L>(a.self());
+}
+
+#endif // VECTOR_EXPR_HH
@@ -0,0 +1,630 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Structure-of-arrays streams of Vector3/Vector4 and element wise kernels
+ * mirroring their member functions. Each component lives in its own 64 byte
+ * aligned array, padded to a multiple of 16 floats, so every kernel runs on
+ * full FloatV registers. Padding lanes are zero after construction and hold
+ * unspecified values after a kernel ran.
+ */
+#ifndef VECTOR_SOA_HH
+#define VECTOR_SOA_HH
+#include "Parallel.hh"
+#include "Simd.hh"
+#include "Vector.hh"
+
+#include <cassert>
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+// Backing store for N float component arrays of equal length
+template<int N>
+class SoAStorage {
+  public:
+  // Floats per component array, multiple of 16 so it also fits AVX-512
+  static constexpr std::size_t
+  padded(std::size_t n)
+  {
+    return (n + 15) & ~static_cast<std::size_t>(15);
+  }
+
+  // Bytes of one block holding all N arrays of n elements
+  static constexpr std::size_t
+  bytes(std::size_t n)
+  {
+    return N * padded(n) * sizeof(float);
+  }
+
+  float *     comp[N] = {nullptr};
+  std::size_t count = 0;
+  std::size_t stride = 0;
+  bool        owned = true; // comp[0] came from simdAlignedAlloc
+
+  SoAStorage() = default;
+  explicit SoAStorage(std::size_t n)
+  {
+    resize(n);
+  }
+  /**
+   * Borrows block, bytes(n) long and simdAlignment aligned, e.g. from a
+   * FrameArena. Only the padding is zeroed, elements start unspecified.
+   * block is never freed, a resize() to another stride moves to the heap.
+   */
+  SoAStorage(std::size_t n, float * block)
+      : count(n), stride(padded(n)), owned(false)
+  {
+    for (int c = 0; c < N; ++c) {
+      comp[c] = (stride != 0) ? block + c * stride : nullptr;
+      if (stride != n) {
+        std::memset(comp[c] + n, 0, (stride - n) * sizeof(float));
+      }
+    }
+  }
+  SoAStorage(const SoAStorage & b)
+  {
+    resize(b.count);
+    if (stride != 0) {
+      std::memcpy(comp[0], b.comp[0], N * stride * sizeof(float));
+    }
+  }
+  SoAStorage(SoAStorage && b) noexcept
+  {
+    swap(b);
+  }
+  ~SoAStorage()
+  {
+    if (owned) {
+      simdAlignedFree(comp[0]);
+    }
+  }
+  SoAStorage &
+  operator=(SoAStorage b) noexcept
+  {
+    swap(b);
+    return *this;
+  }
+
+  void
+  swap(SoAStorage & b) noexcept
+  {
+    for (int c = 0; c < N; ++c) {
+      std::swap(comp[c], b.comp[c]);
+    }
+    std::swap(count, b.count);
+    std::swap(stride, b.stride);
+    std::swap(owned, b.owned);
+  }
+
+  // Keeps the first min(size, n) elements, new elements are zero
+  void
+  resize(std::size_t n)
+  {
+    const std::size_t new_stride = padded(n);
+    if (new_stride != stride) {
+      float * block = nullptr;
+      if (new_stride != 0) {
+        block = static_cast<float *>(
+            simdAlignedAlloc(N * new_stride * sizeof(float)));
+        std::memset(block, 0, N * new_stride * sizeof(float));
+      }
+      const std::size_t keep = count < n ? count : n;
+      for (int c = 0; c < N; ++c) {
+        if (keep != 0) {
+          std::memcpy(block + c * new_stride, comp[c], keep * sizeof(float));
+        }
+      }
+      if (owned) {
+        simdAlignedFree(comp[0]);
+      }
+      for (int c = 0; c < N; ++c) {
+        comp[c] = (block != nullptr) ? block + c * new_stride : nullptr;
+      }
+      stride = new_stride;
+      owned = true;
+    } else if (n > count && n <= stride) {
+      // stride == padded(n) >= n, spelled out because GCC can't see that
+      // padded() doesn't wrap and warns of a huge memset otherwise
+      for (int c = 0; c < N; ++c) {
+        std::memset(comp[c] + count, 0, (n - count) * sizeof(float));
+      }
+    }
+    count = n;
+  }
+};
+
+/**
+ * Runs f(i) for every register offset i of a padded stream of n elements,
+ * split over the pool by parallelBatch() for large n, so f must only touch
+ * register i. Float outputs that are not padded themselves go through
+ * storePartial().
+ */
+template<typename F>
+inline void
+forEachLaneBlock(std::size_t n, F && f)
+{
+  parallelBatch(SoAStorage<1>::padded(n), [&](std::size_t b, std::size_t e) {
+    for (std::size_t i = b; i < e; i += FloatV::width) {
+      f(i);
+    }
+  });
+}
+
+// Store the lanes of v that fall inside [i, n)
+inline void
+storePartial(FloatV v, float * out, std::size_t i, std::size_t n)
+{
+  if (i + FloatV::width <= n) {
+    v.storeu(out + i);
+  } else if (i < n) {
+    alignas(simdAlignment) float tmp[FloatV::width];
+    v.store(tmp);
+    std::memcpy(out + i, tmp, (n - i) * sizeof(float));
+  }
+}
+
+class Vector3SoA {
+  public:
+  Vector3SoA() = default;
+  explicit Vector3SoA(std::size_t n) : data(n)
+  {
+  }
+  explicit Vector3SoA(const Vector3 * in, std::size_t n) : data(n)
+  {
+    for (std::size_t i = 0; i < n; ++i) {
+      set(i, in[i]);
+    }
+  }
+
+  // Components
+  [[nodiscard]] float *
+  x()
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] float *
+  y()
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] float *
+  z()
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] const float *
+  x() const
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] const float *
+  y() const
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] const float *
+  z() const
+  {
+    return data.comp[2];
+  }
+
+  // Size, and the padded length every component array is allocated with
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return data.count;
+  }
+  [[nodiscard]] std::size_t
+  paddedSize() const
+  {
+    return data.stride;
+  }
+  void
+  resize(std::size_t n)
+  {
+    data.resize(n);
+  }
+
+  // Element access
+  [[nodiscard]] Vector3
+  get(std::size_t i) const
+  {
+    return Vector3(x()[i], y()[i], z()[i]);
+  }
+  void
+  set(std::size_t i, const Vector3 & v)
+  {
+    x()[i] = v.x;
+    y()[i] = v.y;
+    z()[i] = v.z;
+  }
+  void
+  toAoS(Vector3 * out) const
+  {
+    for (std::size_t i = 0; i < size(); ++i) {
+      out[i] = get(i);
+    }
+  }
+
+  // Operations with a scalar
+  void
+  operator+=(float b)
+  {
+    apply([b](FloatV & c) { c += FloatV::set1(b); });
+  }
+  void
+  operator-=(float b)
+  {
+    apply([b](FloatV & c) { c -= FloatV::set1(b); });
+  }
+  void
+  operator*=(float b)
+  {
+    apply([b](FloatV & c) { c *= FloatV::set1(b); });
+  }
+  void
+  operator/=(float b)
+  {
+    operator*=(1.0f / b);
+  }
+
+  // Operations with another stream of the same size
+  void
+  operator+=(const Vector3SoA & b)
+  {
+    apply(b, [](FloatV & c, FloatV d) { c += d; });
+  }
+  void
+  operator-=(const Vector3SoA & b)
+  {
+    apply(b, [](FloatV & c, FloatV d) { c -= d; });
+  }
+  void
+  operator*=(const Vector3SoA & b)
+  {
+    apply(b, [](FloatV & c, FloatV d) { c *= d; });
+  }
+  void
+  operator/=(const Vector3SoA & b)
+  {
+    apply(b, [](FloatV & c, FloatV d) { c = c / d; });
+  }
+
+  SoAStorage<3> data;
+
+  private:
+  template<typename F>
+  void
+  apply(F && f)
+  {
+    for (float * c : data.comp) {
+      forEachLaneBlock(size(), [&](std::size_t i) {
+        FloatV v = FloatV::load(c + i);
+        f(v);
+        v.store(c + i);
+      });
+    }
+  }
+  template<typename F>
+  void
+  apply(const Vector3SoA & b, F && f)
+  {
+    assert(b.size() == size());
+    for (int k = 0; k < 3; ++k) {
+      float *       c = data.comp[k];
+      const float * d = b.data.comp[k];
+      forEachLaneBlock(size(), [&](std::size_t i) {
+        FloatV v = FloatV::load(c + i);
+        f(v, FloatV::load(d + i));
+        v.store(c + i);
+      });
+    }
+  }
+};
+
+class Vector4SoA {
+  public:
+  Vector4SoA() = default;
+  explicit Vector4SoA(std::size_t n) : data(n)
+  {
+  }
+  explicit Vector4SoA(const Vector4 * in, std::size_t n) : data(n)
+  {
+    for (std::size_t i = 0; i < n; ++i) {
+      set(i, in[i]);
+    }
+  }
+
+  // Components
+  [[nodiscard]] float *
+  x()
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] float *
+  y()
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] float *
+  z()
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] float *
+  w()
+  {
+    return data.comp[3];
+  }
+  [[nodiscard]] const float *
+  x() const
+  {
+    return data.comp[0];
+  }
+  [[nodiscard]] const float *
+  y() const
+  {
+    return data.comp[1];
+  }
+  [[nodiscard]] const float *
+  z() const
+  {
+    return data.comp[2];
+  }
+  [[nodiscard]] const float *
+  w() const
+  {
+    return data.comp[3];
+  }
+
+  [[nodiscard]] std::size_t
+  size() const
+  {
+    return data.count;
+  }
+  [[nodiscard]] std::size_t
+  paddedSize() const
+  {
+    return data.stride;
+  }
+  void
+  resize(std::size_t n)
+  {
+    data.resize(n);
+  }
+
+  [[nodiscard]] Vector4
+  get(std::size_t i) const
+  {
+    return Vector4(x()[i], y()[i], z()[i], w()[i]);
+  }
+  void
+  set(std::size_t i, const Vector4 & v)
+  {
+    x()[i] = v.x;
+    y()[i] = v.y;
+    z()[i] = v.z;
+    w()[i] = v.w;
+  }
+  void
+  toAoS(Vector4 * out) const
+  {
+    for (std::size_t i = 0; i < size(); ++i) {
+      out[i] = get(i);
+    }
+  }
+
+  // Operation overrides, like Vector4 only scaling is defined
+  void
+  operator*=(float b)
+  {
+    for (float * c : data.comp) {
+      forEachLaneBlock(size(), [&](std::size_t i) {
+        (FloatV::load(c + i) * FloatV::set1(b)).store(c + i);
+      });
+    }
+  }
+  void
+  operator/=(float b)
+  {
+    operator*=(1.0f / b);
+  }
+
+  SoAStorage<4> data;
+};
+
+// Vector3 stream kernels, out may alias an input
+inline void
+dotp(const Vector3SoA & a, const Vector3SoA & b, float * out)
+{
+  assert(a.size() == b.size());
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    FloatV d = FloatV::load(a.x() + i) * FloatV::load(b.x() + i);
+    d = FloatV::mulAdd(FloatV::load(a.y() + i), FloatV::load(b.y() + i), d);
+    d = FloatV::mulAdd(FloatV::load(a.z() + i), FloatV::load(b.z() + i), d);
+    storePartial(d, out, i, a.size());
+  });
+}
+
+inline void
+cross(const Vector3SoA & a, const Vector3SoA & b, Vector3SoA & out)
+{
+  assert(a.size() == b.size());
+  out.resize(a.size());
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV ax = FloatV::load(a.x() + i);
+    const FloatV ay = FloatV::load(a.y() + i);
+    const FloatV az = FloatV::load(a.z() + i);
+    const FloatV bx = FloatV::load(b.x() + i);
+    const FloatV by = FloatV::load(b.y() + i);
+    const FloatV bz = FloatV::load(b.z() + i);
+    (ay * bz - az * by).store(out.x() + i);
+    (az * bx - ax * bz).store(out.y() + i);
+    (ax * by - ay * bx).store(out.z() + i);
+  });
+}
+
+inline FloatV
+magSqLanes(const Vector3SoA & a, std::size_t i)
+{
+  const FloatV x = FloatV::load(a.x() + i);
+  const FloatV y = FloatV::load(a.y() + i);
+  const FloatV z = FloatV::load(a.z() + i);
+  return FloatV::mulAdd(x, x, FloatV::mulAdd(y, y, z * z));
+}
+
+inline void
+magSq(const Vector3SoA & a, float * out)
+{
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    storePartial(magSqLanes(a, i), out, i, a.size());
+  });
+}
+
+inline void
+mag(const Vector3SoA & a, float * out)
+{
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    storePartial(FloatV::sqrt(magSqLanes(a, i)), out, i, a.size());
+  });
+}
+
+// Unsafe like Vector3::normalize, zero length vectors become NaN
+inline void
+normalize(Vector3SoA & a)
+{
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV inv = invSqrt(magSqLanes(a, i));
+    (FloatV::load(a.x() + i) * inv).store(a.x() + i);
+    (FloatV::load(a.y() + i) * inv).store(a.y() + i);
+    (FloatV::load(a.z() + i) * inv).store(a.z() + i);
+  });
+}
+
+// Like Vector3::normalizeSafe, zero length vectors stay zero
+inline void
+normalizeSafe(Vector3SoA & a)
+{
+  const FloatV tiny = FloatV::set1(FLT_MIN);
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV sq = magSqLanes(a, i);
+    const FloatV inv =
+        FloatV::select(sq >= tiny, invSqrt(sq), FloatV::zero());
+    (FloatV::load(a.x() + i) * inv).store(a.x() + i);
+    (FloatV::load(a.y() + i) * inv).store(a.y() + i);
+    (FloatV::load(a.z() + i) * inv).store(a.z() + i);
+  });
+}
+
+inline void
+clipMag(Vector3SoA & a, float clipm)
+{
+  assert(clipm > 0.0f);
+  const FloatV one = FloatV::set1(1.0f);
+  const FloatV inv_clip_sq = FloatV::set1(1.0f / (clipm * clipm));
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV rad = magSqLanes(a, i) * inv_clip_sq;
+    const FloatV s = FloatV::select(rad > one, invSqrt(rad), one);
+    (FloatV::load(a.x() + i) * s).store(a.x() + i);
+    (FloatV::load(a.y() + i) * s).store(a.y() + i);
+    (FloatV::load(a.z() + i) * s).store(a.z() + i);
+  });
+}
+
+// acos of the normalized dot product, clamped so rounding can't give NaN
+inline void
+angle(const Vector3SoA & a, const Vector3SoA & b, float * out)
+{
+  assert(a.size() == b.size());
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    FloatV d = FloatV::load(a.x() + i) * FloatV::load(b.x() + i);
+    d = FloatV::mulAdd(FloatV::load(a.y() + i), FloatV::load(b.y() + i), d);
+    d = FloatV::mulAdd(FloatV::load(a.z() + i), FloatV::load(b.z() + i), d);
+    const FloatV q = FloatV::sqrt(magSqLanes(a, i) * magSqLanes(b, i));
+    storePartial(FloatV::acos(d / q), out, i, a.size());
+  });
+}
+
+// Vector4 stream kernels
+inline FloatV
+magSqLanes(const Vector4SoA & a, std::size_t i)
+{
+  const FloatV x = FloatV::load(a.x() + i);
+  const FloatV y = FloatV::load(a.y() + i);
+  const FloatV z = FloatV::load(a.z() + i);
+  const FloatV w = FloatV::load(a.w() + i);
+  return FloatV::mulAdd(x, x,
+                        FloatV::mulAdd(y, y, FloatV::mulAdd(z, z, w * w)));
+}
+
+inline void
+dotp(const Vector4SoA & a, const Vector4SoA & b, float * out)
+{
+  assert(a.size() == b.size());
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    FloatV d = FloatV::load(a.x() + i) * FloatV::load(b.x() + i);
+    d = FloatV::mulAdd(FloatV::load(a.y() + i), FloatV::load(b.y() + i), d);
+    d = FloatV::mulAdd(FloatV::load(a.z() + i), FloatV::load(b.z() + i), d);
+    d = FloatV::mulAdd(FloatV::load(a.w() + i), FloatV::load(b.w() + i), d);
+    storePartial(d, out, i, a.size());
+  });
+}
+
+inline void
+magSq(const Vector4SoA & a, float * out)
+{
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    storePartial(magSqLanes(a, i), out, i, a.size());
+  });
+}
+
+inline void
+mag(const Vector4SoA & a, float * out)
+{
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    storePartial(FloatV::sqrt(magSqLanes(a, i)), out, i, a.size());
+  });
+}
+
+inline void
+normalize(Vector4SoA & a)
+{
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV inv = invSqrt(magSqLanes(a, i));
+    for (float * c : a.data.comp) {
+      (FloatV::load(c + i) * inv).store(c + i);
+    }
+  });
+}
+
+inline void
+normalizeSafe(Vector4SoA & a)
+{
+  const FloatV tiny = FloatV::set1(FLT_MIN);
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV sq = magSqLanes(a, i);
+    const FloatV inv =
+        FloatV::select(sq >= tiny, invSqrt(sq), FloatV::zero());
+    for (float * c : a.data.comp) {
+      (FloatV::load(c + i) * inv).store(c + i);
+    }
+  });
+}
+
+// xyz / w into out, like Vector4::homogenized
+inline void
+homogenized(const Vector4SoA & a, Vector3SoA & out)
+{
+  out.resize(a.size());
+  const FloatV one = FloatV::set1(1.0f);
+  forEachLaneBlock(a.size(), [&](std::size_t i) {
+    const FloatV inv_w = one / FloatV::load(a.w() + i);
+    (FloatV::load(a.x() + i) * inv_w).store(out.x() + i);
+    (FloatV::load(a.y() + i) * inv_w).store(out.y() + i);
+    (FloatV::load(a.z() + i) * inv_w).store(out.z() + i);
+  });
+}
+
+#endif // VECTOR_SOA_HH
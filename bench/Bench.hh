@@ -0,0 +1,260 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Minimal benchmark harness: self calibrating timing loops, TSC cycles per
+ * element, a text table, JSON output and a comparison against a JSON
+ * baseline written by an earlier run.
+ */
+#ifndef BENCH_HH
+#define BENCH_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Keeps the compiler from discarding a result it can see is unused
+template<typename T>
+inline void
+doNotOptimize(const T & value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  const volatile char * sink = reinterpret_cast<const volatile char *>(&value);
+  (void)*sink;
+  _ReadWriteBarrier();
+#endif
+}
+
+// Time stamp counter, reference cycles rather than core cycles, 0 off x86
+inline std::uint64_t
+readCycles()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+class BenchResult {
+  public:
+  std::string name;
+  std::string scale; // scalar, batch, threaded or scaling
+  std::size_t elems = 0;
+  double      ns_per_elem = 0.0;
+  double      cycles_per_elem = 0.0;
+  double      elems_per_sec = 0.0;
+};
+
+class BenchOptions {
+  public:
+  double      min_seconds = 0.05; // Per sample, the loop count adapts
+  int         samples = 5;        // The median one is reported
+  std::string filter;             // Substring of name to run, empty for all
+};
+
+class Bench {
+  public:
+  explicit Bench(BenchOptions o) : options(std::move(o))
+  {
+  }
+
+  /**
+   * Times f(), which processes elems elements per call, and records the
+   * median of options.samples samples.
+   */
+  template<typename F>
+  void
+  run(const std::string & name, const char * scale, std::size_t elems, F && f)
+  {
+    if (!options.filter.empty() &&
+        name.find(options.filter) == std::string::npos) {
+      return;
+    }
+    // Warm up, then grow the call count until a sample is long enough
+    f();
+    std::size_t calls = 1;
+    for (;;) {
+      const auto t0 = std::chrono::steady_clock::now();
+      for (std::size_t c = 0; c < calls; ++c) {
+        f();
+      }
+      const std::chrono::duration<double> dt =
+          std::chrono::steady_clock::now() - t0;
+      if (dt.count() >= options.min_seconds || calls >= (1u << 30)) {
+        break;
+      }
+      calls = (dt.count() <= 0.0) ? calls * 16
+                                  : std::max<std::size_t>(
+                                        calls * 2,
+                                        static_cast<std::size_t>(
+                                            static_cast<double>(calls) *
+                                            options.min_seconds * 1.2 /
+                                            dt.count()));
+    }
+
+    std::vector<double> ns(options.samples);
+    std::vector<double> cycles(options.samples);
+    for (int s = 0; s < options.samples; ++s) {
+      const auto          t0 = std::chrono::steady_clock::now();
+      const std::uint64_t c0 = readCycles();
+      for (std::size_t c = 0; c < calls; ++c) {
+        f();
+      }
+      const std::uint64_t                      c1 = readCycles();
+      const std::chrono::duration<double, std::nano> dt =
+          std::chrono::steady_clock::now() - t0;
+      const double total = static_cast<double>(calls) * elems;
+      ns[s] = dt.count() / total;
+      cycles[s] = static_cast<double>(c1 - c0) / total;
+    }
+    std::nth_element(ns.begin(), ns.begin() + ns.size() / 2, ns.end());
+    std::nth_element(cycles.begin(), cycles.begin() + cycles.size() / 2,
+                     cycles.end());
+
+    BenchResult r;
+    r.name = name;
+    r.scale = scale;
+    r.elems = elems;
+    r.ns_per_elem = ns[ns.size() / 2];
+    r.cycles_per_elem = cycles[cycles.size() / 2];
+    r.elems_per_sec = 1e9 / r.ns_per_elem;
+    std::printf("%-44s %-9s %10.3f ns %10.2f cyc %12.3e /s\n", r.name.c_str(),
+                r.scale.c_str(), r.ns_per_elem, r.cycles_per_elem,
+                r.elems_per_sec);
+    std::fflush(stdout);
+    results.push_back(r);
+  }
+
+  [[nodiscard]] const std::vector<BenchResult> &
+  getResults() const
+  {
+    return results;
+  }
+
+  // One result object per line, which is all readJson() needs to parse
+  bool
+  writeJson(const std::string & path) const
+  {
+    std::FILE * f = std::fopen(path.c_str(), "w");
+    if (f == nullptr) {
+      return false;
+    }
+    std::fprintf(f, "{\"results\": [\n");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+      const BenchResult & r = results[i];
+      std::fprintf(f,
+                   "  {\"name\": \"%s\", \"scale\": \"%s\", \"elems\": %zu, "
+                   "\"ns_per_elem\": %.6g, \"cycles_per_elem\": %.6g, "
+                   "\"elems_per_sec\": %.6g}%s\n",
+                   r.name.c_str(), r.scale.c_str(), r.elems, r.ns_per_elem,
+                   r.cycles_per_elem, r.elems_per_sec,
+                   i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "]}\n");
+    return std::fclose(f) == 0;
+  }
+
+  // Reads back what writeJson() wrote, unknown lines are skipped
+  static std::vector<BenchResult>
+  readJson(const std::string & path)
+  {
+    std::vector<BenchResult> out;
+    std::FILE *              f = std::fopen(path.c_str(), "r");
+    if (f == nullptr) {
+      return out;
+    }
+    char line[1024];
+    while (std::fgets(line, sizeof(line), f) != nullptr) {
+      BenchResult r;
+      if (!jsonString(line, "name", r.name) ||
+          !jsonString(line, "scale", r.scale) ||
+          !jsonNumber(line, "ns_per_elem", r.ns_per_elem)) {
+        continue;
+      }
+      jsonNumber(line, "cycles_per_elem", r.cycles_per_elem);
+      jsonNumber(line, "elems_per_sec", r.elems_per_sec);
+      out.push_back(r);
+    }
+    std::fclose(f);
+    return out;
+  }
+
+  /**
+   * Prints the change against baseline for every result present in both,
+   * returns how many got slower by more than tolerance (0.05 = 5%).
+   */
+  int
+  compare(const std::vector<BenchResult> & baseline, double tolerance) const
+  {
+    int regressions = 0;
+    std::printf("\n%-44s %-9s %10s %10s %8s\n", "name", "scale", "base ns",
+                "now ns", "change");
+    for (const BenchResult & r : results) {
+      const auto b = std::find_if(
+          baseline.begin(), baseline.end(), [&](const BenchResult & x) {
+            return x.name == r.name && x.scale == r.scale;
+          });
+      if (b == baseline.end() || b->ns_per_elem <= 0.0) {
+        continue;
+      }
+      const double change = r.ns_per_elem / b->ns_per_elem - 1.0;
+      const bool   slower = change > tolerance;
+      regressions += slower ? 1 : 0;
+      std::printf("%-44s %-9s %10.3f %10.3f %+7.1f%%%s\n", r.name.c_str(),
+                  r.scale.c_str(), b->ns_per_elem, r.ns_per_elem,
+                  100.0 * change, slower ? "  REGRESSION" : "");
+    }
+    return regressions;
+  }
+
+  private:
+  // Value of "key": "..." in line
+  static bool
+  jsonString(const char * line, const char * key, std::string & out)
+  {
+    const std::string pattern = std::string("\"") + key + "\": \"";
+    const char *      at = std::strstr(line, pattern.c_str());
+    if (at == nullptr) {
+      return false;
+    }
+    at += pattern.size();
+    const char * end = std::strchr(at, '"');
+    if (end == nullptr) {
+      return false;
+    }
+    out.assign(at, end);
+    return true;
+  }
+  // Value of "key": number in line
+  static bool
+  jsonNumber(const char * line, const char * key, double & out)
+  {
+    const std::string pattern = std::string("\"") + key + "\": ";
+    const char *      at = std::strstr(line, pattern.c_str());
+    if (at == nullptr) {
+      return false;
+    }
+    out = std::strtod(at + pattern.size(), nullptr);
+    return true;
+  }
+
+  BenchOptions             options;
+  std::vector<BenchResult> results;
+};
+
+#endif // BENCH_HH
@@ -0,0 +1,1956 @@
+/*
+ * This file is part on a WIP proprietary engine, by Ario Amin. All rights
+ * reserved.
+ *
+ * Benchmarks for the math headers, every operation at up to three scales:
+ * scalar (the per object API in a loop), batch (the SoA/array kernel on one
+ * thread) and threaded (the same split over the shared ThreadPool). The
+ * scaling entries call the batch kernels on the large data through pools of
+ * 1 to hardware_concurrency threads, so they split over parallelBatch.
+ *
+ *   g++ -std=c++17 -O2 -march=native -pthread -I. bench/MathBench.cc
+ *   ./a.out [--filter name] [--json out.json] [--baseline old.json]
+ *           [--tolerance 0.05] [--min-time seconds] [--samples n]
+ *           [--check]
+ *
+ * With --baseline the exit code is 1 when anything got slower than the
+ * tolerance allows. Build again with -DHB_FAST_NORMALIZE=1 and compare
+ * against a default build's JSON to see what the rsqrt mode buys.
+ *
+ * --check skips the timings and instead holds these to the accuracy their
+ * headers document: the Matrix4 kernel tables, the Matrix4h builders,
+ * rsqrtFast and FloatV::rsqrt, FloatV::sincos, slerp and slerpFast,
+ * quaternion compression, inverseBatch and the rotation and TRS batches.
+ * Threaded skinning must match the single threaded result and, without
+ * HB_FAST_NORMALIZE, normalize must still divide. The exit code is 1 when
+ * one misses its bound.
+ */
+#include "Bench.hh"
+
+#include "Affine3x4.hh"
+#include "AnimationTrack.hh"
+#include "Bvh.hh"
+#include "Culling.hh"
+#include "DualQuat.hh"
+#include "FrameArena.hh"
+#include "Matrix.hh"
+#include "MatrixBatch.hh"
+#include "Parallel.hh"
+#include "Particles2D.hh"
+#include "Quat.hh"
+#include "QuatBatch.hh"
+#include "QuatCompress.hh"
+#include "Skinning.hh"
+#include "TransformHierarchy.hh"
+#include "Vector.hh"
+#include "VectorExpr.hh"
+#include "VectorSoA.hh"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Elements per call: small enough for L2 at batch scale, large for threads
+constexpr std::size_t batchCount = 4096;
+constexpr std::size_t threadedCount = 1u << 20;
+
+class Data {
+  public:
+  explicit Data(std::size_t n) : rng(1234)
+  {
+    std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+    vec3.resize(n);
+    vec3b.resize(n);
+    vec4.resize(n);
+    quat.resize(n);
+    quatb.resize(n);
+    mat.resize(n);
+    rigid.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      vec3[i] = Vector3(u(rng), u(rng), u(rng) + 2.0f);
+      vec3b[i] = Vector3(u(rng) + 2.0f, u(rng), u(rng));
+      vec4[i] = Vector4(u(rng), u(rng), u(rng), 1.0f);
+      quat[i] = randomQuat(u);
+      quatb[i] = randomQuat(u);
+      rigid[i] = quat[i].toMatrix4(vec3[i]);
+      for (float & c : mat[i].cells) {
+        c = u(rng);
+      }
+      mat[i].cells[0] += 4.0f;
+      mat[i].cells[5] += 4.0f;
+      mat[i].cells[10] += 4.0f;
+      mat[i].cells[15] += 4.0f;
+    }
+  }
+
+  Quat<float>
+  randomQuat(std::uniform_real_distribution<float> & u)
+  {
+    Vector4 v(u(rng), u(rng), u(rng), u(rng));
+    v.normalize();
+    return Quat<float>(v.x, v.y, v.z, v.w);
+  }
+
+  std::mt19937                  rng;
+  std::vector<Vector3>          vec3;
+  std::vector<Vector3>          vec3b;
+  std::vector<Vector4>          vec4;
+  std::vector<Quat<float>>      quat;
+  std::vector<Quat<float>>      quatb;
+  std::vector<Matrix4>          mat;
+  std::vector<Matrix4>          rigid;
+};
+
+// Runs f(begin, end) over [0, n) on the pool, in chunks that keep it busy
+template<typename F>
+void
+splitOverPool(std::size_t n, F && f)
+{
+  const std::size_t grain = std::max<std::size_t>(
+      n / (8 * ThreadPool::global().concurrency()), 1024);
+  parallelFor(0, n, grain, f);
+}
+
+/**
+ * The same expressions written with the plain operators and with lazy(),
+ * an explicit Euler step with drag on Vector3 and a blend of three
+ * Matrix4. They are kept out of line so the generated code can be compared
+ * as well as the time:
+ *
+ *   g++ -std=c++17 -O2 -pthread -I. bench/MathBench.cc
+ *   objdump -d --no-show-raw-insn -C a.out |
+ *       awk '/^[0-9a-f]+ <.*(physicsStep|blend)(Plain|Lazy)/,/ret/'
+ *
+ * With GCC 12 both Vector3 versions compile to the same instructions, the
+ * 12 byte temporaries never leave registers. At the default SSE2 target the
+ * plain blend spills its three 64 byte temporaries to the stack and makes
+ * four passes over them, 63 instructions against 21 for the single lazy
+ * loop, and takes twice as long. With -march=native both blends collapse
+ * to the same few AVX-512 instructions.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#define BENCH_NOINLINE __attribute__((noipa))
+#elif defined(__clang__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE Vector3
+physicsStepPlain(const Vector3 & p, const Vector3 & v, const Vector3 & a,
+                 float dt, float drag)
+{
+  return p + v * dt + a * (0.5f * dt * dt) - v * (drag * dt);
+}
+
+BENCH_NOINLINE Vector3
+physicsStepLazy(const Vector3 & p, const Vector3 & v, const Vector3 & a,
+                float dt, float drag)
+{
+  return lazy(p) + lazy(v) * dt + lazy(a) * (0.5f * dt * dt) -
+         lazy(v) * (drag * dt);
+}
+
+BENCH_NOINLINE Matrix4
+blendPlain(const Matrix4 & a, const Matrix4 & b, const Matrix4 & c)
+{
+  Matrix4 a2 = a;
+  Matrix4 c3 = c;
+  a2 *= 2.0f;
+  c3 /= 3.0f;
+  return a2 + b - c3;
+}
+
+BENCH_NOINLINE Matrix4
+blendLazy(const Matrix4 & a, const Matrix4 & b, const Matrix4 & c)
+{
+  return lazy(a) * 2.0f + b - lazy(c) / 3.0f;
+}
+
+void
+vectorBenches(Bench & bench, const Data & d, const Data & big)
+{
+  const std::size_t    n = batchCount;
+  std::vector<Vector3> out(big.vec3.size());
+  std::vector<float>   outf(big.vec3.size());
+  std::vector<Vector4> out4(batchCount);
+
+  bench.run("Vector3::normalize", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.vec3[i];
+      out[i].normalize();
+    }
+    doNotOptimize(out[n - 1]);
+  });
+  bench.run("Vector3::normalizeSafe", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.vec3[i];
+      out[i].normalizeSafe();
+    }
+    doNotOptimize(out[n - 1]);
+  });
+  bench.run("Vector3::cross", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.vec3[i].cross(d.vec3b[i]);
+    }
+    doNotOptimize(out[n - 1]);
+  });
+  bench.run("Vector3::dotp", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outf[i] = d.vec3[i].dotp(d.vec3b[i]);
+    }
+    doNotOptimize(outf[n - 1]);
+  });
+  bench.run("Vector3::mag", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outf[i] = d.vec3[i].mag();
+    }
+    doNotOptimize(outf[n - 1]);
+  });
+  bench.run("Vector3::angle", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outf[i] = d.vec3[i].angle(d.vec3b[i]);
+    }
+    doNotOptimize(outf[n - 1]);
+  });
+  bench.run("Vector3::clipMag", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.vec3[i];
+      out[i].clipMag(1.5f);
+    }
+    doNotOptimize(out[n - 1]);
+  });
+  bench.run("Vector4::normalize", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out4[i] = d.vec4[i];
+      out4[i].normalize();
+    }
+    doNotOptimize(out4[n - 1]);
+  });
+
+  // Expression templates against the plain operators, same expression
+  const float s = 0.75f;
+  bench.run("Vector3 a*s+b.cross(c)-d plain", "scalar", n - 2, [&] {
+    for (std::size_t i = 0; i + 2 < n; ++i) {
+      out[i] = d.vec3[i] * s + d.vec3b[i].cross(d.vec3[i + 1]) - d.vec3b[i + 2];
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Vector3 a*s+b.cross(c)-d lazy", "scalar", n - 2, [&] {
+    for (std::size_t i = 0; i + 2 < n; ++i) {
+      out[i] = lazy(d.vec3[i]) * s + lazy(d.vec3b[i]).cross(d.vec3[i + 1]) -
+               d.vec3b[i + 2];
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Vector3 physicsStep plain noinline", "scalar", n - 1, [&] {
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+      out[i] = physicsStepPlain(d.vec3[i], d.vec3b[i], d.vec3[i + 1],
+                                1.0f / 60.0f, 0.1f);
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Vector3 physicsStep lazy noinline", "scalar", n - 1, [&] {
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+      out[i] = physicsStepLazy(d.vec3[i], d.vec3b[i], d.vec3[i + 1],
+                               1.0f / 60.0f, 0.1f);
+    }
+    doNotOptimize(out[0]);
+  });
+
+  // SoA kernels
+  Vector3SoA a(d.vec3.data(), n);
+  Vector3SoA b(d.vec3b.data(), n);
+  Vector3SoA o(n);
+  bench.run("Vector3::normalize", "batch", n, [&] {
+    o = a;
+    normalize(o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Vector3::normalizeSafe", "batch", n, [&] {
+    o = a;
+    normalizeSafe(o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Vector3::cross", "batch", n, [&] {
+    cross(a, b, o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Vector3::dotp", "batch", n, [&] {
+    dotp(a, b, outf.data());
+    doNotOptimize(outf[0]);
+  });
+  bench.run("Vector3::mag", "batch", n, [&] {
+    mag(a, outf.data());
+    doNotOptimize(outf[0]);
+  });
+  bench.run("Vector3::angle", "batch", n, [&] {
+    angle(a, b, outf.data());
+    doNotOptimize(outf[0]);
+  });
+
+  // Threaded, per object API over a large array
+  const std::size_t nt = big.vec3.size();
+  bench.run("Vector3::normalize", "threaded", nt, [&] {
+    splitOverPool(nt, [&](std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; ++i) {
+        out[i] = big.vec3[i].normalized();
+      }
+    });
+    doNotOptimize(out[0]);
+  });
+  bench.run("Vector3::cross", "threaded", nt, [&] {
+    splitOverPool(nt, [&](std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; ++i) {
+        out[i] = big.vec3[i].cross(big.vec3b[i]);
+      }
+    });
+    doNotOptimize(out[0]);
+  });
+  bench.run("Vector3::angle", "threaded", nt, [&] {
+    splitOverPool(nt, [&](std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; ++i) {
+        outf[i] = big.vec3[i].angle(big.vec3b[i]);
+      }
+    });
+    doNotOptimize(outf[0]);
+  });
+}
+
+void
+matrixBenches(Bench & bench, const Data & d, const Data & big)
+{
+  const std::size_t    n = batchCount;
+  std::vector<Matrix4> out(big.mat.size());
+  std::vector<Vector3> outv(big.vec3.size());
+  std::vector<Vector4> out4(n);
+
+  bench.run("Matrix4::operator*(Matrix4)", "scalar", n - 1, [&] {
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+      out[i] = d.mat[i] * d.mat[i + 1];
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::operator*(Vector4)", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out4[i] = d.mat[i & 63] * d.vec4[i];
+    }
+    doNotOptimize(out4[0]);
+  });
+  bench.run("Matrix4::inverse general", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.mat[i].inverse();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::inverse rigid", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.rigid[i].inverse();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::inverseRigid", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.rigid[i].inverseRigid();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::inverseAffine", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.rigid[i].inverseAffine();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::inverseGeneral", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.mat[i].inverseGeneral();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::transposed", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.mat[i].transposed();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::mulPoint", "scalar", n, [&] {
+    const Matrix4 & m = d.mat[0];
+    for (std::size_t i = 0; i < n; ++i) {
+      outv[i] = m.mulPoint(d.vec3[i]);
+    }
+    doNotOptimize(outv[0]);
+  });
+  bench.run("Matrix4::mulDirection", "scalar", n, [&] {
+    const Matrix4 & m = d.mat[0];
+    for (std::size_t i = 0; i < n; ++i) {
+      outv[i] = m.mulDirection(d.vec3[i]);
+    }
+    doNotOptimize(outv[0]);
+  });
+  bench.run("Matrix4 a*2+b-c/3 plain", "scalar", n - 2, [&] {
+    // Matrix4 only has the compound scalar operators
+    for (std::size_t i = 0; i + 2 < n; ++i) {
+      Matrix4 a = d.mat[i];
+      Matrix4 c = d.mat[i + 2];
+      a *= 2.0f;
+      c /= 3.0f;
+      out[i] = a + d.mat[i + 1] - c;
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4 a*2+b-c/3 lazy", "scalar", n - 2, [&] {
+    for (std::size_t i = 0; i + 2 < n; ++i) {
+      out[i] = lazy(d.mat[i]) * 2.0f + d.mat[i + 1] - lazy(d.mat[i + 2]) / 3.0f;
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4 a*2+b-c/3 plain noinline", "scalar", n - 2, [&] {
+    for (std::size_t i = 0; i + 2 < n; ++i) {
+      out[i] = blendPlain(d.mat[i], d.mat[i + 1], d.mat[i + 2]);
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4 a*2+b-c/3 lazy noinline", "scalar", n - 2, [&] {
+    for (std::size_t i = 0; i + 2 < n; ++i) {
+      out[i] = blendLazy(d.mat[i], d.mat[i + 1], d.mat[i + 2]);
+    }
+    doNotOptimize(out[0]);
+  });
+
+  // Affine3x4 against the Matrix4 rows above, same (affine) inputs
+  std::vector<Affine3x4> aff(n);
+  std::vector<Affine3x4> aff_out(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    aff[i] = Affine3x4(d.rigid[i]);
+  }
+  bench.run("Matrix4::operator*(Matrix4) affine", "scalar", n - 1, [&] {
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+      out[i] = d.rigid[i] * d.rigid[i + 1];
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Affine3x4::operator*(Affine3x4)", "scalar", n - 1, [&] {
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+      aff_out[i] = aff[i] * aff[i + 1];
+    }
+    doNotOptimize(aff_out[0]);
+  });
+  bench.run("Affine3x4::operator*(Affine3x4)", "batch", n - 1, [&] {
+    mulBatch(aff.data(), aff.data() + 1, aff_out.data(), n - 1);
+    doNotOptimize(aff_out[0]);
+  });
+  bench.run("Affine3x4::inverse", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      aff_out[i] = aff[i].inverse();
+    }
+    doNotOptimize(aff_out[0]);
+  });
+  bench.run("Affine3x4::mulPoint", "scalar", n, [&] {
+    const Affine3x4 & m = aff[0];
+    for (std::size_t i = 0; i < n; ++i) {
+      outv[i] = m.mulPoint(d.vec3[i]);
+    }
+    doNotOptimize(outv[0]);
+  });
+
+  // Rotations from angles in [-pi, pi]
+  std::vector<float>   yaw(n), pitch(n), roll(n);
+  std::vector<Vector3> axes(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    axes[i] = d.vec3[i].normalized();
+    yaw[i] = d.vec3[i].x * 3.14159265f;
+    pitch[i] = d.vec3[i].y * 3.14159265f;
+    roll[i] = d.vec3b[i].z * 3.14159265f;
+  }
+  bench.run("Matrix4 rotY*rotX*rotZ", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = Matrix4::rotY(yaw[i]) * Matrix4::rotX(pitch[i]) *
+               Matrix4::rotZ(roll[i]);
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::yawPitchRoll", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = Matrix4::yawPitchRoll(yaw[i], pitch[i], roll[i]);
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::axisAngle", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = Matrix4::axisAngle(axes[i], yaw[i]);
+    }
+    doNotOptimize(out[0]);
+  });
+
+  bench.run("Matrix4::inverse general", "batch", n, [&] {
+    doNotOptimize(inverseBatch(d.mat.data(), out.data(), n));
+  });
+  bench.run("Matrix4::yawPitchRoll", "batch", n, [&] {
+    yawPitchRollBatch(yaw.data(), pitch.data(), roll.data(), n, out.data());
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::axisAngle", "batch", n, [&] {
+    axisAngleBatch(axes.data(), yaw.data(), n, out.data());
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::mulPoint", "batch", n, [&] {
+    transformPoints(d.mat[0], d.vec3.data(), outv.data(), n);
+    doNotOptimize(outv[0]);
+  });
+  bench.run("Matrix4::mulPoint affine", "batch", n, [&] {
+    transformPointsAffine(d.rigid[0], d.vec3.data(), outv.data(), n);
+    doNotOptimize(outv[0]);
+  });
+  bench.run("Matrix4::mulDirection", "batch", n, [&] {
+    transformDirections(d.mat[0], d.vec3.data(), outv.data(), n);
+    doNotOptimize(outv[0]);
+  });
+
+  // Half storage, half the bytes per point of the float stream above
+  const std::size_t     nv = big.vec3.size();
+  std::vector<Vector3h> half_in(nv);
+  std::vector<Vector3h> half_out(nv);
+  convertPrecision(big.vec3.data(), half_in.data(), nv);
+  bench.run("Matrix4::mulPoint half", "batch", n, [&] {
+    transformPoints(d.mat[0], half_in.data(), half_out.data(), n);
+    doNotOptimize(half_out[0]);
+  });
+
+  const std::size_t nm = big.mat.size();
+  bench.run("Matrix4::operator*(Matrix4)", "threaded", nm - 1, [&] {
+    splitOverPool(nm - 1, [&](std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; ++i) {
+        out[i] = big.mat[i] * big.mat[i + 1];
+      }
+    });
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::inverse general", "threaded", nm, [&] {
+    splitOverPool(nm, [&](std::size_t lo, std::size_t hi) {
+      inverseBatch(big.mat.data() + lo, out.data() + lo, hi - lo);
+    });
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4::mulPoint", "threaded", nv, [&] {
+    splitOverPool(nv, [&](std::size_t lo, std::size_t hi) {
+      transformPoints(big.mat[0], big.vec3.data() + lo, outv.data() + lo,
+                      hi - lo);
+    });
+    doNotOptimize(outv[0]);
+  });
+  bench.run("Matrix4::mulPoint half", "threaded", nv, [&] {
+    splitOverPool(nv, [&](std::size_t lo, std::size_t hi) {
+      transformPoints(big.mat[0], half_in.data() + lo, half_out.data() + lo,
+                      hi - lo);
+    });
+    doNotOptimize(half_out[0]);
+  });
+}
+
+void
+quatBenches(Bench & bench, const Data & d, const Data & big)
+{
+  const std::size_t        n = batchCount;
+  std::vector<Quat<float>> out(big.quat.size());
+  std::vector<Vector3>     outv(big.vec3.size());
+  std::vector<Matrix4>     outm(big.mat.size());
+
+  bench.run("Quat::operator*", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.quat[i] * d.quatb[i];
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Quat::rotateVector", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outv[i] = d.quat[i].rotateVector(d.vec3[i]);
+    }
+    doNotOptimize(outv[0]);
+  });
+  bench.run("Quat::invQuat", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = d.quat[i].invQuat();
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Quat::toMatrix4", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outm[i] = d.quat[i].toMatrix4(d.vec3[i]);
+    }
+    doNotOptimize(outm[0]);
+  });
+  bench.run("Quat::fromMatrix4", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = Quat<float>::fromMatrix4(d.rigid[i]);
+    }
+    doNotOptimize(out[0]);
+  });
+  bench.run("Matrix4 trans*rot*scale", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outm[i] = Matrix4::trans(d.vec3[i]) * d.quat[i].toMatrix4() *
+                Matrix4::scale(d.vec3b[i]);
+    }
+    doNotOptimize(outm[0]);
+  });
+  bench.run("composeTRS", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outm[i] = composeTRS(d.vec3[i], d.quat[i], d.vec3b[i]);
+    }
+    doNotOptimize(outm[0]);
+  });
+  bench.run("decomposeTRS", "scalar", n, [&] {
+    Vector3 t, s;
+    for (std::size_t i = 0; i < n; ++i) {
+      decomposeTRS(d.rigid[i], t, out[i], s);
+    }
+    doNotOptimize(out[0]);
+  });
+
+  QuatSoA    a(d.quat.data(), n);
+  QuatSoA    b(d.quatb.data(), n);
+  QuatSoA    o(n);
+  Vector3SoA t(d.vec3.data(), n);
+  bench.run("Quat slerp", "batch", n, [&] {
+    slerp(a, b, 0.3f, o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Quat slerpFast", "batch", n, [&] {
+    slerpFast(a, b, 0.3f, o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Quat nlerp", "batch", n, [&] {
+    nlerp(a, b, 0.3f, o);
+    doNotOptimize(o.x()[0]);
+  });
+  const QuatSoA * poses[3] = {&a, &b, &a};
+  const float     weights[3] = {0.5f, 0.3f, 0.2f};
+  bench.run("Quat blend 3 poses", "batch", n, [&] {
+    blend(poses, weights, 3, o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Quat::toMatrix4", "batch", n, [&] {
+    quatToMatrix4Batch(a, outm.data(), &t);
+    doNotOptimize(outm[0]);
+  });
+  bench.run("Quat::fromMatrix4", "batch", n, [&] {
+    matrix4ToQuatBatch(d.rigid.data(), n, o);
+    doNotOptimize(o.x()[0]);
+  });
+  Vector3SoA scales(d.vec3b.data(), n);
+  Vector3SoA t_out;
+  Vector3SoA s_out;
+  bench.run("composeTRS", "batch", n, [&] {
+    composeTRSBatch(t, a, scales, outm.data());
+    doNotOptimize(outm[0]);
+  });
+  bench.run("decomposeTRS", "batch", n, [&] {
+    decomposeTRSBatch(d.rigid.data(), n, &t_out, o, &s_out);
+    doNotOptimize(o.x()[0]);
+  });
+  std::vector<std::uint8_t> packed(n * QuatPacked48::bytes);
+  bench.run("Quat encode 32 bit", "batch", n, [&] {
+    encodeBatch<QuatPacked32>(a, packed.data());
+    doNotOptimize(packed[0]);
+  });
+  bench.run("Quat decode 32 bit", "batch", n, [&] {
+    decodeBatch<QuatPacked32>(packed.data(), n, o);
+    doNotOptimize(o.x()[0]);
+  });
+  bench.run("Quat encode 48 bit", "batch", n, [&] {
+    encodeBatch<QuatPacked48>(a, packed.data());
+    doNotOptimize(packed[0]);
+  });
+  bench.run("Quat decode 48 bit", "batch", n, [&] {
+    decodeBatch<QuatPacked48>(packed.data(), n, o);
+    doNotOptimize(o.x()[0]);
+  });
+
+  const std::size_t nt = big.quat.size();
+  bench.run("Quat::operator*", "threaded", nt, [&] {
+    splitOverPool(nt, [&](std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; ++i) {
+        out[i] = big.quat[i] * big.quatb[i];
+      }
+    });
+    doNotOptimize(out[0]);
+  });
+  bench.run("Quat::rotateVector", "threaded", nt, [&] {
+    splitOverPool(nt, [&](std::size_t lo, std::size_t hi) {
+      for (std::size_t i = lo; i < hi; ++i) {
+        outv[i] = big.quat[i].rotateVector(big.vec3[i]);
+      }
+    });
+    doNotOptimize(outv[0]);
+  });
+
+  // Dual quaternions
+  std::vector<DualQuat<float>> dq(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    dq[i] = DualQuat<float>(d.quat[i], d.vec3[i]);
+  }
+  bench.run("DualQuat::transformPoint", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      outv[i] = dq[i].transformPoint(d.vec3b[i]);
+    }
+    doNotOptimize(outv[0]);
+  });
+  bench.run("DualQuat::operator*", "scalar", n - 1, [&] {
+    Quat<float> acc;
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+      acc += (dq[i] * dq[i + 1]).real;
+    }
+    doNotOptimize(acc);
+  });
+}
+
+// Skinning palettes and meshes, 64 bones, 4 influences per vertex
+constexpr int skinBones = 64;
+
+std::vector<SkinVertex>
+makeSkinVertices(const Data & d)
+{
+  std::vector<SkinVertex> verts(d.vec3.size());
+  for (std::size_t i = 0; i < verts.size(); ++i) {
+    verts[i].position = d.vec3[i];
+    verts[i].normal = d.vec3b[i].normalized();
+    for (int k = 0; k < 4; ++k) {
+      verts[i].bones[k] =
+          static_cast<std::uint16_t>((i * 7 + k * 13) % skinBones);
+      verts[i].weights[k] = 0.25f;
+    }
+  }
+  return verts;
+}
+
+std::vector<DualQuat<float>>
+makeDualQuatPalette(const Data & d)
+{
+  std::vector<DualQuat<float>> palette(skinBones);
+  for (int b = 0; b < skinBones; ++b) {
+    palette[b] = DualQuat<float>(d.quat[b], d.vec3[b]);
+  }
+  return palette;
+}
+
+// The same meshes carved out of one vertex array, for skinJobs()
+template<typename Bone>
+std::vector<SkinJob<Bone>>
+makeSkinJobs(const std::vector<SkinVertex> & verts, std::size_t meshes,
+             const std::vector<Bone> & palette, std::vector<Vector3> & pos,
+             std::vector<Vector3> & nrm)
+{
+  const std::size_t          per_mesh = verts.size() / meshes;
+  std::vector<SkinJob<Bone>> jobs(meshes);
+  for (std::size_t m = 0; m < meshes; ++m) {
+    const std::size_t first = m * per_mesh;
+    jobs[m].vertices = verts.data() + first;
+    jobs[m].count = per_mesh;
+    jobs[m].palette = palette.data();
+    jobs[m].positions = pos.data() + first;
+    jobs[m].normals = nrm.data() + first;
+  }
+  return jobs;
+}
+
+void
+pipelineBenches(Bench & bench, const Data & d, const Data & big)
+{
+  const std::vector<Matrix4> palette(d.rigid.begin(),
+                                     d.rigid.begin() + skinBones);
+  const std::vector<DualQuat<float>> dq_palette = makeDualQuatPalette(d);
+  const std::vector<SkinVertex>      verts = makeSkinVertices(big);
+  const std::size_t                  nv = verts.size();
+  std::vector<Vector3> pos(nv);
+  std::vector<Vector3> nrm(nv);
+  const std::size_t    n = batchCount;
+  bench.run("skin linear", "batch", n, [&] {
+    skinRange(verts.data(), 0, n, palette.data(), pos.data(), nrm.data());
+    doNotOptimize(pos[0]);
+  });
+  bench.run("skin dual quat", "batch", n, [&] {
+    skinRange(verts.data(), 0, n, dq_palette.data(), pos.data(), nrm.data());
+    doNotOptimize(pos[0]);
+  });
+  bench.run("skin linear", "threaded", nv, [&] {
+    skinLinear(verts.data(), nv, palette.data(), pos.data(), nrm.data());
+    doNotOptimize(pos[0]);
+  });
+  bench.run("skin dual quat", "threaded", nv, [&] {
+    skinDualQuat(verts.data(), nv, dq_palette.data(), pos.data(), nrm.data());
+    doNotOptimize(pos[0]);
+  });
+  const std::vector<SkinJob<Matrix4>> jobs =
+      makeSkinJobs(verts, 64, palette, pos, nrm);
+  bench.run("skin linear 64 meshes", "threaded", nv, [&] {
+    skinJobs(jobs.data(), jobs.size());
+    doNotOptimize(pos[0]);
+  });
+
+  // Culling against one camera and four cascades, bounds spread in front
+  const auto fill_bounds = [](const Data & src, SphereSoA & s, AabbSoA & b) {
+    const std::size_t count = src.vec3.size();
+    s.resize(count);
+    b.resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const Vector3 & v = src.vec3[i];
+      const Vector3   c(v.x * 60.0f, v.y * 40.0f, v.z * -40.0f);
+      s.set(i, c, 0.5f);
+      b.set(i, c - Vector3(0.5f), c + Vector3(0.5f));
+    }
+  };
+  SphereSoA spheres;
+  AabbSoA   boxes;
+  SphereSoA big_spheres;
+  AabbSoA   big_boxes;
+  fill_bounds(d, spheres, boxes);
+  fill_bounds(big, big_spheres, big_boxes);
+
+  // OpenGL style perspective, near 0.1, far growing per cascade
+  Frustum frustums[5];
+  for (int f = 0; f < 5; ++f) {
+    const float near = 0.1f;
+    const float far = 25.0f * static_cast<float>(f + 1);
+    Matrix4     proj = Matrix4::zero();
+    proj.cells[0] = 1.0f;
+    proj.cells[5] = 1.5f;
+    proj.cells[10] = -(far + near) / (far - near);
+    proj.cells[11] = -2.0f * far * near / (far - near);
+    proj.cells[14] = -1.0f;
+    frustums[f] = Frustum::fromMatrix(proj * Matrix4::rotY(0.1f * f));
+  }
+  const std::size_t          words = (nv + 31) / 32;
+  std::vector<std::uint32_t> mask_words(5 * words);
+  std::uint32_t *            masks[5];
+  for (int f = 0; f < 5; ++f) {
+    masks[f] = mask_words.data() + f * words;
+  }
+  std::vector<std::uint32_t> visible(nv);
+  bench.run("cull spheres x1", "batch", n, [&] {
+    cullSpheres(spheres, frustums, 1, masks);
+    doNotOptimize(mask_words[0]);
+  });
+  bench.run("cull spheres x5", "batch", n, [&] {
+    cullSpheres(spheres, frustums, 5, masks);
+    doNotOptimize(mask_words[0]);
+  });
+  bench.run("cull aabbs x1", "batch", n, [&] {
+    cullAabbs(boxes, frustums, 1, masks);
+    doNotOptimize(mask_words[0]);
+  });
+  bench.run("cull aabbs x5", "batch", n, [&] {
+    cullAabbs(boxes, frustums, 5, masks);
+    doNotOptimize(mask_words[0]);
+  });
+  bench.run("cull spheres x5", "threaded", nv, [&] {
+    cullSpheres(big_spheres, frustums, 5, masks);
+    doNotOptimize(mask_words[0]);
+  });
+  bench.run("cull aabbs x5", "threaded", nv, [&] {
+    cullAabbs(big_boxes, frustums, 5, masks);
+    doNotOptimize(mask_words[0]);
+  });
+  cullSpheres(big_spheres, frustums, 1, masks);
+  bench.run("compactVisible", "batch", nv, [&] {
+    doNotOptimize(compactVisible(masks[0], nv, visible.data()));
+  });
+
+  // One frame of transients for n bounds: a palette, cull masks, the
+  // visible list and a blend target, through the heap or a FrameArena
+  const std::size_t n_words = (n + 31) / 32;
+  bench.run("frame transients heap", "batch", n, [&] {
+    std::vector<Matrix4>       frame_palette(skinBones);
+    std::vector<std::uint32_t> frame_mask(n_words);
+    std::vector<std::uint32_t> frame_visible(n);
+    Vector3SoA                 frame_blend(n);
+    std::uint32_t *            frame_masks[1] = {frame_mask.data()};
+    cullSpheres(spheres, frustums, 1, frame_masks);
+    frame_palette[0] = palette[0];
+    frame_blend.set(0, pos[0]);
+    doNotOptimize(compactVisible(frame_mask.data(), n, frame_visible.data()));
+  });
+  FrameArena arena(1u << 20);
+  bench.run("frame transients arena", "batch", n, [&] {
+    Span<Matrix4>       frame_palette = arena.allocArray<Matrix4>(skinBones);
+    Span<std::uint32_t> frame_mask = arena.allocArray<std::uint32_t>(n_words);
+    Span<std::uint32_t> frame_visible = arena.allocArray<std::uint32_t>(n);
+    Vector3SoA          frame_blend = arena.makeSoA<Vector3SoA>(n);
+    std::uint32_t *     frame_masks[1] = {frame_mask.data()};
+    cullSpheres(spheres, frustums, 1, frame_masks);
+    frame_palette[0] = palette[0];
+    frame_blend.set(0, pos[0]);
+    doNotOptimize(compactVisible(frame_mask.data(), n, frame_visible.data()));
+    arena.reset();
+  });
+  bench.run("Vector3::isNormDeviceCoords", "scalar", nv, [&] {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < nv; ++i) {
+      count += (big.vec3[i] * 0.9f).isNormDeviceCoords() ? 1 : 0;
+    }
+    doNotOptimize(count);
+  });
+
+  // Animation sampling, 512 tracks of 64 keys played forward at 60 Hz
+  const std::size_t         tracks = 512;
+  const std::size_t         keys = 64;
+  std::vector<float>        key_times(keys);
+  std::vector<Vector3Track> vtracks;
+  std::vector<QuatTrack>    qtracks;
+  for (std::size_t k = 0; k < keys; ++k) {
+    key_times[k] = static_cast<float>(k) / 30.0f;
+  }
+  for (std::size_t i = 0; i < tracks; ++i) {
+    vtracks.emplace_back(key_times.data(), &d.vec3[i * keys % d.vec3.size()],
+                         keys, Interpolation::Hermite);
+    qtracks.emplace_back(key_times.data(), &d.quat[i * keys % d.quat.size()],
+                         keys, Interpolation::Squad);
+  }
+  std::vector<TrackCursor> cursors(tracks);
+  std::vector<Vector3>     vsampled(tracks);
+  std::vector<Quat<float>> qsampled(tracks);
+  Vector3SoA               vsoa;
+  QuatSoA                  qsoa;
+  float                    clock = 0.0f;
+  // Next frame, looping before the last key
+  const auto tick = [&] {
+    clock += 1.0f / 60.0f;
+    if (clock >= key_times[keys - 1]) {
+      clock = 0.0f;
+    }
+  };
+  bench.run("Vector3Track::sample hermite", "scalar", tracks, [&] {
+    tick();
+    for (std::size_t i = 0; i < tracks; ++i) {
+      vsampled[i] = vtracks[i].sample(clock, cursors[i]);
+    }
+    doNotOptimize(vsampled[0]);
+  });
+  bench.run("Vector3Track::sample hermite", "batch", tracks, [&] {
+    tick();
+    sampleTracks(vtracks.data(), cursors.data(), tracks, clock, vsoa);
+    doNotOptimize(vsoa.x()[0]);
+  });
+  bench.run("QuatTrack::sample squad", "scalar", tracks, [&] {
+    tick();
+    for (std::size_t i = 0; i < tracks; ++i) {
+      qsampled[i] = qtracks[i].sample(clock, cursors[i]);
+    }
+    doNotOptimize(qsampled[0]);
+  });
+  bench.run("QuatTrack::sample squad", "batch", tracks, [&] {
+    tick();
+    sampleTracks(qtracks.data(), cursors.data(), tracks, clock, qsoa);
+    doNotOptimize(qsoa.x()[0]);
+  });
+
+  // Hierarchy update, 2% of the nodes move each frame
+  const std::size_t          nodes = 1u << 17;
+  std::vector<std::uint32_t> parents(nodes);
+  std::mt19937               rng(99);
+  parents[0] = TransformHierarchy::noParent;
+  for (std::size_t i = 1; i < nodes; ++i) {
+    parents[i] = static_cast<std::uint32_t>(rng() % i);
+  }
+  TransformHierarchy hierarchy(parents.data(), nodes);
+  hierarchy.update();
+  bench.run("TransformHierarchy::update 2%", "threaded", nodes, [&] {
+    for (std::size_t k = 0; k < nodes / 50; ++k) {
+      hierarchy.setLocal(static_cast<std::uint32_t>(rng() % nodes),
+                         d.rigid[k % d.rigid.size()]);
+    }
+    hierarchy.update();
+    doNotOptimize(hierarchy.worlds()[0]);
+  });
+}
+
+/**
+ * Ray casts and box queries against a 512 x 512 height field, about half a
+ * million triangles, rays cast down from above on a grid so neighbouring
+ * rays, and so packets, stay coherent.
+ */
+void
+bvhBenches(Bench & bench)
+{
+  constexpr std::uint32_t    side = 512;
+  std::vector<Vector3>       vertices(side * side);
+  std::vector<std::uint32_t> indices;
+  for (std::uint32_t y = 0; y < side; ++y) {
+    for (std::uint32_t x = 0; x < side; ++x) {
+      vertices[y * side + x] =
+          Vector3(float(x), float(y),
+                  4.0f * std::sin(x * 0.05f) * std::cos(y * 0.07f));
+    }
+  }
+  for (std::uint32_t y = 0; y + 1 < side; ++y) {
+    for (std::uint32_t x = 0; x + 1 < side; ++x) {
+      const std::uint32_t i = y * side + x;
+      indices.insert(indices.end(), {i, i + 1, i + side});
+      indices.insert(indices.end(), {i + 1, i + side + 1, i + side});
+    }
+  }
+  const std::size_t triangles = indices.size() / 3;
+
+  constexpr std::size_t rays_side = 64;
+  std::vector<Ray>      rays(rays_side * rays_side);
+  std::vector<RayHit>   hits(rays.size());
+  std::vector<Aabb>     boxes(rays.size());
+  for (std::size_t y = 0; y < rays_side; ++y) {
+    for (std::size_t x = 0; x < rays_side; ++x) {
+      const Vector3 target(x * 8.0f + 1.3f, y * 8.0f + 2.7f, 0.0f);
+      Ray &         r = rays[y * rays_side + x];
+      r.origin = Vector3(256.0f, 256.0f, 300.0f);
+      r.direction = target - r.origin;
+      boxes[y * rays_side + x] =
+          Aabb(target - Vector3(2.0f), target + Vector3(2.0f));
+    }
+  }
+
+  TriangleBvh bvh;
+  bench.run("TriangleBvh::build", "threaded", triangles, [&] {
+    bvh.build(vertices.data(), indices.data(), triangles);
+    doNotOptimize(bvh.tree().nodes()[0]);
+  });
+  bench.run("TriangleBvh::refit", "threaded", triangles, [&] {
+    bvh.refit();
+    doNotOptimize(bvh.tree().nodes()[0]);
+  });
+  bench.run("TriangleBvh::intersect", "scalar", rays.size(), [&] {
+    for (std::size_t i = 0; i < rays.size(); ++i) {
+      (void)bvh.intersect(rays[i], hits[i]);
+    }
+    doNotOptimize(hits[0]);
+  });
+  bench.run("TriangleBvh::intersect packets", "threaded", rays.size(), [&] {
+    bvh.intersect(rays.data(), hits.data(), rays.size());
+    doNotOptimize(hits[0]);
+  });
+  bench.run("TriangleBvh::occluded", "scalar", rays.size(), [&] {
+    std::size_t count = 0;
+    for (const Ray & r : rays) {
+      count += bvh.occluded(r) ? 1 : 0;
+    }
+    doNotOptimize(count);
+  });
+  std::vector<std::uint32_t> found;
+  bench.run("TriangleBvh::overlap", "scalar", boxes.size(), [&] {
+    found.clear();
+    for (const Aabb & b : boxes) {
+      bvh.overlap(b, found);
+    }
+    doNotOptimize(found.size());
+  });
+
+  // What the tree replaces, every triangle against a handful of rays
+  bench.run("TriangleBvh::intersect brute force", "scalar", 4, [&] {
+    for (std::size_t i = 0; i < 4; ++i) {
+      const Ray & r = rays[i * 997 % rays.size()];
+      float       best = r.t_max;
+      for (std::size_t t = 0; t < triangles; ++t) {
+        const Vector3 & v0 = vertices[indices[3 * t]];
+        const Vector3   e1 = vertices[indices[3 * t + 1]] - v0;
+        const Vector3   e2 = vertices[indices[3 * t + 2]] - v0;
+        const Vector3   p = r.direction.cross(e2);
+        const float     inv_det = 1.0f / e1.dotp(p);
+        const Vector3   o = r.origin - v0;
+        const float     u = o.dotp(p) * inv_det;
+        const Vector3   q = o.cross(e1);
+        const float     v = r.direction.dotp(q) * inv_det;
+        const float     hit_t = e2.dotp(q) * inv_det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && hit_t >= 0.0f &&
+            hit_t < best) {
+          best = hit_t;
+        }
+      }
+      doNotOptimize(best);
+    }
+  });
+}
+
+/**
+ * The batch kernels over the large data on 1, 2, ... hardware_concurrency
+ * threads, each its own pool made current by a Scope. The kernels split
+ * themselves, the entries only pick the thread count.
+ */
+// Particles in a 20 x 10 box with a sloped floor and a wedge, under gravity
+const ParticleBox  particleBox{Vector2(-10.0f, -5.0f), Vector2(10.0f, 5.0f)};
+const ParticleLine particleLines[2] = {
+    {Vector2(0.0f, -4.0f), Vector2(1.0f, 0.2f)},
+    {Vector2(-7.0f, 0.0f), Vector2(1.0f, -1.0f)}};
+const Vector2 particleGravity(0.0f, -9.8f);
+constexpr float particleDt = 1.0f / 60.0f;
+
+Particles2D
+makeParticles(const Data & d, std::size_t n)
+{
+  Particles2D p(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    const Vector3 & v = d.vec3[i];
+    p.set(i, Vector2(v.x * 6.0f, v.y * 3.0f),
+          Vector2(v.z * 10.0f, d.vec3b[i].y * 10.0f));
+  }
+  return p;
+}
+
+void
+particleBenches(Bench & bench, const Data & d, const Data & big)
+{
+  const std::size_t n = batchCount;
+
+  // Per particle Vector2 code, the loop step() replaces
+  std::vector<Vector2> pos(n);
+  std::vector<Vector2> vel(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    pos[i] = Vector2(d.vec3[i].x * 6.0f, d.vec3[i].y * 3.0f);
+    vel[i] = Vector2(d.vec3[i].z * 10.0f, d.vec3b[i].y * 10.0f);
+  }
+  bench.run("Particles2D::step", "scalar", n, [&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      Vector2 & p = pos[i];
+      Vector2 & v = vel[i];
+      v += particleGravity * particleDt;
+      p += v * particleDt;
+      for (const ParticleLine & line : particleLines) {
+        const Vector2 normal =
+            Vector2(-line.direction.y, line.direction.x).normalized();
+        const float dist = normal.dotp(p.vecSub(line.point));
+        if (dist < 0.0f) {
+          p -= normal * (2.0f * dist);
+          if (normal.dotp(v) < 0.0f) {
+            v = line.direction.reflected(v);
+          }
+        }
+      }
+      if (p.x < particleBox.min.x || p.x > particleBox.max.x) {
+        p.x = std::min(std::max(p.x, particleBox.min.x), particleBox.max.x);
+        v.x = -v.x;
+      }
+      if (p.y < particleBox.min.y || p.y > particleBox.max.y) {
+        p.y = std::min(std::max(p.y, particleBox.min.y), particleBox.max.y);
+        v.y = -v.y;
+      }
+    }
+    doNotOptimize(pos[0]);
+  });
+
+  Particles2D a = makeParticles(d, n);
+  bench.run("Particles2D::step", "batch", n, [&] {
+    step(a, particleGravity, particleDt, &particleBox, particleLines, 2);
+    doNotOptimize(a.px()[0]);
+  });
+  bench.run("Particles2D::integrate", "batch", n, [&] {
+    integrate(a, particleGravity, particleDt);
+    doNotOptimize(a.px()[0]);
+  });
+  bench.run("Particles2D::reflect lines", "batch", n, [&] {
+    reflect(a, particleLines, 2);
+    doNotOptimize(a.px()[0]);
+  });
+
+  const std::size_t nt = big.vec3.size();
+  Particles2D       b = makeParticles(big, nt);
+  bench.run("Particles2D::step", "threaded", nt, [&] {
+    step(b, particleGravity, particleDt, &particleBox, particleLines, 2);
+    doNotOptimize(b.px()[0]);
+  });
+}
+
+void
+scalingBenches(Bench & bench, const Data & big)
+{
+  const std::size_t    n = big.vec3.size();
+  std::vector<Vector3> outv(n);
+  std::vector<Matrix4> outm(n);
+  Vector3SoA           a;
+  QuatSoA              qa, qb, qo;
+  Particles2D          particles = makeParticles(big, n);
+  a.resize(n);
+  qa.resize(n);
+  qb.resize(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    a.set(i, big.vec3[i]);
+    qa.set(i, big.quat[i]);
+    qb.set(i, big.quatb[i]);
+  }
+
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned t = 1; t <= cores; ++t) {
+    ThreadPool        pool(t - 1);
+    ThreadPool::Scope scope(pool);
+    const std::string suffix = " " + std::to_string(t) + " threads";
+    bench.run("Matrix4::mulPoint" + suffix, "scaling", n, [&] {
+      transformPoints(big.mat[0], big.vec3.data(), outv.data(), n);
+      doNotOptimize(outv[0]);
+    });
+    bench.run("Matrix4::inverse general" + suffix, "scaling", n, [&] {
+      inverseBatch(big.mat.data(), outm.data(), n);
+      doNotOptimize(outm[0]);
+    });
+    bench.run("Vector3::normalize" + suffix, "scaling", n, [&] {
+      normalizeSafe(a);
+      doNotOptimize(a.x()[0]);
+    });
+    bench.run("Quat::slerp" + suffix, "scaling", n, [&] {
+      slerp(qa, qb, 0.3f, qo);
+      doNotOptimize(qo.x()[0]);
+    });
+    bench.run("Particles2D::step" + suffix, "scaling", n, [&] {
+      step(particles, particleGravity, particleDt, &particleBox,
+           particleLines, 2);
+      doNotOptimize(particles.px()[0]);
+    });
+  }
+}
+
+// Self checks for --check, each returns its number of failures
+int
+checkBound(const char * what, double worst, double bound)
+{
+  const bool ok = worst <= bound;
+  std::printf("%-44s worst %8.2f  bound %6.2f  %s\n", what, worst, bound,
+              ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+/**
+ * Every Matrix4Kernels table the CPU runs against the scalar reference, in
+ * ULP as MatrixSimd.hh defines them: products at the magnitude of the sum
+ * of absolute partial products, inverses at the largest reference cell.
+ * Random cells in [-1, 1] plus 4 on the diagonal keep the inverses well
+ * conditioned.
+ */
+int
+matrixKernelChecks()
+{
+  constexpr double productUlpBound = 8.0;
+  constexpr double inverseUlpBound = 16.0;
+  constexpr int    trials = 100000;
+
+  std::mt19937                          rng(4321);
+  std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+  const Matrix4Kernels & ref = Matrix4Kernels::forIsa(SimdIsa::Scalar);
+  const SimdIsa          best = CpuFeatures::get().bestIsa();
+  int                    failures = 0;
+  for (SimdIsa isa : {SimdIsa::Sse41, SimdIsa::Avx2, SimdIsa::Avx512}) {
+    const Matrix4Kernels & k = Matrix4Kernels::forIsa(isa);
+    if (isa > best || k.isa != isa) {
+      std::printf("%-44s not supported here\n", simdIsaName(isa));
+      continue;
+    }
+    double worst_mul = 0.0;
+    double worst_vec = 0.0;
+    double worst_inv = 0.0;
+    for (int t = 0; t < trials; ++t) {
+      float a[16];
+      float b[16];
+      float want[16];
+      float got[16];
+      for (int i = 0; i < 16; ++i) {
+        a[i] = u(rng) + ((i % 5 == 0) ? 4.0f : 0.0f);
+        b[i] = u(rng);
+      }
+
+      ref.mul(a, b, want);
+      k.mul(a, b, got);
+      for (int i = 0; i < 16; ++i) {
+        double sum = 0.0;
+        for (int j = 0; j < 4; ++j) {
+          sum += std::fabs(double(a[i / 4 * 4 + j]) * b[j * 4 + i % 4]);
+        }
+        worst_mul = std::max(worst_mul, std::fabs(double(got[i]) - want[i]) /
+                                            (FLT_EPSILON * sum));
+      }
+
+      ref.mulVec(a, b, want);
+      k.mulVec(a, b, got);
+      for (int i = 0; i < 4; ++i) {
+        double sum = 0.0;
+        for (int j = 0; j < 4; ++j) {
+          sum += std::fabs(double(a[i * 4 + j]) * b[j]);
+        }
+        worst_vec = std::max(worst_vec, std::fabs(double(got[i]) - want[i]) /
+                                            (FLT_EPSILON * sum));
+      }
+
+      ref.inverse(a, want);
+      k.inverse(a, got);
+      double largest = 0.0;
+      for (float c : want) {
+        largest = std::max(largest, double(std::fabs(c)));
+      }
+      for (int i = 0; i < 16; ++i) {
+        worst_inv = std::max(worst_inv, std::fabs(double(got[i]) - want[i]) /
+                                            (FLT_EPSILON * largest));
+      }
+    }
+    const std::string name = std::string(simdIsaName(isa)) + " Matrix4 ";
+    failures +=
+        checkBound((name + "mul ULP").c_str(), worst_mul, productUlpBound);
+    failures += checkBound((name + "mulVec ULP").c_str(), worst_vec,
+                           productUlpBound);
+    failures += checkBound((name + "inverse ULP").c_str(), worst_inv,
+                           inverseUlpBound);
+  }
+  return failures;
+}
+
+/**
+ * skinJobs() on four threads against skinRange() one mesh at a time on
+ * this one. The vertices split at the same chunk boundaries either way, so
+ * the results must match bit for bit. Many frames, so the workers take part
+ * even on a single core and a chunk they skin from the wrong table shows.
+ */
+template<typename Bone>
+int
+skinJobsCheck(const char * what, const std::vector<SkinVertex> & verts,
+              const std::vector<Bone> & palette)
+{
+  constexpr std::size_t meshes = 6;
+  constexpr int         frames = 200;
+
+  const std::size_t    n = verts.size();
+  std::vector<Vector3> want_pos(n);
+  std::vector<Vector3> want_nrm(n);
+  std::vector<Vector3> got_pos(n);
+  std::vector<Vector3> got_nrm(n);
+  const std::vector<SkinJob<Bone>> want =
+      makeSkinJobs(verts, meshes, palette, want_pos, want_nrm);
+  const std::vector<SkinJob<Bone>> got =
+      makeSkinJobs(verts, meshes, palette, got_pos, got_nrm);
+  for (const SkinJob<Bone> & job : want) {
+    skinRange(job.vertices, 0, job.count, job.palette, job.positions,
+              job.normals);
+  }
+
+  ThreadPool        pool(3);
+  ThreadPool::Scope scope(pool);
+  std::size_t       mismatches = 0;
+  for (int f = 0; f < frames; ++f) {
+    std::fill(got_pos.begin(), got_pos.end(), Vector3(0.0f));
+    std::fill(got_nrm.begin(), got_nrm.end(), Vector3(0.0f));
+    skinJobs(got.data(), got.size());
+    for (std::size_t i = 0; i < meshes * want[0].count; ++i) {
+      if (std::memcmp(&got_pos[i], &want_pos[i], sizeof(Vector3)) != 0 ||
+          std::memcmp(&got_nrm[i], &want_nrm[i], sizeof(Vector3)) != 0) {
+        ++mismatches;
+      }
+    }
+  }
+  return checkBound(what, double(mismatches), 0.0);
+}
+
+// Mesh sizes that are no multiple of skinChunkSize or of any FloatV width
+int
+skinningChecks()
+{
+  const Data                    d(6 * 5003);
+  const std::vector<SkinVertex> verts = makeSkinVertices(d);
+  const std::vector<Matrix4>    palette(d.rigid.begin(),
+                                        d.rigid.begin() + skinBones);
+  return skinJobsCheck("skinJobs linear, 4 threads, mismatches", verts,
+                       palette) +
+         skinJobsCheck("skinJobs dual quat, 4 threads, mismatches", verts,
+                       makeDualQuatPalette(d));
+}
+
+/**
+ * Every Matrix4 builder instantiated for Matrix4h, so they keep compiling,
+ * against the float builder rounded to Half. Inputs are exact in Half and
+ * the builders compute in float, so every cell must match bit for bit.
+ */
+int
+halfBuilderChecks()
+{
+  const Half     a(0.75f);
+  const Half     b(-1.25f);
+  const Half     c(2.5f);
+  const Half     d(4.0f); // 1 / d is exact in Half too
+  const Vector3h v(Half(0.0f), Half(0.6f), Half(0.8f));
+  const Vector3  fv(v);
+
+  std::size_t mismatches = 0;
+  const auto  compare = [&](const Matrix4h & got, const Matrix4 & want) {
+    const Matrix4h rounded(want);
+    for (int i = 0; i < 16; ++i) {
+      mismatches += (got.cells[i].bits != rounded.cells[i].bits) ? 1 : 0;
+    }
+  };
+  compare(Matrix4h::zero(), Matrix4::zero());
+  compare(Matrix4h::identity(), Matrix4::identity());
+  compare(Matrix4h::rotX(a), Matrix4::rotX(a));
+  compare(Matrix4h::rotY(b), Matrix4::rotY(b));
+  compare(Matrix4h::rotZ(c), Matrix4::rotZ(c));
+  compare(Matrix4h::yawPitchRoll(a, b, c), Matrix4::yawPitchRoll(a, b, c));
+  compare(Matrix4h::axisAngle(v, a), Matrix4::axisAngle(fv, a));
+  compare(Matrix4h::trans(v), Matrix4::trans(fv));
+  compare(Matrix4h::scale(c), Matrix4::scale(c));
+  compare(Matrix4h::scale(v), Matrix4::scale(fv));
+  // Half times Half is exact in float, so both round the same product
+  Matrix4h scaled = Matrix4h::rotX(a);
+  Matrix4  fscaled(scaled);
+  scaled *= c;
+  fscaled *= c;
+  compare(scaled, fscaled);
+  scaled /= d;
+  fscaled /= d;
+  compare(scaled, fscaled);
+  return checkBound("Matrix4h builders, mismatched cells", double(mismatches),
+                    0.0);
+}
+
+/**
+ * Codec::encode / decode and encodeBatch / decodeBatch round trips against
+ * Codec::maxAngleError, measured in double. Half the inputs are random
+ * rotations, the other half sit in the worst case: all four components
+ * near 0.5 with each kept one just short of half a step off the grid.
+ */
+template<typename Codec>
+int
+quatCompressCheck(const char * name)
+{
+  constexpr std::size_t n = 200000;
+
+  std::mt19937                          rng(99);
+  std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+  std::uniform_int_distribution<int>    pick(0, 3);
+  const std::uint32_t near_half =
+      Codec::quantize(0.5f) - 2u; // Grid points either side of 0.5
+  std::vector<Quat<float>> in(n);
+  for (std::size_t i = 0; i < n; i += 2) {
+    Vector4 v(u(rng), u(rng), u(rng), u(rng));
+    v.normalize();
+    in[i] = Quat<float>(v.x, v.y, v.z, v.w);
+
+    double c[4];
+    double sum_sq = 0.0;
+    for (double & k : c) {
+      const float off = (pick(rng) < 2) ? -0.999f : 0.999f;
+      k = Codec::dequantize(near_half + std::uint32_t(pick(rng))) +
+          off * Codec::maxComponentError;
+      sum_sq += k * k;
+    }
+    const int big = pick(rng);
+    sum_sq -= c[big] * c[big];
+    c[big] = std::sqrt(1.0 - sum_sq);
+    const double sign = (pick(rng) < 2) ? -1.0 : 1.0;
+    in[i + 1] = Quat<float>(float(sign * c[0]), float(sign * c[1]),
+                            float(sign * c[2]), float(sign * c[3]));
+  }
+
+  // 4 asin(|q - q'| / 2) over q' and -q', both unit in double
+  const auto angle = [](const Quat<float> & a, const Quat<float> & b) {
+    const double ca[4] = {a.x, a.y, a.z, a.w};
+    const double cb[4] = {b.x, b.y, b.z, b.w};
+    double       na = 0.0;
+    double       nb = 0.0;
+    for (int k = 0; k < 4; ++k) {
+      na += ca[k] * ca[k];
+      nb += cb[k] * cb[k];
+    }
+    na = std::sqrt(na);
+    nb = std::sqrt(nb);
+    double minus = 0.0;
+    double plus = 0.0;
+    for (int k = 0; k < 4; ++k) {
+      minus += (ca[k] / na - cb[k] / nb) * (ca[k] / na - cb[k] / nb);
+      plus += (ca[k] / na + cb[k] / nb) * (ca[k] / na + cb[k] / nb);
+    }
+    return 4.0 * std::asin(std::sqrt(std::min(minus, plus)) / 2.0);
+  };
+
+  double worst_scalar = 0.0;
+  for (const Quat<float> & q : in) {
+    worst_scalar =
+        std::max(worst_scalar, angle(q, Codec::decode(Codec::encode(q))));
+  }
+  const QuatSoA             soa(in.data(), n);
+  QuatSoA                   back;
+  std::vector<std::uint8_t> packed(n * Codec::bytes);
+  encodeBatch<Codec>(soa, packed.data());
+  decodeBatch<Codec>(packed.data(), n, back);
+  double worst_batch = 0.0;
+  for (std::size_t i = 0; i < n; ++i) {
+    worst_batch = std::max(worst_batch, angle(in[i], back.get(i)));
+  }
+
+  // Millidegrees, so 15 bits still shows
+  const double to_mdeg = 180000.0 / 3.14159265358979323846;
+  const double bound = Codec::maxAngleError * to_mdeg;
+  const std::string what = std::string(name) + " angle, millidegrees, ";
+  return checkBound((what + "scalar").c_str(), worst_scalar * to_mdeg,
+                    bound) +
+         checkBound((what + "batch").c_str(), worst_batch * to_mdeg, bound);
+}
+
+int
+quatCompressChecks()
+{
+  return quatCompressCheck<QuatPacked29>("QuatPacked29") +
+         quatCompressCheck<QuatPacked32>("QuatPacked32") +
+         quatCompressCheck<QuatPacked48>("QuatPacked48");
+}
+
+// Batch sizes below are no multiple of any FloatV width, so tails run too
+constexpr std::size_t checkCount = 100003;
+
+/**
+ * FloatV::sincos against double over |a| <= 8192, where Simd.hh promises
+ * 1.2e-7, half the samples in [-4, 4] where the rotation builders live.
+ */
+int
+sinCosChecks()
+{
+  constexpr std::size_t w = FloatV::width;
+
+  std::mt19937                          rng(11);
+  std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+  alignas(simdAlignment) float          in[w];
+  alignas(simdAlignment) float          s_out[w];
+  alignas(simdAlignment) float          c_out[w];
+  double                                worst = 0.0;
+  for (int t = 0; t < 200000; ++t) {
+    for (float & a : in) {
+      a = u(rng) * ((t % 2 == 0) ? 4.0f : 8192.0f);
+    }
+    FloatV s, c;
+    FloatV::sincos(FloatV::load(in), s, c);
+    s.store(s_out);
+    c.store(c_out);
+    for (std::size_t k = 0; k < w; ++k) {
+      worst = std::max(worst, std::fabs(s_out[k] - std::sin(double(in[k]))));
+      worst = std::max(worst, std::fabs(c_out[k] - std::cos(double(in[k]))));
+    }
+  }
+  return checkBound("FloatV::sincos error, units of 1e-7", worst * 1e7, 1.2);
+}
+
+// Unit length in double, a and -a give the same components
+void
+unitComponents(const Quat<float> & q, double c[4])
+{
+  c[0] = q.x;
+  c[1] = q.y;
+  c[2] = q.z;
+  c[3] = q.w;
+  const double len =
+      std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+  const double sign = (c[3] < 0.0) ? -1.0 : 1.0;
+  for (int k = 0; k < 4; ++k) {
+    c[k] *= sign / len;
+  }
+}
+
+/**
+ * slerp per component and slerpFast as a rotation angle against a double
+ * slerp, at 21 values of t. A quarter of the pairs lie within a few
+ * degrees of each other, where slerpLanes switches to nlerp.
+ */
+int
+slerpChecks()
+{
+  constexpr double exactBound = HB_FAST_NORMALIZE ? 5.5e-7 : 2e-7;
+
+  // Rounded from double, so the inputs are unit in either normalize mode
+  const auto unit = [](double x, double y, double z, double w) {
+    const double len = std::sqrt(x * x + y * y + z * z + w * w);
+    return Quat<float>(float(x / len), float(y / len), float(z / len),
+                       float(w / len));
+  };
+  const Data               d(checkCount);
+  std::vector<Quat<float>> a(checkCount);
+  std::vector<Quat<float>> b(checkCount);
+  for (std::size_t i = 0; i < checkCount; ++i) {
+    const Quat<float> & p = d.quat[i];
+    const Quat<float> & q = d.quatb[i];
+    a[i] = unit(p.x, p.y, p.z, p.w);
+    const double e = (i % 8 == 0) ? 1e-3 : 2e-2;
+    b[i] = (i % 4 == 0) ? unit(p.x + e * q.x, p.y + e * q.y, p.z + e * q.z,
+                               p.w + e * q.w)
+                        : unit(q.x, q.y, q.z, q.w);
+  }
+  const QuatSoA qa(a.data(), checkCount);
+  const QuatSoA qb(b.data(), checkCount);
+  QuatSoA       exact;
+  QuatSoA       fast;
+
+  double worst_exact = 0.0;
+  double worst_fast = 0.0;
+  for (int step = 0; step <= 20; ++step) {
+    const float t = float(step) / 20.0f;
+    slerp(qa, qb, t, exact);
+    slerpFast(qa, qb, t, fast);
+    for (std::size_t i = 0; i < checkCount; ++i) {
+      double ca[4];
+      double cb[4];
+      unitComponents(a[i], ca);
+      unitComponents(b[i], cb);
+      double dot = 0.0;
+      for (int k = 0; k < 4; ++k) {
+        dot += ca[k] * cb[k];
+      }
+      const double sign = (dot < 0.0) ? -1.0 : 1.0;
+      const double theta = std::acos(std::min(dot * sign, 1.0));
+      const double sin_theta = std::sin(theta);
+      const double wa =
+          (sin_theta > 1e-12) ? std::sin((1.0 - t) * theta) / sin_theta
+                              : 1.0 - t;
+      const double wb =
+          (sin_theta > 1e-12) ? std::sin(t * theta) / sin_theta : t;
+      double want[4];
+      double len = 0.0;
+      for (int k = 0; k < 4; ++k) {
+        want[k] = wa * ca[k] + wb * sign * cb[k];
+        len += want[k] * want[k];
+      }
+      len = std::sqrt(len);
+      for (double & c : want) {
+        c /= len;
+      }
+
+      // slerp keeps the sign of a, compare it component for component
+      const Quat<float> got = exact.get(i);
+      const double g[4] = {got.x, got.y, got.z, got.w};
+      const double a_sign = (a[i].w < 0.0f) ? -1.0 : 1.0;
+      for (int k = 0; k < 4; ++k) {
+        worst_exact =
+            std::max(worst_exact, std::fabs(g[k] - a_sign * want[k]));
+      }
+      double f[4];
+      unitComponents(fast.get(i), f);
+      double chord = 0.0;
+      double other = 0.0;
+      for (int k = 0; k < 4; ++k) {
+        chord += (f[k] - want[k]) * (f[k] - want[k]);
+        other += (f[k] + want[k]) * (f[k] + want[k]);
+      }
+      worst_fast = std::max(
+          worst_fast, 4.0 * std::asin(std::sqrt(std::min(chord, other)) / 2.0));
+    }
+  }
+  return checkBound("slerp error per component, units of 1e-7",
+                    worst_exact * 1e7, exactBound * 1e7) +
+         checkBound("slerpFast angle vs slerp, milliradians",
+                    worst_fast * 1e3, 1.3);
+}
+
+/**
+ * inverseBatch against the scalar inverse kernel, in the ULP of
+ * matrixKernelChecks, with every 97th matrix made singular so the flags,
+ * the zeroed outputs and the count get checked too. yawPitchRollBatch and
+ * axisAngleBatch against their scalar builders, cell by cell.
+ */
+int
+matrixBatchChecks()
+{
+  constexpr double inverseUlpBound = 16.0;
+  constexpr double rotationBound = 4.0 * FLT_EPSILON;
+
+  Data                 d(checkCount);
+  const Matrix4Kernels & ref = Matrix4Kernels::forIsa(SimdIsa::Scalar);
+  std::size_t          planted = 0;
+  for (std::size_t i = 0; i < checkCount; i += 97) {
+    std::fill(d.mat[i].cells + 4, d.mat[i].cells + 8, 0.0f);
+    ++planted;
+  }
+  std::vector<Matrix4>       inv(checkCount);
+  std::vector<std::uint32_t> singular((checkCount + 31) / 32);
+  const std::size_t          flagged =
+      inverseBatch(d.mat.data(), inv.data(), checkCount, singular.data());
+  double      worst_inv = 0.0;
+  std::size_t wrong_flags = (flagged == planted) ? 0 : 1;
+  for (std::size_t i = 0; i < checkCount; ++i) {
+    const bool is_singular = (singular[i / 32] >> (i % 32)) & 1u;
+    wrong_flags += (is_singular != (i % 97 == 0)) ? 1 : 0;
+    if (i % 97 == 0) {
+      // Zero times a negative cofactor leaves -0, equal all the same
+      for (float c : inv[i].cells) {
+        wrong_flags += (c != 0.0f) ? 1 : 0;
+      }
+      continue;
+    }
+    float want[16];
+    ref.inverse(d.mat[i].cells, want);
+    double largest = 0.0;
+    for (float c : want) {
+      largest = std::max(largest, double(std::fabs(c)));
+    }
+    for (int k = 0; k < 16; ++k) {
+      worst_inv =
+          std::max(worst_inv, std::fabs(double(inv[i].cells[k]) - want[k]) /
+                                  (FLT_EPSILON * largest));
+    }
+  }
+
+  std::mt19937                          rng(21);
+  std::uniform_real_distribution<float> u(-4.0f, 4.0f);
+  std::vector<float>                    yaw(checkCount);
+  std::vector<float>                    pitch(checkCount);
+  std::vector<float>                    roll(checkCount);
+  std::vector<Vector3>                  axes(checkCount);
+  for (std::size_t i = 0; i < checkCount; ++i) {
+    yaw[i] = u(rng);
+    pitch[i] = u(rng);
+    roll[i] = u(rng);
+    axes[i] = d.vec3[i].normalized();
+  }
+  std::vector<Matrix4> ypr(checkCount);
+  std::vector<Matrix4> aa(checkCount);
+  yawPitchRollBatch(yaw.data(), pitch.data(), roll.data(), checkCount,
+                    ypr.data());
+  axisAngleBatch(axes.data(), yaw.data(), checkCount, aa.data());
+  double worst_ypr = 0.0;
+  double worst_aa = 0.0;
+  for (std::size_t i = 0; i < checkCount; ++i) {
+    const Matrix4 want_ypr = Matrix4::yawPitchRoll(yaw[i], pitch[i], roll[i]);
+    const Matrix4 want_aa = Matrix4::axisAngle(axes[i], yaw[i]);
+    for (int k = 0; k < 16; ++k) {
+      worst_ypr = std::max(
+          worst_ypr, double(std::fabs(ypr[i].cells[k] - want_ypr.cells[k])));
+      worst_aa = std::max(
+          worst_aa, double(std::fabs(aa[i].cells[k] - want_aa.cells[k])));
+    }
+  }
+
+  int failures = 0;
+  failures += checkBound("inverseBatch ULP", worst_inv, inverseUlpBound);
+  failures += checkBound("inverseBatch singular flags, mismatches",
+                         double(wrong_flags), 0.0);
+  failures += checkBound("yawPitchRollBatch error, units of 1e-7",
+                         worst_ypr * 1e7, rotationBound * 1e7);
+  failures += checkBound("axisAngleBatch error, units of 1e-7",
+                         worst_aa * 1e7, rotationBound * 1e7);
+  return failures;
+}
+
+/**
+ * composeTRSBatch and decomposeTRSBatch against composeTRS and
+ * decomposeTRS, with scales in [0.5, 2.5] and a third of them mirrored.
+ */
+int
+trsBatchChecks()
+{
+  const Data                            d(checkCount);
+  std::mt19937                          rng(31);
+  std::uniform_real_distribution<float> u(0.5f, 2.5f);
+  std::vector<Vector3>                  t(checkCount);
+  std::vector<Vector3>                  s(checkCount);
+  for (std::size_t i = 0; i < checkCount; ++i) {
+    t[i] = d.vec3[i] * 10.0f;
+    s[i] = Vector3((i % 3 == 0) ? -u(rng) : u(rng), u(rng), u(rng));
+  }
+  const Vector3SoA     t_soa(t.data(), checkCount);
+  const Vector3SoA     s_soa(s.data(), checkCount);
+  const QuatSoA        r_soa(d.quat.data(), checkCount);
+  std::vector<Matrix4> composed(checkCount);
+  composeTRSBatch(t_soa, r_soa, s_soa, composed.data());
+
+  Vector3SoA t_back;
+  Vector3SoA s_back;
+  QuatSoA    r_back;
+  decomposeTRSBatch(composed.data(), checkCount, &t_back, r_back, &s_back);
+
+  double      worst_compose = 0.0;
+  double      worst_scale = 0.0;
+  double      worst_rotation = 0.0;
+  std::size_t moved = 0;
+  for (std::size_t i = 0; i < checkCount; ++i) {
+    const Matrix4 want = composeTRS(t[i], d.quat[i], s[i]);
+    const double  largest = std::max(
+        {std::fabs(s[i].x), std::fabs(s[i].y), std::fabs(s[i].z)});
+    for (int k = 0; k < 16; ++k) {
+      worst_compose = std::max(
+          worst_compose, std::fabs(double(composed[i].cells[k]) -
+                                   want.cells[k]) /
+                             (FLT_EPSILON * largest));
+    }
+
+    Vector3     want_t;
+    Vector3     want_s;
+    Quat<float> want_r;
+    decomposeTRS(composed[i], want_t, want_r, want_s);
+    const Vector3 got_t = t_back.get(i);
+    moved += (std::memcmp(&got_t, &want_t, sizeof(Vector3)) != 0) ? 1 : 0;
+    const Vector3 got_s = s_back.get(i);
+    const double  gs[3] = {got_s.x, got_s.y, got_s.z};
+    const double  ws[3] = {want_s.x, want_s.y, want_s.z};
+    for (int k = 0; k < 3; ++k) {
+      worst_scale = std::max(
+          worst_scale, std::fabs((gs[k] - ws[k]) / ws[k]) / FLT_EPSILON);
+    }
+    const Quat<float> got_r = r_back.get(i);
+    const double g[4] = {got_r.x, got_r.y, got_r.z, got_r.w};
+    const double r[4] = {want_r.x, want_r.y, want_r.z, want_r.w};
+    double       minus = 0.0;
+    double       plus = 0.0;
+    for (int k = 0; k < 4; ++k) {
+      minus = std::max(minus, std::fabs(g[k] - r[k]));
+      plus = std::max(plus, std::fabs(g[k] + r[k]));
+    }
+    worst_rotation = std::max(worst_rotation, std::min(minus, plus));
+  }
+
+  int failures = 0;
+  failures += checkBound("composeTRSBatch ULP of the largest |s|",
+                         worst_compose, 4.0);
+  failures += checkBound("decomposeTRSBatch t, mismatches", double(moved),
+                         0.0);
+  failures += checkBound("decomposeTRSBatch s ULP", worst_scale, 4.0);
+  failures += checkBound("decomposeTRSBatch r error, units of 1e-7",
+                         worst_rotation * 1e7, 4.0);
+  return failures;
+}
+
+/**
+ * rsqrtFast and FloatV::rsqrt, which HB_FAST_NORMALIZE builds on, against
+ * 1 / sqrt in double for every float in [1, 4): all mantissas at both
+ * exponent parities, which is all the estimates see. Without the fast mode
+ * the Vector normalizations must divide bit for bit as they always did.
+ */
+int
+rsqrtChecks()
+{
+  constexpr double scalarBound = 3.5e-7;
+  constexpr double lanesBound = (FloatV::width == 16) ? 1.4e-7 : 3.5e-7;
+  constexpr std::size_t w = FloatV::width;
+
+  double                       worst_scalar = 0.0;
+  double                       worst_lanes = 0.0;
+  alignas(simdAlignment) float in[w];
+  alignas(simdAlignment) float out[w];
+  std::size_t                  k = 0;
+  for (float a = 1.0f; a < 4.0f; a = std::nextafter(a, 8.0f)) {
+    const double want = 1.0 / std::sqrt(double(a));
+    worst_scalar =
+        std::max(worst_scalar, std::fabs(rsqrtFast(a) - want) / want);
+    in[k++] = a;
+    if (k == w) {
+      FloatV::rsqrt(FloatV::load(in)).store(out);
+      for (std::size_t j = 0; j < w; ++j) {
+        const double lane_want = 1.0 / std::sqrt(double(in[j]));
+        worst_lanes = std::max(
+            worst_lanes, std::fabs(out[j] - lane_want) / lane_want);
+      }
+      k = 0;
+    }
+  }
+  int failures = 0;
+  failures += checkBound("rsqrtFast relative error, units of 1e-7",
+                         worst_scalar * 1e7, scalarBound * 1e7);
+  failures += checkBound("FloatV::rsqrt relative error, units of 1e-7",
+                         worst_lanes * 1e7, lanesBound * 1e7);
+
+#if !HB_FAST_NORMALIZE
+  std::mt19937                          rng(77);
+  std::uniform_real_distribution<float> u(-100.0f, 100.0f);
+  std::size_t                           mismatches = 0;
+  for (int t = 0; t < 100000; ++t) {
+    const Vector2 a(u(rng), u(rng));
+    const Vector3 b(u(rng), u(rng), u(rng));
+    Vector4       c(u(rng), u(rng), u(rng), u(rng));
+    const Vector4 c_want = c / c.mag();
+    c.normalize();
+    const Vector2 a_got = a.normalized();
+    const Vector2 a_want = a / a.mag();
+    const Vector3 b_got = b.normalized();
+    const Vector3 b_want = b / b.mag();
+    mismatches += std::memcmp(&a_got, &a_want, sizeof(a_got)) != 0;
+    mismatches += std::memcmp(&b_got, &b_want, sizeof(b_got)) != 0;
+    mismatches += std::memcmp(&c, &c_want, sizeof(c)) != 0;
+  }
+  failures += checkBound("Vector normalize vs v / mag(), mismatches",
+                         double(mismatches), 0.0);
+#endif
+  return failures;
+}
+
+} // namespace
+
+int
+main(int argc, char ** argv)
+{
+  BenchOptions options;
+  std::string  json_path;
+  std::string  baseline_path;
+  double       tolerance = 0.05;
+  bool         check = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool        has_value = i + 1 < argc;
+    if (arg == "--filter" && has_value) {
+      options.filter = argv[++i];
+    } else if (arg == "--json" && has_value) {
+      json_path = argv[++i];
+    } else if (arg == "--baseline" && has_value) {
+      baseline_path = argv[++i];
+    } else if (arg == "--tolerance" && has_value) {
+      tolerance = std::atof(argv[++i]);
+    } else if (arg == "--min-time" && has_value) {
+      options.min_seconds = std::atof(argv[++i]);
+    } else if (arg == "--samples" && has_value) {
+      options.samples = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--check") {
+      check = true;
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--filter name] [--json out.json] "
+                   "[--baseline old.json] [--tolerance 0.05] "
+                   "[--min-time seconds] [--samples n] [--check]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+
+  std::printf("isa %s, FloatV width %d, %u threads\n\n",
+              simdIsaName(CpuFeatures::get().bestIsa()), FloatV::width,
+              ThreadPool::global().concurrency());
+  if (check) {
+    int failures = matrixKernelChecks();
+    failures += skinningChecks();
+    failures += halfBuilderChecks();
+    failures += rsqrtChecks();
+    failures += quatCompressChecks();
+    failures += sinCosChecks();
+    failures += slerpChecks();
+    failures += matrixBatchChecks();
+    failures += trsBatchChecks();
+    std::printf("\n%d check(s) failed\n", failures);
+    return failures == 0 ? 0 : 1;
+  }
+  const Data small(batchCount);
+  const Data big(threadedCount);
+  Bench      bench(options);
+  vectorBenches(bench, small, big);
+  matrixBenches(bench, small, big);
+  quatBenches(bench, small, big);
+  pipelineBenches(bench, small, big);
+  bvhBenches(bench);
+  particleBenches(bench, small, big);
+  scalingBenches(bench, big);
+
+  if (!json_path.empty() && !bench.writeJson(json_path)) {
+    std::fprintf(stderr, "could not write %s\n", json_path.c_str());
+    return 2;
+  }
+  if (!baseline_path.empty()) {
+    const std::vector<BenchResult> baseline = Bench::readJson(baseline_path);
+    if (baseline.empty()) {
+      std::fprintf(stderr, "no results in %s\n", baseline_path.c_str());
+      return 2;
+    }
+    const int regressions = bench.compare(baseline, tolerance);
+    std::printf("\n%d regression(s) beyond %.1f%%\n", regressions,
+                100.0 * tolerance);
+    return regressions == 0 ? 0 : 1;
+  }
+  return 0;
+}